@@ -0,0 +1,490 @@
+/*
+ ============================================================================
+ Name        : async.c
+ Author      : Qiniu.com
+ Copyright   : 2012(c) Shanghai Qiniu Information Technologies Co., Ltd.
+ Description :
+ ============================================================================
+ */
+
+#include "async.h"
+#include "region.h"
+#include "tm.h"
+#include "../cJSON/cJSON.h"
+#include <curl/curl.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+/*============================================================================*/
+/* type Qiniu_Async */
+
+#define QINIU_ASYNC_IDLE_MAX 16
+#define QINIU_ASYNC_EVENT_MAX 64
+
+typedef struct _Qiniu_Async_Request {
+	struct _Qiniu_Async_Request* prev;
+	struct _Qiniu_Async_Request* next;
+
+	CURL* curl;
+	Qiniu_Header* headers;
+	struct curl_httppost* formpost;
+	Qiniu_Buffer resp;
+
+	Qiniu_Bool voting;
+	Qiniu_Rgn_HostVote vote;
+
+	Qiniu_Async_FnDone done;
+	void* recvr;
+} Qiniu_Async_Request;
+
+struct _Qiniu_Async {
+	CURLM* multi;
+	Qiniu_Client* cli;
+
+	Qiniu_Async_Request* reqs;
+	int pending;
+
+	CURL* idles[QINIU_ASYNC_IDLE_MAX];
+	int idleCount;
+
+#if defined(__linux__)
+	int epfd;
+	Qiniu_Int64 deadline;
+#endif
+};
+
+CURLSH* Qiniu_Share_handle(Qiniu_Share* self);
+Qiniu_Error Qiniu_callresult(CURL* curl, CURLcode curlCode, Qiniu_Buffer *resp, Qiniu_Json** ret, Qiniu_Bool simpleError);
+
+#if defined(__linux__)
+
+static int Qiniu_Async_onSocket(CURL* curl, curl_socket_t s, int what, void* userp, void* socketp)
+{
+	Qiniu_Async* self = (Qiniu_Async*)userp;
+	struct epoll_event ev;
+
+	if (what == CURL_POLL_REMOVE) {
+		epoll_ctl(self->epfd, EPOLL_CTL_DEL, s, NULL);
+		return 0;
+	} // if
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0) | ((what & CURL_POLL_OUT) ? EPOLLOUT : 0);
+	ev.data.fd = s;
+
+	if (socketp == NULL) {
+		if (epoll_ctl(self->epfd, EPOLL_CTL_ADD, s, &ev) != 0 && errno == EEXIST) {
+			epoll_ctl(self->epfd, EPOLL_CTL_MOD, s, &ev);
+		} // if
+		curl_multi_assign(self->multi, s, self);
+	} else {
+		epoll_ctl(self->epfd, EPOLL_CTL_MOD, s, &ev);
+	} // if
+	return 0;
+} // Qiniu_Async_onSocket
+
+static int Qiniu_Async_onTimer(CURLM* multi, long timeout, void* userp)
+{
+	Qiniu_Async* self = (Qiniu_Async*)userp;
+	self->deadline = (timeout < 0) ? -1 : (Qiniu_Int64)Qiniu_Tm_MonotonicMs() + timeout;
+	return 0;
+} // Qiniu_Async_onTimer
+
+#endif
+
+Qiniu_Async* Qiniu_Async_Create(Qiniu_Client* cli, long maxConnections)
+{
+	Qiniu_Async* self = (Qiniu_Async*)calloc(1, sizeof(*self));
+	if (self == NULL) {
+		return NULL;
+	} // if
+
+	self->multi = curl_multi_init();
+	if (self->multi == NULL) {
+		free(self);
+		return NULL;
+	} // if
+	self->cli = cli;
+
+#if defined(__linux__)
+	self->epfd = epoll_create(QINIU_ASYNC_EVENT_MAX);
+	if (self->epfd < 0) {
+		curl_multi_cleanup(self->multi);
+		free(self);
+		return NULL;
+	} // if
+	self->deadline = -1;
+
+	curl_multi_setopt(self->multi, CURLMOPT_SOCKETFUNCTION, Qiniu_Async_onSocket);
+	curl_multi_setopt(self->multi, CURLMOPT_SOCKETDATA, self);
+	curl_multi_setopt(self->multi, CURLMOPT_TIMERFUNCTION, Qiniu_Async_onTimer);
+	curl_multi_setopt(self->multi, CURLMOPT_TIMERDATA, self);
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	if (maxConnections > 0) {
+		curl_multi_setopt(self->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, maxConnections);
+	} // if
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	// Let requests to the same host share one connection if HTTP/2 is negotiated.
+	curl_multi_setopt(self->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+	return self;
+} // Qiniu_Async_Create
+
+static void Qiniu_Async_release(Qiniu_Async* self, Qiniu_Async_Request* req)
+{
+	// Give the host back if the request is never sent, which does nothing once it is voted.
+	if (req->voting) {
+		Qiniu_Rgn_Table_ReleaseHost(self->cli->regionTable, &req->vote);
+	} // if
+	curl_slist_free_all(req->headers);
+	if (req->formpost != NULL) {
+		curl_formfree(req->formpost);
+	} // if
+	Qiniu_Buffer_Cleanup(&req->resp);
+
+	if (req->curl != NULL) {
+		if (self->idleCount < QINIU_ASYNC_IDLE_MAX) {
+			curl_easy_reset(req->curl);
+			self->idles[self->idleCount++] = req->curl;
+		} else {
+			curl_easy_cleanup(req->curl);
+		} // if
+	} // if
+	free(req);
+} // Qiniu_Async_release
+
+static void Qiniu_Async_finish(Qiniu_Async* self, Qiniu_Async_Request* req, Qiniu_Error err, Qiniu_Json* root)
+{
+	double uploaded = 0;
+
+	curl_multi_remove_handle(self->multi, req->curl);
+
+	if (req->prev != NULL) {
+		req->prev->next = req->next;
+	} else {
+		self->reqs = req->next;
+	} // if
+	if (req->next != NULL) {
+		req->next->prev = req->prev;
+	} // if
+	self->pending -= 1;
+
+	if (req->voting) {
+		if (req->vote.bytes == 0) {
+			curl_easy_getinfo(req->curl, CURLINFO_SIZE_UPLOAD, &uploaded);
+			req->vote.bytes = (Qiniu_Int64)uploaded;
+		} // if
+		Qiniu_Rgn_Table_VoteHost(self->cli->regionTable, &req->vote, err);
+	} // if
+
+	req->done(req->recvr, err, root);
+
+	if (root != NULL) {
+		cJSON_Delete(root);
+	} // if
+	Qiniu_Async_release(self, req);
+} // Qiniu_Async_finish
+
+void Qiniu_Async_Destroy(Qiniu_Async* self)
+{
+	int i;
+	Qiniu_Error err;
+
+	if (self == NULL) {
+		return;
+	} // if
+
+	err.code = 9985;
+	err.message = "request is aborted";
+	while (self->reqs != NULL) {
+		Qiniu_Async_finish(self, self->reqs, err, NULL);
+	} // while
+
+	for (i = 0; i < self->idleCount; i += 1) {
+		curl_easy_cleanup(self->idles[i]);
+	} // for
+	curl_multi_cleanup(self->multi);
+
+#if defined(__linux__)
+	close(self->epfd);
+#endif
+	free(self);
+} // Qiniu_Async_Destroy
+
+static Qiniu_Async_Request* Qiniu_Async_newRequest(
+	Qiniu_Async* self, const char* url, Qiniu_Async_FnDone done, void* recvr, Qiniu_Error* err)
+{
+	Qiniu_Client* cli = self->cli;
+	Qiniu_Async_Request* req = (Qiniu_Async_Request*)calloc(1, sizeof(*req));
+	if (req == NULL) {
+		err->code = 499;
+		err->message = "No enough memory";
+		return NULL;
+	} // if
+
+	Qiniu_Buffer_Init(&req->resp, 1024);
+	req->done = done;
+	req->recvr = recvr;
+
+	if (self->idleCount > 0) {
+		req->curl = self->idles[--self->idleCount];
+	} else {
+		req->curl = curl_easy_init();
+		if (req->curl == NULL) {
+			Qiniu_Async_release(self, req);
+			err->code = 9986;
+			err->message = "Can not create the curl handle";
+			return NULL;
+		} // if
+	} // if
+
+	curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+	curl_easy_setopt(req->curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(req->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(req->curl, CURLOPT_CUSTOMREQUEST, "POST");
+	curl_easy_setopt(req->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	curl_easy_setopt(req->curl, CURLOPT_SSL_VERIFYHOST, 0L);
+	curl_easy_setopt(req->curl, CURLOPT_URL, url);
+	curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, Qiniu_Buffer_Fwrite);
+	curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, &req->resp);
+
+	if (cli->share != NULL) {
+		curl_easy_setopt(req->curl, CURLOPT_SHARE, Qiniu_Share_handle(cli->share));
+	} // if
+
+	// Bind the NIC for sending packets.
+	if (cli->boundNic != NULL) {
+		if (curl_easy_setopt(req->curl, CURLOPT_INTERFACE, cli->boundNic) == CURLE_INTERFACE_FAILED) {
+			Qiniu_Async_release(self, req);
+			err->code = 9994;
+			err->message = "Can not bind the given NIC";
+			return NULL;
+		} // if
+	} // if
+
+	// Specify the low speed limit and time
+	if (cli->lowSpeedLimit > 0 && cli->lowSpeedTime > 0) {
+		curl_easy_setopt(req->curl, CURLOPT_LOW_SPEED_LIMIT, cli->lowSpeedLimit);
+		curl_easy_setopt(req->curl, CURLOPT_LOW_SPEED_TIME, cli->lowSpeedTime);
+	} // if
+
+	*err = Qiniu_OK;
+	return req;
+} // Qiniu_Async_newRequest
+
+static Qiniu_Error Qiniu_Async_submit(
+	Qiniu_Async* self, Qiniu_Async_Request* req, const char* url,
+	const char* body, Qiniu_Int64 bodyLen, const char* mimeType, Qiniu_Bool hasBody)
+{
+	Qiniu_Error err;
+	Qiniu_Client* cli = self->cli;
+	char* ctxType;
+	char ctxLength[64];
+
+	if (hasBody) {
+		curl_easy_setopt(req->curl, CURLOPT_POST, 1L);
+
+		ctxType = Qiniu_String_Concat2("Content-Type: ", (mimeType != NULL) ? mimeType : "application/octet-stream");
+		Qiniu_snprintf(ctxLength, 64, "Content-Length: %lld", bodyLen);
+		req->headers = curl_slist_append(req->headers, ctxLength);
+		req->headers = curl_slist_append(req->headers, ctxType);
+		Qiniu_Free(ctxType);
+	} // if
+	req->headers = curl_slist_append(req->headers, "Expect:");
+
+	if (cli->auth.itbl != NULL && req->formpost == NULL) {
+		err = cli->auth.itbl->Auth(cli->auth.self, &req->headers, url, body, (body != NULL) ? (size_t)bodyLen : 0);
+		if (err.code != 200) {
+			Qiniu_Async_release(self, req);
+			return err;
+		} // if
+	} // if
+	curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, req->headers);
+
+	if (curl_multi_add_handle(self->multi, req->curl) != CURLM_OK) {
+		Qiniu_Async_release(self, req);
+		err.code = 9986;
+		err.message = "Can not add the curl handle";
+		return err;
+	} // if
+
+	req->next = self->reqs;
+	if (self->reqs != NULL) {
+		self->reqs->prev = req;
+	} // if
+	self->reqs = req;
+	self->pending += 1;
+	return Qiniu_OK;
+} // Qiniu_Async_submit
+
+Qiniu_Error Qiniu_Async_Call(Qiniu_Async* self, const char* url, Qiniu_Async_FnDone done, void* recvr)
+{
+	Qiniu_Error err;
+	Qiniu_Async_Request* req = Qiniu_Async_newRequest(self, url, done, recvr, &err);
+	if (req == NULL) {
+		return err;
+	} // if
+	return Qiniu_Async_submit(self, req, url, NULL, 0, NULL, Qiniu_False);
+} // Qiniu_Async_Call
+
+Qiniu_Error Qiniu_Async_CallWithBuffer(
+	Qiniu_Async* self, const char* url, const char* body, size_t bodyLen, const char* mimeType,
+	Qiniu_Async_FnDone done, void* recvr)
+{
+	Qiniu_Error err;
+	Qiniu_Async_Request* req = Qiniu_Async_newRequest(self, url, done, recvr, &err);
+	if (req == NULL) {
+		return err;
+	} // if
+
+	curl_easy_setopt(req->curl, CURLOPT_POSTFIELDSIZE, (long)bodyLen);
+	curl_easy_setopt(req->curl, CURLOPT_POSTFIELDS, body);
+	return Qiniu_Async_submit(self, req, url, body, bodyLen, mimeType, Qiniu_True);
+} // Qiniu_Async_CallWithBuffer
+
+Qiniu_Error Qiniu_Async_CallWithBinary(
+	Qiniu_Async* self, const char* url, Qiniu_Reader body, Qiniu_Int64 bodyLen, const char* mimeType,
+	Qiniu_Async_FnDone done, void* recvr)
+{
+	Qiniu_Error err;
+	Qiniu_Async_Request* req = Qiniu_Async_newRequest(self, url, done, recvr, &err);
+	if (req == NULL) {
+		return err;
+	} // if
+
+	curl_easy_setopt(req->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)bodyLen);
+	curl_easy_setopt(req->curl, CURLOPT_READFUNCTION, body.Read);
+	curl_easy_setopt(req->curl, CURLOPT_READDATA, body.self);
+	return Qiniu_Async_submit(self, req, url, NULL, bodyLen, mimeType, Qiniu_True);
+} // Qiniu_Async_CallWithBinary
+
+Qiniu_Error Qiniu_Async_PostForm(
+	Qiniu_Async* self, const char* url, struct curl_httppost* formpost, struct _Qiniu_Rgn_HostVote* vote,
+	Qiniu_Async_FnDone done, void* recvr)
+{
+	Qiniu_Error err;
+	Qiniu_Async_Request* req = Qiniu_Async_newRequest(self, url, done, recvr, &err);
+	if (req == NULL) {
+		if (vote != NULL) {
+			Qiniu_Rgn_Table_ReleaseHost(self->cli->regionTable, vote);
+		} // if
+		curl_formfree(formpost);
+		return err;
+	} // if
+
+	req->formpost = formpost;
+	if (vote != NULL) {
+		req->voting = Qiniu_True;
+		req->vote = *vote;
+	} // if
+
+	curl_easy_setopt(req->curl, CURLOPT_HTTPPOST, formpost);
+	return Qiniu_Async_submit(self, req, url, NULL, 0, NULL, Qiniu_False);
+} // Qiniu_Async_PostForm
+
+int Qiniu_Async_Pending(Qiniu_Async* self)
+{
+	return self->pending;
+} // Qiniu_Async_Pending
+
+Qiniu_Client* Qiniu_Async_Client(Qiniu_Async* self)
+{
+	return self->cli;
+} // Qiniu_Async_Client
+
+static void Qiniu_Async_collect(Qiniu_Async* self)
+{
+	int left;
+	CURLMsg* msg;
+	Qiniu_Error err;
+	Qiniu_Json* root;
+	Qiniu_Async_Request* req;
+
+	while ((msg = curl_multi_info_read(self->multi, &left)) != NULL) {
+		if (msg->msg != CURLMSG_DONE) {
+			continue;
+		} // if
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&req);
+		err = Qiniu_callresult(req->curl, msg->data.result, &req->resp, &root, Qiniu_False);
+		Qiniu_Async_finish(self, req, err, root);
+	} // while
+} // Qiniu_Async_collect
+
+#if defined(__linux__)
+
+int Qiniu_Async_Perform(Qiniu_Async* self, int timeout)
+{
+	int i;
+	int n;
+	int mask;
+	int running = 0;
+	int wait = timeout;
+	Qiniu_Int64 now;
+	struct epoll_event events[QINIU_ASYNC_EVENT_MAX];
+
+	// Wake up for the timer of curl, even if the caller waits without a limit.
+	if (self->deadline >= 0) {
+		now = (Qiniu_Int64)Qiniu_Tm_MonotonicMs();
+		if (self->deadline <= now) {
+			wait = 0;
+		} else if (wait < 0 || self->deadline - now < wait) {
+			wait = (int)(self->deadline - now);
+		} // if
+	} // if
+
+	n = epoll_wait(self->epfd, events, QINIU_ASYNC_EVENT_MAX, wait);
+	for (i = 0; i < n; i += 1) {
+		mask = 0;
+		if (events[i].events & EPOLLIN) {
+			mask |= CURL_CSELECT_IN;
+		} // if
+		if (events[i].events & EPOLLOUT) {
+			mask |= CURL_CSELECT_OUT;
+		} // if
+		if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+			mask |= CURL_CSELECT_ERR;
+		} // if
+		curl_multi_socket_action(self->multi, events[i].data.fd, mask, &running);
+	} // for
+
+	if (self->deadline >= 0 && self->deadline <= (Qiniu_Int64)Qiniu_Tm_MonotonicMs()) {
+		self->deadline = -1;
+		curl_multi_socket_action(self->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+	} // if
+
+	Qiniu_Async_collect(self);
+	return self->pending;
+} // Qiniu_Async_Perform
+
+#else
+
+int Qiniu_Async_Perform(Qiniu_Async* self, int timeout)
+{
+	int running = 0;
+	int numfds = 0;
+
+	curl_multi_perform(self->multi, &running);
+	Qiniu_Async_collect(self);
+	if (self->pending > 0) {
+		curl_multi_wait(self->multi, NULL, 0, timeout, &numfds);
+		curl_multi_perform(self->multi, &running);
+		Qiniu_Async_collect(self);
+	} // if
+	return self->pending;
+} // Qiniu_Async_Perform
+
+#endif
+
+void Qiniu_Async_Run(Qiniu_Async* self)
+{
+	while (self->pending > 0) {
+		Qiniu_Async_Perform(self, 1000);
+	} // while
+} // Qiniu_Async_Run
@@ -0,0 +1,77 @@
+/*
+ ============================================================================
+ Name        : async.h
+ Author      : Qiniu.com
+ Copyright   : 2012(c) Shanghai Qiniu Information Technologies Co., Ltd.
+ Description :
+ ============================================================================
+ */
+
+#ifndef QINIU_ASYNC_H
+#define QINIU_ASYNC_H
+
+#include "http.h"
+
+#pragma pack(1)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*============================================================================*/
+/* type Qiniu_Async */
+
+// Called once a request is finished. The root is the parsed response body (maybe NULL), and it
+// will be destroyed after the callback returns. It is allowed to submit new requests in the callback.
+typedef void (*Qiniu_Async_FnDone)(void* recvr, Qiniu_Error err, Qiniu_Json* root);
+
+typedef struct _Qiniu_Async Qiniu_Async;
+
+// Create an event loop which drives all submitted requests on the calling thread.
+// The client provides the auth, the bound NIC, the low speed limit, the share object and the region table,
+// and it must outlive the event loop. Pass 0 to maxConnections for no limit on the total connections.
+QINIU_DLLAPI extern Qiniu_Async* Qiniu_Async_Create(Qiniu_Client* cli, long maxConnections);
+
+// Pending requests are aborted with error 9985 and their callbacks are invoked.
+QINIU_DLLAPI extern void Qiniu_Async_Destroy(Qiniu_Async* self);
+
+// **NOTICE**: The body must keep valid until the callback is invoked.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Async_Call(
+	Qiniu_Async* self, const char* url, Qiniu_Async_FnDone done, void* recvr);
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Async_CallWithBuffer(
+	Qiniu_Async* self, const char* url, const char* body, size_t bodyLen, const char* mimeType,
+	Qiniu_Async_FnDone done, void* recvr);
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Async_CallWithBinary(
+	Qiniu_Async* self, const char* url, Qiniu_Reader body, Qiniu_Int64 bodyLen, const char* mimeType,
+	Qiniu_Async_FnDone done, void* recvr);
+
+// Post a multipart form, whose ownership is taken over even if an error is returned.
+// If vote is not NULL, the host will be voted by the result of the request.
+struct curl_httppost;
+struct _Qiniu_Rgn_HostVote;
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Async_PostForm(
+	Qiniu_Async* self, const char* url, struct curl_httppost* formpost, struct _Qiniu_Rgn_HostVote* vote,
+	Qiniu_Async_FnDone done, void* recvr);
+
+QINIU_DLLAPI extern int Qiniu_Async_Pending(Qiniu_Async* self);
+
+// Wait at most timeout milliseconds for network events, then process them and invoke the callbacks of
+// finished requests. Return the number of pending requests. A negative timeout waits without a limit of
+// its own, but still wakes up when curl has to handle timeouts of the requests.
+QINIU_DLLAPI extern int Qiniu_Async_Perform(Qiniu_Async* self, int timeout);
+
+// Run the event loop until all requests, including those submitted in callbacks, are finished.
+QINIU_DLLAPI extern void Qiniu_Async_Run(Qiniu_Async* self);
+
+QINIU_DLLAPI extern Qiniu_Client* Qiniu_Async_Client(Qiniu_Async* self);
+
+/*============================================================================*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#pragma pack()
+
+#endif // QINIU_ASYNC_H
@@ -63,6 +63,15 @@ extern "C"
 #define Qiniu_snprintf		snprintf
 #endif
 
+/*============================================================================*/
+/* func Qiniu_strtoll */
+
+#if defined(_MSC_VER)
+#define Qiniu_strtoll		_strtoi64
+#else
+#define Qiniu_strtoll		strtoll
+#endif
+
 /*============================================================================*/
 /* type Qiniu_Int64, Qiniu_Uint32 */
 
@@ -267,6 +276,19 @@ QINIU_DLLAPI extern Qiniu_Reader Qiniu_SectionReader(Qiniu_Section* self, Qiniu_
 
 QINIU_DLLAPI extern unsigned long Qiniu_Crc32_Update(unsigned long inCrc32, const void *buf, size_t bufLen);
 
+// Implementations of the same IEEE polynomial. QINIU_CRC32_AUTO picks the fastest one supported
+// by the CPU, which is also what Qiniu_Crc32_Update() uses after Qiniu_Global_Init() is called.
+enum {
+	QINIU_CRC32_AUTO = 0,
+	QINIU_CRC32_BYTEWISE,
+	QINIU_CRC32_SLICE8,
+	QINIU_CRC32_SLICE16,
+	QINIU_CRC32_PCLMUL
+};
+
+QINIU_DLLAPI extern int Qiniu_Crc32_IsSupported(int impl);
+QINIU_DLLAPI extern unsigned long Qiniu_Crc32_UpdateWith(int impl, unsigned long inCrc32, const void *buf, size_t bufLen);
+
 typedef struct _Qiniu_Crc32 {
 	unsigned long val;
 } Qiniu_Crc32;
@@ -286,6 +308,7 @@ typedef struct _Qiniu_FileInfo {
 	time_t          st_ctime;   /* time of last status change */
 } Qiniu_FileInfo;
 #else
+#include <sys/stat.h>
 typedef struct stat Qiniu_FileInfo;
 #endif
 
@@ -298,8 +321,35 @@ QINIU_DLLAPI extern void Qiniu_File_Close(void* self);
 
 QINIU_DLLAPI extern ssize_t Qiniu_File_ReadAt(void* self, void *buf, size_t bytes, Qiniu_Off_T offset);
 
+// Open the file for reading and writing, which is created if it does not exist.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_File_OpenRW(Qiniu_File** pp, const char* file);
+
+QINIU_DLLAPI extern ssize_t Qiniu_File_WriteAt(void* self, const void *buf, size_t bytes, Qiniu_Off_T offset);
+
+// Set the size of the file, and reserve the disk space of it where the system supports, so that
+// writes at any offset do not run out of space halfway.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_File_Allocate(Qiniu_File* self, Qiniu_Off_T fsize);
+
 QINIU_DLLAPI extern Qiniu_ReaderAt Qiniu_FileReaderAt(Qiniu_File* self);
 
+/*============================================================================*/
+/* type Qiniu_MappedFile */
+
+// Map a whole file into memory for reading. The file must not be truncated while it is mapped.
+typedef struct _Qiniu_MappedFile Qiniu_MappedFile;
+
+QINIU_DLLAPI extern Qiniu_Error Qiniu_MappedFile_Open(Qiniu_MappedFile** pp, const char* file);
+QINIU_DLLAPI extern void Qiniu_MappedFile_Close(void* self);
+QINIU_DLLAPI extern Qiniu_Int64 Qiniu_MappedFile_Size(Qiniu_MappedFile* self);
+
+QINIU_DLLAPI extern ssize_t Qiniu_MappedFile_ReadAt(void* self, void *buf, size_t bytes, Qiniu_Off_T offset);
+
+QINIU_DLLAPI extern Qiniu_ReaderAt Qiniu_MappedFileReaderAt(Qiniu_MappedFile* self);
+
+// Return the memory of [offset, offset + bytes) if the reader is backed by a mapped file, or NULL otherwise.
+// The range is advised to be read ahead, so that callers can hand it to a request body without copying.
+QINIU_DLLAPI extern const char* Qiniu_ReaderAt_Slice(Qiniu_ReaderAt self, Qiniu_Off_T offset, size_t bytes);
+
 /*============================================================================*/
 /* type Qiniu_Log */
 
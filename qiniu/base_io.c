@@ -19,6 +19,8 @@
 #define Qiniu_Posix_Handle	int
 #define Qiniu_Posix_Open	open
 #define Qiniu_Posix_Pread	pread
+#define Qiniu_Posix_Pwrite	pwrite
+#define Qiniu_Posix_Ftruncate	ftruncate
 #define Qiniu_Posix_Fstat	fstat
 #define Qiniu_Posix_Close	close
 #define Qiniu_Posix_InvalidHandle -1
@@ -72,7 +74,7 @@ static const unsigned long crcTable[256] =
 	0xB40BBE37,0xC30C8EA1,0x5A05DF1B,0x2D02EF8D
 };
 
-unsigned long Qiniu_Crc32_Update(unsigned long inCrc32, const void *buf, size_t bufLen)
+static unsigned long Qiniu_Crc32_bytewise(unsigned long inCrc32, const void *buf, size_t bufLen)
 {
 	unsigned long crc32;
 	unsigned char *byteBuf;
@@ -87,6 +89,253 @@ unsigned long Qiniu_Crc32_Update(unsigned long inCrc32, const void *buf, size_t
 	return crc32 ^ 0xFFFFFFFF;
 }
 
+// Slicing-by-N tables, crcTables[k][i] is the crc of byte i followed by k zero bytes.
+// They are only valid on little-endian machines and built by Qiniu_Crc32_init().
+static Qiniu_Uint32 crcTables[16][256];
+static int crcTablesReady = 0;
+static int crcBestImpl = QINIU_CRC32_BYTEWISE;
+
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define QINIU_CRC32_SLICING 1
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define QINIU_CRC32_CLMUL 1
+#include <immintrin.h>
+#endif
+
+static Qiniu_Uint32 Qiniu_Crc32_load(const unsigned char* p)
+{
+	Qiniu_Uint32 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static Qiniu_Uint32 Qiniu_Crc32_slice8(Qiniu_Uint32 crc, const unsigned char* p, size_t len)
+{
+	Qiniu_Uint32 one, two;
+
+	while (len >= 8) {
+		one = Qiniu_Crc32_load(p) ^ crc;
+		two = Qiniu_Crc32_load(p + 4);
+		crc = crcTables[7][one & 0xFF] ^ crcTables[6][(one >> 8) & 0xFF] ^
+			crcTables[5][(one >> 16) & 0xFF] ^ crcTables[4][one >> 24] ^
+			crcTables[3][two & 0xFF] ^ crcTables[2][(two >> 8) & 0xFF] ^
+			crcTables[1][(two >> 16) & 0xFF] ^ crcTables[0][two >> 24];
+		p += 8;
+		len -= 8;
+	}
+	while (len-- > 0) {
+		crc = (crc >> 8) ^ crcTables[0][(crc ^ *p++) & 0xFF];
+	}
+	return crc;
+}
+
+static Qiniu_Uint32 Qiniu_Crc32_slice16(Qiniu_Uint32 crc, const unsigned char* p, size_t len)
+{
+	Qiniu_Uint32 one, two, three, four;
+
+	while (len >= 16) {
+		one = Qiniu_Crc32_load(p) ^ crc;
+		two = Qiniu_Crc32_load(p + 4);
+		three = Qiniu_Crc32_load(p + 8);
+		four = Qiniu_Crc32_load(p + 12);
+		crc = crcTables[15][one & 0xFF] ^ crcTables[14][(one >> 8) & 0xFF] ^
+			crcTables[13][(one >> 16) & 0xFF] ^ crcTables[12][one >> 24] ^
+			crcTables[11][two & 0xFF] ^ crcTables[10][(two >> 8) & 0xFF] ^
+			crcTables[9][(two >> 16) & 0xFF] ^ crcTables[8][two >> 24] ^
+			crcTables[7][three & 0xFF] ^ crcTables[6][(three >> 8) & 0xFF] ^
+			crcTables[5][(three >> 16) & 0xFF] ^ crcTables[4][three >> 24] ^
+			crcTables[3][four & 0xFF] ^ crcTables[2][(four >> 8) & 0xFF] ^
+			crcTables[1][(four >> 16) & 0xFF] ^ crcTables[0][four >> 24];
+		p += 16;
+		len -= 16;
+	}
+	return Qiniu_Crc32_slice8(crc, p, len);
+}
+
+#if defined(QINIU_CRC32_CLMUL)
+
+// Fold 64 bytes at a time with carry-less multiplication, then apply a Barrett reduction,
+// as described in "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" by Intel.
+// The length must be at least 64 and a multiple of 16. The crc is the inverted register.
+__attribute__((target("pclmul,sse4.1")))
+static Qiniu_Uint32 Qiniu_Crc32_clmul(Qiniu_Uint32 crc, const unsigned char* p, size_t len)
+{
+	static const Qiniu_Uint64 k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+	static const Qiniu_Uint64 k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+	static const Qiniu_Uint64 k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+	static const Qiniu_Uint64 poly[2] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	x0 = _mm_load_si128((const __m128i*)k1k2);
+	p += 64;
+	len -= 64;
+
+	// Fold four 128-bit lanes in parallel.
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+		y6 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+		y7 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+		y8 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		p += 64;
+		len -= 64;
+	}
+
+	// Fold the four lanes into one.
+	x0 = _mm_load_si128((const __m128i*)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// Fold the remaining 16-byte blocks.
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i*)p);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		p += 16;
+		len -= 16;
+	}
+
+	// Fold 128 bits to 64 bits.
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits.
+	x0 = _mm_load_si128((const __m128i*)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (Qiniu_Uint32)_mm_extract_epi32(x1, 1);
+}
+
+#endif
+
+void Qiniu_Crc32_init()
+{
+	int i, k;
+	Qiniu_Uint32 crc;
+
+	if (crcTablesReady) {
+		return;
+	}
+	for (i = 0; i < 256; i++) {
+		crcTables[0][i] = (Qiniu_Uint32)crcTable[i];
+	}
+	for (k = 1; k < 16; k++) {
+		for (i = 0; i < 256; i++) {
+			crc = crcTables[k - 1][i];
+			crcTables[k][i] = (crc >> 8) ^ crcTables[0][crc & 0xFF];
+		}
+	}
+	crcTablesReady = 1;
+
+	for (k = QINIU_CRC32_PCLMUL; k > QINIU_CRC32_BYTEWISE; k--) {
+		if (Qiniu_Crc32_IsSupported(k)) {
+			break;
+		}
+	}
+	crcBestImpl = k;
+}
+
+int Qiniu_Crc32_IsSupported(int impl)
+{
+	switch (impl) {
+	case QINIU_CRC32_AUTO:
+	case QINIU_CRC32_BYTEWISE:
+		return 1;
+
+#if defined(QINIU_CRC32_SLICING)
+	case QINIU_CRC32_SLICE8:
+	case QINIU_CRC32_SLICE16:
+		return crcTablesReady;
+#endif
+
+#if defined(QINIU_CRC32_SLICING) && defined(QINIU_CRC32_CLMUL)
+	case QINIU_CRC32_PCLMUL:
+		__builtin_cpu_init();
+		return crcTablesReady && __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+
+	default:
+		return 0;
+	}
+}
+
+unsigned long Qiniu_Crc32_UpdateWith(int impl, unsigned long inCrc32, const void *buf, size_t bufLen)
+{
+	const unsigned char* p = (const unsigned char*)buf;
+	Qiniu_Uint32 crc = (Qiniu_Uint32)inCrc32 ^ 0xFFFFFFFF;
+
+	if (impl == QINIU_CRC32_AUTO) {
+		impl = crcBestImpl;
+	}
+	switch (impl) {
+#if defined(QINIU_CRC32_SLICING) && defined(QINIU_CRC32_CLMUL)
+	case QINIU_CRC32_PCLMUL:
+		if (bufLen >= 64) {
+			crc = Qiniu_Crc32_clmul(crc, p, bufLen & ~(size_t)15);
+			p += bufLen & ~(size_t)15;
+			bufLen &= 15;
+		}
+		crc = Qiniu_Crc32_slice16(crc, p, bufLen);
+		break;
+#endif
+
+#if defined(QINIU_CRC32_SLICING)
+	case QINIU_CRC32_SLICE16:
+		crc = Qiniu_Crc32_slice16(crc, p, bufLen);
+		break;
+
+	case QINIU_CRC32_SLICE8:
+		crc = Qiniu_Crc32_slice8(crc, p, bufLen);
+		break;
+#endif
+
+	default:
+		return Qiniu_Crc32_bytewise(inCrc32, buf, bufLen);
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+unsigned long Qiniu_Crc32_Update(unsigned long inCrc32, const void *buf, size_t bufLen)
+{
+	return Qiniu_Crc32_UpdateWith(crcBestImpl, inCrc32, buf, bufLen);
+}
+
 static size_t Qiniu_Crc32_Fwrite(const void* buf, size_t cbelem, size_t n, Qiniu_Crc32* self)
 {
 	self->val = Qiniu_Crc32_Update(self->val, buf, n);
@@ -221,6 +470,8 @@ Qiniu_Error Qiniu_File_Open(Qiniu_File** pp, const char* file)
 #if defined(_MSC_VER)
 
 #define Qiniu_Posix_Pread Qiniu_Posix_Pread2
+#define Qiniu_Posix_Pwrite Qiniu_Posix_Pwrite2
+#define Qiniu_Posix_Ftruncate Qiniu_Posix_Ftruncate2
 
 int Qiniu_Posix_Fstat(Qiniu_Posix_Handle fd, Qiniu_FileInfo* fi)
 {
@@ -270,5 +521,193 @@ Qiniu_ReaderAt Qiniu_FileReaderAt(Qiniu_File* self)
 	return ret;
 }
 
+Qiniu_Error Qiniu_File_OpenRW(Qiniu_File** pp, const char* file)
+{
+	Qiniu_Error err;
+	Qiniu_Posix_Handle fd = Qiniu_Posix_Open(file, O_BINARY | O_RDWR | O_CREAT, 0644);
+	if (fd != Qiniu_Posix_InvalidHandle) {
+		err = Qiniu_OK;
+		*pp = (Qiniu_File*)(size_t)fd;
+	} else {
+		err.code = errno;
+		err.message = "open file failed";
+	}
+	return err;
+}
+
+ssize_t Qiniu_File_WriteAt(void* self, const void *buf, size_t bytes, Qiniu_Off_T offset)
+{
+	return Qiniu_Posix_Pwrite((Qiniu_Posix_Handle)(size_t)self, buf, bytes, offset);
+}
+
+Qiniu_Error Qiniu_File_Allocate(Qiniu_File* self, Qiniu_Off_T fsize)
+{
+	Qiniu_Error err;
+	Qiniu_Posix_Handle fd = (Qiniu_Posix_Handle)(size_t)self;
+
+	if (Qiniu_Posix_Ftruncate(fd, fsize) != 0) {
+		err.code = errno;
+		err.message = "ftruncate failed";
+		return err;
+	}
+#if defined(__linux__)
+	// Not all file systems support it, and a sparse file still works in that case.
+	posix_fallocate(fd, 0, fsize);
+#endif
+	return Qiniu_OK;
+}
+
+/*============================================================================*/
+/* type Qiniu_MappedFile */
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+struct _Qiniu_MappedFile {
+	char* data;
+	Qiniu_Int64 size;
+};
+
+Qiniu_Error Qiniu_MappedFile_Open(Qiniu_MappedFile** pp, const char* file)
+{
+	Qiniu_Error err;
+	Qiniu_FileInfo fi;
+	Qiniu_File* f;
+	Qiniu_MappedFile* self;
+#if defined(_WIN32)
+	HANDLE mapping;
+#endif
+
+	err = Qiniu_File_Open(&f, file);
+	if (err.code != 200) {
+		return err;
+	}
+	err = Qiniu_File_Stat(f, &fi);
+	if (err.code != 200) {
+		Qiniu_File_Close(f);
+		return err;
+	}
+
+	self = (Qiniu_MappedFile*)calloc(1, sizeof(*self));
+	if (self == NULL) {
+		Qiniu_File_Close(f);
+		err.code = 499;
+		err.message = "No enough memory";
+		return err;
+	}
+	self->size = Qiniu_FileInfo_Fsize(fi);
+
+	// An empty file can not be mapped, and it has nothing to read either.
+	if (self->size > 0) {
+		if ((Qiniu_Uint64)self->size > (Qiniu_Uint64)(size_t)-1) {
+			err.code = 9999;
+			err.message = "file is too large to map";
+			goto lzError;
+		}
+#if defined(_WIN32)
+		mapping = CreateFileMapping((HANDLE)(size_t)f, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL) {
+			self->data = (char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			// The view keeps the mapping alive.
+			CloseHandle(mapping);
+		}
+		if (self->data == NULL) {
+			err.code = (int)GetLastError();
+			err.message = "mmap failed";
+			goto lzError;
+		}
+#else
+		self->data = (char*)mmap(NULL, (size_t)self->size, PROT_READ, MAP_SHARED, (int)(size_t)f, 0);
+		if (self->data == (char*)MAP_FAILED) {
+			self->data = NULL;
+			err.code = errno;
+			err.message = "mmap failed";
+			goto lzError;
+		}
+		madvise(self->data, (size_t)self->size, MADV_SEQUENTIAL);
+#endif
+	}
+
+	// The mapping stays valid after the file is closed.
+	Qiniu_File_Close(f);
+	*pp = self;
+	return Qiniu_OK;
+
+lzError:
+	Qiniu_File_Close(f);
+	free(self);
+	return err;
+}
+
+void Qiniu_MappedFile_Close(void* self)
+{
+	Qiniu_MappedFile* mf = (Qiniu_MappedFile*)self;
+
+	if (mf->data != NULL) {
+#if defined(_WIN32)
+		UnmapViewOfFile(mf->data);
+#else
+		munmap(mf->data, (size_t)mf->size);
+#endif
+	}
+	free(mf);
+}
+
+Qiniu_Int64 Qiniu_MappedFile_Size(Qiniu_MappedFile* self)
+{
+	return self->size;
+}
+
+ssize_t Qiniu_MappedFile_ReadAt(void* self, void *buf, size_t bytes, Qiniu_Off_T offset)
+{
+	Qiniu_MappedFile* mf = (Qiniu_MappedFile*)self;
+
+	if (offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((Qiniu_Int64)offset >= mf->size) {
+		return 0;
+	}
+	if ((Qiniu_Int64)bytes > mf->size - offset) {
+		bytes = (size_t)(mf->size - offset);
+	}
+	memcpy(buf, mf->data + offset, bytes);
+	return (ssize_t)bytes;
+}
+
+Qiniu_ReaderAt Qiniu_MappedFileReaderAt(Qiniu_MappedFile* self)
+{
+	Qiniu_ReaderAt ret = {self, Qiniu_MappedFile_ReadAt};
+	return ret;
+}
+
+const char* Qiniu_ReaderAt_Slice(Qiniu_ReaderAt self, Qiniu_Off_T offset, size_t bytes)
+{
+	Qiniu_MappedFile* mf = (Qiniu_MappedFile*)self.self;
+#if !defined(_WIN32)
+	size_t page;
+	size_t head;
+#endif
+
+	if (self.ReadAt != Qiniu_MappedFile_ReadAt || offset < 0 || (Qiniu_Int64)offset > mf->size ||
+		(Qiniu_Int64)bytes > mf->size - offset) {
+		return NULL;
+	}
+	if (bytes == 0) {
+		return mf->data + offset;
+	}
+
+#if !defined(_WIN32)
+	page = (size_t)sysconf(_SC_PAGESIZE);
+	head = (size_t)offset % page;
+	madvise(mf->data + offset - head, bytes + head, MADV_WILLNEED);
+#endif
+	return mf->data + offset;
+}
+
 /*============================================================================*/
 
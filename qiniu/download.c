@@ -0,0 +1,1365 @@
+/*
+ ============================================================================
+ Name        : download.c
+ Author      : Qiniu.com
+ Copyright   : 2012(c) Shanghai Qiniu Information Technologies Co., Ltd.
+ Description :
+ ============================================================================
+ */
+
+#include "download.h"
+#include "qetag.h"
+#include "private.h"
+#include <curl/curl.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stddef.h>
+
+#define QINIU_DOWNLOAD_CONNECTIONS		4
+#define QINIU_DOWNLOAD_SEGMENT_SIZE		(4 * 1024 * 1024)
+#define QINIU_DOWNLOAD_TRY_TIMES		3
+
+CURL* Qiniu_Client_reset(Qiniu_Client* self);
+Qiniu_Error Qiniu_callresult(CURL* curl, CURLcode curlCode, Qiniu_Buffer *resp, Qiniu_Json** ret, Qiniu_Bool simpleError);
+
+static Qiniu_Error ErrInvalidRange = {
+	Qiniu_Download_InvalidRange, "Invalid range response"
+};
+
+static Qiniu_Error ErrChanged = {
+	Qiniu_Download_Changed, "The object is changed during the download"
+};
+
+static Qiniu_Error ErrUnmatchedQetag = {
+	Qiniu_Download_UnmatchedQetag, "unmatched qetag"
+};
+
+static Qiniu_Error ErrUnverifiedQetag = {
+	Qiniu_Download_UnverifiedQetag, "unverified qetag: no etag in the response"
+};
+
+/*============================================================================*/
+/* type Qiniu_Download_fetch */
+
+// One ranged GET. The body of a 206 response is written at the offset of its range, and a 200
+// response is only accepted if acceptWhole is set, whose body is written from the beginning.
+// If a writer is given instead of a file, the body is passed to it in order, and the bytes of a
+// 200 response before the wanted range are skipped.
+typedef struct _Qiniu_Download_fetch {
+	Qiniu_Client* cli;
+	Qiniu_File* f;
+	const Qiniu_Writer* w;
+	struct _Qiniu_Qetag_Context* qetag;
+	Qiniu_Int64 from;
+	Qiniu_Int64 to;
+	Qiniu_Bool noRange;
+	Qiniu_Bool acceptWhole;
+	const char* ifNoneMatch;
+
+	// The object which the response must belong to, if they are known.
+	Qiniu_Int64 expectFsize;
+	const char* expectEtag;
+
+	long status;
+	Qiniu_Int64 written;
+	Qiniu_Int64 rangeFrom;
+	Qiniu_Int64 rangeTo;
+	Qiniu_Int64 total;
+	Qiniu_Int64 contentLength;
+	char etag[QINIU_DOWNLOAD_ETAG_MAX];
+
+	// Set if the transfer is aborted by the writer, which is not worth retrying.
+	Qiniu_Bool aborted;
+	Qiniu_Error err;
+} Qiniu_Download_fetch;
+
+static void Qiniu_Download_fetch_Init(
+	Qiniu_Download_fetch* self, Qiniu_Client* cli, Qiniu_File* f, Qiniu_Int64 from, Qiniu_Int64 to)
+{
+	memset(self, 0, sizeof(*self));
+	self->cli = cli;
+	self->f = f;
+	self->from = from;
+	self->to = to;
+	self->expectFsize = -1;
+}
+
+static const char* Qiniu_Download_headerValue(const char* line, size_t len, const char* name, size_t* valueLen)
+{
+	size_t i;
+	size_t nameLen = strlen(name);
+
+	if (len <= nameLen) {
+		return NULL;
+	}
+	for (i = 0; i < nameLen; i++) {
+		if (tolower((unsigned char)line[i]) != name[i]) {
+			return NULL;
+		}
+	}
+	while (i < len && (line[i] == ' ' || line[i] == '\t')) {
+		i++;
+	}
+	while (len > i && isspace((unsigned char)line[len - 1])) {
+		len--;
+	}
+	*valueLen = len - i;
+	return line + i;
+}
+
+static size_t Qiniu_Download_fetch_onHeader(char* buf, size_t size, size_t n, void* self)
+{
+	Qiniu_Download_fetch* fe = (Qiniu_Download_fetch*)self;
+	size_t len = size * n;
+	size_t valueLen;
+	const char* value;
+	char range[96];
+	long long from, to, total;
+
+	if (len >= 5 && memcmp(buf, "HTTP/", 5) == 0) {
+		// A new response begins, e.g. after a redirect.
+		fe->rangeFrom = -1;
+		fe->rangeTo = -1;
+		fe->total = -1;
+		fe->contentLength = -1;
+		fe->etag[0] = '\0';
+	} else if ((value = Qiniu_Download_headerValue(buf, len, "etag:", &valueLen)) != NULL) {
+		if (valueLen >= 2 && value[0] == 'W' && value[1] == '/') {
+			value += 2;
+			valueLen -= 2;
+		}
+		if (valueLen >= 2 && value[0] == '"' && value[valueLen - 1] == '"') {
+			value++;
+			valueLen -= 2;
+		}
+		if (valueLen >= sizeof(fe->etag)) {
+			valueLen = sizeof(fe->etag) - 1;
+		}
+		memcpy(fe->etag, value, valueLen);
+		fe->etag[valueLen] = '\0';
+	} else if ((value = Qiniu_Download_headerValue(buf, len, "content-range:", &valueLen)) != NULL) {
+		if (valueLen < sizeof(range)) {
+			memcpy(range, value, valueLen);
+			range[valueLen] = '\0';
+			if (sscanf(range, "bytes %lld-%lld/%lld", &from, &to, &total) == 3) {
+				fe->rangeFrom = from;
+				fe->rangeTo = to;
+				fe->total = total;
+			}
+		}
+	} else if ((value = Qiniu_Download_headerValue(buf, len, "content-length:", &valueLen)) != NULL) {
+		if (valueLen < sizeof(range)) {
+			memcpy(range, value, valueLen);
+			range[valueLen] = '\0';
+			if (sscanf(range, "%lld", &total) == 1) {
+				fe->contentLength = total;
+			}
+		}
+	}
+	return len;
+}
+
+static Qiniu_Bool Qiniu_Download_fetch_check(Qiniu_Download_fetch* self)
+{
+	CURL* curl = (CURL*)self->cli->curl;
+	Qiniu_Int64 last;
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &self->status);
+	if (self->status / 100 != 2) {
+		return Qiniu_True;
+	}
+	if (self->status == 206) {
+		// The range must cover all the requested bytes, or a short one would be taken as complete.
+		last = self->total - 1;
+		if (self->to >= 0 && self->to < last) {
+			last = self->to;
+		}
+		if (self->rangeFrom != self->from || self->rangeTo < self->rangeFrom || self->rangeTo != last) {
+			self->err = ErrInvalidRange;
+			return Qiniu_False;
+		}
+	} else if (self->status == 200 && self->acceptWhole) {
+		self->total = self->contentLength;
+	} else {
+		self->err = ErrInvalidRange;
+		return Qiniu_False;
+	}
+	if ((self->expectFsize >= 0 && self->total >= 0 && self->total != self->expectFsize) ||
+		(self->expectEtag != NULL && strcmp(self->etag, self->expectEtag) != 0)) {
+		self->err = ErrChanged;
+		return Qiniu_False;
+	}
+	return Qiniu_True;
+}
+
+static size_t Qiniu_Download_fetch_onBody(const void* buf, size_t size, size_t n, void* self)
+{
+	Qiniu_Download_fetch* fe = (Qiniu_Download_fetch*)self;
+	const char* p = (const char*)buf;
+	size_t len = size * n;
+	size_t left = len;
+	Qiniu_Int64 off;
+	ssize_t done;
+	Qiniu_Error err;
+
+	if (fe->status == 0 && !Qiniu_Download_fetch_check(fe)) {
+		fe->aborted = Qiniu_True;
+		return 0;
+	}
+	if (fe->status / 100 != 2) {
+		return Qiniu_Buffer_Fwrite(buf, size, n, &fe->cli->b);
+	}
+
+	off = (fe->status == 206) ? fe->from + fe->written : fe->written;
+	if (fe->status == 206 && off + (Qiniu_Int64)len > fe->rangeTo + 1) {
+		fe->err = ErrInvalidRange;
+		fe->aborted = Qiniu_True;
+		return 0;
+	}
+	if (fe->w != NULL) {
+		if (off < fe->from) {
+			done = (fe->from - off < (Qiniu_Int64)left) ? (ssize_t)(fe->from - off) : (ssize_t)left;
+			p += done;
+			left -= done;
+		}
+		if (left > 0) {
+			if (fe->w->Write(p, 1, left, fe->w->self) != left) {
+				fe->err.code = CURLE_WRITE_ERROR;
+				fe->err.message = "write failed";
+				fe->aborted = Qiniu_True;
+				return 0;
+			}
+			if (fe->qetag != NULL) {
+				err = Qiniu_Qetag_Update(fe->qetag, p, left);
+				if (err.code != 200) {
+					fe->err = err;
+					fe->aborted = Qiniu_True;
+					return 0;
+				}
+			}
+		}
+		fe->written += len;
+		return len;
+	}
+	while (left > 0) {
+		done = Qiniu_File_WriteAt(fe->f, p, left, (Qiniu_Off_T)off);
+		if (done <= 0) {
+			fe->err.code = errno;
+			fe->err.message = "write file failed";
+			fe->aborted = Qiniu_True;
+			return 0;
+		}
+		p += done;
+		off += done;
+		left -= done;
+	}
+	fe->written += len;
+	return len;
+}
+
+static Qiniu_Error Qiniu_Download_fetch_Do(Qiniu_Download_fetch* self, const char* url)
+{
+	int retCode = 0;
+	Qiniu_Error err;
+	CURLcode curlCode;
+	char range[96];
+	char cond[QINIU_DOWNLOAD_ETAG_MAX + 32];
+	Qiniu_Header* headers = NULL;
+	Qiniu_Client* cli = self->cli;
+	CURL* curl = Qiniu_Client_reset(cli);
+
+	// Bind the NIC for sending packets.
+	if (cli->boundNic != NULL) {
+		retCode = curl_easy_setopt(curl, CURLOPT_INTERFACE, cli->boundNic);
+		if (retCode == CURLE_INTERFACE_FAILED) {
+			err.code = 9994;
+			err.message = "Can not bind the given NIC";
+			return err;
+		}
+	}
+	if (cli->lowSpeedLimit > 0 && cli->lowSpeedTime > 0) {
+		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, cli->lowSpeedLimit);
+		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, cli->lowSpeedTime);
+	}
+
+	if (!self->noRange) {
+		if (self->to >= 0) {
+			Qiniu_snprintf(range, sizeof(range), "Range: bytes=%lld-%lld", (long long)self->from, (long long)self->to);
+		} else {
+			Qiniu_snprintf(range, sizeof(range), "Range: bytes=%lld-", (long long)self->from);
+		}
+		headers = curl_slist_append(NULL, range);
+	}
+	if (self->ifNoneMatch != NULL) {
+		Qiniu_snprintf(cond, sizeof(cond), "If-None-Match: \"%s\"", self->ifNoneMatch);
+		headers = curl_slist_append(headers, cond);
+	}
+
+	self->status = 0;
+	self->written = 0;
+	self->aborted = Qiniu_False;
+	self->err = Qiniu_OK;
+
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, Qiniu_Download_fetch_onHeader);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, self);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, Qiniu_Download_fetch_onBody);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, self);
+
+	curlCode = curl_easy_perform(curl);
+	curl_slist_free_all(headers);
+
+	if (self->aborted) {
+		return self->err;
+	}
+	err = Qiniu_callresult(curl, curlCode, &cli->b, &cli->root, Qiniu_False);
+	if (err.code / 100 == 2) {
+		// An empty body never reaches the writer.
+		if (self->status == 0 && !Qiniu_Download_fetch_check(self)) {
+			self->aborted = Qiniu_True;
+			return self->err;
+		}
+		if (self->status == 206 && self->written != self->rangeTo - self->rangeFrom + 1) {
+			return ErrInvalidRange;
+		}
+	}
+	return err;
+}
+
+static Qiniu_Bool Qiniu_Download_fetch_retryable(Qiniu_Download_fetch* self, Qiniu_Error err)
+{
+	// A bad range is the server's fault even if it aborts the transfer, so it is worth retrying.
+	return err.code == Qiniu_Download_InvalidRange || (!self->aborted && (err.code < 100 || err.code / 100 == 5));
+}
+
+/*============================================================================*/
+/* type Qiniu_Download_task */
+
+#define QINIU_DOWNLOAD_STATE_MAGIC		0x4c44514e // "NQDL"
+#define QINIU_DOWNLOAD_STATE_VERSION	1
+
+// The state file is the header followed by one byte per segment, which is set once the segment
+// is written into the local file.
+typedef struct _Qiniu_Download_stateHeader {
+	Qiniu_Uint32 magic;
+	Qiniu_Uint32 version;
+	Qiniu_Int64 fsize;
+	Qiniu_Int64 segmentSize;
+	char etag[QINIU_DOWNLOAD_ETAG_MAX];
+	Qiniu_Uint32 checksum;
+} Qiniu_Download_stateHeader;
+
+typedef struct _Qiniu_Download_task {
+	const char* url;
+	const char* ifNoneMatch;
+	Qiniu_File* f;
+	Qiniu_File* state;
+	int tryTimes;
+
+	Qiniu_Int64 fsize;
+	Qiniu_Int64 segmentSize;
+	char etag[QINIU_DOWNLOAD_ETAG_MAX];
+	int segCount;
+	unsigned char* done;
+
+	Qiniu_Mutex mutex;
+	int next;
+	Qiniu_Bool failed;
+	Qiniu_Error err;
+} Qiniu_Download_task;
+
+static Qiniu_Error ErrNoMemory = {
+	499, "No enough memory"
+};
+
+static Qiniu_Error Qiniu_Download_task_layout(Qiniu_Download_task* self, Qiniu_Int64 fsize, Qiniu_Int64 segmentSize)
+{
+	Qiniu_Int64 segCount = (fsize + segmentSize - 1) / segmentSize;
+
+	if (segCount > 0x7fffffff) {
+		return ErrInvalidRange;
+	}
+	free(self->done);
+	self->done = (unsigned char*)calloc((size_t)segCount + 1, 1);
+	if (self->done == NULL) {
+		self->segCount = 0;
+		return ErrNoMemory;
+	}
+	self->fsize = fsize;
+	self->segmentSize = segmentSize;
+	self->segCount = (int)segCount;
+	return Qiniu_OK;
+}
+
+static void Qiniu_Download_stateHeader_Init(Qiniu_Download_stateHeader* hdr, Qiniu_Download_task* self)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = QINIU_DOWNLOAD_STATE_MAGIC;
+	hdr->version = QINIU_DOWNLOAD_STATE_VERSION;
+	hdr->fsize = self->fsize;
+	hdr->segmentSize = self->segmentSize;
+	memcpy(hdr->etag, self->etag, sizeof(hdr->etag));
+	hdr->checksum = (Qiniu_Uint32)Qiniu_Crc32_Update(0, hdr, offsetof(Qiniu_Download_stateHeader, checksum));
+}
+
+// Load the finished segments of a former download, and return whether they can be reused.
+static Qiniu_Bool Qiniu_Download_task_loadState(Qiniu_Download_task* self)
+{
+	Qiniu_Download_stateHeader hdr, expect;
+
+	if (Qiniu_File_ReadAt(self->state, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+		return Qiniu_False;
+	}
+	if (hdr.magic != QINIU_DOWNLOAD_STATE_MAGIC || hdr.version != QINIU_DOWNLOAD_STATE_VERSION ||
+		hdr.fsize < 0 || hdr.segmentSize <= 0 ||
+		hdr.checksum != (Qiniu_Uint32)Qiniu_Crc32_Update(0, &hdr, offsetof(Qiniu_Download_stateHeader, checksum))) {
+		return Qiniu_False;
+	}
+	if (Qiniu_Download_task_layout(self, hdr.fsize, hdr.segmentSize).code != 200) {
+		return Qiniu_False;
+	}
+	memcpy(self->etag, hdr.etag, sizeof(self->etag));
+	self->etag[sizeof(self->etag) - 1] = '\0';
+
+	Qiniu_Download_stateHeader_Init(&expect, self);
+	if (memcmp(&hdr, &expect, sizeof(hdr)) != 0 ||
+		Qiniu_File_ReadAt(self->state, self->done, self->segCount, sizeof(hdr)) != (ssize_t)self->segCount) {
+		memset(self->done, 0, self->segCount);
+		return Qiniu_False;
+	}
+	return Qiniu_True;
+}
+
+static Qiniu_Error Qiniu_Download_task_saveState(Qiniu_Download_task* self)
+{
+	Qiniu_Error err;
+	Qiniu_Download_stateHeader hdr;
+
+	if (self->state == NULL) {
+		return Qiniu_OK;
+	}
+	Qiniu_Download_stateHeader_Init(&hdr, self);
+	err = Qiniu_File_Allocate(self->state, 0);
+	if (err.code != 200) {
+		return err;
+	}
+	if (Qiniu_File_WriteAt(self->state, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+		(self->segCount > 0 &&
+		 Qiniu_File_WriteAt(self->state, self->done, self->segCount, sizeof(hdr)) != (ssize_t)self->segCount)) {
+		err.code = errno;
+		err.message = "write state file failed";
+		return err;
+	}
+	return Qiniu_OK;
+}
+
+// Segments are owned by one worker at a time, so concurrent updates never touch the same byte.
+static void Qiniu_Download_task_markDone(Qiniu_Download_task* self, int idx)
+{
+	self->done[idx] = 1;
+	if (self->state != NULL) {
+		Qiniu_File_WriteAt(self->state, &self->done[idx], 1, sizeof(Qiniu_Download_stateHeader) + idx);
+	}
+}
+
+static Qiniu_Error Qiniu_Download_task_fetchSegment(Qiniu_Download_task* self, Qiniu_Client* cli, int idx)
+{
+	Qiniu_Error err;
+	Qiniu_Download_fetch fe;
+	Qiniu_Int64 from = (Qiniu_Int64)idx * self->segmentSize;
+	Qiniu_Int64 to = from + self->segmentSize;
+	int tries = 0;
+
+	if (to > self->fsize) {
+		to = self->fsize;
+	}
+	to--;
+
+	for (;;) {
+		Qiniu_Download_fetch_Init(&fe, cli, self->f, from, to);
+		fe.expectFsize = self->fsize;
+		fe.expectEtag = (self->etag[0] != '\0') ? self->etag : NULL;
+
+		err = Qiniu_Download_fetch_Do(&fe, self->url);
+		if (err.code == 206) {
+			return Qiniu_OK;
+		}
+		if (!Qiniu_Download_fetch_retryable(&fe, err) || ++tries >= self->tryTimes) {
+			Qiniu_Log_Warn("download.ToFile: segment %d failed - %E", idx, err);
+			return err;
+		}
+		Qiniu_Log_Info("download.ToFile %E, retrying ...", err);
+
+		// Only the rest of the segment is requested again.
+		if (fe.status == 206) {
+			from += fe.written;
+		}
+	}
+}
+
+static void Qiniu_Download_task_work(Qiniu_Download_task* self, Qiniu_Client* cli)
+{
+	int idx;
+	Qiniu_Error err;
+
+	for (;;) {
+		Qiniu_Mutex_Lock(&self->mutex);
+		while (self->next < self->segCount && self->done[self->next]) {
+			self->next++;
+		}
+		if (self->failed || self->next >= self->segCount) {
+			Qiniu_Mutex_Unlock(&self->mutex);
+			return;
+		}
+		idx = self->next++;
+		Qiniu_Mutex_Unlock(&self->mutex);
+
+		err = Qiniu_Download_task_fetchSegment(self, cli, idx);
+		if (err.code != 200) {
+			Qiniu_Mutex_Lock(&self->mutex);
+			if (!self->failed) {
+				self->failed = Qiniu_True;
+				self->err = err;
+			}
+			Qiniu_Mutex_Unlock(&self->mutex);
+			return;
+		}
+		Qiniu_Download_task_markDone(self, idx);
+	}
+}
+
+typedef struct _Qiniu_Download_worker {
+	Qiniu_Download_task* task;
+	Qiniu_Client client;
+	Qiniu_Thread thread;
+} Qiniu_Download_worker;
+
+static void Qiniu_Download_worker_run(void* params)
+{
+	Qiniu_Download_worker* self = (Qiniu_Download_worker*)params;
+	Qiniu_Download_task_work(self->task, &self->client);
+}
+
+// Fetch the first wanted segment, which also tells the size and the ETag of the object. If the
+// server ignores the Range header, the whole object is written and fe->status is 200.
+static Qiniu_Error Qiniu_Download_task_probe(
+	Qiniu_Download_task* self, Qiniu_Client* cli, Qiniu_Int64 from, Qiniu_Int64 segmentSize,
+	Qiniu_Download_fetch* fe)
+{
+	Qiniu_Error err;
+	Qiniu_Bool noRange = Qiniu_False;
+	int tries = 0;
+
+	for (;;) {
+		Qiniu_Download_fetch_Init(fe, cli, self->f, from, from + segmentSize - 1);
+		fe->noRange = noRange;
+		fe->acceptWhole = Qiniu_True;
+		fe->ifNoneMatch = self->ifNoneMatch;
+
+		err = Qiniu_Download_fetch_Do(fe, self->url);
+		if (err.code == 416 && from == 0 && !noRange) {
+			// The object is empty, so no range of it is satisfiable.
+			noRange = Qiniu_True;
+			continue;
+		}
+		if (err.code / 100 == 2 || !Qiniu_Download_fetch_retryable(fe, err) || ++tries >= self->tryTimes) {
+			return err;
+		}
+		Qiniu_Log_Info("download.ToFile %E, retrying ...", err);
+	}
+}
+
+/*============================================================================*/
+/* func Qiniu_Download_ToFile/ToWriter */
+
+static Qiniu_Error Qiniu_Download_verifyQetag(const char* etag, char* qetag, Qiniu_Download_Ret* ret)
+{
+	Qiniu_Error err = Qiniu_OK;
+
+	if (ret != NULL) {
+		Qiniu_snprintf(ret->qetag, sizeof(ret->qetag), "%s", qetag);
+	}
+	if (etag[0] == '\0') {
+		Qiniu_Log_Warn("download: no etag to verify the local qetag %s", qetag);
+		err = ErrUnverifiedQetag;
+	} else if (strcmp(etag, qetag) != 0) {
+		Qiniu_Log_Warn("download: unmatched qetag, local %s, remote %s", qetag, etag);
+		err = ErrUnmatchedQetag;
+	}
+	free(qetag);
+	return err;
+}
+
+static Qiniu_Error Qiniu_Download_run(Qiniu_Download_task* self, Qiniu_Client* cli, Qiniu_Download_Extra* extra)
+{
+	Qiniu_Error err;
+	Qiniu_Download_fetch fe;
+	Qiniu_Download_worker* workers = NULL;
+	Qiniu_Bool resumed = Qiniu_False;
+	Qiniu_Int64 segmentSize = (extra->segmentSize > 0) ? extra->segmentSize : QINIU_DOWNLOAD_SEGMENT_SIZE;
+	int connections = (extra->connections > 0) ? extra->connections : QINIU_DOWNLOAD_CONNECTIONS;
+	int first = 0;
+	int pending = 0;
+	int workerCount = 0;
+	int i;
+
+	if (self->state != NULL && Qiniu_Download_task_loadState(self)) {
+		resumed = Qiniu_True;
+		segmentSize = self->segmentSize;
+		while (first < self->segCount && self->done[first]) {
+			first++;
+		}
+		if (first == self->segCount) {
+			return Qiniu_File_Allocate(self->f, self->fsize);
+		}
+	}
+
+	err = Qiniu_Download_task_probe(self, cli, (Qiniu_Int64)first * segmentSize, segmentSize, &fe);
+	if (resumed && (err.code == 416 || (err.code == 206 && (fe.total != self->fsize || strcmp(fe.etag, self->etag) != 0)))) {
+		// The object is changed since the former download, whose segments are useless.
+		resumed = Qiniu_False;
+		first = 0;
+		err = Qiniu_Download_task_probe(self, cli, 0, segmentSize, &fe);
+	}
+	if (err.code / 100 != 2) {
+		return err;
+	}
+
+	memcpy(self->etag, fe.etag, sizeof(self->etag));
+	if (fe.status == 200) {
+		self->fsize = fe.written;
+		return Qiniu_File_Allocate(self->f, self->fsize);
+	}
+	if (!resumed) {
+		err = Qiniu_Download_task_layout(self, fe.total, segmentSize);
+		if (err.code != 200) {
+			return err;
+		}
+	}
+	err = Qiniu_File_Allocate(self->f, self->fsize);
+	if (err.code != 200) {
+		return err;
+	}
+	if (!resumed) {
+		err = Qiniu_Download_task_saveState(self);
+		if (err.code != 200) {
+			return err;
+		}
+	}
+	Qiniu_Download_task_markDone(self, first);
+
+	for (i = 0; i < self->segCount; i++) {
+		pending += !self->done[i];
+	}
+	if (connections > pending) {
+		connections = pending;
+	}
+	if (connections > 1) {
+		workers = (Qiniu_Download_worker*)calloc(connections - 1, sizeof(Qiniu_Download_worker));
+		if (workers == NULL) {
+			return ErrNoMemory;
+		}
+	}
+
+	// The calling thread works with the given client, and the others with their own ones.
+	for (i = 0; i < connections - 1; i++) {
+		Qiniu_Download_worker* w = &workers[i];
+		w->task = self;
+		Qiniu_Client_InitNoAuth(&w->client, 1024);
+		w->client.boundNic = cli->boundNic;
+		w->client.lowSpeedLimit = cli->lowSpeedLimit;
+		w->client.lowSpeedTime = cli->lowSpeedTime;
+		if (Qiniu_Share_forThreads(cli->share) != NULL) {
+			Qiniu_Client_SetShare(&w->client, cli->share);
+		}
+		if (Qiniu_Thread_Create(&w->thread, Qiniu_Download_worker_run, w) != 0) {
+			// Go on with the workers created so far.
+			Qiniu_Client_Cleanup(&w->client);
+			break;
+		}
+		workerCount++;
+	}
+	Qiniu_Download_task_work(self, cli);
+
+	for (i = 0; i < workerCount; i++) {
+		Qiniu_Thread_Join(workers[i].thread);
+		Qiniu_Client_Cleanup(&workers[i].client);
+	}
+	free(workers);
+
+	return self->failed ? self->err : Qiniu_OK;
+}
+
+Qiniu_Error Qiniu_Download_ToFile(
+	Qiniu_Client* self, Qiniu_Download_Ret* ret, const char* url, const char* localFile,
+	Qiniu_Download_Extra* extra)
+{
+	Qiniu_Error err;
+	Qiniu_Download_task task;
+	Qiniu_Download_Extra extra1;
+	char* qetag = NULL;
+
+	if (extra == NULL) {
+		memset(&extra1, 0, sizeof(extra1));
+		extra = &extra1;
+	}
+
+	memset(&task, 0, sizeof(task));
+	task.url = url;
+	task.ifNoneMatch = extra->ifNoneMatch;
+	task.tryTimes = (extra->tryTimes > 0) ? extra->tryTimes : QINIU_DOWNLOAD_TRY_TIMES;
+
+	err = Qiniu_File_OpenRW(&task.f, localFile);
+	if (err.code != 200) {
+		return err;
+	}
+	if (extra->stateFile != NULL) {
+		err = Qiniu_File_OpenRW(&task.state, extra->stateFile);
+		if (err.code != 200) {
+			Qiniu_File_Close(task.f);
+			return err;
+		}
+	}
+	Qiniu_Mutex_Init(&task.mutex);
+
+	err = Qiniu_Download_run(&task, self, extra);
+
+	Qiniu_Mutex_Cleanup(&task.mutex);
+	Qiniu_File_Close(task.f);
+
+	if (err.code == 200 && extra->checkQetag) {
+		err = Qiniu_Qetag_DigestFileEx(localFile, (extra->connections > 0) ? extra->connections : QINIU_DOWNLOAD_CONNECTIONS, &qetag);
+		if (err.code == 200) {
+			err = Qiniu_Download_verifyQetag(task.etag, qetag, ret);
+		}
+	}
+	if (task.state != NULL) {
+		Qiniu_File_Close(task.state);
+
+		// The segments of a corrupted or unverified file are useless as well.
+		if (err.code == 200 || err.code == Qiniu_Download_UnmatchedQetag ||
+			err.code == Qiniu_Download_UnverifiedQetag) {
+			remove(extra->stateFile);
+		}
+	}
+	free(task.done);
+
+	if ((err.code == 200 || err.code == Qiniu_Download_UnverifiedQetag) && ret != NULL) {
+		ret->fsize = task.fsize;
+		memcpy(ret->etag, task.etag, sizeof(ret->etag));
+		if (!extra->checkQetag) {
+			ret->qetag[0] = '\0';
+		}
+	}
+	return err;
+}
+
+Qiniu_Error Qiniu_Download_ToWriter(
+	Qiniu_Client* self, Qiniu_Download_Ret* ret, const char* url, Qiniu_Writer w,
+	Qiniu_Download_Extra* extra)
+{
+	Qiniu_Error err;
+	Qiniu_Download_fetch fe;
+	Qiniu_Download_Extra extra1;
+	struct _Qiniu_Qetag_Context* ctx = NULL;
+	char etag[QINIU_DOWNLOAD_ETAG_MAX];
+	char* qetag = NULL;
+	Qiniu_Bool known = Qiniu_False;
+	Qiniu_Int64 fsize = -1;
+	Qiniu_Int64 delivered = 0;
+	Qiniu_Int64 pos;
+	int tryTimes;
+	int tries = 0;
+
+	if (extra == NULL) {
+		memset(&extra1, 0, sizeof(extra1));
+		extra = &extra1;
+	}
+	tryTimes = (extra->tryTimes > 0) ? extra->tryTimes : QINIU_DOWNLOAD_TRY_TIMES;
+
+	if (extra->checkQetag) {
+		err = Qiniu_Qetag_New(&ctx, 1);
+		if (err.code != 200) {
+			return err;
+		}
+	}
+	etag[0] = '\0';
+
+	for (;;) {
+		// A broken stream is resumed from the first byte not passed to the writer yet.
+		Qiniu_Download_fetch_Init(&fe, self, NULL, delivered, -1);
+		fe.w = &w;
+		fe.qetag = ctx;
+		fe.noRange = (delivered == 0);
+		fe.acceptWhole = Qiniu_True;
+		if (known) {
+			fe.expectFsize = fsize;
+			fe.expectEtag = etag;
+		} else {
+			fe.ifNoneMatch = extra->ifNoneMatch;
+		}
+
+		err = Qiniu_Download_fetch_Do(&fe, url);
+		if (!known && fe.status / 100 == 2) {
+			known = Qiniu_True;
+			fsize = fe.total;
+			memcpy(etag, fe.etag, sizeof(etag));
+		}
+		pos = ((fe.status == 206) ? fe.from : 0) + fe.written;
+		if (pos > delivered) {
+			delivered = pos;
+		}
+		if (err.code / 100 == 2) {
+			break;
+		}
+		if (!Qiniu_Download_fetch_retryable(&fe, err) || ++tries >= tryTimes) {
+			goto done;
+		}
+		Qiniu_Log_Info("download.ToWriter %E, retrying ...", err);
+	}
+
+	err = Qiniu_OK;
+	if (ctx != NULL) {
+		err = Qiniu_Qetag_Final(ctx, &qetag);
+		if (err.code == 200) {
+			err = Qiniu_Download_verifyQetag(etag, qetag, ret);
+		}
+	}
+	if ((err.code == 200 || err.code == Qiniu_Download_UnverifiedQetag) && ret != NULL) {
+		ret->fsize = delivered;
+		memcpy(ret->etag, etag, sizeof(ret->etag));
+		if (ctx == NULL) {
+			ret->qetag[0] = '\0';
+		}
+	}
+
+done:
+	if (ctx != NULL) {
+		Qiniu_Qetag_Destroy(ctx);
+	}
+	return err;
+}
+
+/*============================================================================*/
+/* type Qiniu_Download_Cache */
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <utime.h>
+#endif
+#include <sys/stat.h>
+#include <time.h>
+#include <openssl/sha.h>
+
+#define QINIU_DOWNLOAD_CACHE_HEX_SIZE		(SHA_DIGEST_LENGTH * 2)
+#define QINIU_DOWNLOAD_CACHE_BUCKETS		64
+
+// A cached file is named by the SHA1 of bucket:key in hex, a dash and the ETag of the object, and a
+// temporary file ends with ".tmp". The entries are chained in a hash table by the id, and in a list
+// ordered from the most recently used one.
+typedef struct _Qiniu_Download_cacheEntry {
+	struct _Qiniu_Download_cacheEntry* hnext;
+	struct _Qiniu_Download_cacheEntry* prev;
+	struct _Qiniu_Download_cacheEntry* next;
+	char id[QINIU_DOWNLOAD_CACHE_HEX_SIZE + 1];
+	char etag[QINIU_DOWNLOAD_ETAG_MAX];
+	Qiniu_Int64 fsize;
+	time_t usedAt;
+	time_t validatedAt;
+} Qiniu_Download_cacheEntry;
+
+struct _Qiniu_Download_Cache {
+	char* dir;
+	Qiniu_Int64 maxBytes;
+	int maxAge;
+	Qiniu_Mutex mutex;
+	Qiniu_Download_cacheEntry** buckets;
+	size_t bucketCount;
+	Qiniu_Download_cacheEntry lru;
+	Qiniu_Download_CacheStats stats;
+	Qiniu_Count seq;
+};
+
+static size_t Qiniu_Download_cache_hash(const char* id)
+{
+	size_t h = 0;
+	int i;
+
+	// The id is a digest already, so its leading bits are good enough.
+	for (i = 0; i < 8; i++) {
+		h = (h << 4) | (size_t)(isdigit((unsigned char)id[i]) ? id[i] - '0' : id[i] - 'a' + 10);
+	}
+	return h;
+}
+
+static Qiniu_Download_cacheEntry* Qiniu_Download_cache_find(Qiniu_Download_Cache* self, const char* id)
+{
+	Qiniu_Download_cacheEntry* e = self->buckets[Qiniu_Download_cache_hash(id) % self->bucketCount];
+
+	while (e != NULL && strcmp(e->id, id) != 0) {
+		e = e->hnext;
+	}
+	return e;
+}
+
+static void Qiniu_Download_cache_touch(Qiniu_Download_Cache* self, Qiniu_Download_cacheEntry* e)
+{
+	if (e->prev != NULL) {
+		e->prev->next = e->next;
+		e->next->prev = e->prev;
+	}
+	e->prev = &self->lru;
+	e->next = self->lru.next;
+	self->lru.next->prev = e;
+	self->lru.next = e;
+}
+
+static void Qiniu_Download_cache_add(Qiniu_Download_Cache* self, Qiniu_Download_cacheEntry* e)
+{
+	size_t i, h;
+	size_t bucketCount;
+	Qiniu_Download_cacheEntry** buckets;
+	Qiniu_Download_cacheEntry* next;
+
+	if (self->stats.entries >= (Qiniu_Int64)self->bucketCount * 2) {
+		bucketCount = self->bucketCount * 2;
+		buckets = (Qiniu_Download_cacheEntry**)calloc(bucketCount, sizeof(Qiniu_Download_cacheEntry*));
+		if (buckets != NULL) {
+			for (i = 0; i < self->bucketCount; i++) {
+				for (next = self->buckets[i]; next != NULL; ) {
+					Qiniu_Download_cacheEntry* moved = next;
+					next = moved->hnext;
+					h = Qiniu_Download_cache_hash(moved->id) % bucketCount;
+					moved->hnext = buckets[h];
+					buckets[h] = moved;
+				}
+			}
+			free(self->buckets);
+			self->buckets = buckets;
+			self->bucketCount = bucketCount;
+		}
+	}
+
+	h = Qiniu_Download_cache_hash(e->id) % self->bucketCount;
+	e->hnext = self->buckets[h];
+	self->buckets[h] = e;
+	self->stats.entries++;
+	self->stats.bytes += e->fsize;
+}
+
+static void Qiniu_Download_cache_remove(Qiniu_Download_Cache* self, Qiniu_Download_cacheEntry* e)
+{
+	Qiniu_Download_cacheEntry** pp = &self->buckets[Qiniu_Download_cache_hash(e->id) % self->bucketCount];
+
+	while (*pp != e) {
+		pp = &(*pp)->hnext;
+	}
+	*pp = e->hnext;
+	if (e->prev != NULL) {
+		e->prev->next = e->next;
+		e->next->prev = e->prev;
+	}
+	self->stats.entries--;
+	self->stats.bytes -= e->fsize;
+	free(e);
+}
+
+static char* Qiniu_Download_cache_path(Qiniu_Download_Cache* self, const char* id, const char* etag)
+{
+	return Qiniu_String_Concat(self->dir, "/", id, "-", etag, NULL);
+}
+
+static void Qiniu_Download_cache_removeFile(Qiniu_Download_Cache* self, Qiniu_Download_cacheEntry* e)
+{
+	char* path = Qiniu_Download_cache_path(self, e->id, e->etag);
+	remove(path);
+	free(path);
+}
+
+// Remove the least recently used entries, except the given one, until the limit is met.
+static void Qiniu_Download_cache_evict(Qiniu_Download_Cache* self, Qiniu_Download_cacheEntry* keep)
+{
+	Qiniu_Download_cacheEntry* e = self->lru.prev;
+
+	while (self->stats.bytes > self->maxBytes && e != &self->lru) {
+		Qiniu_Download_cacheEntry* prev = e->prev;
+		if (e != keep) {
+			Qiniu_Download_cache_removeFile(self, e);
+			Qiniu_Download_cache_remove(self, e);
+			self->stats.evictions++;
+		}
+		e = prev;
+	}
+}
+
+// Only ETags which are safe as a part of a file name can be used to validate a cached file.
+static Qiniu_Bool Qiniu_Download_cache_isSafeEtag(const char* etag)
+{
+	const char* p;
+
+	for (p = etag; *p != '\0'; p++) {
+		if (!isalnum((unsigned char)*p) && *p != '-' && *p != '_' && *p != '=') {
+			return Qiniu_False;
+		}
+	}
+	return Qiniu_True;
+}
+
+static Qiniu_Bool Qiniu_Download_cache_parseName(const char* name, char* id, const char** etag)
+{
+	size_t i;
+	size_t len = strlen(name);
+
+	if (len <= QINIU_DOWNLOAD_CACHE_HEX_SIZE || name[QINIU_DOWNLOAD_CACHE_HEX_SIZE] != '-' ||
+		len - QINIU_DOWNLOAD_CACHE_HEX_SIZE - 1 >= QINIU_DOWNLOAD_ETAG_MAX) {
+		return Qiniu_False;
+	}
+	for (i = 0; i < QINIU_DOWNLOAD_CACHE_HEX_SIZE; i++) {
+		if (!isdigit((unsigned char)name[i]) && !(name[i] >= 'a' && name[i] <= 'f')) {
+			return Qiniu_False;
+		}
+	}
+	memcpy(id, name, QINIU_DOWNLOAD_CACHE_HEX_SIZE);
+	id[QINIU_DOWNLOAD_CACHE_HEX_SIZE] = '\0';
+	*etag = name + QINIU_DOWNLOAD_CACHE_HEX_SIZE + 1;
+	return Qiniu_Download_cache_isSafeEtag(*etag);
+}
+
+static void Qiniu_Download_cache_loadFile(Qiniu_Download_Cache* self, const char* name, Qiniu_Buffer* loaded)
+{
+	struct stat st;
+	char* path = Qiniu_String_Concat(self->dir, "/", name, NULL);
+	char id[QINIU_DOWNLOAD_CACHE_HEX_SIZE + 1];
+	const char* etag;
+	size_t len = strlen(name);
+	Qiniu_Download_cacheEntry* e;
+
+	if (len > 4 && strcmp(name + len - 4, ".tmp") == 0) {
+		// Left by a download which was interrupted.
+		remove(path);
+	} else if (Qiniu_Download_cache_parseName(name, id, &etag) && stat(path, &st) == 0) {
+		e = (Qiniu_Download_cacheEntry*)calloc(1, sizeof(Qiniu_Download_cacheEntry));
+		if (e != NULL) {
+			memcpy(e->id, id, sizeof(e->id));
+			strcpy(e->etag, etag);
+			e->fsize = (Qiniu_Int64)st.st_size;
+			e->usedAt = st.st_mtime;
+			Qiniu_Buffer_Write(loaded, &e, sizeof(e));
+		}
+	}
+	free(path);
+}
+
+static int Qiniu_Download_cache_compareUsedAt(const void* a, const void* b)
+{
+	const Qiniu_Download_cacheEntry* ea = *(const Qiniu_Download_cacheEntry* const*)a;
+	const Qiniu_Download_cacheEntry* eb = *(const Qiniu_Download_cacheEntry* const*)b;
+
+	return (ea->usedAt < eb->usedAt) ? -1 : (ea->usedAt > eb->usedAt) ? 1 : 0;
+}
+
+static Qiniu_Error Qiniu_Download_cache_load(Qiniu_Download_Cache* self)
+{
+	Qiniu_Error err;
+	Qiniu_Buffer loaded;
+	Qiniu_Download_cacheEntry** entries;
+	Qiniu_Download_cacheEntry* e;
+	size_t i, count;
+
+	Qiniu_Buffer_Init(&loaded, 64 * sizeof(Qiniu_Download_cacheEntry*));
+
+#if defined(_WIN32)
+	{
+		WIN32_FIND_DATAA fd;
+		char* pattern = Qiniu_String_Concat2(self->dir, "/*");
+		HANDLE h = FindFirstFileA(pattern, &fd);
+
+		free(pattern);
+		if (h == INVALID_HANDLE_VALUE) {
+			Qiniu_Buffer_Cleanup(&loaded);
+			err.code = GetLastError();
+			err.message = "open cache directory failed";
+			return err;
+		}
+		do {
+			if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+				Qiniu_Download_cache_loadFile(self, fd.cFileName, &loaded);
+			}
+		} while (FindNextFileA(h, &fd));
+		FindClose(h);
+	}
+#else
+	{
+		struct dirent* ent;
+		DIR* d = opendir(self->dir);
+
+		if (d == NULL) {
+			Qiniu_Buffer_Cleanup(&loaded);
+			err.code = errno;
+			err.message = "open cache directory failed";
+			return err;
+		}
+		while ((ent = readdir(d)) != NULL) {
+			if (ent->d_name[0] != '.') {
+				Qiniu_Download_cache_loadFile(self, ent->d_name, &loaded);
+			}
+		}
+		closedir(d);
+	}
+#endif
+
+	// Add the files from the least recently used one, so that the most recent one is the head at last.
+	// Only the newest file of an object is kept, and the others are left by crashes.
+	entries = (Qiniu_Download_cacheEntry**)loaded.buf;
+	count = Qiniu_Buffer_Len(&loaded) / sizeof(Qiniu_Download_cacheEntry*);
+	qsort(entries, count, sizeof(Qiniu_Download_cacheEntry*), Qiniu_Download_cache_compareUsedAt);
+	for (i = 0; i < count; i++) {
+		e = Qiniu_Download_cache_find(self, entries[i]->id);
+		if (e != NULL) {
+			Qiniu_Download_cache_removeFile(self, e);
+			Qiniu_Download_cache_remove(self, e);
+		}
+		Qiniu_Download_cache_add(self, entries[i]);
+		Qiniu_Download_cache_touch(self, entries[i]);
+	}
+	Qiniu_Buffer_Cleanup(&loaded);
+
+	Qiniu_Download_cache_evict(self, NULL);
+	self->stats.evictions = 0;
+	return Qiniu_OK;
+}
+
+Qiniu_Error Qiniu_Download_Cache_Open(
+	Qiniu_Download_Cache** self, const char* dir, Qiniu_Int64 maxBytes, int maxAge)
+{
+	Qiniu_Error err;
+	Qiniu_Download_Cache* c;
+
+#if defined(_WIN32)
+	_mkdir(dir);
+#else
+	mkdir(dir, 0755);
+#endif
+
+	c = (Qiniu_Download_Cache*)calloc(1, sizeof(Qiniu_Download_Cache));
+	if (c == NULL) {
+		return ErrNoMemory;
+	}
+	c->buckets = (Qiniu_Download_cacheEntry**)calloc(QINIU_DOWNLOAD_CACHE_BUCKETS, sizeof(Qiniu_Download_cacheEntry*));
+	if (c->buckets == NULL) {
+		free(c);
+		return ErrNoMemory;
+	}
+	c->bucketCount = QINIU_DOWNLOAD_CACHE_BUCKETS;
+	c->dir = Qiniu_String_Dup(dir);
+	c->maxBytes = maxBytes;
+	c->maxAge = maxAge;
+	c->lru.prev = &c->lru;
+	c->lru.next = &c->lru;
+	Qiniu_Mutex_Init(&c->mutex);
+
+	err = Qiniu_Download_cache_load(c);
+	if (err.code != 200) {
+		Qiniu_Download_Cache_Close(c);
+		return err;
+	}
+	*self = c;
+	return Qiniu_OK;
+}
+
+void Qiniu_Download_Cache_Close(Qiniu_Download_Cache* self)
+{
+	Qiniu_Download_cacheEntry* e = self->lru.next;
+
+	while (e != &self->lru) {
+		Qiniu_Download_cacheEntry* next = e->next;
+		free(e);
+		e = next;
+	}
+	Qiniu_Mutex_Cleanup(&self->mutex);
+	free(self->buckets);
+	free(self->dir);
+	free(self);
+}
+
+void Qiniu_Download_Cache_GetStats(Qiniu_Download_Cache* self, Qiniu_Download_CacheStats* stats)
+{
+	Qiniu_Mutex_Lock(&self->mutex);
+	*stats = self->stats;
+	Qiniu_Mutex_Unlock(&self->mutex);
+}
+
+// Called with the mutex held.
+static char* Qiniu_Download_cache_hit(
+	Qiniu_Download_Cache* self, Qiniu_Download_cacheEntry* e, time_t now, Qiniu_Download_Ret* ret)
+{
+	char* path = Qiniu_Download_cache_path(self, e->id, e->etag);
+
+	// The modification time keeps the order of use for the next run.
+	utime(path, NULL);
+	e->usedAt = now;
+	Qiniu_Download_cache_touch(self, e);
+	self->stats.hits++;
+
+	if (ret != NULL) {
+		ret->fsize = e->fsize;
+		memcpy(ret->etag, e->etag, sizeof(ret->etag));
+		ret->qetag[0] = '\0';
+	}
+	return path;
+}
+
+static Qiniu_Error Qiniu_Download_cache_rename(const char* from, const char* to)
+{
+	Qiniu_Error err;
+
+#if defined(_WIN32)
+	if (!MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING)) {
+		err.code = GetLastError();
+		err.message = "rename file failed";
+		return err;
+	}
+#else
+	if (rename(from, to) != 0) {
+		err.code = errno;
+		err.message = "rename file failed";
+		return err;
+	}
+#endif
+	return Qiniu_OK;
+}
+
+Qiniu_Error Qiniu_Download_Cache_Get(
+	Qiniu_Download_Cache* self, Qiniu_Client* cli, Qiniu_Download_Ret* ret,
+	const char* bucket, const char* key, const char* url, const char* hash,
+	Qiniu_Download_Extra* extra, char** localFile)
+{
+	Qiniu_Error err;
+	Qiniu_Download_Extra extra1;
+	Qiniu_Download_Ret ret1;
+	Qiniu_Download_cacheEntry* e;
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	char id[QINIU_DOWNLOAD_CACHE_HEX_SIZE + 1];
+	char known[QINIU_DOWNLOAD_ETAG_MAX];
+	char seq[32];
+	char* entryUri = Qiniu_String_Concat3(bucket, ":", key);
+	char* tmp;
+	char* path;
+	time_t now = time(NULL);
+	int i;
+
+	SHA1((const unsigned char*)entryUri, strlen(entryUri), digest);
+	free(entryUri);
+	for (i = 0; i < SHA_DIGEST_LENGTH; i++) {
+		Qiniu_snprintf(id + i * 2, 3, "%02x", digest[i]);
+	}
+
+	Qiniu_Mutex_Lock(&self->mutex);
+	e = Qiniu_Download_cache_find(self, id);
+	known[0] = '\0';
+	if (e != NULL) {
+		if ((hash != NULL && e->etag[0] != '\0' && strcmp(hash, e->etag) == 0) ||
+			(self->maxAge > 0 && now - e->validatedAt < self->maxAge)) {
+			*localFile = Qiniu_Download_cache_hit(self, e, now, ret);
+			Qiniu_Mutex_Unlock(&self->mutex);
+			return Qiniu_OK;
+		}
+		memcpy(known, e->etag, sizeof(known));
+	}
+	Qiniu_Mutex_Unlock(&self->mutex);
+
+	if (extra == NULL) {
+		memset(&extra1, 0, sizeof(extra1));
+	} else {
+		extra1 = *extra;
+	}
+	extra1.stateFile = NULL;
+	extra1.ifNoneMatch = (known[0] != '\0') ? known : NULL;
+
+	Qiniu_snprintf(seq, sizeof(seq), ".%ld.tmp", (long)Qiniu_Count_Inc(&self->seq));
+	tmp = Qiniu_String_Concat(self->dir, "/", id, seq, NULL);
+
+	for (;;) {
+		err = Qiniu_Download_ToFile(cli, &ret1, url, tmp, &extra1);
+		if (err.code != Qiniu_Download_NotModified) {
+			break;
+		}
+		remove(tmp);
+
+		Qiniu_Mutex_Lock(&self->mutex);
+		e = Qiniu_Download_cache_find(self, id);
+		if (e != NULL && strcmp(e->etag, known) == 0) {
+			e->validatedAt = now;
+			self->stats.revalidations++;
+			*localFile = Qiniu_Download_cache_hit(self, e, now, ret);
+			Qiniu_Mutex_Unlock(&self->mutex);
+			free(tmp);
+			return Qiniu_OK;
+		}
+		Qiniu_Mutex_Unlock(&self->mutex);
+
+		// The cached file is evicted meanwhile.
+		extra1.ifNoneMatch = NULL;
+	}
+	if (err.code != 200) {
+		remove(tmp);
+		free(tmp);
+		return err;
+	}
+
+	if (!Qiniu_Download_cache_isSafeEtag(ret1.etag)) {
+		// The file can not be validated later, so it is only served within maxAge.
+		ret1.etag[0] = '\0';
+	}
+	path = Qiniu_Download_cache_path(self, id, ret1.etag);
+	err = Qiniu_Download_cache_rename(tmp, path);
+	free(tmp);
+	if (err.code != 200) {
+		free(path);
+		return err;
+	}
+
+	Qiniu_Mutex_Lock(&self->mutex);
+	e = Qiniu_Download_cache_find(self, id);
+	if (e != NULL) {
+		if (strcmp(e->etag, ret1.etag) != 0) {
+			Qiniu_Download_cache_removeFile(self, e);
+		}
+		self->stats.bytes += ret1.fsize - e->fsize;
+	} else {
+		e = (Qiniu_Download_cacheEntry*)calloc(1, sizeof(Qiniu_Download_cacheEntry));
+		if (e == NULL) {
+			Qiniu_Mutex_Unlock(&self->mutex);
+			remove(path);
+			free(path);
+			return ErrNoMemory;
+		}
+		memcpy(e->id, id, sizeof(e->id));
+		e->fsize = ret1.fsize;
+		Qiniu_Download_cache_add(self, e);
+	}
+	memcpy(e->etag, ret1.etag, sizeof(e->etag));
+	e->fsize = ret1.fsize;
+	e->usedAt = now;
+	e->validatedAt = now;
+	Qiniu_Download_cache_touch(self, e);
+	self->stats.misses++;
+	Qiniu_Download_cache_evict(self, e);
+	Qiniu_Mutex_Unlock(&self->mutex);
+
+	if (ret != NULL) {
+		*ret = ret1;
+	}
+	*localFile = path;
+	return Qiniu_OK;
+}
+
+/*============================================================================*/
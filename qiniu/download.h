@@ -0,0 +1,135 @@
+/*
+ ============================================================================
+ Name        : download.h
+ Author      : Qiniu.com
+ Copyright   : 2012(c) Shanghai Qiniu Information Technologies Co., Ltd.
+ Description :
+ ============================================================================
+ */
+
+#ifndef QINIU_DOWNLOAD_H
+#define QINIU_DOWNLOAD_H
+
+#include "http.h"
+
+#pragma pack(1)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*============================================================================*/
+/* func Qiniu_Download_ToFile/ToWriter */
+
+#define Qiniu_Download_InvalidRange	9981
+#define Qiniu_Download_Changed		9980
+#define Qiniu_Download_UnmatchedQetag	9979
+#define Qiniu_Download_UnverifiedQetag	9978
+#define Qiniu_Download_NotModified		304
+
+#define QINIU_DOWNLOAD_ETAG_MAX		128
+
+typedef struct _Qiniu_Download_Extra {
+	// The number of connections used at the same time, 4 by default.
+	int connections;
+
+	// The size of the ranges fetched by one request, 4MB by default.
+	Qiniu_Int64 segmentSize;
+
+	// How many times a segment is tried before the download fails, 3 by default.
+	int tryTimes;
+
+	// Use the following field to name a state file, which records the finished segments. If the
+	// download is restarted with the same local file and state file, and the object is not changed,
+	// only the missing segments are fetched. The state file is removed once the download succeeds.
+	const char* stateFile;
+
+	// Set the following field to non-zero to compute the qetag of the downloaded data, and verify it
+	// against the ETag sent by the server. Qiniu_Download_ToWriter computes it while the data is
+	// passed to the writer, and Qiniu_Download_ToFile reads the local file once it is written.
+	// If the server sends no ETag, the data is kept and the ret is filled, but
+	// Qiniu_Download_UnverifiedQetag is returned, so that the caller can tell it is not verified.
+	int checkQetag;
+
+	// Use the following field to give the ETag of a copy the caller already has. If the object is not
+	// changed, Qiniu_Download_NotModified is returned without writing any data.
+	const char* ifNoneMatch;
+} Qiniu_Download_Extra;
+
+typedef struct _Qiniu_Download_Ret {
+	Qiniu_Int64 fsize;
+
+	// The ETag of the object without quotes, or an empty string if the server does not send it.
+	char etag[QINIU_DOWNLOAD_ETAG_MAX];
+
+	// The qetag of the downloaded data if checkQetag is set, or an empty string otherwise.
+	char qetag[QINIU_DOWNLOAD_ETAG_MAX];
+} Qiniu_Download_Ret;
+
+// Download the url, which is made by Qiniu_RS_MakeBaseUrl or Qiniu_RS_GetPolicy_MakeRequest, into the
+// local file. The object is split into HTTP Range segments which are fetched over several connections
+// and written into the file at their offsets. Servers without Range support are read in one stream.
+// The client provides the bound NIC, the low speed limit and the share object. The extra and the ret
+// may be NULL.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Download_ToFile(
+	Qiniu_Client* self, Qiniu_Download_Ret* ret, const char* url, const char* localFile,
+	Qiniu_Download_Extra* extra);
+
+// Download the url in one stream, and pass the data to the writer in order as it arrives, so the
+// object is never held in memory. If the connection breaks, the rest of the object is requested
+// from where it stopped. Only tryTimes and checkQetag of the extra are used. If the writer returns
+// less than it is given, the download is aborted with CURLE_WRITE_ERROR.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Download_ToWriter(
+	Qiniu_Client* self, Qiniu_Download_Ret* ret, const char* url, Qiniu_Writer w,
+	Qiniu_Download_Extra* extra);
+
+/*============================================================================*/
+/* type Qiniu_Download_Cache */
+
+typedef struct _Qiniu_Download_Cache Qiniu_Download_Cache;
+
+typedef struct _Qiniu_Download_CacheStats {
+	Qiniu_Int64 hits;
+	Qiniu_Int64 misses;
+
+	// The hits confirmed by the server with a conditional request.
+	Qiniu_Int64 revalidations;
+	Qiniu_Int64 evictions;
+
+	Qiniu_Int64 entries;
+	Qiniu_Int64 bytes;
+} Qiniu_Download_CacheStats;
+
+// Open a read-through cache of downloaded objects in the directory, which is created if it does not
+// exist, and keep the objects cached by former runs. The least recently used objects are removed once
+// the cached bytes exceed maxBytes. An object is served without asking the server within maxAge
+// seconds after it is validated, and 0 means that it is always validated unless the caller gives the
+// hash. A directory must be used by one cache at a time, while other processes may read the files.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Download_Cache_Open(
+	Qiniu_Download_Cache** self, const char* dir, Qiniu_Int64 maxBytes, int maxAge);
+
+QINIU_DLLAPI extern void Qiniu_Download_Cache_Close(Qiniu_Download_Cache* self);
+
+QINIU_DLLAPI extern void Qiniu_Download_Cache_GetStats(Qiniu_Download_Cache* self, Qiniu_Download_CacheStats* stats);
+
+// Return the cached file of bucket:key in *localFile, which must be freed by Qiniu_Free. If the hash,
+// e.g. got by Qiniu_RS_Stat or Qiniu_RSF_List, equals the ETag of the cached file, the network is not
+// touched at all. Otherwise the cached file is validated by a conditional request to the url, and a
+// missing or changed object is downloaded by Qiniu_Download_ToFile with the extra into a temporary
+// file, which is then renamed into the cache. So the cached files are always complete, and readers
+// which opened a file before it is replaced or evicted keep reading the old content on POSIX systems.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Download_Cache_Get(
+	Qiniu_Download_Cache* self, Qiniu_Client* cli, Qiniu_Download_Ret* ret,
+	const char* bucket, const char* key, const char* url, const char* hash,
+	Qiniu_Download_Extra* extra, char** localFile);
+
+/*============================================================================*/
+
+#pragma pack()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QINIU_DOWNLOAD_H */
@@ -9,8 +9,11 @@
 
 #include "http.h"
 #include "region.h"
+#include "private.h"
 #include "../cJSON/cJSON.h"
 #include <curl/curl.h>
+#include <errno.h>
+#include <time.h>
 
 #if defined(_WIN32)
 #pragma comment(lib, "curllib.lib")
@@ -41,6 +44,35 @@ void Qiniu_Mutex_Unlock(Qiniu_Mutex* self)
 	LeaveCriticalSection(self);
 }
 
+void Qiniu_Cond_Init(Qiniu_Cond* self)
+{
+	InitializeConditionVariable(self);
+}
+
+void Qiniu_Cond_Cleanup(Qiniu_Cond* self)
+{
+}
+
+void Qiniu_Cond_Wait(Qiniu_Cond* self, Qiniu_Mutex* mutex)
+{
+	SleepConditionVariableCS(self, mutex, INFINITE);
+}
+
+void Qiniu_Cond_TimedWait(Qiniu_Cond* self, Qiniu_Mutex* mutex, int ms)
+{
+	SleepConditionVariableCS(self, mutex, (DWORD)ms);
+}
+
+void Qiniu_Cond_Signal(Qiniu_Cond* self)
+{
+	WakeConditionVariable(self);
+}
+
+void Qiniu_Cond_Broadcast(Qiniu_Cond* self)
+{
+	WakeAllConditionVariable(self);
+}
+
 #else
 
 void Qiniu_Mutex_Init(Qiniu_Mutex* self)
@@ -63,22 +95,150 @@ void Qiniu_Mutex_Unlock(Qiniu_Mutex* self)
 	pthread_mutex_unlock(self);
 }
 
+void Qiniu_Cond_Init(Qiniu_Cond* self)
+{
+	pthread_cond_init(self, NULL);
+}
+
+void Qiniu_Cond_Cleanup(Qiniu_Cond* self)
+{
+	pthread_cond_destroy(self);
+}
+
+void Qiniu_Cond_Wait(Qiniu_Cond* self, Qiniu_Mutex* mutex)
+{
+	pthread_cond_wait(self, mutex);
+}
+
+void Qiniu_Cond_TimedWait(Qiniu_Cond* self, Qiniu_Mutex* mutex, int ms)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += ms / 1000;
+	deadline.tv_nsec += (long)(ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(self, mutex, &deadline);
+}
+
+void Qiniu_Cond_Signal(Qiniu_Cond* self)
+{
+	pthread_cond_signal(self);
+}
+
+void Qiniu_Cond_Broadcast(Qiniu_Cond* self)
+{
+	pthread_cond_broadcast(self);
+}
+
+#endif
+
+/*============================================================================*/
+/* type Qiniu_Thread */
+
+typedef struct _Qiniu_Thread_start {
+	Qiniu_FnThread fn;
+	void* params;
+} Qiniu_Thread_start;
+
+#if defined(_WIN32)
+
+static DWORD WINAPI Qiniu_Thread_run(LPVOID data)
+{
+	Qiniu_Thread_start start = *(Qiniu_Thread_start*)data;
+	free(data);
+	start.fn(start.params);
+	return 0;
+}
+
+int Qiniu_Thread_Create(Qiniu_Thread* self, Qiniu_FnThread fn, void* params)
+{
+	Qiniu_Thread_start* start = (Qiniu_Thread_start*)malloc(sizeof(*start));
+	if (start == NULL) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	start->fn = fn;
+	start->params = params;
+	*self = CreateThread(NULL, 0, Qiniu_Thread_run, start, 0, NULL);
+	if (*self == NULL) {
+		free(start);
+		return (int)GetLastError();
+	}
+	return 0;
+}
+
+void Qiniu_Thread_Join(Qiniu_Thread self)
+{
+	WaitForSingleObject(self, INFINITE);
+	CloseHandle(self);
+}
+
+Qiniu_Bool Qiniu_Thread_IsCurrent(Qiniu_Thread self)
+{
+	return GetThreadId(self) == GetCurrentThreadId();
+}
+
+#else
+
+static void* Qiniu_Thread_run(void* data)
+{
+	Qiniu_Thread_start start = *(Qiniu_Thread_start*)data;
+	free(data);
+	start.fn(start.params);
+	return NULL;
+}
+
+int Qiniu_Thread_Create(Qiniu_Thread* self, Qiniu_FnThread fn, void* params)
+{
+	int ret;
+	Qiniu_Thread_start* start = (Qiniu_Thread_start*)malloc(sizeof(*start));
+	if (start == NULL) {
+		return ENOMEM;
+	}
+	start->fn = fn;
+	start->params = params;
+	ret = pthread_create(self, NULL, Qiniu_Thread_run, start);
+	if (ret != 0) {
+		free(start);
+	}
+	return ret;
+}
+
+void Qiniu_Thread_Join(Qiniu_Thread self)
+{
+	pthread_join(self, NULL);
+}
+
+Qiniu_Bool Qiniu_Thread_IsCurrent(Qiniu_Thread self)
+{
+	return pthread_equal(self, pthread_self()) ? Qiniu_True : Qiniu_False;
+}
+
 #endif
 
 /*============================================================================*/
 /* Global */
 
 void Qiniu_Buffer_formatInit();
+void Qiniu_Crc32_init();
+void Qiniu_Rgn_Table_globalInit(void);
+void Qiniu_Rgn_Table_globalCleanup(void);
 
 void Qiniu_Global_Init(long flags)
 {
 	Qiniu_Buffer_formatInit();
+	Qiniu_Crc32_init();
 	Qiniu_Rgn_Enable();
+	Qiniu_Rgn_Table_globalInit();
 	curl_global_init(CURL_GLOBAL_ALL);
 }
 
 void Qiniu_Global_Cleanup()
 {
+	Qiniu_Rgn_Table_globalCleanup();
 	curl_global_cleanup();
 }
 
@@ -87,22 +247,13 @@ void Qiniu_Global_Cleanup()
 
 static const char g_statusCodeError[] = "http status code is not OK";
 
-Qiniu_Error Qiniu_callex(CURL* curl, Qiniu_Buffer *resp, Qiniu_Json** ret, Qiniu_Bool simpleError, Qiniu_Buffer *resph)
+// Translate the result of a finished transfer, shared by the blocking and the asynchronous call paths.
+Qiniu_Error Qiniu_callresult(CURL* curl, CURLcode curlCode, Qiniu_Buffer *resp, Qiniu_Json** ret, Qiniu_Bool simpleError)
 {
 	Qiniu_Error err;
-	CURLcode curlCode;
 	long httpCode;
 	Qiniu_Json* root;
 
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, Qiniu_Buffer_Fwrite);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, resp);
-	if (resph != NULL) {
-		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, Qiniu_Buffer_Fwrite);
-		curl_easy_setopt(curl, CURLOPT_WRITEHEADER, resph);
-	}
-
-	curlCode = curl_easy_perform(curl);
-
 	if (curlCode == 0) {
 		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
 		if (Qiniu_Buffer_Len(resp) != 0) {
@@ -130,6 +281,66 @@ Qiniu_Error Qiniu_callex(CURL* curl, Qiniu_Buffer *resp, Qiniu_Json** ret, Qiniu
 	return err;
 }
 
+Qiniu_Error Qiniu_callex(CURL* curl, Qiniu_Buffer *resp, Qiniu_Json** ret, Qiniu_Bool simpleError, Qiniu_Buffer *resph)
+{
+	CURLcode curlCode;
+
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, Qiniu_Buffer_Fwrite);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, resp);
+	if (resph != NULL) {
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, Qiniu_Buffer_Fwrite);
+		curl_easy_setopt(curl, CURLOPT_WRITEHEADER, resph);
+	}
+
+	curlCode = curl_easy_perform(curl);
+	return Qiniu_callresult(curl, curlCode, resp, ret, simpleError);
+}
+
+// Pass a 2xx response body to the writer as it arrives. Other responses are buffered as usual,
+// so that the error can be read from them.
+typedef struct _Qiniu_streamWriter {
+	CURL* curl;
+	Qiniu_Buffer* resp;
+	const Qiniu_Writer* w;
+	int status;
+} Qiniu_streamWriter;
+
+static size_t Qiniu_streamWriter_Write(const void* buf, size_t size, size_t n, void* self)
+{
+	long httpCode;
+	Qiniu_streamWriter* sw = (Qiniu_streamWriter*)self;
+
+	if (sw->status == 0) {
+		curl_easy_getinfo(sw->curl, CURLINFO_RESPONSE_CODE, &httpCode);
+		sw->status = (httpCode / 100 == 2) ? 1 : 2;
+	}
+	if (sw->status == 1) {
+		return sw->w->Write(buf, size, n, sw->w->self);
+	}
+	return Qiniu_Buffer_Fwrite(buf, size, n, sw->resp);
+}
+
+static Qiniu_Error Qiniu_callstream(CURL* curl, Qiniu_Buffer *resp, Qiniu_Json** ret, const Qiniu_Writer* w, Qiniu_Buffer *resph)
+{
+	CURLcode curlCode;
+	Qiniu_streamWriter sw;
+
+	sw.curl = curl;
+	sw.resp = resp;
+	sw.w = w;
+	sw.status = 0;
+
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, Qiniu_streamWriter_Write);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sw);
+	if (resph != NULL) {
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, Qiniu_Buffer_Fwrite);
+		curl_easy_setopt(curl, CURLOPT_WRITEHEADER, resph);
+	}
+
+	curlCode = curl_easy_perform(curl);
+	return Qiniu_callresult(curl, curlCode, resp, ret, Qiniu_False);
+}
+
 /*============================================================================*/
 /* type Qiniu_Json */
 
@@ -239,6 +450,299 @@ Qiniu_Uint32 Qiniu_Json_GetInt(Qiniu_Json* self, const char* key, Qiniu_Uint32 d
 	}
 }
 
+/*============================================================================*/
+/* type Qiniu_JsonStream */
+
+enum {
+	Qiniu_JsonStream_tokNone,
+	Qiniu_JsonStream_tokString,
+	Qiniu_JsonStream_tokNumber,
+	Qiniu_JsonStream_tokLiteral
+};
+
+void Qiniu_JsonStream_Init(Qiniu_JsonStream* js, const Qiniu_JsonStream_Itbl* itbl, void* self)
+{
+	js->self = self;
+	js->itbl = itbl;
+	Qiniu_Buffer_Init(&js->tok, 256);
+	Qiniu_JsonStream_Reset(js);
+} // Qiniu_JsonStream_Init
+
+void Qiniu_JsonStream_Reset(Qiniu_JsonStream* js)
+{
+	Qiniu_Buffer_Reset(&js->tok);
+	js->tokType = Qiniu_JsonStream_tokNone;
+	js->escape = 0;
+	js->codepoint = 0;
+	js->highSurrogate = 0;
+	js->depth = 0;
+	js->expectKey = 0;
+	js->started = 0;
+	js->failed = 0;
+} // Qiniu_JsonStream_Reset
+
+void Qiniu_JsonStream_Cleanup(Qiniu_JsonStream* js)
+{
+	Qiniu_Buffer_Cleanup(&js->tok);
+} // Qiniu_JsonStream_Cleanup
+
+Qiniu_Bool Qiniu_JsonStream_Done(Qiniu_JsonStream* js)
+{
+	if (js->started && js->depth == 0 && !js->failed && js->tokType == Qiniu_JsonStream_tokNone) {
+		return Qiniu_True;
+	} // if
+	return Qiniu_False;
+} // Qiniu_JsonStream_Done
+
+static void Qiniu_JsonStream_putUtf8(Qiniu_JsonStream* js, unsigned int c)
+{
+	if (c < 0x80) {
+		Qiniu_Buffer_PutChar(&js->tok, (char)c);
+	} else if (c < 0x800) {
+		Qiniu_Buffer_PutChar(&js->tok, (char)(0xC0 | (c >> 6)));
+		Qiniu_Buffer_PutChar(&js->tok, (char)(0x80 | (c & 0x3F)));
+	} else if (c < 0x10000) {
+		Qiniu_Buffer_PutChar(&js->tok, (char)(0xE0 | (c >> 12)));
+		Qiniu_Buffer_PutChar(&js->tok, (char)(0x80 | ((c >> 6) & 0x3F)));
+		Qiniu_Buffer_PutChar(&js->tok, (char)(0x80 | (c & 0x3F)));
+	} else {
+		Qiniu_Buffer_PutChar(&js->tok, (char)(0xF0 | (c >> 18)));
+		Qiniu_Buffer_PutChar(&js->tok, (char)(0x80 | ((c >> 12) & 0x3F)));
+		Qiniu_Buffer_PutChar(&js->tok, (char)(0x80 | ((c >> 6) & 0x3F)));
+		Qiniu_Buffer_PutChar(&js->tok, (char)(0x80 | (c & 0x3F)));
+	} // if
+} // Qiniu_JsonStream_putUtf8
+
+static void Qiniu_JsonStream_onString(Qiniu_JsonStream* js)
+{
+	size_t n = Qiniu_Buffer_Len(&js->tok);
+
+	if (js->expectKey) {
+		js->expectKey = 0;
+		js->itbl->Key(js->self, js, js->tok.buf, n);
+	} else {
+		js->itbl->String(js->self, js, js->tok.buf, n);
+	} // if
+} // Qiniu_JsonStream_onString
+
+static void Qiniu_JsonStream_string(Qiniu_JsonStream* js, char c)
+{
+	static const char escapes[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+	const char* p;
+	unsigned int c16;
+
+	if (js->escape == 1) {
+		js->escape = 0;
+		if (c == 'u') {
+			js->escape = 2;
+			js->codepoint = 0;
+			return;
+		} // if
+		for (p = escapes; *p != '\0'; p += 2) {
+			if (*p == c) {
+				Qiniu_Buffer_PutChar(&js->tok, p[1]);
+				return;
+			} // if
+		} // for
+		js->failed = 1;
+	} else if (js->escape >= 2) {
+		if (c >= '0' && c <= '9') {
+			c16 = c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			c16 = c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			c16 = c - 'A' + 10;
+		} else {
+			js->failed = 1;
+			return;
+		} // if
+		js->codepoint = (js->codepoint << 4) | c16;
+		if (++js->escape < 6) {
+			return;
+		} // if
+		js->escape = 0;
+		if (js->codepoint >= 0xD800 && js->codepoint < 0xDC00) {
+			js->highSurrogate = js->codepoint;
+			return;
+		} // if
+		if (js->codepoint >= 0xDC00 && js->codepoint < 0xE000 && js->highSurrogate != 0) {
+			js->codepoint = 0x10000 + ((js->highSurrogate - 0xD800) << 10) + (js->codepoint - 0xDC00);
+		} // if
+		js->highSurrogate = 0;
+		Qiniu_JsonStream_putUtf8(js, js->codepoint);
+	} else if (c == '\\') {
+		js->escape = 1;
+	} else if (c == '"') {
+		js->tokType = Qiniu_JsonStream_tokNone;
+		Qiniu_JsonStream_onString(js);
+	} else {
+		Qiniu_Buffer_PutChar(&js->tok, c);
+	} // if
+} // Qiniu_JsonStream_string
+
+static void Qiniu_JsonStream_open(Qiniu_JsonStream* js, char c)
+{
+	if (js->depth == QINIU_JSON_STREAM_MAX_DEPTH || (js->depth == 0 && js->started)) {
+		js->failed = 1;
+		return;
+	} // if
+	js->stack[js->depth++] = c;
+	js->expectKey = (c == '{');
+	js->started = 1;
+	js->itbl->Open(js->self, js, c);
+} // Qiniu_JsonStream_open
+
+static void Qiniu_JsonStream_close(Qiniu_JsonStream* js, char c)
+{
+	if (js->depth == 0 || js->stack[js->depth - 1] != c) {
+		js->failed = 1;
+		return;
+	} // if
+	js->itbl->Close(js->self, js, c);
+	js->depth--;
+	js->expectKey = 0;
+} // Qiniu_JsonStream_close
+
+size_t Qiniu_JsonStream_Write(const void* buf, size_t size, size_t n, void* self)
+{
+	char c;
+	const char* p = (const char*)buf;
+	const char* end = p + size * n;
+	Qiniu_JsonStream* js = (Qiniu_JsonStream*)self;
+
+	for (; p < end && !js->failed; p++) {
+		c = *p;
+		if (js->tokType == Qiniu_JsonStream_tokString) {
+			Qiniu_JsonStream_string(js, c);
+			continue;
+		} // if
+		if (js->tokType != Qiniu_JsonStream_tokNone) {
+			if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.' || c == '+' || c == '-' || c == 'E') {
+				Qiniu_Buffer_PutChar(&js->tok, c);
+				continue;
+			} // if
+			if (js->tokType == Qiniu_JsonStream_tokNumber) {
+				js->itbl->Number(js->self, js, Qiniu_Buffer_CStr(&js->tok));
+			} // if
+			js->tokType = Qiniu_JsonStream_tokNone;
+		} // if
+
+		switch (c) {
+		case ' ': case '\t': case '\r': case '\n': case ':':
+			break;
+		case '"':
+			Qiniu_Buffer_Reset(&js->tok);
+			js->tokType = Qiniu_JsonStream_tokString;
+			break;
+		case '[': case '{':
+			Qiniu_JsonStream_open(js, c);
+			break;
+		case ']':
+			Qiniu_JsonStream_close(js, '[');
+			break;
+		case '}':
+			Qiniu_JsonStream_close(js, '{');
+			break;
+		case ',':
+			js->expectKey = (js->depth > 0 && js->stack[js->depth - 1] == '{');
+			break;
+		default:
+			Qiniu_Buffer_Reset(&js->tok);
+			Qiniu_Buffer_PutChar(&js->tok, c);
+			if (c == '-' || (c >= '0' && c <= '9')) {
+				js->tokType = Qiniu_JsonStream_tokNumber;
+			} else if (c == 't' || c == 'f' || c == 'n') {
+				js->tokType = Qiniu_JsonStream_tokLiteral;
+			} else {
+				js->failed = 1;
+			} // if
+		} // switch
+	} // for
+	return js->failed ? 0 : size * n;
+} // Qiniu_JsonStream_Write
+
+/*============================================================================*/
+/* type Qiniu_Share */
+
+struct _Qiniu_Share {
+	CURLSH* sh;
+	Qiniu_Uint32 flags;
+	Qiniu_Mutex locks[CURL_LOCK_DATA_LAST];
+};
+
+static void Qiniu_Share_lock(CURL* curl, curl_lock_data data, curl_lock_access access, void* self)
+{
+	Qiniu_Mutex_Lock(&((Qiniu_Share*)self)->locks[data]);
+}
+
+static void Qiniu_Share_unlock(CURL* curl, curl_lock_data data, void* self)
+{
+	Qiniu_Mutex_Unlock(&((Qiniu_Share*)self)->locks[data]);
+}
+
+Qiniu_Share* Qiniu_Share_Create(Qiniu_Uint32 flags)
+{
+	int i;
+	Qiniu_Share* self = (Qiniu_Share*)calloc(1, sizeof(*self));
+	if (self == NULL) {
+		return NULL;
+	}
+
+	self->sh = curl_share_init();
+	if (self->sh == NULL) {
+		free(self);
+		return NULL;
+	}
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+		Qiniu_Mutex_Init(&self->locks[i]);
+	}
+
+	curl_share_setopt(self->sh, CURLSHOPT_LOCKFUNC, Qiniu_Share_lock);
+	curl_share_setopt(self->sh, CURLSHOPT_UNLOCKFUNC, Qiniu_Share_unlock);
+	curl_share_setopt(self->sh, CURLSHOPT_USERDATA, self);
+	self->flags = flags;
+
+	if (flags & QINIU_SHARE_DNS) {
+		curl_share_setopt(self->sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	}
+	if (flags & QINIU_SHARE_SSL_SESSION) {
+		curl_share_setopt(self->sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	}
+#if LIBCURL_VERSION_NUM >= 0x073900
+	// Sharing the connection cache is supported since libcurl 7.57.0.
+	if (flags & QINIU_SHARE_CONNECTION) {
+		curl_share_setopt(self->sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	}
+#endif
+	return self;
+} // Qiniu_Share_Create
+
+Qiniu_Share* Qiniu_Share_forThreads(Qiniu_Share* self)
+{
+	if (self == NULL || (self->flags & QINIU_SHARE_CONNECTION)) {
+		return NULL;
+	}
+	return self;
+} // Qiniu_Share_forThreads
+
+void Qiniu_Share_Destroy(Qiniu_Share* self)
+{
+	int i;
+	if (self == NULL) {
+		return;
+	}
+	curl_share_cleanup(self->sh);
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+		Qiniu_Mutex_Cleanup(&self->locks[i]);
+	}
+	free(self);
+} // Qiniu_Share_Destroy
+
+CURLSH* Qiniu_Share_handle(Qiniu_Share* self)
+{
+	return self->sh;
+} // Qiniu_Share_handle
+
 /*============================================================================*/
 /* type Qiniu_Client */
 
@@ -261,7 +765,13 @@ void Qiniu_Client_InitEx(Qiniu_Client* self, Qiniu_Auth auth, size_t bufSize)
 	self->lowSpeedLimit = 0;
 	self->lowSpeedTime = 0;
 
-	self->regionTable = Qiniu_Rgn_Table_Create();
+	// Share the region table of the process, and fall back on a private one before Qiniu_Global_Init.
+	if (Qiniu_Rgn_Table_Global() != NULL) {
+		self->regionTable = Qiniu_Rgn_Table_Acquire(Qiniu_Rgn_Table_Global());
+	} else {
+		self->regionTable = Qiniu_Rgn_Table_Create();
+	}
+	self->share = NULL;
 }
 
 void Qiniu_Client_InitNoAuth(Qiniu_Client* self, size_t bufSize)
@@ -279,6 +789,7 @@ void Qiniu_Client_Cleanup(Qiniu_Client* self)
 		curl_easy_cleanup((CURL*)self->curl);
 		self->curl = NULL;
 	}
+	self->share = NULL;
 	if (self->root != NULL) {
 		cJSON_Delete(self->root);
 		self->root = NULL;
@@ -302,11 +813,22 @@ void Qiniu_Client_SetLowSpeedLimit(Qiniu_Client* self, long lowSpeedLimit, long
 	self->lowSpeedTime = lowSpeedTime;
 } // Qiniu_Client_SetLowSpeedLimit
 
+void Qiniu_Client_SetShare(Qiniu_Client* self, Qiniu_Share* share)
+{
+	self->share = share;
+	curl_easy_setopt((CURL*)self->curl, CURLOPT_SHARE, (share != NULL) ? share->sh : NULL);
+} // Qiniu_Client_SetShare
+
 CURL* Qiniu_Client_reset(Qiniu_Client* self)
 {
 	CURL* curl = (CURL*)self->curl;
 
+	// Only the options are reset, the live connections and caches are kept in the handle.
 	curl_easy_reset(curl);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	if (self->share != NULL) {
+		curl_easy_setopt(curl, CURLOPT_SHARE, self->share->sh);
+	}
 	Qiniu_Buffer_Reset(&self->b);
 	Qiniu_Buffer_Reset(&self->respHeader);
 	if (self->root != NULL) {
@@ -331,7 +853,7 @@ static CURL* Qiniu_Client_initcall(Qiniu_Client* self, const char* url)
 
 static Qiniu_Error Qiniu_Client_callWithBody(
 	Qiniu_Client* self, Qiniu_Json** ret, const char* url,
-	const char* body, Qiniu_Int64 bodyLen, const char* mimeType)
+	const char* body, Qiniu_Int64 bodyLen, const char* mimeType, const Qiniu_Writer* w)
 {
 	int retCode = 0;
 	Qiniu_Error err;
@@ -377,7 +899,11 @@ static Qiniu_Error Qiniu_Client_callWithBody(
 
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
-	err = Qiniu_callex(curl, &self->b, &self->root, Qiniu_False, &self->respHeader);
+	if (w == NULL) {
+		err = Qiniu_callex(curl, &self->b, &self->root, Qiniu_False, &self->respHeader);
+	} else {
+		err = Qiniu_callstream(curl, &self->b, &self->root, w, &self->respHeader);
+	}
 
 	curl_slist_free_all(headers);
 	if (mimeType != NULL) {
@@ -398,7 +924,7 @@ Qiniu_Error Qiniu_Client_CallWithBinary(
 	curl_easy_setopt(curl, CURLOPT_READFUNCTION, body.Read);
 	curl_easy_setopt(curl, CURLOPT_READDATA, body.self);
 
-	return Qiniu_Client_callWithBody(self, ret, url, NULL, bodyLen, mimeType);
+	return Qiniu_Client_callWithBody(self, ret, url, NULL, bodyLen, mimeType, NULL);
 }
 
 Qiniu_Error Qiniu_Client_CallWithBuffer(
@@ -410,7 +936,19 @@ Qiniu_Error Qiniu_Client_CallWithBuffer(
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, bodyLen);
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
 
-	return Qiniu_Client_callWithBody(self, ret, url, body, bodyLen, mimeType);
+	return Qiniu_Client_callWithBody(self, ret, url, body, bodyLen, mimeType, NULL);
+}
+
+Qiniu_Error Qiniu_Client_CallWithBufferStream(
+	Qiniu_Client* self, Qiniu_Json** ret, const char* url,
+	const char* body, size_t bodyLen, const char* mimeType, Qiniu_Writer w)
+{
+	CURL* curl = Qiniu_Client_initcall(self, url);
+
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, bodyLen);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+
+	return Qiniu_Client_callWithBody(self, ret, url, body, bodyLen, mimeType, &w);
 }
 
 Qiniu_Error Qiniu_Client_Call(Qiniu_Client* self, Qiniu_Json** ret, const char* url)
@@ -22,6 +22,9 @@ extern "C"
 #endif
 
 extern void Qiniu_Global_Init(long flags);
+
+// Call it once when the process exits, after all clients are cleaned up, since it tears down curl.
+// The regions are no longer refreshed in the background afterwards.
 extern void Qiniu_Global_Cleanup();
 
 extern void Qiniu_MacAuth_Init();
@@ -40,9 +43,13 @@ extern void Qiniu_Servend_Cleanup();
 #if defined(_WIN32)
 #include <windows.h>
 typedef CRITICAL_SECTION Qiniu_Mutex;
+typedef CONDITION_VARIABLE Qiniu_Cond;
+typedef HANDLE Qiniu_Thread;
 #else
 #include <pthread.h>
 typedef pthread_mutex_t Qiniu_Mutex;
+typedef pthread_cond_t Qiniu_Cond;
+typedef pthread_t Qiniu_Thread;
 #endif
 
 #ifdef __cplusplus
@@ -56,6 +63,30 @@ QINIU_DLLAPI extern void Qiniu_Mutex_Cleanup(Qiniu_Mutex* self);
 QINIU_DLLAPI extern void Qiniu_Mutex_Lock(Qiniu_Mutex* self);
 QINIU_DLLAPI extern void Qiniu_Mutex_Unlock(Qiniu_Mutex* self);
 
+/*============================================================================*/
+/* type Qiniu_Cond */
+
+QINIU_DLLAPI extern void Qiniu_Cond_Init(Qiniu_Cond* self);
+QINIU_DLLAPI extern void Qiniu_Cond_Cleanup(Qiniu_Cond* self);
+
+QINIU_DLLAPI extern void Qiniu_Cond_Wait(Qiniu_Cond* self, Qiniu_Mutex* mutex);
+
+// Wait for a signal at most ms milliseconds. Like Qiniu_Cond_Wait, it may return early.
+QINIU_DLLAPI extern void Qiniu_Cond_TimedWait(Qiniu_Cond* self, Qiniu_Mutex* mutex, int ms);
+
+QINIU_DLLAPI extern void Qiniu_Cond_Signal(Qiniu_Cond* self);
+QINIU_DLLAPI extern void Qiniu_Cond_Broadcast(Qiniu_Cond* self);
+
+/*============================================================================*/
+/* type Qiniu_Thread */
+
+typedef void (*Qiniu_FnThread)(void* params);
+
+// Return 0 if the thread is started, or the error code from the system otherwise.
+QINIU_DLLAPI extern int Qiniu_Thread_Create(Qiniu_Thread* self, Qiniu_FnThread fn, void* params);
+QINIU_DLLAPI extern void Qiniu_Thread_Join(Qiniu_Thread self);
+QINIU_DLLAPI extern Qiniu_Bool Qiniu_Thread_IsCurrent(Qiniu_Thread self);
+
 /*============================================================================*/
 /* type Qiniu_Json */
 
@@ -69,6 +100,49 @@ QINIU_DLLAPI extern Qiniu_Json* Qiniu_Json_GetObjectItem(Qiniu_Json* self, const
 QINIU_DLLAPI extern Qiniu_Json* Qiniu_Json_GetArrayItem(Qiniu_Json* self, int n, Qiniu_Json* defval);
 QINIU_DLLAPI extern void Qiniu_Json_Destroy(Qiniu_Json* self);
 
+/*============================================================================*/
+/* type Qiniu_JsonStream */
+
+// A push parser fed by a response stream, which reports each value to the handler once it is
+// complete, so that large responses are decoded without building a JSON tree. Values of the top
+// level container are at depth 1. A handler may set failed to abort the stream.
+typedef struct _Qiniu_JsonStream Qiniu_JsonStream;
+
+typedef struct _Qiniu_JsonStream_Itbl {
+	void (*Open)(void* self, Qiniu_JsonStream* js, char c);
+	void (*Close)(void* self, Qiniu_JsonStream* js, char c);
+	void (*Key)(void* self, Qiniu_JsonStream* js, const char* key, size_t n);
+	void (*String)(void* self, Qiniu_JsonStream* js, const char* s, size_t n);
+	void (*Number)(void* self, Qiniu_JsonStream* js, const char* s);
+} Qiniu_JsonStream_Itbl;
+
+#define QINIU_JSON_STREAM_MAX_DEPTH	32
+
+struct _Qiniu_JsonStream {
+	void* self;
+	const Qiniu_JsonStream_Itbl* itbl;
+	Qiniu_Buffer tok;
+	int tokType;
+	int escape;
+	unsigned int codepoint;
+	unsigned int highSurrogate;
+	int depth;
+	int expectKey;
+	int started;
+	int failed;
+	char stack[QINIU_JSON_STREAM_MAX_DEPTH];
+};
+
+QINIU_DLLAPI extern void Qiniu_JsonStream_Init(Qiniu_JsonStream* js, const Qiniu_JsonStream_Itbl* itbl, void* self);
+QINIU_DLLAPI extern void Qiniu_JsonStream_Reset(Qiniu_JsonStream* js);
+QINIU_DLLAPI extern void Qiniu_JsonStream_Cleanup(Qiniu_JsonStream* js);
+
+// Has the same signature as Qiniu_FnWrite, and returns 0 once the stream is failed.
+QINIU_DLLAPI extern size_t Qiniu_JsonStream_Write(const void* buf, size_t size, size_t n, void* js);
+
+// Return Qiniu_True if a whole value has been parsed without error.
+QINIU_DLLAPI extern Qiniu_Bool Qiniu_JsonStream_Done(Qiniu_JsonStream* js);
+
 /*============================================================================*/
 /* type Qiniu_Auth */
 
@@ -88,6 +162,26 @@ typedef struct _Qiniu_Auth {
 
 QINIU_DLLAPI extern Qiniu_Auth Qiniu_NoAuth;
 
+/*============================================================================*/
+/* type Qiniu_Share */
+
+enum {
+	QINIU_SHARE_DNS             = 0x0001,
+	QINIU_SHARE_SSL_SESSION     = 0x0002,
+	QINIU_SHARE_CONNECTION      = 0x0004,
+	QINIU_SHARE_ALL             = 0x0003
+};
+
+typedef struct _Qiniu_Share Qiniu_Share;
+
+// Create a share object which lets the attached clients reuse the DNS cache and TLS sessions of each
+// other, which is safe for clients running in different threads. QINIU_SHARE_CONNECTION also shares
+// the live connections, which libcurl does not support across threads, so it must only be used when
+// all attached clients run in one thread. QINIU_SHARE_ALL does not include it.
+// **NOTICE**: Destroy it only after all attached clients have been cleaned up.
+QINIU_DLLAPI extern Qiniu_Share* Qiniu_Share_Create(Qiniu_Uint32 flags);
+QINIU_DLLAPI extern void Qiniu_Share_Destroy(Qiniu_Share* self);
+
 /*============================================================================*/
 /* type Qiniu_Client */
 
@@ -115,12 +209,16 @@ typedef struct _Qiniu_Client {
 
 	// Use the following field to manange information of multi-region.
 	struct _Qiniu_Rgn_RegionTable * regionTable;
+
+	// Use the following field to share connections, DNS cache and TLS sessions with other clients.
+	Qiniu_Share* share;
 } Qiniu_Client;
 
 QINIU_DLLAPI extern void Qiniu_Client_InitEx(Qiniu_Client* self, Qiniu_Auth auth, size_t bufSize);
 QINIU_DLLAPI extern void Qiniu_Client_Cleanup(Qiniu_Client* self);
 QINIU_DLLAPI extern void Qiniu_Client_BindNic(Qiniu_Client* self, const char* nic);
 QINIU_DLLAPI extern void Qiniu_Client_SetLowSpeedLimit(Qiniu_Client* self, long lowSpeedLimit, long lowSpeedTime);
+QINIU_DLLAPI extern void Qiniu_Client_SetShare(Qiniu_Client* self, Qiniu_Share* share);
 
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Client_Call(Qiniu_Client* self, Qiniu_Json** ret, const char* url);
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Client_CallNoRet(Qiniu_Client* self, const char* url);
@@ -131,6 +229,13 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_Client_CallWithBuffer(
 	Qiniu_Client* self, Qiniu_Json** ret, const char* url,
 	const char* body, size_t bodyLen, const char* mimeType);
 
+// Same as Qiniu_Client_CallWithBuffer, but a 2xx response body is passed to the writer as it arrives
+// instead of being parsed, so *ret is NULL on success. If the writer returns less than it is given,
+// the transfer is aborted with CURLE_WRITE_ERROR.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Client_CallWithBufferStream(
+	Qiniu_Client* self, Qiniu_Json** ret, const char* url,
+	const char* body, size_t bodyLen, const char* mimeType, Qiniu_Writer w);
+
 /*============================================================================*/
 /* func Qiniu_Client_InitNoAuth/InitMacAuth  */
 
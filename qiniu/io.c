@@ -50,6 +50,44 @@ static void Qiniu_Io_form_init(
 CURL* Qiniu_Client_reset(Qiniu_Client* self);
 Qiniu_Error Qiniu_callex(CURL* curl, Qiniu_Buffer *resp, Qiniu_Json** ret, Qiniu_Bool simpleError, Qiniu_Buffer *resph);
 
+static Qiniu_Error Qiniu_Io_upHost(
+	Qiniu_Client* self, Qiniu_Io_PutExtra* extra, const char** upHost, Qiniu_Rgn_HostVote* upHostVote)
+{
+	Qiniu_Error err;
+
+	memset(upHostVote, 0, sizeof(*upHostVote));
+
+	//// For using multi-region storage.
+	if ((*upHost = extra->upHost) == NULL) {
+		if (Qiniu_Rgn_IsEnabled()) {
+			if (extra->upBucket && extra->accessKey) {
+				err = Qiniu_Rgn_Table_GetHost(self->regionTable, self, extra->upBucket, extra->accessKey, extra->upHostFlags, upHost, upHostVote);
+			} else {
+				err = Qiniu_Rgn_Table_GetHostByUptoken(self->regionTable, self, extra->uptoken, extra->upHostFlags, upHost, upHostVote);
+			} // if
+			if (err.code != 200) {
+				return err;
+			} // if
+		} else {
+			*upHost = QINIU_UP_HOST;
+		} // if
+
+		if (*upHost == NULL) {
+			err.code = 9988;
+			err.message = "No proper upload host name";
+			return err;
+		} // if
+	} // if
+	return Qiniu_OK;
+}
+
+static Qiniu_Int64 Qiniu_Io_uploadedBytes(CURL* curl)
+{
+	double bytes = 0;
+	curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD, &bytes);
+	return (Qiniu_Int64)bytes;
+}
+
 static Qiniu_Error Qiniu_Io_call(
 	Qiniu_Client* self, Qiniu_Io_PutRet* ret, struct curl_httppost* formpost,
 	Qiniu_Io_PutExtra* extra)
@@ -88,31 +126,13 @@ static Qiniu_Error Qiniu_Io_call(
 		}
     }
 
-	headers = curl_slist_append(NULL, "Expect:");
+	err = Qiniu_Io_upHost(self, extra, &upHost, &upHostVote);
+	if (err.code != 200) {
+		curl_formfree(formpost);
+		return err;
+	} // if
 
-	//// For using multi-region storage.
-	{
-		if ((upHost = extra->upHost) == NULL) {
-			if (Qiniu_Rgn_IsEnabled()) {
-				if (extra->upBucket && extra->accessKey) {
-					err = Qiniu_Rgn_Table_GetHost(self->regionTable, self, extra->upBucket, extra->accessKey, extra->upHostFlags, &upHost, &upHostVote);
-				} else {
-					err = Qiniu_Rgn_Table_GetHostByUptoken(self->regionTable, self, extra->uptoken, extra->upHostFlags, &upHost, &upHostVote);
-				} // if
-				if (err.code != 200) {
-					return err;
-				} // if
-			} else {
-				upHost = QINIU_UP_HOST;
-			} // if
-
-			if (upHost == NULL) {
-				err.code = 9988;
-				err.message = "No proper upload host name";
-				return err;
-			} // if
-		} // if
-	} 
+	headers = curl_slist_append(NULL, "Expect:");
 
 	curl_easy_setopt(curl, CURLOPT_URL, upHost);
 	curl_easy_setopt(curl, CURLOPT_HTTPPOST, formpost);
@@ -126,12 +146,14 @@ static Qiniu_Error Qiniu_Io_call(
 			ret->hash = Qiniu_Json_GetString(self->root, "hash", NULL);
 			ret->key = Qiniu_Json_GetString(self->root, "key", NULL);
 			ret->persistentId = Qiniu_Json_GetString(self->root, "persistentId", NULL);
+			ret->qetag[0] = '\0';
 		} 
 	}
 
 	//// For using multi-region storage.
 	{
 		if (Qiniu_Rgn_IsEnabled()) {
+			upHostVote.bytes = Qiniu_Io_uploadedBytes(curl);
 			Qiniu_Rgn_Table_VoteHost(self->regionTable, &upHostVote, err);
 		} // if
 	}
@@ -146,39 +168,33 @@ static Qiniu_Error Qiniu_Io_call(
 	return err;
 }
 
-Qiniu_Error Qiniu_Io_PutFile(
-	Qiniu_Client* self, Qiniu_Io_PutRet* ret,
-	const char* uptoken, const char* key, const char* localFile, Qiniu_Io_PutExtra* extra)
+static void Qiniu_Io_form_file(
+	Qiniu_Io_form* form, const char* uptoken, const char* key, const char* localFile, Qiniu_Io_PutExtra** extra)
 {
-	Qiniu_Io_form form;
-	Qiniu_Io_form_init(&form, uptoken, key, &extra);
+	Qiniu_Io_form_init(form, uptoken, key, extra);
 
-    if (extra->localFileName != NULL) {
+    if ((*extra)->localFileName != NULL) {
         curl_formadd(
-            &form.formpost, &form.lastptr, CURLFORM_COPYNAME, "file", CURLFORM_FILE, localFile, CURLFORM_FILENAME, extra->localFileName, CURLFORM_END);
+            &form->formpost, &form->lastptr, CURLFORM_COPYNAME, "file", CURLFORM_FILE, localFile, CURLFORM_FILENAME, (*extra)->localFileName, CURLFORM_END);
     } else {
         curl_formadd(
-            &form.formpost, &form.lastptr, CURLFORM_COPYNAME, "file", CURLFORM_FILE, localFile, CURLFORM_END);
+            &form->formpost, &form->lastptr, CURLFORM_COPYNAME, "file", CURLFORM_FILE, localFile, CURLFORM_END);
     }
 
 	//// For using multi-region storage.
 	{
 		if (Qiniu_Rgn_IsEnabled()) {
-			if (!extra->uptoken) {
-				extra->uptoken = uptoken;
+			if (!(*extra)->uptoken) {
+				(*extra)->uptoken = uptoken;
 			} // if
 		} // if
 	}
-
-	return Qiniu_Io_call(self, ret, form.formpost, extra);
 }
 
-Qiniu_Error Qiniu_Io_PutBuffer(
-	Qiniu_Client* self, Qiniu_Io_PutRet* ret,
-	const char* uptoken, const char* key, const char* buf, size_t fsize, Qiniu_Io_PutExtra* extra)
+static void Qiniu_Io_form_buffer(
+	Qiniu_Io_form* form, const char* uptoken, const char* key, const char* buf, size_t fsize, Qiniu_Io_PutExtra** extra)
 {
-	Qiniu_Io_form form;
-	Qiniu_Io_form_init(&form, uptoken, key, &extra);
+	Qiniu_Io_form_init(form, uptoken, key, extra);
 
     if (key == NULL) {
         // Use an empty string instead of the NULL pointer to prevent the curl lib from crashing
@@ -186,20 +202,77 @@ Qiniu_Error Qiniu_Io_PutBuffer(
         // **NOTICE**: The magic variable $(filename) will be set as empty string.
         key = "";
     }
+    if (fsize == 0) {
+        // The curl lib takes the length of an empty buffer by strlen().
+        buf = "";
+    }
 
 	curl_formadd(
-		&form.formpost, &form.lastptr, CURLFORM_COPYNAME, "file",
-		CURLFORM_BUFFER, key, CURLFORM_BUFFERPTR, buf, CURLFORM_BUFFERLENGTH, fsize, CURLFORM_END);
+		&form->formpost, &form->lastptr, CURLFORM_COPYNAME, "file",
+		CURLFORM_BUFFER, key, CURLFORM_BUFFERPTR, buf, CURLFORM_BUFFERLENGTH, (long)fsize, CURLFORM_END);
 
 	//// For using multi-region storage.
 	{
 		if (Qiniu_Rgn_IsEnabled()) {
-			if (!extra->uptoken) {
-				extra->uptoken = uptoken;
+			if (!(*extra)->uptoken) {
+				(*extra)->uptoken = uptoken;
 			} // if
 		} // if
 	}
+}
 
+Qiniu_Error Qiniu_Io_PutFile(
+	Qiniu_Client* self, Qiniu_Io_PutRet* ret,
+	const char* uptoken, const char* key, const char* localFile, Qiniu_Io_PutExtra* extra)
+{
+	Qiniu_Io_form form;
+	Qiniu_Io_form_file(&form, uptoken, key, localFile, &extra);
 	return Qiniu_Io_call(self, ret, form.formpost, extra);
 }
 
+Qiniu_Error Qiniu_Io_PutBuffer(
+	Qiniu_Client* self, Qiniu_Io_PutRet* ret,
+	const char* uptoken, const char* key, const char* buf, size_t fsize, Qiniu_Io_PutExtra* extra)
+{
+	Qiniu_Io_form form;
+	Qiniu_Io_form_buffer(&form, uptoken, key, buf, fsize, &extra);
+	return Qiniu_Io_call(self, ret, form.formpost, extra);
+}
+
+/*============================================================================*/
+/* func Qiniu_Io_AsyncPutXXX */
+
+static Qiniu_Error Qiniu_Io_asyncCall(
+	Qiniu_Async* async, struct curl_httppost* formpost, Qiniu_Io_PutExtra* extra,
+	Qiniu_Async_FnDone done, void* recvr)
+{
+	Qiniu_Error err;
+	const char* upHost = NULL;
+	Qiniu_Rgn_HostVote upHostVote;
+
+	// The host is resolved on the calling thread, which blocks only if the region information is not cached.
+	err = Qiniu_Io_upHost(Qiniu_Async_Client(async), extra, &upHost, &upHostVote);
+	if (err.code != 200) {
+		curl_formfree(formpost);
+		return err;
+	} // if
+	return Qiniu_Async_PostForm(async, upHost, formpost, (Qiniu_Rgn_IsEnabled() ? &upHostVote : NULL), done, recvr);
+}
+
+Qiniu_Error Qiniu_Io_AsyncPutFile(
+	Qiniu_Async* async, const char* uptoken, const char* key, const char* localFile, Qiniu_Io_PutExtra* extra,
+	Qiniu_Async_FnDone done, void* recvr)
+{
+	Qiniu_Io_form form;
+	Qiniu_Io_form_file(&form, uptoken, key, localFile, &extra);
+	return Qiniu_Io_asyncCall(async, form.formpost, extra, done, recvr);
+}
+
+Qiniu_Error Qiniu_Io_AsyncPutBuffer(
+	Qiniu_Async* async, const char* uptoken, const char* key, const char* buf, size_t fsize, Qiniu_Io_PutExtra* extra,
+	Qiniu_Async_FnDone done, void* recvr)
+{
+	Qiniu_Io_form form;
+	Qiniu_Io_form_buffer(&form, uptoken, key, buf, fsize, &extra);
+	return Qiniu_Io_asyncCall(async, form.formpost, extra, done, recvr);
+}
@@ -12,6 +12,7 @@
 
 #include "http.h"
 #include "region.h"
+#include "async.h"
 
 #pragma pack(1)
 
@@ -55,10 +56,16 @@ typedef struct _Qiniu_Io_PutExtra {
 /*============================================================================*/
 /* type Qiniu_Io_PutRet */
 
+#define QINIU_IO_QETAG_MAX	32
+
 typedef struct _Qiniu_Io_PutRet {
 	const char* hash;
 	const char* key;
     const char* persistentId;
+
+	// The qetag computed locally, set only by the resumable upload with checkQetag enabled, or an
+	// empty string otherwise. It is kept in the ret itself, so it outlives the client response.
+	char qetag[QINIU_IO_QETAG_MAX];
 } Qiniu_Io_PutRet;
 
 /*============================================================================*/
@@ -76,6 +83,19 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_Io_PutBuffer(
 	Qiniu_Client* self, Qiniu_Io_PutRet* ret,
 	const char* uptoken, const char* key, const char* buf, size_t fsize, Qiniu_Io_PutExtra* extra);
 
+/*============================================================================*/
+/* func Qiniu_Io_AsyncPutXXX */
+
+// Submit the upload to the event loop. The callback receives the JSON object returned by the server,
+// while extra->callbackRetParser is not used. **NOTICE**: The buffer must keep valid until the callback is invoked.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Io_AsyncPutFile(
+	Qiniu_Async* async, const char* uptoken, const char* key, const char* localFile, Qiniu_Io_PutExtra* extra,
+	Qiniu_Async_FnDone done, void* recvr);
+
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Io_AsyncPutBuffer(
+	Qiniu_Async* async, const char* uptoken, const char* key, const char* buf, size_t fsize, Qiniu_Io_PutExtra* extra,
+	Qiniu_Async_FnDone done, void* recvr);
+
 /*============================================================================*/
 
 #pragma pack()
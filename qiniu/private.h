@@ -0,0 +1,57 @@
+/*
+ ============================================================================
+ Name        : private.h
+ Author      : Qiniu.com
+ Copyright   : 2012(c) Shanghai Qiniu Information Technologies Co., Ltd.
+ Description : The declarations shared by the sources of the SDK, which are
+               not part of its API and are not installed.
+ ============================================================================
+ */
+
+#ifndef QINIU_PRIVATE_H
+#define QINIU_PRIVATE_H
+
+#include "resumable_io.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*============================================================================*/
+/* func Qiniu_Share_forThreads */
+
+// Return the share for the clients which the SDK runs in its own threads on behalf of a client, or
+// NULL if the share holds the connection cache, which must not be used by several threads.
+Qiniu_Share* Qiniu_Share_forThreads(Qiniu_Share* self);
+
+/*============================================================================*/
+/* type Qiniu_Rio_chunkSizer */
+
+// Choose the size of the next bput when adaptiveChunkSize is set, so that it takes about 2 seconds at
+// the measured throughput. The size doubles at most after a success and halves after a failure, and
+// the recent error rate shrinks it further, which bounds the data sent again on lossy links. The size
+// is always a multiple of 4 KB between minSize and maxSize.
+
+typedef struct _Qiniu_Rio_chunkSizer {
+	Qiniu_Mutex mutex;
+	int size;
+	int minSize;
+	int maxSize;
+	double rate;
+	double errRate;
+} Qiniu_Rio_chunkSizer;
+
+void Qiniu_Rio_chunkSizer_Init(Qiniu_Rio_chunkSizer* self, Qiniu_Rio_PutExtra* extra);
+void Qiniu_Rio_chunkSizer_Cleanup(Qiniu_Rio_chunkSizer* self);
+
+// Measure a bput of the given bytes, which took the given seconds, or is never sent if they are negative.
+void Qiniu_Rio_chunkSizer_Update(Qiniu_Rio_chunkSizer* self, int bytes, double seconds, int ok);
+
+/*============================================================================*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QINIU_PRIVATE_H
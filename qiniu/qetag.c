@@ -1,6 +1,7 @@
 #include <openssl/sha.h>
 
 #include "qetag.h"
+#include "http.h"
 
 #define NO 0
 #define YES 1
@@ -314,6 +315,102 @@ void Qiniu_Qetag_CommitBlock(struct _Qiniu_Qetag_Context * ctx, struct _Qiniu_Qe
     }
 } // Qiniu_Qetag_CommitBlock
 
+Qiniu_Error Qiniu_Qetag_NewBlock(struct _Qiniu_Qetag_Block ** blk)
+{
+    Qiniu_Error err;
+    struct _Qiniu_Qetag_Block * newBlk = NULL;
+
+    newBlk = calloc(1, sizeof(*newBlk));
+    if (newBlk == NULL) {
+        err.code = 9999;
+        err.message = "no enough memory";
+        return err;
+    }
+
+    err = Qiniu_Qetag_ResetBlock(newBlk);
+    if (err.code != 200) {
+        free(newBlk);
+        return err;
+    }
+
+    *blk = newBlk;
+    return err;
+} // Qiniu_Qetag_NewBlock
+
+Qiniu_Error Qiniu_Qetag_ResetBlock(struct _Qiniu_Qetag_Block * blk)
+{
+    Qiniu_Error err;
+
+    if (SHA1_Init(&blk->sha1Ctx) == 0) {
+        err.code = 9999;
+        err.message = "openssl internal error";
+        return err;
+    }
+    blk->done = NO;
+    blk->capacity = BLOCK_MAX_SIZE;
+
+    err.code = 200;
+    err.message = "ok";
+    return err;
+} // Qiniu_Qetag_ResetBlock
+
+void Qiniu_Qetag_DestroyBlock(struct _Qiniu_Qetag_Block * blk)
+{
+    if (blk) {
+        free(blk);
+    } // if
+} // Qiniu_Qetag_DestroyBlock
+
+Qiniu_Error Qiniu_Qetag_SumBlock(struct _Qiniu_Qetag_Block * blk, unsigned char * digest)
+{
+    Qiniu_Error err;
+
+    if (SHA1_Final(digest, &blk->sha1Ctx) == 0) {
+        err.code = 9999;
+        err.message = "openssl internal error";
+        return err;
+    }
+
+    err.code = 200;
+    err.message = "ok";
+    return err;
+} // Qiniu_Qetag_SumBlock
+
+Qiniu_Error Qiniu_Qetag_SumBlockDigests(const unsigned char * digests, size_t blkCount, char ** digest)
+{
+    Qiniu_Error err;
+    unsigned char digestSummary[1 + SHA_DIGEST_LENGTH];
+    SHA_CTX sha1Ctx;
+    char * newDigest = NULL;
+
+    if (blkCount == 1) {
+        digestSummary[0] = 0x16;
+        memcpy(&digestSummary[1], digests, SHA_DIGEST_LENGTH);
+    } else {
+        // 空文件取空数据的 SHA1，多个块则取各块摘要拼接后的 SHA1
+        digestSummary[0] = (blkCount == 0) ? 0x16 : 0x96;
+        if (SHA1_Init(&sha1Ctx) == 0 ||
+            SHA1_Update(&sha1Ctx, digests, blkCount * SHA_DIGEST_LENGTH) == 0 ||
+            SHA1_Final(&digestSummary[1], &sha1Ctx) == 0) {
+            err.code = 9999;
+            err.message = "openssl internal error";
+            return err;
+        }
+    } // if
+
+    newDigest = Qiniu_Memory_Encode((const char *)digestSummary, 1 + SHA_DIGEST_LENGTH);
+    if (newDigest == NULL) {
+        err.code = 9999;
+        err.message = "no enough memory";
+        return err;
+    }
+
+    *digest = newDigest;
+    err.code = 200;
+    err.message = "ok";
+    return err;
+} // Qiniu_Qetag_SumBlockDigests
+
 Qiniu_Error Qiniu_Qetag_DigestFile(const char * localFile, char ** digest)
 {
     Qiniu_Error err;
@@ -371,6 +468,194 @@ DIGESTFILE_NEWCTX_ERROR:
     return err;
 } // Qiniu_Qetag_DigestFile
 
+// 多线程计算 QETAG
+// The counters are updated by atomic operations, and the mutex is used by the threads, so the struct
+// must keep the natural alignment despite the pack(1) of this file.
+#pragma pack(push, 8)
+typedef struct _Qiniu_Qetag_Parallel {
+    Qiniu_ReaderAt f;
+    Qiniu_Int64 fsize;
+    unsigned int blkCount;
+    Qiniu_Count nextBlk;
+    Qiniu_Count failed;
+    Qiniu_Error err;
+    Qiniu_Mutex mutex;
+    unsigned char * digests;
+} Qiniu_Qetag_Parallel;
+#pragma pack(pop)
+
+static void Qiniu_Qetag_parallelFail(Qiniu_Qetag_Parallel * par, int code, const char * message)
+{
+    Qiniu_Mutex_Lock(&par->mutex);
+    if (par->failed == 0) {
+        par->err.code = code;
+        par->err.message = message;
+        par->failed = 1;
+    } // if
+    Qiniu_Mutex_Unlock(&par->mutex);
+} // Qiniu_Qetag_parallelFail
+
+static void Qiniu_Qetag_parallelWorker(void * params)
+{
+    Qiniu_Qetag_Parallel * par = (Qiniu_Qetag_Parallel *)params;
+    size_t readingBytes = (BLOCK_MAX_SIZE >> 2);
+    ssize_t readBytes = 0;
+    Qiniu_Off_T offset = 0;
+    Qiniu_Off_T blkEnd = 0;
+    unsigned int blkIdx = 0;
+    SHA_CTX sha1Ctx;
+    const char * blk = NULL;
+    char * buf = NULL;
+
+    // 每个线程独立持有 1MB 缓冲区，用定位读取互不干扰
+    buf = malloc(readingBytes);
+    if (!buf) {
+        Qiniu_Qetag_parallelFail(par, 9999, "no enough memory");
+        return;
+    }
+
+    while (par->failed == 0) {
+        blkIdx = (unsigned int)(Qiniu_Count_Inc(&par->nextBlk) - 1);
+        if (blkIdx >= par->blkCount) {
+            break;
+        }
+
+        offset = (Qiniu_Off_T)blkIdx * BLOCK_MAX_SIZE;
+        blkEnd = offset + BLOCK_MAX_SIZE;
+        if (blkEnd > par->fsize) {
+            blkEnd = par->fsize;
+        }
+
+        if (SHA1_Init(&sha1Ctx) == 0) {
+            Qiniu_Qetag_parallelFail(par, 9999, "openssl internal error");
+            break;
+        }
+
+        // 映射的文件直接计算整块内存的摘要
+        blk = Qiniu_ReaderAt_Slice(par->f, offset, (size_t)(blkEnd - offset));
+        if (blk != NULL) {
+            if (SHA1_Update(&sha1Ctx, blk, (size_t)(blkEnd - offset)) == 0) {
+                Qiniu_Qetag_parallelFail(par, 9999, "openssl internal error");
+                break;
+            }
+            offset = blkEnd;
+        } // if
+
+        while (offset < blkEnd) {
+            if ((Qiniu_Off_T)readingBytes > blkEnd - offset) {
+                readingBytes = (size_t)(blkEnd - offset);
+            }
+            readBytes = par->f.ReadAt(par->f.self, buf, readingBytes, offset);
+            if (readBytes <= 0) {
+                Qiniu_Qetag_parallelFail(par, 9990, "failed in reading file");
+                goto PARALLELWORKER_EXIT;
+            }
+            if (SHA1_Update(&sha1Ctx, buf, readBytes) == 0) {
+                Qiniu_Qetag_parallelFail(par, 9999, "openssl internal error");
+                goto PARALLELWORKER_EXIT;
+            }
+            offset += readBytes;
+        } // while
+        readingBytes = (BLOCK_MAX_SIZE >> 2);
+
+        // 各块摘要按块序号落位，最后再顺序合并
+        if (SHA1_Final(&par->digests[blkIdx * SHA_DIGEST_LENGTH], &sha1Ctx) == 0) {
+            Qiniu_Qetag_parallelFail(par, 9999, "openssl internal error");
+            break;
+        }
+    } // while
+
+PARALLELWORKER_EXIT:
+    free(buf);
+} // Qiniu_Qetag_parallelWorker
+
+Qiniu_Error Qiniu_Qetag_DigestReaderAt(Qiniu_ReaderAt f, Qiniu_Int64 fsize, unsigned int concurrency, char ** digest)
+{
+    Qiniu_Error err;
+    Qiniu_Qetag_Parallel par;
+    Qiniu_Thread * threads = NULL;
+    unsigned int threadCount = 0;
+    unsigned int i = 0;
+
+    memset(&par, 0, sizeof(par));
+    par.f = f;
+    par.fsize = fsize;
+    par.blkCount = (unsigned int)((par.fsize + BLOCK_MAX_SIZE - 1) / BLOCK_MAX_SIZE);
+
+    if (concurrency > par.blkCount) {
+        concurrency = par.blkCount;
+    }
+    if (concurrency < 1) {
+        concurrency = 1;
+    }
+
+    // 多分配一个字节，空数据时 malloc 也不会返回 NULL
+    par.digests = malloc((size_t)par.blkCount * SHA_DIGEST_LENGTH + 1);
+    threads = malloc(sizeof(Qiniu_Thread) * concurrency);
+    if (!par.digests || !threads) {
+        free(par.digests);
+        free(threads);
+        err.code = 9999;
+        err.message = "no enough memory";
+        return err;
+    }
+
+    Qiniu_Mutex_Init(&par.mutex);
+
+    // 当前线程也参与计算；创建线程失败时以已有线程继续
+    for (threadCount = 0; threadCount < concurrency - 1; ++threadCount) {
+        if (Qiniu_Thread_Create(&threads[threadCount], Qiniu_Qetag_parallelWorker, &par) != 0) {
+            break;
+        }
+    } // for
+    Qiniu_Qetag_parallelWorker(&par);
+    for (i = 0; i < threadCount; ++i) {
+        Qiniu_Thread_Join(threads[i]);
+    } // for
+
+    Qiniu_Mutex_Cleanup(&par.mutex);
+    free(threads);
+
+    if (par.failed) {
+        free(par.digests);
+        return par.err;
+    }
+
+    err = Qiniu_Qetag_SumBlockDigests(par.digests, par.blkCount, digest);
+    free(par.digests);
+    return err;
+} // Qiniu_Qetag_DigestReaderAt
+
+Qiniu_Error Qiniu_Qetag_DigestFileEx(const char * localFile, unsigned int concurrency, char ** digest)
+{
+    Qiniu_Error err;
+    Qiniu_FileInfo fi;
+    Qiniu_File * f = NULL;
+    Qiniu_Int64 fsize = 0;
+
+    err = Qiniu_File_Open(&f, localFile);
+    if (err.code != 200) {
+        return err;
+    }
+
+    err = Qiniu_File_Stat(f, &fi);
+    if (err.code != 200) {
+        Qiniu_File_Close(f);
+        return err;
+    }
+    fsize = Qiniu_FileInfo_Fsize(fi);
+
+    // 只有一个块时无法并行，沿用单线程流程
+    if (concurrency <= 1 || fsize <= BLOCK_MAX_SIZE) {
+        Qiniu_File_Close(f);
+        return Qiniu_Qetag_DigestFile(localFile, digest);
+    }
+
+    err = Qiniu_Qetag_DigestReaderAt(Qiniu_FileReaderAt(f), fsize, concurrency, digest);
+    Qiniu_File_Close(f);
+    return err;
+} // Qiniu_Qetag_DigestFileEx
+
 Qiniu_Error Qiniu_Qetag_DigestBuffer(const char * buf, size_t bufSize, char ** digest)
 {
     Qiniu_Error err;
@@ -34,10 +34,30 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_Qetag_AllocateBlock(struct _Qiniu_Qetag_Co
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Qetag_UpdateBlock(struct _Qiniu_Qetag_Block * blk, const char * buf, size_t bufSize, size_t * blkCapacity);
 QINIU_DLLAPI extern void Qiniu_Qetag_CommitBlock(struct _Qiniu_Qetag_Context * ctx, struct _Qiniu_Qetag_Block * blk);
 
+// 独立于上下文计算单个块的摘要，适用于各块并发、乱序计算的场景
+#define QINIU_QETAG_BLOCK_DIGEST_SIZE 20
+
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Qetag_NewBlock(struct _Qiniu_Qetag_Block ** blk);
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Qetag_ResetBlock(struct _Qiniu_Qetag_Block * blk);
+QINIU_DLLAPI extern void Qiniu_Qetag_DestroyBlock(struct _Qiniu_Qetag_Block * blk);
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Qetag_SumBlock(struct _Qiniu_Qetag_Block * blk, unsigned char * digest);
+
+// 按块顺序合并各块的摘要（每块 QINIU_QETAG_BLOCK_DIGEST_SIZE 字节），得到最终的 QETAG
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Qetag_SumBlockDigests(const unsigned char * digests, size_t blkCount, char ** digest);
+
 // 单线程计算 QETAG
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Qetag_DigestFile(const char * localFile, char ** digest);
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Qetag_DigestBuffer(const char * buf, size_t fsize, char ** digest);
 
+// 多线程计算 QETAG，各线程以定位读取独立计算 4MB 块的摘要，再按块顺序合并
+// concurrency 为计算线程数（含调用线程），文件只有一个块时退化为单线程计算
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Qetag_DigestFileEx(const char * localFile, unsigned int concurrency, char ** digest);
+
+// 多线程计算长度为 fsize 的 ReaderAt 的 QETAG，concurrency 含义同上
+// 传入 Qiniu_MappedFileReaderAt 时直接计算映射内存的摘要，省去读取时的复制；但映射期间文件若被其他进程截断，
+// 访问越界的页面会触发 SIGBUS（Windows 上为异常）使进程崩溃，而不是返回读取错误，因此只对不会被改动的文件使用
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Qetag_DigestReaderAt(Qiniu_ReaderAt f, Qiniu_Int64 fsize, unsigned int concurrency, char ** digest);
+
 #pragma pack()
 
 #ifdef __cplusplus
@@ -8,11 +8,21 @@
  */
 
 #include <ctype.h>
+#include <stddef.h>
 #include <curl/curl.h>
 
+#if defined(_WIN32)
+#include <process.h>
+#define Qiniu_Rgn_getpid _getpid
+#else
+#include <unistd.h>
+#define Qiniu_Rgn_getpid getpid
+#endif
+
 #include "conf.h"
 #include "tm.h"
 #include "region.h"
+#include "../cJSON/cJSON.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -114,10 +124,10 @@ static void Qiniu_Rgn_Info_duplicateHosts(Qiniu_Json * root, Qiniu_Rgn_HostInfo
 	} // if
 } // Qiniu_Rgn_Info_duplicateHosts
 
-QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Info_Fetch(Qiniu_Client * cli, Qiniu_Rgn_RegionInfo ** rgnInfo, const char * bucket, const char * accessKey)
+// Build the region from a response of the UC query, or an entry of the cache file in the same form.
+static Qiniu_Error Qiniu_Rgn_Info_parse(Qiniu_Json * root, Qiniu_Rgn_RegionInfo ** rgnInfo, const char * bucket)
 {
 	Qiniu_Error err;
-	Qiniu_Json * root = NULL;
 	Qiniu_Json * http = NULL;
 	Qiniu_Json * https = NULL;
 	Qiniu_Uint32 i = 0;
@@ -128,16 +138,8 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Info_Fetch(Qiniu_Client * cli, Qiniu_R
 	Qiniu_Rgn_RegionInfo * newRgnInfo = NULL;
 	char * buf = NULL;
 	char * pos = NULL;
-	char * url = NULL;
 	Qiniu_Uint32 bufLen = 0;
 
-	url = Qiniu_String_Format(256, "%s/v1/query?ak=%s&bucket=%s", QINIU_UC_HOST, accessKey, bucket);
-	err = Qiniu_Client_Call(cli, &root, url);
-	free(url);
-	if (err.code != 200) {
-		return err;
-	} // if
-
 	bufLen += sizeof(Qiniu_Rgn_RegionInfo) + strlen(bucket) + 1;
 
 	http = Qiniu_Json_GetObjectItem(root, "http", NULL);
@@ -196,84 +198,109 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Info_Fetch(Qiniu_Client * cli, Qiniu_R
 
 	*rgnInfo = newRgnInfo;
 	return Qiniu_OK;
+} // Qiniu_Rgn_Info_parse
+
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Info_Fetch(Qiniu_Client * cli, Qiniu_Rgn_RegionInfo ** rgnInfo, const char * bucket, const char * accessKey)
+{
+	Qiniu_Error err;
+	Qiniu_Json * root = NULL;
+	char * url = NULL;
+
+	url = Qiniu_String_Format(256, "%s/v1/query?ak=%s&bucket=%s", QINIU_UC_HOST, accessKey, bucket);
+	err = Qiniu_Client_Call(cli, &root, url);
+	free(url);
+	if (err.code != 200) {
+		return err;
+	} // if
+
+	return Qiniu_Rgn_Info_parse(root, rgnInfo, bucket);
 } // Qiniu_Rgn_Info_Fetch
 
-static Qiniu_Error Qiniu_Rgn_parseQueryArguments(const char * uptoken, char ** bucket, char ** accessKey)
+// Find the value of the field in the put policy, which is a flat JSON object.
+static const char * Qiniu_Rgn_findPolicyField(const char * putPolicy, const char * name)
+{
+	const char * pos = strstr(putPolicy, name);
+	if (!pos) {
+		return NULL;
+	} // if
+	pos += strlen(name);
+	while (isspace(*pos) || *pos == ':') {
+		pos += 1;
+	} // while
+	return pos;
+} // Qiniu_Rgn_findPolicyField
+
+// Get the bucket and the access key from the uptoken, and the deadline if it is not NULL.
+static Qiniu_Error Qiniu_Rgn_parseQueryArguments(const char * uptoken, char ** bucket, char ** accessKey, Qiniu_Uint64 * deadline)
 {
 	Qiniu_Error err;
 	const char * begin = uptoken;
 	const char * end = uptoken;
 	char * putPolicy = NULL;
 
+	*bucket = NULL;
+	*accessKey = NULL;
+
 	end = strchr(begin, ':');
 	if (!end) {
 		err.code = 9989;
 		err.message = "Invalid uptoken";
 		return err;
 	} // if
-
-	*accessKey = calloc(1, end - begin + 1);
-	if (!*accessKey) {
-		err.code = 499;
-		err.message = "No enough memory";
-		return err;
-	} // if
-	memcpy(*accessKey, begin, end - begin);
-
 	begin = strchr(end + 1, ':');
 	if (!begin) {
-		free(*accessKey);
-		*accessKey = NULL;
 		err.code = 9989;
 		err.message = "Invalid uptoken";
 		return err;
 	} // if
 
-	putPolicy = Qiniu_String_Decode(begin);
-	begin = strstr(putPolicy, "\"scope\"");
-	if (!begin) {
-		free(*accessKey);
-		*accessKey = NULL;
-		err.code = 9989;
-		err.message = "Invalid uptoken";
-		return err;
+	*accessKey = calloc(1, end - uptoken + 1);
+	putPolicy = Qiniu_String_Decode(begin + 1);
+	if (!*accessKey || !putPolicy) {
+		err.code = 499;
+		err.message = "No enough memory";
+		goto PARSE_QUERY_ARGUMENTS_ERROR;
 	} // if
+	memcpy(*accessKey, uptoken, end - uptoken);
 
-	begin += strlen("\"scope\"");
-	while (isspace(*begin) || *begin == ':') {
-		begin += 1;
-	} // while
-	if (*begin != '"') {
-		free(putPolicy);
-		free(*accessKey);
-		*accessKey = NULL;
-
+	begin = Qiniu_Rgn_findPolicyField(putPolicy, "\"scope\"");
+	if (!begin || *begin != '"') {
 		err.code = 9989;
 		err.message = "Invalid uptoken";
-		return err;
+		goto PARSE_QUERY_ARGUMENTS_ERROR;
 	} // if
 
 	begin += 1;
 	end = begin;
-	while (1) {
-		if (*end == ':' || (*end == '"' && *(end - 1) != '\\')) {
-			break;
-		} // if
+	while (*end && *end != ':' && !(*end == '"' && *(end - 1) != '\\')) {
 		end += 1;
 	} // while
+	if (!*end) {
+		err.code = 9989;
+		err.message = "Invalid uptoken";
+		goto PARSE_QUERY_ARGUMENTS_ERROR;
+	} // if
 
 	*bucket = calloc(1, end - begin + 1);
 	if (!*bucket) {
-		free(putPolicy);
-		free(*accessKey);
-		*accessKey = NULL;
-
 		err.code = 499;
 		err.message = "No enough memory";
-		return err;
+		goto PARSE_QUERY_ARGUMENTS_ERROR;
 	} // if
 	memcpy(*bucket, begin, end - begin);
+
+	if (deadline) {
+		begin = Qiniu_Rgn_findPolicyField(putPolicy, "\"deadline\"");
+		*deadline = (begin) ? strtoull(begin, NULL, 10) : 0;
+	} // if
+	free(putPolicy);
 	return Qiniu_OK;
+
+PARSE_QUERY_ARGUMENTS_ERROR:
+	free(putPolicy);
+	free(*accessKey);
+	*accessKey = NULL;
+	return err;
 } // Qiniu_Rgn_parseQueryArguments
 
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Info_FetchByUptoken(Qiniu_Client * cli, Qiniu_Rgn_RegionInfo ** rgnInfo, const char * uptoken)
@@ -282,7 +309,7 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Info_FetchByUptoken(Qiniu_Client * cli
 	char * bucket = NULL;
 	char * accessKey = NULL;
 
-	err = Qiniu_Rgn_parseQueryArguments(uptoken, &bucket, &accessKey);
+	err = Qiniu_Rgn_parseQueryArguments(uptoken, &bucket, &accessKey, NULL);
 	if (err.code != 200) {
 		return err;
 	} // if
@@ -330,6 +357,265 @@ QINIU_DLLAPI extern const char * Qiniu_Rgn_Info_GetHost(Qiniu_Rgn_RegionInfo * r
 	return NULL;
 } // Qiniu_Rgn_Info_GetHost
 
+// The table is read without locks. The buckets are chained in an index, whose slots and nodes are
+// published with release stores after they are filled. A refreshed region replaces the old one in
+// its node atomically, and a full index is replaced by a copy twice as large. The replaced indexes
+// may still be read by other threads, so they are kept until the table is destroyed. A replaced
+// region is freed by the writer once no lookup is running and no one holds it.
+#if defined(_MSC_VER)
+// Accesses to volatile objects have acquire and release semantics with MSVC.
+#define Qiniu_Rgn_load(p)		(*(p))
+#define Qiniu_Rgn_store(p, v)	(*(p) = (v))
+#define Qiniu_Rgn_incVote(p)		InterlockedIncrement((volatile LONG *)(p))
+#define Qiniu_Rgn_decVote(p)		InterlockedDecrement((volatile LONG *)(p))
+#define Qiniu_Rgn_cas(p, o, n)		(InterlockedCompareExchange((volatile LONG *)(p), (LONG)(n), (LONG)(o)) == (LONG)(o))
+#else
+#define Qiniu_Rgn_load(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define Qiniu_Rgn_store(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define Qiniu_Rgn_incVote(p)		__atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define Qiniu_Rgn_decVote(p)		__atomic_sub_fetch((p), 1, __ATOMIC_RELAXED)
+#define Qiniu_Rgn_cas(p, o, n)		__sync_bool_compare_and_swap((p), (o), (n))
+#endif
+#define Qiniu_Rgn_claim(p)			Qiniu_Rgn_cas((p), 0, 1)
+
+#define QINIU_RGN_TABLE_INIT_SLOTS	16
+
+// How long to wait before a failed refresh is tried again, in seconds.
+#define QINIU_RGN_REFRESH_RETRY_INTERVAL	30
+
+typedef struct _Qiniu_Rgn_TableNode {
+	struct _Qiniu_Rgn_TableNode * next;
+	Qiniu_Uint32 hash;
+	Qiniu_Rgn_RegionInfo * volatile rgnInfo;
+
+	// Set while the region is being refreshed in the background.
+	volatile long refreshing;
+	volatile Qiniu_Uint64 retryAt;
+} Qiniu_Rgn_TableNode;
+
+// How many uptokens are remembered. The expired ones, or the oldest one if none is expired, are
+// unlinked to make room for a new one, and freed like the replaced regions.
+#define QINIU_RGN_TOKEN_SLOTS		64
+#define QINIU_RGN_TOKEN_MAX_COUNT	256
+
+// The bucket and the access key parsed from an uptoken, with the strings following the entry.
+typedef struct _Qiniu_Rgn_TokenEntry {
+	struct _Qiniu_Rgn_TokenEntry * volatile next;
+	Qiniu_Uint32 hash;
+	Qiniu_Uint32 serial;
+	Qiniu_Uint64 deadline;
+	Qiniu_Count refCount;
+	const char * uptoken;
+	const char * bucket;
+	const char * accessKey;
+} Qiniu_Rgn_TokenEntry;
+
+typedef struct _Qiniu_Rgn_TableIndex {
+	struct _Qiniu_Rgn_TableIndex * older;
+	Qiniu_Uint32 rgnCount;
+	Qiniu_Uint32 slotCount;
+	Qiniu_Rgn_TableNode * volatile slots[1];
+} Qiniu_Rgn_TableIndex;
+
+struct _Qiniu_Rgn_RegionTable {
+	Qiniu_Rgn_TableIndex * volatile index;
+	Qiniu_Count refCount;
+
+	// Randomize the hosts picked.
+	Qiniu_Count picks;
+
+	// Serialize the writers.
+	Qiniu_Mutex mutex;
+
+	// The replaced regions which are still held.
+	Qiniu_Buffer retired;
+
+	// The lookups which may have found a region without holding it yet.
+	Qiniu_Count readers;
+
+	char * cacheFile;
+
+	// The parsed uptokens, which are published in the same way as the nodes of the index.
+	Qiniu_Rgn_TokenEntry * volatile tokens[QINIU_RGN_TOKEN_SLOTS];
+	Qiniu_Uint32 tokenCount;
+	Qiniu_Uint32 tokenSerial;
+
+	// The unlinked uptokens which are still held.
+	Qiniu_Buffer retiredTokens;
+
+	// The regions due to expire are renewed one by one by the refresher, which is started on demand
+	// and owns the client.
+	struct _Qiniu_Rgn_RefreshJob * jobs;
+	struct _Qiniu_Rgn_RefreshJob ** lastJob;
+	Qiniu_Cond cond;
+	Qiniu_Thread refresher;
+	Qiniu_Client refreshCli;
+	Qiniu_Bool refresherStarted;
+	Qiniu_Bool stopping;
+
+	// The hosts are probed by the refresher every probeInterval seconds if it is positive.
+	int probeInterval;
+	Qiniu_Uint64 nextProbeAt;
+};
+
+typedef struct _Qiniu_Rgn_RefreshJob {
+	struct _Qiniu_Rgn_RefreshJob * next;
+	char * bucket;
+	char * accessKey;
+} Qiniu_Rgn_RefreshJob;
+
+static Qiniu_Rgn_RegionTable * Qiniu_Rgn_globalTable = NULL;
+
+static Qiniu_Uint32 Qiniu_Rgn_Table_hash(const char * bucket)
+{
+	// FNV-1a
+	Qiniu_Uint32 hash = 2166136261U;
+	while (*bucket) {
+		hash = (hash ^ (unsigned char)*bucket++) * 16777619U;
+	} // while
+	return hash;
+} // Qiniu_Rgn_Table_hash
+
+static Qiniu_Rgn_TableIndex * Qiniu_Rgn_Table_newIndex(Qiniu_Uint32 slotCount)
+{
+	return calloc(1, offsetof(Qiniu_Rgn_TableIndex, slots) + sizeof(Qiniu_Rgn_TableNode *) * slotCount);
+} // Qiniu_Rgn_Table_newIndex
+
+static void Qiniu_Rgn_Table_freeIndex(Qiniu_Rgn_TableIndex * index, Qiniu_Uint32 freeRegions)
+{
+	Qiniu_Uint32 i = 0;
+	Qiniu_Rgn_TableNode * node = NULL;
+	Qiniu_Rgn_TableNode * next = NULL;
+
+	for (i = 0; i < index->slotCount; i += 1) {
+		for (node = index->slots[i]; node; node = next) {
+			next = node->next;
+			if (freeRegions) {
+				Qiniu_Rgn_Info_Destroy(node->rgnInfo);
+			} // if
+			free(node);
+		} // for
+	} // for
+	free(index);
+} // Qiniu_Rgn_Table_freeIndex
+
+static Qiniu_Rgn_TableNode * Qiniu_Rgn_Table_findNode(Qiniu_Rgn_TableIndex * index, const char * bucket, Qiniu_Uint32 hash)
+{
+	Qiniu_Rgn_TableNode * node = Qiniu_Rgn_load(&index->slots[hash % index->slotCount]);
+
+	while (node) {
+		if (node->hash == hash && strcmp(Qiniu_Rgn_load(&node->rgnInfo)->bucket, bucket) == 0) {
+			return node;
+		} // if
+		node = node->next;
+	} // while
+	return NULL;
+} // Qiniu_Rgn_Table_findNode
+
+static Qiniu_Rgn_TableNode * Qiniu_Rgn_Table_newNode(Qiniu_Rgn_TableIndex * index, Qiniu_Uint32 hash, Qiniu_Rgn_RegionInfo * rgnInfo)
+{
+	Qiniu_Rgn_TableNode * node = NULL;
+
+	node = calloc(1, sizeof(Qiniu_Rgn_TableNode));
+	if (!node) {
+		return NULL;
+	} // if
+	node->hash = hash;
+	node->rgnInfo = rgnInfo;
+	node->next = index->slots[hash % index->slotCount];
+	return node;
+} // Qiniu_Rgn_Table_newNode
+
+// Called by the writer. The new index is filled before it is published.
+static Qiniu_Rgn_TableIndex * Qiniu_Rgn_Table_growIndex(Qiniu_Rgn_TableIndex * index)
+{
+	Qiniu_Uint32 i = 0;
+	Qiniu_Rgn_TableNode * node = NULL;
+	Qiniu_Rgn_TableNode * newNode = NULL;
+	Qiniu_Rgn_TableIndex * newIndex = NULL;
+
+	newIndex = Qiniu_Rgn_Table_newIndex(index->slotCount * 2);
+	if (!newIndex) {
+		return NULL;
+	} // if
+	newIndex->slotCount = index->slotCount * 2;
+
+	for (i = 0; i < index->slotCount; i += 1) {
+		for (node = index->slots[i]; node; node = node->next) {
+			newNode = Qiniu_Rgn_Table_newNode(newIndex, node->hash, node->rgnInfo);
+			if (!newNode) {
+				Qiniu_Rgn_Table_freeIndex(newIndex, 0);
+				return NULL;
+			} // if
+			newNode->refreshing = node->refreshing;
+			newNode->retryAt = node->retryAt;
+			newIndex->slots[node->hash % newIndex->slotCount] = newNode;
+		} // for
+	} // for
+
+	newIndex->rgnCount = index->rgnCount;
+	newIndex->older = index;
+	return newIndex;
+} // Qiniu_Rgn_Table_growIndex
+
+// Find the region of the bucket and hold it, so it is not freed by a refresh until it is dropped.
+static Qiniu_Rgn_TableNode * Qiniu_Rgn_Table_holdRegion(Qiniu_Rgn_RegionTable * rgnTable, const char * bucket, Qiniu_Rgn_RegionInfo ** rgnInfo)
+{
+	Qiniu_Rgn_TableNode * node = NULL;
+
+	*rgnInfo = NULL;
+	Qiniu_Count_Inc(&rgnTable->readers);
+	node = Qiniu_Rgn_Table_findNode(Qiniu_Rgn_load(&rgnTable->index), bucket, Qiniu_Rgn_Table_hash(bucket));
+	if (node) {
+		*rgnInfo = Qiniu_Rgn_load(&node->rgnInfo);
+		Qiniu_Count_Inc(&(*rgnInfo)->refCount);
+	} // if
+	Qiniu_Count_Dec(&rgnTable->readers);
+	return node;
+} // Qiniu_Rgn_Table_holdRegion
+
+static void Qiniu_Rgn_Table_dropRegion(Qiniu_Rgn_RegionInfo * rgnInfo)
+{
+	Qiniu_Count_Dec(&rgnInfo->refCount);
+} // Qiniu_Rgn_Table_dropRegion
+
+// Free the replaced regions and the unlinked uptokens which are no longer held. Called by the writer
+// with the mutex held.
+static void Qiniu_Rgn_Table_reclaim(Qiniu_Rgn_RegionTable * rgnTable)
+{
+	Qiniu_Rgn_RegionInfo ** retired = (Qiniu_Rgn_RegionInfo **)rgnTable->retired.buf;
+	Qiniu_Rgn_TokenEntry ** retiredTokens = (Qiniu_Rgn_TokenEntry **)rgnTable->retiredTokens.buf;
+	size_t count = Qiniu_Buffer_Len(&rgnTable->retired) / sizeof(Qiniu_Rgn_RegionInfo *);
+	size_t kept = 0;
+	size_t i = 0;
+
+	// A running lookup may have found a replaced region and not held it yet. The CAS is a full
+	// barrier, so the lookups started after it only find the new regions.
+	if (!Qiniu_Rgn_cas(&rgnTable->readers, 0, 0)) {
+		return;
+	} // if
+
+	for (i = 0; i < count; i += 1) {
+		if (Qiniu_Rgn_load(&retired[i]->refCount) == 0) {
+			Qiniu_Rgn_Info_Destroy(retired[i]);
+		} else {
+			retired[kept++] = retired[i];
+		} // if
+	} // for
+	rgnTable->retired.curr = rgnTable->retired.buf + kept * sizeof(Qiniu_Rgn_RegionInfo *);
+
+	count = Qiniu_Buffer_Len(&rgnTable->retiredTokens) / sizeof(Qiniu_Rgn_TokenEntry *);
+	kept = 0;
+	for (i = 0; i < count; i += 1) {
+		if (Qiniu_Rgn_load(&retiredTokens[i]->refCount) == 0) {
+			free(retiredTokens[i]);
+		} else {
+			retiredTokens[kept++] = retiredTokens[i];
+		} // if
+	} // for
+	rgnTable->retiredTokens.curr = rgnTable->retiredTokens.buf + kept * sizeof(Qiniu_Rgn_TokenEntry *);
+} // Qiniu_Rgn_Table_reclaim
+
 QINIU_DLLAPI extern Qiniu_Rgn_RegionTable * Qiniu_Rgn_Table_Create(void)
 {
 	Qiniu_Rgn_RegionTable * new_tbl = NULL;
@@ -339,20 +625,885 @@ QINIU_DLLAPI extern Qiniu_Rgn_RegionTable * Qiniu_Rgn_Table_Create(void)
 		return NULL;
 	} // if
 
+	new_tbl->index = Qiniu_Rgn_Table_newIndex(QINIU_RGN_TABLE_INIT_SLOTS);
+	if (!new_tbl->index) {
+		free(new_tbl);
+		return NULL;
+	} // if
+	new_tbl->index->slotCount = QINIU_RGN_TABLE_INIT_SLOTS;
+	new_tbl->refCount = 1;
+
+	Qiniu_Mutex_Init(&new_tbl->mutex);
+	Qiniu_Cond_Init(&new_tbl->cond);
+	Qiniu_Buffer_Init(&new_tbl->retired, sizeof(Qiniu_Rgn_RegionInfo *) * 4);
+	Qiniu_Buffer_Init(&new_tbl->retiredTokens, sizeof(Qiniu_Rgn_TokenEntry *) * 4);
+	new_tbl->lastJob = &new_tbl->jobs;
 	return new_tbl;
 } // Qiniu_Rgn_Create
 
+QINIU_DLLAPI extern Qiniu_Rgn_RegionTable * Qiniu_Rgn_Table_Acquire(Qiniu_Rgn_RegionTable * rgnTable)
+{
+	Qiniu_Count_Inc(&rgnTable->refCount);
+	return rgnTable;
+} // Qiniu_Rgn_Table_Acquire
+
+// Stop the refresher and free its client for good. The regions are not refreshed in the background
+// afterwards, but they are still refreshed by the lookups when they expire.
+static void Qiniu_Rgn_Table_stopRefresher(Qiniu_Rgn_RegionTable * rgnTable)
+{
+	Qiniu_Bool started = Qiniu_False;
+
+	Qiniu_Mutex_Lock(&rgnTable->mutex);
+	rgnTable->stopping = Qiniu_True;
+	started = rgnTable->refresherStarted;
+	rgnTable->refresherStarted = Qiniu_False;
+	Qiniu_Cond_Signal(&rgnTable->cond);
+	Qiniu_Mutex_Unlock(&rgnTable->mutex);
+
+	if (started) {
+		Qiniu_Thread_Join(rgnTable->refresher);
+		Qiniu_Client_Cleanup(&rgnTable->refreshCli);
+	} // if
+} // Qiniu_Rgn_Table_stopRefresher
+
 QINIU_DLLAPI extern void Qiniu_Rgn_Table_Destroy(Qiniu_Rgn_RegionTable * rgnTable)
 {
-	Qiniu_Uint32 i = 0;
+	Qiniu_Rgn_TableIndex * index = NULL;
+	Qiniu_Rgn_TableIndex * older = NULL;
+	Qiniu_Rgn_RegionInfo ** retired = NULL;
+	Qiniu_Rgn_RefreshJob * job = NULL;
+	Qiniu_Rgn_TokenEntry ** retiredTokens = NULL;
+	Qiniu_Rgn_TokenEntry * token = NULL;
+	size_t i = 0;
+
 	if (rgnTable) {
-		for (i = 0; i < rgnTable->rgnCount; i += 1) {
-			Qiniu_Rgn_Info_Destroy(rgnTable->regions[i]);
+		if (Qiniu_Count_Dec(&rgnTable->refCount) > 0) {
+			return;
+		} // if
+
+		Qiniu_Rgn_Table_stopRefresher(rgnTable);
+		while ((job = rgnTable->jobs)) {
+			rgnTable->jobs = job->next;
+			free(job->bucket);
+			free(job->accessKey);
+			free(job);
+		} // while
+
+		// Only the current index owns the live regions.
+		for (index = rgnTable->index; index; index = older) {
+			older = index->older;
+			Qiniu_Rgn_Table_freeIndex(index, index == rgnTable->index);
+		} // for
+
+		retired = (Qiniu_Rgn_RegionInfo **)rgnTable->retired.buf;
+		for (i = 0; i < Qiniu_Buffer_Len(&rgnTable->retired) / sizeof(Qiniu_Rgn_RegionInfo *); i += 1) {
+			Qiniu_Rgn_Info_Destroy(retired[i]);
+		} // for
+		Qiniu_Buffer_Cleanup(&rgnTable->retired);
+
+		for (i = 0; i < QINIU_RGN_TOKEN_SLOTS; i += 1) {
+			while ((token = rgnTable->tokens[i])) {
+				rgnTable->tokens[i] = token->next;
+				free(token);
+			} // while
 		} // for
+
+		retiredTokens = (Qiniu_Rgn_TokenEntry **)rgnTable->retiredTokens.buf;
+		for (i = 0; i < Qiniu_Buffer_Len(&rgnTable->retiredTokens) / sizeof(Qiniu_Rgn_TokenEntry *); i += 1) {
+			free(retiredTokens[i]);
+		} // for
+		Qiniu_Buffer_Cleanup(&rgnTable->retiredTokens);
+
+		free(rgnTable->cacheFile);
+		Qiniu_Cond_Cleanup(&rgnTable->cond);
+		Qiniu_Mutex_Cleanup(&rgnTable->mutex);
 		free(rgnTable);
 	} // if
 } // Qiniu_Rgn_Destroy
 
+QINIU_DLLAPI extern Qiniu_Rgn_RegionTable * Qiniu_Rgn_Table_Global(void)
+{
+	return Qiniu_Rgn_globalTable;
+} // Qiniu_Rgn_Table_Global
+
+void Qiniu_Rgn_Table_globalInit(void)
+{
+	if (!Qiniu_Rgn_globalTable) {
+		Qiniu_Rgn_globalTable = Qiniu_Rgn_Table_Create();
+	} // if
+} // Qiniu_Rgn_Table_globalInit
+
+// Called before curl_global_cleanup. The clients left may keep the table alive, so its refresher is
+// stopped here, which would otherwise keep using curl.
+void Qiniu_Rgn_Table_globalCleanup(void)
+{
+	if (Qiniu_Rgn_globalTable) {
+		Qiniu_Rgn_Table_stopRefresher(Qiniu_Rgn_globalTable);
+	} // if
+	Qiniu_Rgn_Table_Destroy(Qiniu_Rgn_globalTable);
+	Qiniu_Rgn_globalTable = NULL;
+} // Qiniu_Rgn_Table_globalCleanup
+
+/*============================================================================*/
+/* The host scores */
+
+// The requests with smaller bodies measure the latency, and the others measure the speed.
+#define QINIU_RGN_SCORE_LARGE_BYTES		(64 * 1024)
+
+// The size in KB of a block whose upload time is expected.
+#define QINIU_RGN_SCORE_BLOCK_KB		(4 * 1024)
+
+// The time in ms charged to a host which always fails, for the retry after a timeout or so.
+#define QINIU_RGN_SCORE_FAILURE_MS		10000
+
+// The error rate of a host is halved every so many seconds without failures, so that a host which
+// is not picked any more for its failures gets tried again.
+#define QINIU_RGN_SCORE_ERROR_HALF_LIFE	60
+
+// A moving average weighing the new sample by 1/8. The first sample is taken as it is, while the
+// error rate starts from 0.
+static Qiniu_Uint32 Qiniu_Rgn_Score_average(Qiniu_Uint32 avg, Qiniu_Uint32 sample)
+{
+	if (avg == 0) {
+		return sample;
+	} // if
+	return (Qiniu_Uint32)(((Qiniu_Uint64)avg * 7 + sample) / 8);
+} // Qiniu_Rgn_Score_average
+
+// The expected time to upload a block to the host behind the requests in flight, including the time
+// wasted by failures. A host without requests yet is charged its connect time if it is probed, and a
+// host never measured costs the least, so it is tried soon.
+static Qiniu_Uint64 Qiniu_Rgn_Score_cost(Qiniu_Rgn_HostInfo * host, Qiniu_Uint64 now)
+{
+	Qiniu_Uint64 cost = Qiniu_Rgn_load(&host->latency);
+	Qiniu_Uint32 throughput = Qiniu_Rgn_load(&host->throughput);
+	Qiniu_Uint32 errorRate = Qiniu_Rgn_load(&host->errorRate);
+	Qiniu_Uint64 quiet = now / 1000 - Qiniu_Rgn_load(&host->failedAt);
+
+	if (cost == 0) {
+		cost = Qiniu_Rgn_load(&host->connectTime);
+	} // if
+	if (throughput > 0) {
+		cost += (Qiniu_Uint64)QINIU_RGN_SCORE_BLOCK_KB * 1000 / throughput;
+	} // if
+	if (errorRate > 0) {
+		errorRate >>= (quiet / QINIU_RGN_SCORE_ERROR_HALF_LIFE < 10) ? quiet / QINIU_RGN_SCORE_ERROR_HALF_LIFE : 10;
+	} // if
+	cost += (Qiniu_Uint64)QINIU_RGN_SCORE_FAILURE_MS * errorRate / 1000;
+	return (cost + 1) * (Qiniu_Rgn_load(&host->inflight) + 1);
+} // Qiniu_Rgn_Score_cost
+
+/*============================================================================*/
+/* The circuit breakers */
+
+// How many consecutive failures open the breaker of a host.
+#define QINIU_RGN_BREAKER_FAILURES			3
+
+// The first cooldown in seconds, which is doubled by every failed trial up to the max one.
+#define QINIU_RGN_BREAKER_COOLDOWN			5
+#define QINIU_RGN_BREAKER_MAX_COOLDOWN		300
+
+// How long in seconds a trial request may take before another one is sent.
+#define QINIU_RGN_BREAKER_TRIAL_TIMEOUT		60
+
+static void Qiniu_Rgn_Breaker_open(Qiniu_Rgn_HostInfo * host, Qiniu_Uint32 cooldown, Qiniu_Uint32 now)
+{
+	Qiniu_Rgn_store(&host->cooldown, cooldown);
+	Qiniu_Rgn_store(&host->openUntil, now + cooldown);
+	Qiniu_Rgn_store(&host->breaker, QINIU_RGN_BREAKER_OPEN);
+} // Qiniu_Rgn_Breaker_open
+
+// Feed the result of a request or a probe to the breaker of the host, at the second now of
+// Qiniu_Tm_MonotonicMs. Like the scores, the breaker is updated without locks.
+static void Qiniu_Rgn_Breaker_report(Qiniu_Rgn_HostInfo * host, Qiniu_Bool failed, Qiniu_Uint32 now)
+{
+	Qiniu_Uint32 cooldown = 0;
+
+	if (!failed) {
+		Qiniu_Rgn_store(&host->failures, 0);
+		if (Qiniu_Rgn_load(&host->breaker) != QINIU_RGN_BREAKER_CLOSED) {
+			Qiniu_Rgn_store(&host->cooldown, 0);
+			Qiniu_Rgn_store(&host->breaker, QINIU_RGN_BREAKER_CLOSED);
+		} // if
+		return;
+	} // if
+
+	if (Qiniu_Rgn_incVote(&host->failures) < QINIU_RGN_BREAKER_FAILURES) {
+		if (Qiniu_Rgn_load(&host->breaker) != QINIU_RGN_BREAKER_HALF_OPEN) {
+			return;
+		} // if
+	} // if
+
+	switch (Qiniu_Rgn_load(&host->breaker)) {
+		case QINIU_RGN_BREAKER_CLOSED:
+			Qiniu_Rgn_Breaker_open(host, QINIU_RGN_BREAKER_COOLDOWN, now);
+			break;
+
+		case QINIU_RGN_BREAKER_HALF_OPEN:
+			cooldown = Qiniu_Rgn_load(&host->cooldown) * 2;
+			if (cooldown < QINIU_RGN_BREAKER_COOLDOWN) {
+				cooldown = QINIU_RGN_BREAKER_COOLDOWN;
+			} else if (cooldown > QINIU_RGN_BREAKER_MAX_COOLDOWN) {
+				cooldown = QINIU_RGN_BREAKER_MAX_COOLDOWN;
+			} // if
+			Qiniu_Rgn_Breaker_open(host, cooldown, now);
+			break;
+
+		default:
+			// Already open, e.g. by the requests sent before it is opened.
+			break;
+	} // switch
+} // Qiniu_Rgn_Breaker_report
+
+// Take the host for the trial request if its breaker is due for one. The trial is claimed by moving
+// the deadline forward, so one thread sends it at a time.
+static Qiniu_Bool Qiniu_Rgn_Breaker_tryTrial(Qiniu_Rgn_HostInfo * host, Qiniu_Uint32 now)
+{
+	Qiniu_Uint32 openUntil = 0;
+
+	if (Qiniu_Rgn_load(&host->breaker) == QINIU_RGN_BREAKER_CLOSED) {
+		return Qiniu_False;
+	} // if
+	openUntil = Qiniu_Rgn_load(&host->openUntil);
+	if (now < openUntil || !Qiniu_Rgn_cas(&host->openUntil, openUntil, now + QINIU_RGN_BREAKER_TRIAL_TIMEOUT)) {
+		return Qiniu_False;
+	} // if
+	Qiniu_Rgn_store(&host->breaker, QINIU_RGN_BREAKER_HALF_OPEN);
+	return Qiniu_True;
+} // Qiniu_Rgn_Breaker_tryTrial
+
+/*============================================================================*/
+
+// Pick the cheaper one of two random hosts with the flags, by the power of two choices. The choices are
+// randomized by a counter of the table scattered by the golden ratio. The hosts whose breakers are open
+// are left out, unless no host is closed, and a host due for a trial is taken before all the others.
+static Qiniu_Rgn_HostInfo ** Qiniu_Rgn_Table_pickHost(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_HostInfo ** hosts, Qiniu_Uint32 hostCount, Qiniu_Uint32 hostFlags, Qiniu_Uint64 now)
+{
+	Qiniu_Uint32 i = 0;
+	Qiniu_Uint32 n = 0;
+	Qiniu_Uint32 closed = 0;
+	Qiniu_Uint32 first = 0;
+	Qiniu_Uint32 second = 0;
+	Qiniu_Uint32 r = 0;
+	Qiniu_Bool closedOnly = Qiniu_False;
+	Qiniu_Rgn_HostInfo ** a = NULL;
+	Qiniu_Rgn_HostInfo ** b = NULL;
+	Qiniu_Rgn_HostInfo ** any = NULL;
+
+	for (i = 0; i < hostCount; i += 1) {
+		if ((hosts[i]->flags & hostFlags) == hostFlags) {
+			if (!any) {
+				any = &hosts[i];
+			} // if
+			if (Qiniu_Rgn_Breaker_tryTrial(hosts[i], (Qiniu_Uint32)(now / 1000))) {
+				return &hosts[i];
+			} // if
+			if (Qiniu_Rgn_load(&hosts[i]->breaker) == QINIU_RGN_BREAKER_CLOSED) {
+				closed += 1;
+			} // if
+			n += 1;
+		} // if
+	} // for
+	if (n == 0) {
+		return NULL;
+	} // if
+	if (closed > 0) {
+		closedOnly = Qiniu_True;
+		n = closed;
+	} // if
+
+	r = (Qiniu_Uint32)Qiniu_Count_Inc(&rgnTable->picks) * 2654435761U;
+	first = (r >> 16) % n;
+	if (n > 1) {
+		second = (r & 0xFFFF) % (n - 1);
+		if (second >= first) {
+			second += 1;
+		} // if
+	} else {
+		second = first;
+	} // if
+
+	for (i = 0; i < hostCount; i += 1) {
+		if ((hosts[i]->flags & hostFlags) == hostFlags) {
+			if (closedOnly && Qiniu_Rgn_load(&hosts[i]->breaker) != QINIU_RGN_BREAKER_CLOSED) {
+				continue;
+			} // if
+			if (first-- == 0) {
+				a = &hosts[i];
+			} // if
+			if (second-- == 0) {
+				b = &hosts[i];
+			} // if
+		} // if
+	} // for
+
+	// A breaker may be opened meanwhile by another thread, which leaves a choice out.
+	if (!a) {
+		a = (b) ? b : any;
+	} // if
+	if (!b) {
+		b = a;
+	} // if
+	return (Qiniu_Rgn_Score_cost(*b, now) < Qiniu_Rgn_Score_cost(*a, now)) ? b : a;
+} // Qiniu_Rgn_Table_pickHost
+
+static void Qiniu_Rgn_Score_inheritHosts(Qiniu_Rgn_HostInfo ** hosts, Qiniu_Uint32 hostCount, Qiniu_Rgn_HostInfo ** oldHosts, Qiniu_Uint32 oldHostCount)
+{
+	Qiniu_Uint32 i = 0;
+	Qiniu_Uint32 j = 0;
+	Qiniu_Rgn_HostInfo * host = NULL;
+	Qiniu_Rgn_HostInfo * oldHost = NULL;
+
+	for (i = 0; i < hostCount; i += 1) {
+		host = hosts[i];
+		for (j = 0; j < oldHostCount; j += 1) {
+			oldHost = oldHosts[j];
+			if (oldHost->flags == host->flags && strcmp(oldHost->host, host->host) == 0) {
+				host->voteCount = Qiniu_Rgn_load(&oldHost->voteCount);
+				host->latency = Qiniu_Rgn_load(&oldHost->latency);
+				host->throughput = Qiniu_Rgn_load(&oldHost->throughput);
+				host->errorRate = Qiniu_Rgn_load(&oldHost->errorRate);
+				host->failedAt = Qiniu_Rgn_load(&oldHost->failedAt);
+				host->failures = Qiniu_Rgn_load(&oldHost->failures);
+				host->breaker = Qiniu_Rgn_load(&oldHost->breaker);
+				host->cooldown = Qiniu_Rgn_load(&oldHost->cooldown);
+				host->openUntil = Qiniu_Rgn_load(&oldHost->openUntil);
+				host->connectTime = Qiniu_Rgn_load(&oldHost->connectTime);
+				break;
+			} // if
+		} // for
+	} // for
+} // Qiniu_Rgn_Score_inheritHosts
+
+// Carry the scores and the breakers of the hosts over to the refreshed region. Called with the mutex held.
+static void Qiniu_Rgn_Score_inherit(Qiniu_Rgn_RegionInfo * rgnInfo, Qiniu_Rgn_RegionInfo * oldRgnInfo)
+{
+	Qiniu_Rgn_Score_inheritHosts(rgnInfo->upHosts, rgnInfo->upHostCount, oldRgnInfo->upHosts, oldRgnInfo->upHostCount);
+	Qiniu_Rgn_Score_inheritHosts(rgnInfo->ioHosts, rgnInfo->ioHostCount, oldRgnInfo->ioHosts, oldRgnInfo->ioHostCount);
+} // Qiniu_Rgn_Score_inherit
+
+/*============================================================================*/
+/* The cache file */
+
+// The cache file is a JSON object keyed by the buckets. Each entry is in the form of the response of
+// the UC query, plus the time when it expires. It is replaced with a temporary file as a whole, so
+// the processes sharing it never read a partial file.
+
+QINIU_DLLAPI extern void Qiniu_Rgn_Table_SetCacheFile(Qiniu_Rgn_RegionTable * rgnTable, const char * cacheFile)
+{
+	Qiniu_Mutex_Lock(&rgnTable->mutex);
+	free(rgnTable->cacheFile);
+	rgnTable->cacheFile = (cacheFile) ? Qiniu_String_Dup(cacheFile) : NULL;
+	Qiniu_Mutex_Unlock(&rgnTable->mutex);
+} // Qiniu_Rgn_Table_SetCacheFile
+
+static Qiniu_Json * Qiniu_Rgn_Cache_read(const char * cacheFile)
+{
+	FILE * fp = NULL;
+	Qiniu_Json * root = NULL;
+	Qiniu_Buffer text;
+	char buf[4096];
+	size_t n = 0;
+
+	fp = fopen(cacheFile, "rb");
+	if (!fp) {
+		return NULL;
+	} // if
+
+	Qiniu_Buffer_Init(&text, sizeof(buf));
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		Qiniu_Buffer_Write(&text, buf, n);
+	} // while
+	fclose(fp);
+
+	root = cJSON_Parse(Qiniu_Buffer_CStr(&text));
+	Qiniu_Buffer_Cleanup(&text);
+	if (root && root->type != cJSON_Object) {
+		cJSON_Delete(root);
+		return NULL;
+	} // if
+	return root;
+} // Qiniu_Rgn_Cache_read
+
+static void Qiniu_Rgn_Cache_addHosts(Qiniu_Json * http, Qiniu_Json * https, const char * name, Qiniu_Rgn_HostInfo ** hosts, Qiniu_Uint32 hostCount)
+{
+	Qiniu_Uint32 i = 0;
+	Qiniu_Json * httpHosts = cJSON_CreateArray();
+	Qiniu_Json * httpsHosts = cJSON_CreateArray();
+
+	for (i = 0; i < hostCount; i += 1) {
+		cJSON_AddItemToArray((hosts[i]->flags & QINIU_RGN_HTTPS_HOST) ? httpsHosts : httpHosts, cJSON_CreateString(hosts[i]->host));
+	} // for
+	cJSON_AddItemToObject(http, name, httpHosts);
+	cJSON_AddItemToObject(https, name, httpsHosts);
+} // Qiniu_Rgn_Cache_addHosts
+
+static Qiniu_Json * Qiniu_Rgn_Cache_makeEntry(Qiniu_Rgn_RegionInfo * rgnInfo)
+{
+	Qiniu_Json * entry = cJSON_CreateObject();
+	Qiniu_Json * http = cJSON_CreateObject();
+	Qiniu_Json * https = cJSON_CreateObject();
+
+	Qiniu_Rgn_Cache_addHosts(http, https, "up", rgnInfo->upHosts, rgnInfo->upHostCount);
+	Qiniu_Rgn_Cache_addHosts(http, https, "io", rgnInfo->ioHosts, rgnInfo->ioHostCount);
+	cJSON_AddItemToObject(entry, "http", http);
+	cJSON_AddItemToObject(entry, "https", https);
+	cJSON_AddItemToObject(entry, "ttl", cJSON_CreateNumber((double)rgnInfo->ttl));
+	cJSON_AddItemToObject(entry, "global", cJSON_CreateBool((int)rgnInfo->global));
+	cJSON_AddItemToObject(entry, "deadline", cJSON_CreateNumber((double)rgnInfo->nextTimestampToUpdate));
+	return entry;
+} // Qiniu_Rgn_Cache_makeEntry
+
+static int Qiniu_Rgn_Cache_rename(const char * from, const char * to)
+{
+#if defined(_WIN32)
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+	return rename(from, to);
+#endif
+} // Qiniu_Rgn_Cache_rename
+
+// Return the unexpired region of the bucket kept in the cache file, or NULL.
+static Qiniu_Rgn_RegionInfo * Qiniu_Rgn_Table_loadCache(Qiniu_Rgn_RegionTable * rgnTable, const char * bucket)
+{
+	Qiniu_Error err;
+	Qiniu_Json * root = NULL;
+	Qiniu_Json * entry = NULL;
+	Qiniu_Rgn_RegionInfo * rgnInfo = NULL;
+	Qiniu_Uint64 deadline = 0;
+
+	Qiniu_Mutex_Lock(&rgnTable->mutex);
+	if (rgnTable->cacheFile) {
+		root = Qiniu_Rgn_Cache_read(rgnTable->cacheFile);
+	} // if
+	Qiniu_Mutex_Unlock(&rgnTable->mutex);
+	if (!root) {
+		return NULL;
+	} // if
+
+	entry = Qiniu_Json_GetObjectItem(root, bucket, NULL);
+	deadline = (Qiniu_Uint64)Qiniu_Json_GetInt64(entry, "deadline", 0);
+	if (entry && deadline > Qiniu_Tm_LocalTime()) {
+		err = Qiniu_Rgn_Info_parse(entry, &rgnInfo, bucket);
+		if (err.code == 200) {
+			if (rgnInfo->upHostCount == 0) {
+				Qiniu_Rgn_Info_Destroy(rgnInfo);
+				rgnInfo = NULL;
+			} else {
+				rgnInfo->nextTimestampToUpdate = deadline;
+			} // if
+		} // if
+	} // if
+	cJSON_Delete(root);
+	return rgnInfo;
+} // Qiniu_Rgn_Table_loadCache
+
+// Merge the region into the cache file, and drop the expired entries of it. Failures are ignored,
+// since the file only saves the queries of later processes.
+static void Qiniu_Rgn_Table_saveCache(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_RegionInfo * rgnInfo)
+{
+	Qiniu_Json * root = NULL;
+	Qiniu_Json * item = NULL;
+	Qiniu_Json * next = NULL;
+	Qiniu_Uint64 now = Qiniu_Tm_LocalTime();
+	FILE * fp = NULL;
+	char * text = NULL;
+	char * tmpFile = NULL;
+	size_t len = 0;
+	int i = 0;
+
+	Qiniu_Mutex_Lock(&rgnTable->mutex);
+	if (!rgnTable->cacheFile) {
+		Qiniu_Mutex_Unlock(&rgnTable->mutex);
+		return;
+	} // if
+
+	root = Qiniu_Rgn_Cache_read(rgnTable->cacheFile);
+	if (!root) {
+		root = cJSON_CreateObject();
+	} // if
+
+	for (item = root->child; item; item = next) {
+		next = item->next;
+		if ((Qiniu_Uint64)Qiniu_Json_GetInt64(item, "deadline", 0) <= now || strcmp(item->string, rgnInfo->bucket) == 0) {
+			cJSON_DeleteItemFromArray(root, i);
+		} else {
+			i += 1;
+		} // if
+	} // for
+	cJSON_AddItemToObject(root, rgnInfo->bucket, Qiniu_Rgn_Cache_makeEntry(rgnInfo));
+
+	text = cJSON_PrintUnformatted(root);
+	cJSON_Delete(root);
+
+	tmpFile = Qiniu_String_Format(256, "%s.%d.tmp", rgnTable->cacheFile, (int)Qiniu_Rgn_getpid());
+	fp = fopen(tmpFile, "wb");
+	if (fp) {
+		len = strlen(text);
+		if (fwrite(text, 1, len, fp) != len) {
+			fclose(fp);
+			remove(tmpFile);
+		} else if (fclose(fp) != 0 || Qiniu_Rgn_Cache_rename(tmpFile, rgnTable->cacheFile) != 0) {
+			remove(tmpFile);
+		} // if
+	} // if
+	Qiniu_Mutex_Unlock(&rgnTable->mutex);
+
+	free(tmpFile);
+	free(text);
+} // Qiniu_Rgn_Table_saveCache
+
+/*============================================================================*/
+/* The refresher */
+
+static void Qiniu_Rgn_Table_refresh(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_RefreshJob * job)
+{
+	Qiniu_Error err;
+	Qiniu_Rgn_RegionInfo * newRgnInfo = NULL;
+	Qiniu_Rgn_TableNode * node = NULL;
+
+	err = Qiniu_Rgn_Info_Fetch(&rgnTable->refreshCli, &newRgnInfo, job->bucket, job->accessKey);
+	if (err.code == 200) {
+		// Hold the region before it is published, since another refresh may replace it at once.
+		newRgnInfo->refCount = 1;
+		err = Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRgnInfo);
+		if (err.code != 200) {
+			Qiniu_Rgn_Info_Destroy(newRgnInfo);
+		} else {
+			Qiniu_Rgn_Table_saveCache(rgnTable, newRgnInfo);
+			Qiniu_Rgn_Table_dropRegion(newRgnInfo);
+		} // if
+	} // if
+	if (err.code != 200) {
+		Qiniu_Log_Warn("region: refresh %s failed - %E", job->bucket, err);
+	} // if
+
+	Qiniu_Mutex_Lock(&rgnTable->mutex);
+	node = Qiniu_Rgn_Table_findNode(rgnTable->index, job->bucket, Qiniu_Rgn_Table_hash(job->bucket));
+	if (node) {
+		if (err.code != 200) {
+			Qiniu_Rgn_store(&node->retryAt, Qiniu_Tm_LocalTime() + QINIU_RGN_REFRESH_RETRY_INTERVAL);
+		} // if
+		Qiniu_Rgn_store(&node->refreshing, 0);
+	} // if
+	Qiniu_Mutex_Unlock(&rgnTable->mutex);
+} // Qiniu_Rgn_Table_refresh
+
+// How long in ms a probe waits for the connection, which then counts as a failure.
+#define QINIU_RGN_PROBE_TIMEOUT		3000
+
+typedef struct _Qiniu_Rgn_ProbeResult {
+	const char * host;
+	CURL * curl;
+	Qiniu_Bool done;
+	Qiniu_Bool failed;
+	Qiniu_Uint32 connectTime;
+} Qiniu_Rgn_ProbeResult;
+
+static Qiniu_Rgn_ProbeResult * Qiniu_Rgn_Probe_find(Qiniu_Buffer * results, const char * host)
+{
+	Qiniu_Rgn_ProbeResult * items = (Qiniu_Rgn_ProbeResult *)results->buf;
+	size_t count = Qiniu_Buffer_Len(results) / sizeof(Qiniu_Rgn_ProbeResult);
+	size_t i = 0;
+
+	for (i = 0; i < count; i += 1) {
+		if (strcmp(items[i].host, host) == 0) {
+			return &items[i];
+		} // if
+	} // for
+	return NULL;
+} // Qiniu_Rgn_Probe_find
+
+// Add the hosts to the results, which are probed once a round even if they are shared by the regions
+// of several buckets.
+static void Qiniu_Rgn_Probe_addHosts(Qiniu_Buffer * results, Qiniu_Rgn_HostInfo ** hosts, Qiniu_Uint32 hostCount)
+{
+	Qiniu_Rgn_ProbeResult * found = NULL;
+	Qiniu_Rgn_ProbeResult newResult;
+	Qiniu_Uint32 i = 0;
+
+	for (i = 0; i < hostCount; i += 1) {
+		found = Qiniu_Rgn_Probe_find(results, hosts[i]->host);
+		if (!found) {
+			memset(&newResult, 0, sizeof(newResult));
+			newResult.host = hosts[i]->host;
+			Qiniu_Buffer_Write(results, &newResult, sizeof(newResult));
+		} // if
+	} // for
+} // Qiniu_Rgn_Probe_addHosts
+
+// Start connecting to the host without sending a request.
+static CURL * Qiniu_Rgn_Probe_start(Qiniu_Rgn_RegionTable * rgnTable, CURLM * multi, const char * host)
+{
+	CURL * curl = curl_easy_init();
+
+	if (!curl) {
+		return NULL;
+	} // if
+	curl_easy_setopt(curl, CURLOPT_URL, host);
+	curl_easy_setopt(curl, CURLOPT_CONNECT_ONLY, 1L);
+	curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, 1L);
+	curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long)QINIU_RGN_PROBE_TIMEOUT);
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+	if (rgnTable->refreshCli.boundNic != NULL) {
+		curl_easy_setopt(curl, CURLOPT_INTERFACE, rgnTable->refreshCli.boundNic);
+	} // if
+	if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+		curl_easy_cleanup(curl);
+		return NULL;
+	} // if
+	return curl;
+} // Qiniu_Rgn_Probe_start
+
+// Connect to all hosts at the same time, so that a round takes no longer than one timeout however
+// many hosts are down, and the refresher is not kept from the queued refreshes for long. The time to
+// connect includes the TLS handshake for https. A host which can not be probed for lack of memory is
+// left out.
+static void Qiniu_Rgn_Probe_connect(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_ProbeResult * results, size_t count)
+{
+	CURLM * multi = curl_multi_init();
+	CURLMsg * msg = NULL;
+	double seconds = 0;
+	int running = 0;
+	int numfds = 0;
+	int left = 0;
+	size_t i = 0;
+
+	if (!multi) {
+		return;
+	} // if
+	for (i = 0; i < count; i += 1) {
+		results[i].curl = Qiniu_Rgn_Probe_start(rgnTable, multi, results[i].host);
+	} // for
+
+	do {
+		curl_multi_perform(multi, &running);
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			} // if
+			for (i = 0; i < count && results[i].curl != msg->easy_handle; i += 1) {
+			} // for
+			if (i == count) {
+				continue;
+			} // if
+			results[i].done = Qiniu_True;
+			results[i].failed = (msg->data.result != CURLE_OK);
+			if (!results[i].failed) {
+				seconds = 0;
+				if (curl_easy_getinfo(results[i].curl, CURLINFO_APPCONNECT_TIME, &seconds) != CURLE_OK || seconds <= 0) {
+					curl_easy_getinfo(results[i].curl, CURLINFO_CONNECT_TIME, &seconds);
+				} // if
+				results[i].connectTime = (Qiniu_Uint32)(seconds * 1000) + 1;
+			} // if
+		} // while
+		if (running > 0) {
+			curl_multi_wait(multi, NULL, 0, 100, &numfds);
+		} // if
+	} while (running > 0);
+
+	for (i = 0; i < count; i += 1) {
+		if (results[i].curl) {
+			curl_multi_remove_handle(multi, results[i].curl);
+			curl_easy_cleanup(results[i].curl);
+			results[i].curl = NULL;
+		} // if
+	} // for
+	curl_multi_cleanup(multi);
+} // Qiniu_Rgn_Probe_connect
+
+static void Qiniu_Rgn_Probe_report(Qiniu_Buffer * results, Qiniu_Rgn_HostInfo ** hosts, Qiniu_Uint32 hostCount)
+{
+	Qiniu_Uint32 i = 0;
+	Qiniu_Uint64 now = Qiniu_Tm_MonotonicMs();
+	Qiniu_Rgn_HostInfo * host = NULL;
+	Qiniu_Rgn_ProbeResult * result = NULL;
+
+	for (i = 0; i < hostCount; i += 1) {
+		host = hosts[i];
+		result = Qiniu_Rgn_Probe_find(results, host->host);
+		if (!result || !result->done) {
+			continue;
+		} // if
+		if (result->failed) {
+			Qiniu_Rgn_Breaker_report(host, Qiniu_True, (Qiniu_Uint32)(now / 1000));
+			continue;
+		} // if
+
+		Qiniu_Rgn_store(&host->connectTime, Qiniu_Rgn_Score_average(Qiniu_Rgn_load(&host->connectTime), result->connectTime));
+		if (Qiniu_Rgn_load(&host->breaker) == QINIU_RGN_BREAKER_OPEN) {
+			// The host is back, so a trial request may be sent right now instead of after the cooldown.
+			Qiniu_Rgn_store(&host->openUntil, (Qiniu_Uint32)(now / 1000));
+		} // if
+	} // for
+} // Qiniu_Rgn_Probe_report
+
+// Probe the hosts of all regions in the table once. The regions are held during the round, so that
+// their hosts are not freed by the refreshes meanwhile.
+static void Qiniu_Rgn_Table_probe(Qiniu_Rgn_RegionTable * rgnTable)
+{
+	Qiniu_Rgn_TableIndex * index = Qiniu_Rgn_load(&rgnTable->index);
+	Qiniu_Rgn_TableNode * node = NULL;
+	Qiniu_Rgn_RegionInfo * rgnInfo = NULL;
+	Qiniu_Rgn_RegionInfo ** held = NULL;
+	Qiniu_Buffer regions;
+	Qiniu_Buffer results;
+	size_t count = 0;
+	size_t i = 0;
+
+	Qiniu_Buffer_Init(&regions, sizeof(Qiniu_Rgn_RegionInfo *) * 8);
+	Qiniu_Buffer_Init(&results, sizeof(Qiniu_Rgn_ProbeResult) * 8);
+	for (i = 0; i < index->slotCount; i += 1) {
+		for (node = Qiniu_Rgn_load(&index->slots[i]); node; node = node->next) {
+			Qiniu_Count_Inc(&rgnTable->readers);
+			rgnInfo = Qiniu_Rgn_load(&node->rgnInfo);
+			Qiniu_Count_Inc(&rgnInfo->refCount);
+			Qiniu_Count_Dec(&rgnTable->readers);
+
+			Qiniu_Buffer_Write(&regions, &rgnInfo, sizeof(rgnInfo));
+			Qiniu_Rgn_Probe_addHosts(&results, rgnInfo->upHosts, rgnInfo->upHostCount);
+			Qiniu_Rgn_Probe_addHosts(&results, rgnInfo->ioHosts, rgnInfo->ioHostCount);
+		} // for
+	} // for
+
+	Qiniu_Rgn_Probe_connect(rgnTable, (Qiniu_Rgn_ProbeResult *)results.buf, Qiniu_Buffer_Len(&results) / sizeof(Qiniu_Rgn_ProbeResult));
+
+	held = (Qiniu_Rgn_RegionInfo **)regions.buf;
+	count = Qiniu_Buffer_Len(&regions) / sizeof(Qiniu_Rgn_RegionInfo *);
+	for (i = 0; i < count; i += 1) {
+		Qiniu_Rgn_Probe_report(&results, held[i]->upHosts, held[i]->upHostCount);
+		Qiniu_Rgn_Probe_report(&results, held[i]->ioHosts, held[i]->ioHostCount);
+		Qiniu_Rgn_Table_dropRegion(held[i]);
+	} // for
+	Qiniu_Buffer_Cleanup(&results);
+	Qiniu_Buffer_Cleanup(&regions);
+} // Qiniu_Rgn_Table_probe
+
+static void Qiniu_Rgn_Table_runRefresher(void * params)
+{
+	Qiniu_Rgn_RegionTable * rgnTable = (Qiniu_Rgn_RegionTable *)params;
+	Qiniu_Rgn_RefreshJob * job = NULL;
+	Qiniu_Uint64 now = 0;
+
+	Qiniu_Mutex_Lock(&rgnTable->mutex);
+	for (;;) {
+		while (!rgnTable->jobs && !rgnTable->stopping) {
+			if (rgnTable->probeInterval <= 0) {
+				Qiniu_Cond_Wait(&rgnTable->cond, &rgnTable->mutex);
+				continue;
+			} // if
+			now = Qiniu_Tm_MonotonicMs();
+			if (now >= rgnTable->nextProbeAt) {
+				break;
+			} // if
+			Qiniu_Cond_TimedWait(&rgnTable->cond, &rgnTable->mutex, (int)(rgnTable->nextProbeAt - now));
+		} // while
+		if (rgnTable->stopping) {
+			break;
+		} // if
+
+		if (!rgnTable->jobs) {
+			rgnTable->nextProbeAt = now + (Qiniu_Uint64)rgnTable->probeInterval * 1000;
+			Qiniu_Mutex_Unlock(&rgnTable->mutex);
+
+			Qiniu_Rgn_Table_probe(rgnTable);
+
+			Qiniu_Mutex_Lock(&rgnTable->mutex);
+			continue;
+		} // if
+
+		job = rgnTable->jobs;
+		rgnTable->jobs = job->next;
+		if (!rgnTable->jobs) {
+			rgnTable->lastJob = &rgnTable->jobs;
+		} // if
+		Qiniu_Mutex_Unlock(&rgnTable->mutex);
+
+		Qiniu_Rgn_Table_refresh(rgnTable, job);
+		free(job->bucket);
+		free(job->accessKey);
+		free(job);
+
+		Qiniu_Mutex_Lock(&rgnTable->mutex);
+	} // for
+	Qiniu_Mutex_Unlock(&rgnTable->mutex);
+} // Qiniu_Rgn_Table_runRefresher
+
+// Start the refresher unless it is running. Called with the mutex held.
+static Qiniu_Bool Qiniu_Rgn_Table_startRefresher(Qiniu_Rgn_RegionTable * rgnTable)
+{
+	if (rgnTable->refresherStarted) {
+		return Qiniu_True;
+	} // if
+	if (rgnTable->stopping) {
+		return Qiniu_False;
+	} // if
+
+	// The refresher must not keep the table alive, so the client gives up its region table.
+	Qiniu_Client_InitNoAuth(&rgnTable->refreshCli, 1024);
+	Qiniu_Rgn_Table_Destroy(rgnTable->refreshCli.regionTable);
+	rgnTable->refreshCli.regionTable = NULL;
+
+	if (Qiniu_Thread_Create(&rgnTable->refresher, Qiniu_Rgn_Table_runRefresher, rgnTable) != 0) {
+		Qiniu_Client_Cleanup(&rgnTable->refreshCli);
+		return Qiniu_False;
+	} // if
+	rgnTable->refresherStarted = Qiniu_True;
+	return Qiniu_True;
+} // Qiniu_Rgn_Table_startRefresher
+
+// Queue the region of the node to be refreshed, unless it is being refreshed already or the last try
+// failed lately. Return false only if the refresh can not be queued.
+static Qiniu_Bool Qiniu_Rgn_Table_refreshLater(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_TableNode * node, const char * bucket, const char * accessKey, Qiniu_Uint64 now)
+{
+	Qiniu_Rgn_RefreshJob * job = NULL;
+
+	if (Qiniu_Rgn_load(&node->refreshing) || now < Qiniu_Rgn_load(&node->retryAt) || !Qiniu_Rgn_claim(&node->refreshing)) {
+		return Qiniu_True;
+	} // if
+
+	job = calloc(1, sizeof(Qiniu_Rgn_RefreshJob));
+	if (!job) {
+		Qiniu_Rgn_store(&node->refreshing, 0);
+		return Qiniu_False;
+	} // if
+	job->bucket = Qiniu_String_Dup(bucket);
+	job->accessKey = (accessKey) ? Qiniu_String_Dup(accessKey) : NULL;
+
+	Qiniu_Mutex_Lock(&rgnTable->mutex);
+	if (!Qiniu_Rgn_Table_startRefresher(rgnTable)) {
+		Qiniu_Mutex_Unlock(&rgnTable->mutex);
+		free(job->bucket);
+		free(job->accessKey);
+		free(job);
+		Qiniu_Rgn_store(&node->refreshing, 0);
+		return Qiniu_False;
+	} // if
+	*rgnTable->lastJob = job;
+	rgnTable->lastJob = &job->next;
+	Qiniu_Cond_Signal(&rgnTable->cond);
+	Qiniu_Mutex_Unlock(&rgnTable->mutex);
+	return Qiniu_True;
+} // Qiniu_Rgn_Table_refreshLater
+
+QINIU_DLLAPI extern void Qiniu_Rgn_Table_SetProbeInterval(Qiniu_Rgn_RegionTable * rgnTable, int seconds)
+{
+	Qiniu_Mutex_Lock(&rgnTable->mutex);
+	rgnTable->probeInterval = (seconds > 0) ? seconds : 0;
+	rgnTable->nextProbeAt = 0;
+	if (rgnTable->probeInterval > 0 && !Qiniu_Rgn_Table_startRefresher(rgnTable)) {
+		Qiniu_Log_Warn("region: failed to start the prober");
+		rgnTable->probeInterval = 0;
+	} // if
+	Qiniu_Cond_Signal(&rgnTable->cond);
+	Qiniu_Mutex_Unlock(&rgnTable->mutex);
+} // Qiniu_Rgn_Table_SetProbeInterval
+
+/*============================================================================*/
+
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_FetchAndUpdate(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Client * cli, const char * bucket, const char * accessKey)
 {
 	Qiniu_Error err;
@@ -363,7 +1514,16 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_FetchAndUpdate(Qiniu_Rgn_RegionT
 		return err;
 	} // if
 
-	return Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRgnInfo);
+	newRgnInfo->refCount = 1;
+	err = Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRgnInfo);
+	if (err.code != 200) {
+		Qiniu_Rgn_Info_Destroy(newRgnInfo);
+		return err;
+	} // if
+
+	Qiniu_Rgn_Table_saveCache(rgnTable, newRgnInfo);
+	Qiniu_Rgn_Table_dropRegion(newRgnInfo);
+	return Qiniu_OK;
 } // Qiniu_Rgn_Table_FetchAndUpdate
 
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_FetchAndUpdateByUptoken(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Client * cli, const char * uptoken)
@@ -376,53 +1536,82 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_FetchAndUpdateByUptoken(Qiniu_Rg
 		return err;
 	} // if
 
-	return Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRgnInfo);
+	newRgnInfo->refCount = 1;
+	err = Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRgnInfo);
+	if (err.code != 200) {
+		Qiniu_Rgn_Info_Destroy(newRgnInfo);
+		return err;
+	} // if
+
+	Qiniu_Rgn_Table_saveCache(rgnTable, newRgnInfo);
+	Qiniu_Rgn_Table_dropRegion(newRgnInfo);
+	return Qiniu_OK;
 } // Qiniu_Rgn_Table_FetchAndUpdateByUptoken
 
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_SetRegionInfo(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_RegionInfo * rgnInfo)
 {
 	Qiniu_Error err;
-	Qiniu_Uint32 i = 0;
-	Qiniu_Rgn_RegionInfo ** newRegions = NULL;
+	Qiniu_Uint32 hash = Qiniu_Rgn_Table_hash(rgnInfo->bucket);
+	Qiniu_Rgn_TableIndex * index = NULL;
+	Qiniu_Rgn_TableIndex * newIndex = NULL;
+	Qiniu_Rgn_TableNode * node = NULL;
+	Qiniu_Rgn_RegionInfo * oldRgnInfo = NULL;
+
+	Qiniu_Mutex_Lock(&rgnTable->mutex);
+
+	index = rgnTable->index;
+	node = Qiniu_Rgn_Table_findNode(index, rgnInfo->bucket, hash);
+	if (node) {
+		oldRgnInfo = node->rgnInfo;
+		if (oldRgnInfo != rgnInfo) {
+			Qiniu_Rgn_Score_inherit(rgnInfo, oldRgnInfo);
+			Qiniu_Rgn_store(&node->rgnInfo, rgnInfo);
+			Qiniu_Buffer_Write(&rgnTable->retired, &oldRgnInfo, sizeof(oldRgnInfo));
+			Qiniu_Rgn_Table_reclaim(rgnTable);
+		} // if
+		Qiniu_Mutex_Unlock(&rgnTable->mutex);
+		return Qiniu_OK;
+	} // if
 
-	for (i = 0; i < rgnTable->rgnCount; i += 1) {
-		if (strcmp(rgnTable->regions[i]->bucket, rgnInfo->bucket) == 0) {
-			Qiniu_Rgn_Info_Destroy(rgnTable->regions[i]);
-			rgnTable->regions[i] = rgnInfo;
-			return Qiniu_OK;
+	if (index->rgnCount >= index->slotCount * 2) {
+		// Keep using the full index if there is no memory to grow it.
+		newIndex = Qiniu_Rgn_Table_growIndex(index);
+		if (newIndex) {
+			Qiniu_Rgn_store(&rgnTable->index, newIndex);
+			index = newIndex;
 		} // if
-	} // for
+	} // if
 
-	newRegions = calloc(1, sizeof(Qiniu_Rgn_RegionInfo *) * rgnTable->rgnCount + 1);
-	if (!newRegions) {
+	node = Qiniu_Rgn_Table_newNode(index, hash, rgnInfo);
+	if (!node) {
+		Qiniu_Mutex_Unlock(&rgnTable->mutex);
 		err.code = 499;
 		err.message = "No enough memory";
 		return err;
 	} // if
+	Qiniu_Rgn_store(&index->slots[hash % index->slotCount], node);
+	index->rgnCount += 1;
 
-	if (rgnTable->rgnCount > 0) {
-		memcpy(newRegions, rgnTable->regions, sizeof(Qiniu_Rgn_RegionInfo *) * rgnTable->rgnCount);
-	} // if
-	newRegions[rgnTable->rgnCount] = rgnInfo;
-
-	free(rgnTable->regions);
-	rgnTable->regions = newRegions;
-	rgnTable->rgnCount += 1;
-	
+	Qiniu_Mutex_Unlock(&rgnTable->mutex);
 	return Qiniu_OK;
 } // Qiniu_Rgn_Table_SetRegionInfo
 
 QINIU_DLLAPI extern Qiniu_Rgn_RegionInfo * Qiniu_Rgn_Table_GetRegionInfo(Qiniu_Rgn_RegionTable * rgnTable, const char * bucket)
 {
-	Qiniu_Uint32 i = 0;
-	for (i = 0; i < rgnTable->rgnCount; i += 1) {
-		if (strcmp(rgnTable->regions[i]->bucket, bucket) == 0) {
-			return rgnTable->regions[i];
-		} // if
-	} // for
-	return NULL;
+	Qiniu_Rgn_RegionInfo * rgnInfo = NULL;
+
+	Qiniu_Rgn_Table_holdRegion(rgnTable, bucket, &rgnInfo);
+	return rgnInfo;
 } // Qiniu_Rgn_Table_GetRegionInfo
 
+QINIU_DLLAPI extern void Qiniu_Rgn_Table_ReleaseRegionInfo(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_RegionInfo * rgnInfo)
+{
+	if (!rgnInfo) {
+		return;
+	} // if
+	Qiniu_Rgn_Table_dropRegion(rgnInfo);
+} // Qiniu_Rgn_Table_ReleaseRegionInfo
+
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_GetHost(
 	Qiniu_Rgn_RegionTable * rgnTable,
 	Qiniu_Client * cli,
@@ -435,38 +1624,186 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_GetHost(
 	Qiniu_Error err;
 	Qiniu_Rgn_RegionInfo * rgnInfo = NULL;
 	Qiniu_Rgn_RegionInfo * newRgnInfo = NULL;
+	Qiniu_Rgn_TableNode * node = NULL;
+	Qiniu_Uint64 now = Qiniu_Tm_LocalTime();
+	Qiniu_Bool queued = Qiniu_False;
+	Qiniu_Rgn_HostInfo ** host = NULL;
+	Qiniu_Rgn_HostInfo ** hosts = NULL;
+	Qiniu_Uint32 hostCount = 0;
+	int fetched = 0;
 
-	memset(vote, 0, sizeof(Qiniu_Rgn_HostVote));
-	rgnInfo = Qiniu_Rgn_Table_GetRegionInfo(rgnTable, bucket);
-	if (!rgnInfo || Qiniu_Rgn_Info_HasExpirated(rgnInfo)) {
-		err = Qiniu_Rgn_Info_Fetch(cli, &newRgnInfo, bucket, accessKey);
-		if (err.code != 200) {
-			return err;
+	if (vote) {
+		memset(vote, 0, sizeof(Qiniu_Rgn_HostVote));
+	} // if
+	// The region is held until the picked host is voted or released, or until the host is picked if
+	// there is no vote.
+	node = Qiniu_Rgn_Table_holdRegion(rgnTable, bucket, &rgnInfo);
+	if (rgnInfo && now + rgnInfo->ttl / 10 >= rgnInfo->nextTimestampToUpdate) {
+		// Renew the region in the last tenth of its ttl in the background, and keep using it meanwhile.
+		// An expired region is used for at most another ttl while the refreshes are failing.
+		queued = Qiniu_Rgn_Table_refreshLater(rgnTable, node, bucket, accessKey, now);
+		if (now >= rgnInfo->nextTimestampToUpdate && (!queued || now >= rgnInfo->nextTimestampToUpdate + rgnInfo->ttl)) {
+			Qiniu_Rgn_Table_dropRegion(rgnInfo);
+			rgnInfo = NULL;
+		} // if
+	} // if
+	if (!rgnInfo) {
+		// Another process may have queried the bucket lately.
+		newRgnInfo = Qiniu_Rgn_Table_loadCache(rgnTable, bucket);
+		if (!newRgnInfo) {
+			err = Qiniu_Rgn_Info_Fetch(cli, &newRgnInfo, bucket, accessKey);
+			if (err.code != 200) {
+				return err;
+			} // if
+			fetched = 1;
 		} // if
 
+		// Hold the region before it is published, since a refresh may replace it at once.
+		newRgnInfo->refCount = 1;
 		err = Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRgnInfo);
 		if (err.code != 200) {
+			Qiniu_Rgn_Info_Destroy(newRgnInfo);
 			return err;
 		} // if
 
+		if (fetched) {
+			Qiniu_Rgn_Table_saveCache(rgnTable, newRgnInfo);
+		} // if
 		rgnInfo = newRgnInfo;
 	} // if
 
 	if ((hostFlags & QINIU_RGN_HTTPS_HOST) == 0) {
 		hostFlags |= QINIU_RGN_HTTP_HOST;
 	} // if
-	*upHost = Qiniu_Rgn_Info_GetHost(rgnInfo, 0, hostFlags);
+	if (hostFlags & QINIU_RGN_DOWNLOAD_HOST) {
+		hosts = rgnInfo->ioHosts;
+		hostCount = rgnInfo->ioHostCount;
+	} else {
+		hosts = rgnInfo->upHosts;
+		hostCount = rgnInfo->upHostCount;
+	} // if
+	host = Qiniu_Rgn_Table_pickHost(rgnTable, hosts, hostCount, hostFlags, Qiniu_Tm_MonotonicMs());
+	if (!host) {
+		Qiniu_Rgn_Table_dropRegion(rgnInfo);
+		*upHost = NULL;
+		return Qiniu_OK;
+	} // if
+	*upHost = (*host)->host;
 
 	if (vote) {
+		Qiniu_Rgn_incVote(&(*host)->inflight);
 		vote->rgnInfo = rgnInfo;
-		vote->host = &rgnInfo->upHosts[0];
+		vote->host = host;
 		vote->hostFlags = hostFlags;
-		vote->hosts = rgnInfo->upHosts;
-		vote->hostCount = rgnInfo->upHostCount;
+		vote->hosts = hosts;
+		vote->hostCount = hostCount;
+		vote->startedAt = Qiniu_Tm_MonotonicMs();
+		vote->bytes = 0;
+	} else {
+		Qiniu_Rgn_Table_dropRegion(rgnInfo);
 	} // if
 	return Qiniu_OK;
 } // Qiniu_Rgn_Table_GetHost
 
+// Find the unexpired uptoken and hold it, so it is not freed until it is dropped. Called by the
+// readers, or by the writer with the mutex held and holdIt unset.
+static Qiniu_Rgn_TokenEntry * Qiniu_Rgn_Table_findToken(Qiniu_Rgn_RegionTable * rgnTable, const char * uptoken, Qiniu_Uint32 hash, Qiniu_Uint64 now, Qiniu_Bool holdIt)
+{
+	Qiniu_Rgn_TokenEntry * token = NULL;
+
+	if (holdIt) {
+		Qiniu_Count_Inc(&rgnTable->readers);
+	} // if
+	token = Qiniu_Rgn_load(&rgnTable->tokens[hash % QINIU_RGN_TOKEN_SLOTS]);
+	while (token) {
+		if (token->hash == hash && (token->deadline == 0 || token->deadline > now) && strcmp(token->uptoken, uptoken) == 0) {
+			if (holdIt) {
+				Qiniu_Count_Inc(&token->refCount);
+			} // if
+			break;
+		} // if
+		token = Qiniu_Rgn_load(&token->next);
+	} // while
+	if (holdIt) {
+		Qiniu_Count_Dec(&rgnTable->readers);
+	} // if
+	return token;
+} // Qiniu_Rgn_Table_findToken
+
+// Unlink the expired uptokens, or the oldest one if none is expired. The readers walking through them
+// still reach the rest of the chains, and they are freed once no one holds them. Called by the writer
+// with the mutex held.
+static void Qiniu_Rgn_Table_evictTokens(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Uint64 now)
+{
+	Qiniu_Rgn_TokenEntry * volatile * prev = NULL;
+	Qiniu_Rgn_TokenEntry * volatile * oldest = NULL;
+	Qiniu_Rgn_TokenEntry * token = NULL;
+	Qiniu_Uint32 count = rgnTable->tokenCount;
+	Qiniu_Uint32 i = 0;
+
+	for (i = 0; i < QINIU_RGN_TOKEN_SLOTS; i += 1) {
+		prev = &rgnTable->tokens[i];
+		while ((token = *prev)) {
+			if (token->deadline > 0 && token->deadline <= now) {
+				Qiniu_Rgn_store(prev, token->next);
+				Qiniu_Buffer_Write(&rgnTable->retiredTokens, &token, sizeof(token));
+				rgnTable->tokenCount -= 1;
+				continue;
+			} // if
+			// The serials wrap around, so they are compared by their distance to the next one.
+			if (!oldest || (Qiniu_Uint32)(token->serial - rgnTable->tokenSerial) < (Qiniu_Uint32)((*oldest)->serial - rgnTable->tokenSerial)) {
+				oldest = prev;
+			} // if
+			prev = &token->next;
+		} // while
+	} // for
+
+	if (rgnTable->tokenCount == count && oldest) {
+		token = *oldest;
+		Qiniu_Rgn_store(oldest, token->next);
+		Qiniu_Buffer_Write(&rgnTable->retiredTokens, &token, sizeof(token));
+		rgnTable->tokenCount -= 1;
+	} // if
+	Qiniu_Rgn_Table_reclaim(rgnTable);
+} // Qiniu_Rgn_Table_evictTokens
+
+// Remember the parsed uptoken, unless it is expired so it is never used again.
+static void Qiniu_Rgn_Table_addToken(Qiniu_Rgn_RegionTable * rgnTable, const char * uptoken, Qiniu_Uint32 hash, const char * bucket, const char * accessKey, Qiniu_Uint64 deadline, Qiniu_Uint64 now)
+{
+	Qiniu_Rgn_TokenEntry * token = NULL;
+	size_t uptokenLen = strlen(uptoken) + 1;
+	size_t bucketLen = strlen(bucket) + 1;
+	size_t accessKeyLen = strlen(accessKey) + 1;
+	char * pos = NULL;
+
+	if (deadline > 0 && deadline <= now) {
+		return;
+	} // if
+
+	Qiniu_Mutex_Lock(&rgnTable->mutex);
+	if (!Qiniu_Rgn_Table_findToken(rgnTable, uptoken, hash, now, Qiniu_False)) {
+		if (rgnTable->tokenCount >= QINIU_RGN_TOKEN_MAX_COUNT) {
+			Qiniu_Rgn_Table_evictTokens(rgnTable, now);
+		} // if
+		token = malloc(sizeof(Qiniu_Rgn_TokenEntry) + uptokenLen + bucketLen + accessKeyLen);
+		if (token) {
+			pos = (char *)(token + 1);
+			token->uptoken = memcpy(pos, uptoken, uptokenLen);
+			token->bucket = memcpy(pos + uptokenLen, bucket, bucketLen);
+			token->accessKey = memcpy(pos + uptokenLen + bucketLen, accessKey, accessKeyLen);
+			token->hash = hash;
+			token->serial = rgnTable->tokenSerial++;
+			token->deadline = deadline;
+			token->refCount = 0;
+			token->next = rgnTable->tokens[hash % QINIU_RGN_TOKEN_SLOTS];
+			Qiniu_Rgn_store(&rgnTable->tokens[hash % QINIU_RGN_TOKEN_SLOTS], token);
+			rgnTable->tokenCount += 1;
+		} // if
+	} // if
+	Qiniu_Mutex_Unlock(&rgnTable->mutex);
+} // Qiniu_Rgn_Table_addToken
+
+// The uptokens are parsed once, and then looked up by their hashes without locks until they expire.
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_GetHostByUptoken(
 	Qiniu_Rgn_RegionTable * rgnTable,
 	Qiniu_Client * cli,
@@ -476,55 +1813,74 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_GetHostByUptoken(
 	Qiniu_Rgn_HostVote * vote)
 {
 	Qiniu_Error err;
+	Qiniu_Uint32 hash = Qiniu_Rgn_Table_hash(uptoken);
+	Qiniu_Uint64 now = Qiniu_Tm_LocalTime();
+	Qiniu_Rgn_TokenEntry * token = NULL;
 	char * bucket = NULL;
 	char * accessKey = NULL;
+	Qiniu_Uint64 deadline = 0;
+
+	token = Qiniu_Rgn_Table_findToken(rgnTable, uptoken, hash, now, Qiniu_True);
+	if (token) {
+		err = Qiniu_Rgn_Table_GetHost(rgnTable, cli, token->bucket, token->accessKey, hostFlags, upHost, vote);
+		Qiniu_Count_Dec(&token->refCount);
+		return err;
+	} // if
 
-	err = Qiniu_Rgn_parseQueryArguments(uptoken, &bucket, &accessKey);
+	err = Qiniu_Rgn_parseQueryArguments(uptoken, &bucket, &accessKey, &deadline);
 	if (err.code != 200) {
 		return err;
 	} // if
 
+	Qiniu_Rgn_Table_addToken(rgnTable, uptoken, hash, bucket, accessKey, deadline, now);
 	err = Qiniu_Rgn_Table_GetHost(rgnTable, cli, bucket, accessKey, hostFlags, upHost, vote);
 	free(bucket);
 	free(accessKey);
-	return Qiniu_OK;
+	return err;
 } // Qiniu_Rgn_Table_GetHostByUptoken
 
-static void Qiniu_Rgn_Vote_downgradeHost(Qiniu_Rgn_HostVote * vote)
+QINIU_DLLAPI extern void Qiniu_Rgn_Table_ReleaseHost(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_HostVote * vote)
 {
-	Qiniu_Rgn_HostInfo ** next = vote->host + 1;
-	Qiniu_Rgn_HostInfo * t = NULL;
-
-	while (next < (vote->hosts + vote->hostCount) && ((*next)->flags & vote->hostFlags) == vote->hostFlags) {
-		if ((*next)->voteCount >= (*vote->host)->voteCount) {
-			t = *next;
-			*next = *(vote->host);
-			*(vote->host) = t;
-		} // if
-		vote->host = next;
-		next += 1;
-	} // while
-} // Qiniu_Rgn_Vote_downgradeHost
+	if (!vote->rgnInfo) {
+		return;
+	} // if
+	Qiniu_Rgn_decVote(&(*vote->host)->inflight);
+	Qiniu_Rgn_Table_dropRegion(vote->rgnInfo);
+	vote->rgnInfo = NULL;
+} // Qiniu_Rgn_Table_ReleaseHost
 
 QINIU_DLLAPI extern void Qiniu_Rgn_Table_VoteHost(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_HostVote * vote, Qiniu_Error err)
 {
+	Qiniu_Rgn_HostInfo * host = NULL;
+	Qiniu_Uint64 now = 0;
+	Qiniu_Uint32 elapsed = 0;
+	Qiniu_Bool failed = Qiniu_False;
+
 	if (!vote->rgnInfo) {
 		return;
 	} // if
-	if (err.code >= 100) {
-		(*vote->host)->voteCount += 1;
-		return;
+
+	host = *vote->host;
+	now = Qiniu_Tm_MonotonicMs();
+	elapsed = (now > vote->startedAt) ? (Qiniu_Uint32)(now - vote->startedAt) : 1;
+
+	// The averages are updated without locks, and a concurrent update may be lost, which is harmless.
+	// Timeouts and other transport errors count as failures as well as 5xx.
+	failed = (err.code < 100 || err.code / 100 == 5);
+	Qiniu_Rgn_Breaker_report(host, failed, (Qiniu_Uint32)(now / 1000));
+	if (failed) {
+		Qiniu_Rgn_store(&host->errorRate, (Qiniu_Rgn_load(&host->errorRate) * 7 + 1000) / 8);
+		Qiniu_Rgn_store(&host->failedAt, (Qiniu_Uint32)(now / 1000));
+	} else {
+		Qiniu_Rgn_store(&host->errorRate, Qiniu_Rgn_load(&host->errorRate) * 7 / 8);
+		if (vote->bytes >= QINIU_RGN_SCORE_LARGE_BYTES) {
+			// Bytes per ms is about KB/s.
+			Qiniu_Rgn_store(&host->throughput, Qiniu_Rgn_Score_average(Qiniu_Rgn_load(&host->throughput), (Qiniu_Uint32)(vote->bytes / elapsed) + 1));
+		} else {
+			Qiniu_Rgn_store(&host->latency, Qiniu_Rgn_Score_average(Qiniu_Rgn_load(&host->latency), elapsed));
+		} // if
+		Qiniu_Rgn_incVote(&host->voteCount);
 	} // if
-	switch (err.code) {
-		case CURLE_UNSUPPORTED_PROTOCOL:
-		case CURLE_COULDNT_RESOLVE_PROXY:
-		case CURLE_COULDNT_RESOLVE_HOST:
-		case CURLE_COULDNT_CONNECT:
-			(*vote->host)->voteCount /= 4;
-			Qiniu_Rgn_Vote_downgradeHost(vote);
-			break;
 
-		default:
-			break;
-	} // switch
+	Qiniu_Rgn_Table_ReleaseHost(rgnTable, vote);
 } // Qiniu_Rgn_VoteHost
@@ -34,8 +34,36 @@ typedef struct _Qiniu_Rgn_HostInfo {
 	const char * host;
 	Qiniu_Uint32 flags;
 	Qiniu_Uint32 voteCount;
+
+	// The moving averages of the time of small requests in ms, the speed of large requests in KB/s,
+	// and the rate of failures in 1/1000, and the second of Qiniu_Tm_MonotonicMs when the host failed
+	// last, which are updated by Qiniu_Rgn_Table_VoteHost.
+	Qiniu_Uint32 latency;
+	Qiniu_Uint32 throughput;
+	Qiniu_Uint32 errorRate;
+	Qiniu_Uint32 failedAt;
+
+	// The number of requests sent to the host and not voted yet.
+	Qiniu_Uint32 inflight;
+
+	// The circuit breaker of the host. It opens after some consecutive failures, and the host gets no
+	// requests until the cooldown in seconds passes. Then one trial request is sent in the half-open
+	// state, which closes the breaker if it succeeds, or opens it again for a doubled cooldown.
+	Qiniu_Uint32 failures;
+	Qiniu_Uint32 breaker;
+	Qiniu_Uint32 cooldown;
+	Qiniu_Uint32 openUntil;
+
+	// The moving average of the time in ms to connect to the host, measured by the prober.
+	Qiniu_Uint32 connectTime;
 } Qiniu_Rgn_HostInfo;
 
+enum {
+	QINIU_RGN_BREAKER_CLOSED    = 0,
+	QINIU_RGN_BREAKER_OPEN      = 1,
+	QINIU_RGN_BREAKER_HALF_OPEN = 2
+};
+
 typedef struct _Qiniu_Rgn_RegionInfo {
 	Qiniu_Uint64 nextTimestampToUpdate;
 
@@ -44,6 +72,10 @@ typedef struct _Qiniu_Rgn_RegionInfo {
 	Qiniu_Int64 ttl;
 	Qiniu_Int64 global;
 
+	// The picked hosts and the threads holding the region, which is freed when it is replaced in
+	// its table and no longer held.
+	Qiniu_Count refCount;
+
 	Qiniu_Uint32 upHostCount;
 	Qiniu_Rgn_HostInfo ** upHosts;
 
@@ -60,10 +92,10 @@ QINIU_DLLAPI extern Qiniu_Uint32 Qiniu_Rgn_Info_CountIoHost(Qiniu_Rgn_RegionInfo
 QINIU_DLLAPI extern const char * Qiniu_Rgn_Info_GetHost(Qiniu_Rgn_RegionInfo * rgnInfo, Qiniu_Uint32 n, Qiniu_Uint32 hostFlags);
 QINIU_DLLAPI extern const char * Qiniu_Rgn_Info_GetIoHost(Qiniu_Rgn_RegionInfo * rgnInfo, Qiniu_Uint32 n, Qiniu_Uint32 hostFlags);
 
-typedef struct _Qiniu_Rgn_RegionTable {
-	Qiniu_Uint32 rgnCount;
-	Qiniu_Rgn_RegionInfo ** regions;
-} Qiniu_Rgn_RegionTable;
+// The table can be shared by threads. Lookups take no locks. A refreshed region is freed once it is
+// no longer held, by Qiniu_Rgn_Table_GetRegionInfo until Qiniu_Rgn_Table_ReleaseRegionInfo, or by the
+// hosts picked from it until they are voted or released.
+typedef struct _Qiniu_Rgn_RegionTable Qiniu_Rgn_RegionTable;
 
 typedef struct _Qiniu_Rgn_HostVote {
 	Qiniu_Rgn_RegionInfo * rgnInfo;
@@ -71,18 +103,52 @@ typedef struct _Qiniu_Rgn_HostVote {
 	Qiniu_Rgn_HostInfo ** hosts;
 	Qiniu_Uint32 hostCount;
 	Qiniu_Uint32 hostFlags;
+
+	// When the host is picked, in ms of Qiniu_Tm_MonotonicMs.
+	Qiniu_Uint64 startedAt;
+
+	// The size of the request body, which is set by the caller before voting to measure the speed.
+	Qiniu_Int64 bytes;
 } Qiniu_Rgn_HostVote;
 
 QINIU_DLLAPI extern Qiniu_Rgn_RegionTable * Qiniu_Rgn_Table_Create(void);
 QINIU_DLLAPI extern void Qiniu_Rgn_Table_Destroy(Qiniu_Rgn_RegionTable * rgnTable);
 
+// Add a reference to the table, which is then released by Qiniu_Rgn_Table_Destroy.
+QINIU_DLLAPI extern Qiniu_Rgn_RegionTable * Qiniu_Rgn_Table_Acquire(Qiniu_Rgn_RegionTable * rgnTable);
+
+// Return the process-wide table created by Qiniu_Global_Init, or NULL before it. Every client
+// initialized after it refers to this table, so a bucket is queried once for all of them.
+QINIU_DLLAPI extern Qiniu_Rgn_RegionTable * Qiniu_Rgn_Table_Global(void);
+
+// Keep the queried regions in the file, which may be shared by processes, so that a new process
+// needs no query for a bucket until its region expires. Pass NULL to stop using the file.
+QINIU_DLLAPI extern void Qiniu_Rgn_Table_SetCacheFile(Qiniu_Rgn_RegionTable * rgnTable, const char * cacheFile);
+
+// Connect to every up and io host of the regions in the table at the same time, every so many seconds in
+// the background, to measure the connect time of the hosts which are not used yet, and to find out the hosts that
+// are down or back again before a request is sent to them. Pass 0 to stop probing.
+QINIU_DLLAPI extern void Qiniu_Rgn_Table_SetProbeInterval(Qiniu_Rgn_RegionTable * rgnTable, int seconds);
+
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_FetchAndUpdate(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Client * cli, const char * bucket, const char * access_key);
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_FetchAndUpdateByUptoken(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Client * cli, const char * uptoken);
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_SetRegionInfo(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_RegionInfo * rgnInfo);
 QINIU_DLLAPI extern Qiniu_Rgn_RegionInfo * Qiniu_Rgn_Table_GetRegionInfo(Qiniu_Rgn_RegionTable * rgnTable, const char * bucket);
+QINIU_DLLAPI extern void Qiniu_Rgn_Table_ReleaseRegionInfo(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_RegionInfo * rgnInfo);
+
+// The upload host is picked from two random ones by the expected time to upload a block, which grows
+// with the latency, the requests in flight and the failures of the host. So the blocks uploaded at the
+// same time are spread over the healthy hosts, and a slow host gets less requests. The hosts whose
+// breakers are open are skipped unless all of them are. Pass QINIU_RGN_DOWNLOAD_HOST to pick an io
+// host in the same way. If the vote is NULL, the region is not held, and the host is valid only until
+// the region of the bucket is refreshed.
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_GetHost(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Client * cli, const char * bucket, const char * accessKey, Qiniu_Uint32 hostFlags, const char ** upHost, Qiniu_Rgn_HostVote * vote);
 QINIU_DLLAPI extern Qiniu_Error Qiniu_Rgn_Table_GetHostByUptoken(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Client * cli, const char * uptoken, Qiniu_Uint32 hostFlags, const char ** upHost, Qiniu_Rgn_HostVote * vote);
+
+// Every host picked with a vote must be voted with the result of the request, or released if no
+// request is sent, so that the region it belongs to can be freed once it is refreshed.
 QINIU_DLLAPI extern void Qiniu_Rgn_Table_VoteHost(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_HostVote * vote, Qiniu_Error err);
+QINIU_DLLAPI extern void Qiniu_Rgn_Table_ReleaseHost(Qiniu_Rgn_RegionTable * rgnTable, Qiniu_Rgn_HostVote * vote);
 
 #ifdef __cplusplus
 }
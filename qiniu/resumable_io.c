@@ -9,8 +9,13 @@
 
 #include "region.h"
 #include "resumable_io.h"
+#include "private.h"
+#include "rs.h"
+#include "qetag.h"
+#include "../cJSON/cJSON.h"
 #include <curl/curl.h>
 #include <sys/stat.h>
+#include <stddef.h>
 
 #define	blockBits			22
 #define blockMask			((1 << blockBits) - 1)
@@ -77,6 +82,11 @@ Qiniu_Rio_WaitGroup Qiniu_Rio_MTWG_Create(void)
     Qiniu_Rio_MTWG_Data * newData = NULL;
 
     newData = (Qiniu_Rio_MTWG_Data*)malloc(sizeof(*newData));
+    if (newData == NULL) {
+        wg.itbl = NULL;
+        wg.self = NULL;
+        return wg;
+    }
     newData->addedCount = 0;
     newData->doneCount = 0;
     newData->event = CreateEvent(NULL, FALSE, FALSE, NULL);
@@ -86,6 +96,83 @@ Qiniu_Rio_WaitGroup Qiniu_Rio_MTWG_Create(void)
     return wg;
 } // Qiniu_Rio_MTWG_Create
 
+#else
+
+typedef struct _Qiniu_Rio_MTWG_Data
+{
+	Qiniu_Mutex mutex;
+	Qiniu_Cond cond;
+	int count;
+} Qiniu_Rio_MTWG_Data;
+
+static void Qiniu_Rio_MTWG_Add(void* self, int n)
+{
+	Qiniu_Rio_MTWG_Data * data = (Qiniu_Rio_MTWG_Data*)self;
+
+	Qiniu_Mutex_Lock(&data->mutex);
+	data->count += n;
+	Qiniu_Mutex_Unlock(&data->mutex);
+} // Qiniu_Rio_MTWG_Add
+
+static void Qiniu_Rio_MTWG_Done(void* self)
+{
+	Qiniu_Rio_MTWG_Data * data = (Qiniu_Rio_MTWG_Data*)self;
+
+	Qiniu_Mutex_Lock(&data->mutex);
+	data->count -= 1;
+	if (data->count <= 0) {
+		Qiniu_Cond_Broadcast(&data->cond);
+	} // if
+	Qiniu_Mutex_Unlock(&data->mutex);
+} // Qiniu_Rio_MTWG_Done
+
+static void Qiniu_Rio_MTWG_Wait(void* self)
+{
+	Qiniu_Rio_MTWG_Data * data = (Qiniu_Rio_MTWG_Data*)self;
+
+	Qiniu_Mutex_Lock(&data->mutex);
+	while (data->count > 0) {
+		Qiniu_Cond_Wait(&data->cond, &data->mutex);
+	} // while
+	Qiniu_Mutex_Unlock(&data->mutex);
+} // Qiniu_Rio_MTWG_Wait
+
+static void Qiniu_Rio_MTWG_Release(void* self)
+{
+	Qiniu_Rio_MTWG_Data * data = (Qiniu_Rio_MTWG_Data*)self;
+
+	Qiniu_Cond_Cleanup(&data->cond);
+	Qiniu_Mutex_Cleanup(&data->mutex);
+	free(data);
+} // Qiniu_Rio_MTWG_Release
+
+static Qiniu_Rio_WaitGroup_Itbl Qiniu_Rio_MTWG_Itbl = {
+	&Qiniu_Rio_MTWG_Add,
+	&Qiniu_Rio_MTWG_Done,
+	&Qiniu_Rio_MTWG_Wait,
+	&Qiniu_Rio_MTWG_Release,
+};
+
+Qiniu_Rio_WaitGroup Qiniu_Rio_MTWG_Create(void)
+{
+	Qiniu_Rio_WaitGroup wg;
+	Qiniu_Rio_MTWG_Data * newData = NULL;
+
+	newData = (Qiniu_Rio_MTWG_Data*)malloc(sizeof(*newData));
+	if (newData == NULL) {
+		wg.itbl = NULL;
+		wg.self = NULL;
+		return wg;
+	}
+	Qiniu_Mutex_Init(&newData->mutex);
+	Qiniu_Cond_Init(&newData->cond);
+	newData->count = 0;
+
+	wg.itbl = &Qiniu_Rio_MTWG_Itbl;
+	wg.self = newData;
+	return wg;
+} // Qiniu_Rio_MTWG_Create
+
 #endif
 
 static void Qiniu_Rio_STWG_Add(void* self, int n) {}
@@ -158,6 +245,216 @@ void Qiniu_Rio_SetSettings(Qiniu_Rio_Settings* v)
 	}
 }
 
+/*============================================================================*/
+/* type Qiniu_Rio_MT - MultiThread */
+
+typedef struct _Qiniu_Rio_MT_Task {
+	void (*task)(void* params);
+	void* params;
+} Qiniu_Rio_MT_Task;
+
+typedef struct _Qiniu_Rio_MT_Worker {
+	Qiniu_Thread thread;
+	Qiniu_Client client;
+	struct _Qiniu_Rio_MT_Data* pool;
+} Qiniu_Rio_MT_Worker;
+
+typedef struct _Qiniu_Rio_MT_Data {
+	Qiniu_Mutex mutex;
+	Qiniu_Cond notEmpty;
+	Qiniu_Cond notFull;
+
+	Qiniu_Rio_MT_Task* tasks;
+	int taskQsize;
+	int taskBegin;
+	int taskCount;
+	int stopping;
+
+	int workerCount;
+	Qiniu_Rio_MT_Worker workers[1];
+} Qiniu_Rio_MT_Data;
+
+static void Qiniu_Rio_MT_runWorker(void* params)
+{
+	Qiniu_Rio_MT_Worker* worker = (Qiniu_Rio_MT_Worker*)params;
+	Qiniu_Rio_MT_Data* pool = worker->pool;
+	Qiniu_Rio_MT_Task t;
+
+	for (;;) {
+		Qiniu_Mutex_Lock(&pool->mutex);
+		while (pool->taskCount == 0 && !pool->stopping) {
+			Qiniu_Cond_Wait(&pool->notEmpty, &pool->mutex);
+		} // while
+		if (pool->taskCount == 0) {
+			// Stopping and all queued tasks have been taken.
+			Qiniu_Mutex_Unlock(&pool->mutex);
+			break;
+		} // if
+
+		t = pool->tasks[pool->taskBegin];
+		pool->taskBegin = (pool->taskBegin + 1) % pool->taskQsize;
+		pool->taskCount -= 1;
+		Qiniu_Cond_Signal(&pool->notFull);
+		Qiniu_Mutex_Unlock(&pool->mutex);
+
+		t.task(t.params);
+	} // for
+} // Qiniu_Rio_MT_runWorker
+
+static Qiniu_Rio_WaitGroup Qiniu_Rio_MT_WaitGroup(void* self)
+{
+	return Qiniu_Rio_MTWG_Create();
+} // Qiniu_Rio_MT_WaitGroup
+
+static Qiniu_Client* Qiniu_Rio_MT_ClientTls(void* self, Qiniu_Client* mc)
+{
+	Qiniu_Rio_MT_Data* pool = (Qiniu_Rio_MT_Data*)self;
+	Qiniu_Client* c;
+	int i;
+
+	for (i = 0; i < pool->workerCount; i++) {
+		if (Qiniu_Thread_IsCurrent(pool->workers[i].thread)) {
+			// The auth object is borrowed from the main client and must not be released here.
+			c = &pool->workers[i].client;
+			c->auth = mc->auth;
+			c->boundNic = mc->boundNic;
+			c->lowSpeedLimit = mc->lowSpeedLimit;
+			c->lowSpeedTime = mc->lowSpeedTime;
+			// Pick the hosts from the region table of the main client, and vote for them there.
+			if (c->regionTable != mc->regionTable) {
+				Qiniu_Rgn_Table_Destroy(c->regionTable);
+				c->regionTable = (mc->regionTable != NULL) ? Qiniu_Rgn_Table_Acquire(mc->regionTable) : NULL;
+			} // if
+			if (c->share != Qiniu_Share_forThreads(mc->share)) {
+				Qiniu_Client_SetShare(c, Qiniu_Share_forThreads(mc->share));
+			} // if
+			return c;
+		} // if
+	} // for
+	return mc;
+} // Qiniu_Rio_MT_ClientTls
+
+static int Qiniu_Rio_MT_RunTask(void* self, void (*task)(void* params), void* params)
+{
+	Qiniu_Rio_MT_Data* pool = (Qiniu_Rio_MT_Data*)self;
+	Qiniu_Rio_MT_Task* t;
+
+	Qiniu_Mutex_Lock(&pool->mutex);
+	while (pool->taskCount == pool->taskQsize && !pool->stopping) {
+		Qiniu_Cond_Wait(&pool->notFull, &pool->mutex);
+	} // while
+	if (pool->stopping) {
+		Qiniu_Mutex_Unlock(&pool->mutex);
+		return QINIU_RIO_NOTIFY_EXIT;
+	} // if
+
+	t = &pool->tasks[(pool->taskBegin + pool->taskCount) % pool->taskQsize];
+	t->task = task;
+	t->params = params;
+	pool->taskCount += 1;
+	Qiniu_Cond_Signal(&pool->notEmpty);
+	Qiniu_Mutex_Unlock(&pool->mutex);
+	return QINIU_RIO_NOTIFY_OK;
+} // Qiniu_Rio_MT_RunTask
+
+static Qiniu_Rio_ThreadModel_Itbl Qiniu_Rio_MT_Itbl = {
+	Qiniu_Rio_MT_WaitGroup,
+	Qiniu_Rio_MT_ClientTls,
+	Qiniu_Rio_MT_RunTask
+};
+
+static void Qiniu_Rio_MT_stop(Qiniu_Rio_MT_Data* pool, int startedCount)
+{
+	int i;
+
+	Qiniu_Mutex_Lock(&pool->mutex);
+	pool->stopping = 1;
+	Qiniu_Cond_Broadcast(&pool->notEmpty);
+	Qiniu_Cond_Broadcast(&pool->notFull);
+	Qiniu_Mutex_Unlock(&pool->mutex);
+
+	for (i = 0; i < startedCount; i++) {
+		Qiniu_Thread_Join(pool->workers[i].thread);
+	} // for
+	for (i = 0; i < pool->workerCount; i++) {
+		pool->workers[i].client.auth = Qiniu_NoAuth;
+		Qiniu_Client_Cleanup(&pool->workers[i].client);
+	} // for
+
+	Qiniu_Cond_Cleanup(&pool->notFull);
+	Qiniu_Cond_Cleanup(&pool->notEmpty);
+	Qiniu_Mutex_Cleanup(&pool->mutex);
+	free(pool->tasks);
+	free(pool);
+} // Qiniu_Rio_MT_stop
+
+Qiniu_Error Qiniu_Rio_MT_Create(Qiniu_Rio_ThreadModel* tm, int workers, int taskQsize)
+{
+	Qiniu_Error err;
+	Qiniu_Rio_MT_Data* pool;
+	int i;
+
+	if (workers <= 0) {
+		workers = settings.workers;
+	}
+	if (taskQsize <= 0) {
+		taskQsize = settings.taskQsize;
+	}
+
+	pool = (Qiniu_Rio_MT_Data*)calloc(1, sizeof(*pool) + sizeof(pool->workers[0]) * (workers - 1));
+	if (pool == NULL) {
+		err.code = 499;
+		err.message = "No enough memory";
+		return err;
+	}
+	pool->tasks = (Qiniu_Rio_MT_Task*)calloc(taskQsize, sizeof(Qiniu_Rio_MT_Task));
+	if (pool->tasks == NULL) {
+		free(pool);
+		err.code = 499;
+		err.message = "No enough memory";
+		return err;
+	}
+	pool->taskQsize = taskQsize;
+	pool->workerCount = workers;
+
+	Qiniu_Mutex_Init(&pool->mutex);
+	Qiniu_Cond_Init(&pool->notEmpty);
+	Qiniu_Cond_Init(&pool->notFull);
+
+	for (i = 0; i < workers; i++) {
+		Qiniu_Client_InitNoAuth(&pool->workers[i].client, 1024);
+		pool->workers[i].pool = pool;
+	} // for
+
+	// Workers only touch their own fields, so the lookup in ClientTls needs no locking
+	// once all threads are started.
+	Qiniu_Mutex_Lock(&pool->mutex);
+	for (i = 0; i < workers; i++) {
+		if (Qiniu_Thread_Create(&pool->workers[i].thread, Qiniu_Rio_MT_runWorker, &pool->workers[i]) != 0) {
+			Qiniu_Mutex_Unlock(&pool->mutex);
+			Qiniu_Rio_MT_stop(pool, i);
+			err.code = 9987;
+			err.message = "Can not create worker thread";
+			return err;
+		} // if
+	} // for
+	Qiniu_Mutex_Unlock(&pool->mutex);
+
+	tm->self = pool;
+	tm->itbl = &Qiniu_Rio_MT_Itbl;
+	return Qiniu_OK;
+} // Qiniu_Rio_MT_Create
+
+void Qiniu_Rio_MT_Destroy(Qiniu_Rio_ThreadModel tm)
+{
+	Qiniu_Rio_MT_Data* pool = (Qiniu_Rio_MT_Data*)tm.self;
+
+	if (pool == NULL || tm.itbl != &Qiniu_Rio_MT_Itbl) {
+		return;
+	} // if
+	Qiniu_Rio_MT_stop(pool, pool->workerCount);
+} // Qiniu_Rio_MT_Destroy
+
 /*============================================================================*/
 /* func Qiniu_UptokenAuth */
 
@@ -320,71 +617,99 @@ static void Qiniu_Io_PutExtra_initFrom(Qiniu_Io_PutExtra* self, Qiniu_Rio_PutExt
 
 /*============================================================================*/
 
-static Qiniu_Error Qiniu_Rio_bput(
-	Qiniu_Client* self, Qiniu_Rio_BlkputRet* ret, Qiniu_Reader body, int bodyLength, const char* url)
+static Qiniu_Error Qiniu_Rio_upHost(
+	Qiniu_Client* self, Qiniu_Rio_PutExtra* extra, const char** upHost, Qiniu_Rgn_HostVote* upHostVote)
+{
+	Qiniu_Error err;
+
+	memset(upHostVote, 0, sizeof(*upHostVote));
+
+	//// For using multi-region storage.
+	if ((*upHost = extra->upHost) == NULL) {
+		if (Qiniu_Rgn_IsEnabled()) {
+			if (extra->upBucket && extra->accessKey) {
+				err = Qiniu_Rgn_Table_GetHost(self->regionTable, self, extra->upBucket, extra->accessKey, extra->upHostFlags, upHost, upHostVote);
+			} else {
+				err = Qiniu_Rgn_Table_GetHostByUptoken(self->regionTable, self, extra->uptoken, extra->upHostFlags, upHost, upHostVote);
+			} // if
+			if (err.code != 200) {
+				return err;
+			} // if
+		} else {
+			*upHost = QINIU_UP_HOST;
+		} // if
+
+		if (*upHost == NULL) {
+			err.code = 9988;
+			err.message = "No proper upload host name";
+			return err;
+		} // if
+	} // if
+	return Qiniu_OK;
+}
+
+static Qiniu_Error Qiniu_Rio_bputResult(Qiniu_Rio_BlkputRet* ret, Qiniu_Json* root)
 {
+	Qiniu_Error err;
 	Qiniu_Rio_BlkputRet retFromResp;
+
+	retFromResp.ctx = Qiniu_Json_GetString(root, "ctx", NULL);
+	retFromResp.checksum = Qiniu_Json_GetString(root, "checksum", NULL);
+	retFromResp.host = Qiniu_Json_GetString(root, "host", NULL);
+	retFromResp.crc32 = (Qiniu_Uint32)Qiniu_Json_GetInt64(root, "crc32", 0);
+	retFromResp.offset = (Qiniu_Uint32)Qiniu_Json_GetInt64(root, "offset", 0);
+
+	if (retFromResp.ctx == NULL || retFromResp.host == NULL || retFromResp.offset == 0) {
+		err.code = 9998;
+		err.message = "unexcepted response: invalid ctx, host or offset";
+		return err;
+	}
+
+	Qiniu_Rio_BlkputRet_Assign(ret, &retFromResp);
+	return Qiniu_OK;
+}
+
+// The body is sent from bodyBuf directly if it is not NULL.
+static Qiniu_Error Qiniu_Rio_bput(
+	Qiniu_Client* self, Qiniu_Rio_BlkputRet* ret, Qiniu_Reader body, const char* bodyBuf, int bodyLength, const char* url)
+{
 	Qiniu_Json* root;
+	Qiniu_Error err;
 
-	Qiniu_Error err = Qiniu_Client_CallWithBinary(self, &root, url, body, bodyLength, NULL);
+	if (bodyBuf != NULL) {
+		err = Qiniu_Client_CallWithBuffer(self, &root, url, bodyBuf, bodyLength, NULL);
+	} else {
+		err = Qiniu_Client_CallWithBinary(self, &root, url, body, bodyLength, NULL);
+	}
 	if (err.code == 200) {
-		retFromResp.ctx = Qiniu_Json_GetString(root, "ctx", NULL);
-		retFromResp.checksum = Qiniu_Json_GetString(root, "checksum", NULL);
-		retFromResp.host = Qiniu_Json_GetString(root, "host", NULL);
-		retFromResp.crc32 = (Qiniu_Uint32)Qiniu_Json_GetInt64(root, "crc32", 0);
-		retFromResp.offset = (Qiniu_Uint32)Qiniu_Json_GetInt64(root, "offset", 0);
-
-		if (retFromResp.ctx == NULL || retFromResp.host == NULL || retFromResp.offset == 0) {
-			err.code = 9998;
-			err.message = "unexcepted response: invalid ctx, host or offset";
-			return err;
-		}
-
-		Qiniu_Rio_BlkputRet_Assign(ret, &retFromResp);
+		err = Qiniu_Rio_bputResult(ret, root);
 	}
 
 	return err;
 }
 
 static Qiniu_Error Qiniu_Rio_Mkblock(
-	Qiniu_Client* self, Qiniu_Rio_BlkputRet* ret, int blkSize, Qiniu_Reader body, int bodyLength, Qiniu_Rio_PutExtra* extra)
+	Qiniu_Client* self, Qiniu_Rio_BlkputRet* ret, int blkSize, Qiniu_Reader body, const char* bodyBuf, int bodyLength,
+	Qiniu_Rio_PutExtra* extra)
 {
 	Qiniu_Error err;
 	Qiniu_Rgn_HostVote upHostVote;
 	const char * upHost = NULL;
 	char* url = NULL;
 
-	//// For using multi-region storage.
-	{
-		if ((upHost = extra->upHost) == NULL) {
-			if (Qiniu_Rgn_IsEnabled()) {
-				if (extra->upBucket && extra->accessKey) {
-					err = Qiniu_Rgn_Table_GetHost(self->regionTable, self, extra->upBucket, extra->accessKey, extra->upHostFlags, &upHost, &upHostVote);
-				} else {
-					err = Qiniu_Rgn_Table_GetHostByUptoken(self->regionTable, self, extra->uptoken, extra->upHostFlags, &upHost, &upHostVote);
-				} // if
-				if (err.code != 200) {
-					return err;
-				} // if
-			} else {
-				upHost = QINIU_UP_HOST;
-			} // if
-
-			if (upHost == NULL) {
-				err.code = 9988;
-				err.message = "No proper upload host name";
-				return err;
-			} // if
-		} // if
-	} 
+	err = Qiniu_Rio_upHost(self, extra, &upHost, &upHostVote);
+	if (err.code != 200) {
+		return err;
+	} // if
 
 	url = Qiniu_String_Format(128, "%s/mkblk/%d", upHost, blkSize);
-	err = Qiniu_Rio_bput(self, ret, body, bodyLength, url);
+	err = Qiniu_Rio_bput(self, ret, body, bodyBuf, bodyLength, url);
 	Qiniu_Free(url);
 
 	//// For using multi-region storage.
 	{
 		if (Qiniu_Rgn_IsEnabled()) {
+			upHostVote.bytes = bodyLength;
 			Qiniu_Rgn_Table_VoteHost(self->regionTable, &upHostVote, err);
 		} // if
 	}
@@ -393,146 +718,639 @@ static Qiniu_Error Qiniu_Rio_Mkblock(
 }
 
 static Qiniu_Error Qiniu_Rio_Blockput(
-	Qiniu_Client* self, Qiniu_Rio_BlkputRet* ret, Qiniu_Reader body, int bodyLength)
+	Qiniu_Client* self, Qiniu_Rio_BlkputRet* ret, Qiniu_Reader body, const char* bodyBuf, int bodyLength)
 {
 	char* url = Qiniu_String_Format(1024, "%s/bput/%s/%d", ret->host, ret->ctx, (int)ret->offset);
-	Qiniu_Error err = Qiniu_Rio_bput(self, ret, body, bodyLength, url);
+	Qiniu_Error err = Qiniu_Rio_bput(self, ret, body, bodyBuf, bodyLength, url);
 	Qiniu_Free(url);
 	return err;
 }
 
 /*============================================================================*/
+/* type Qiniu_Rio_readahead */
+
+// Chunk buffers shared by all blocks in flight of a Put, which bounds the memory used for reading ahead.
+// The mutex and the condition also guard the readaheads that take buffers from the pool.
+typedef struct _Qiniu_Rio_bufPool {
+	Qiniu_Mutex mutex;
+	Qiniu_Cond cond;
+	char** bufs;
+	int nfree;
+	int nalloc;
+	int limit;
+	size_t bufSize;
+} Qiniu_Rio_bufPool;
+
+static Qiniu_Error Qiniu_Rio_bufPool_Init(Qiniu_Rio_bufPool* self, int limit, size_t bufSize)
+{
+	Qiniu_Error err;
 
-static Qiniu_Error ErrUnmatchedChecksum = {
-	Qiniu_Rio_UnmatchedChecksum, "unmatched checksum"
-};
+	memset(self, 0, sizeof(*self));
+	self->bufs = (char**)malloc(sizeof(char*) * limit);
+	if (self->bufs == NULL) {
+		err.code = 499;
+		err.message = "No enough memory";
+		return err;
+	}
+	self->limit = limit;
+	self->bufSize = bufSize;
+	Qiniu_Mutex_Init(&self->mutex);
+	Qiniu_Cond_Init(&self->cond);
+	return Qiniu_OK;
+}
 
-static int Qiniu_TemporaryError(int code) {
-	return code != 401;
+static void Qiniu_Rio_bufPool_Cleanup(Qiniu_Rio_bufPool* self)
+{
+	int i;
+	for (i = 0; i < self->nfree; i++) {
+		free(self->bufs[i]);
+	}
+	free(self->bufs);
+	self->bufs = NULL;
+	Qiniu_Cond_Cleanup(&self->cond);
+	Qiniu_Mutex_Cleanup(&self->mutex);
 }
 
-static Qiniu_Error Qiniu_Rio_ResumableBlockput(
-	Qiniu_Client* c, Qiniu_Rio_BlkputRet* ret, Qiniu_ReaderAt f, int blkIdx, int blkSize, Qiniu_Rio_PutExtra* extra)
+// Called with the mutex held. Return NULL if all buffers are taken.
+static char* Qiniu_Rio_bufPool_take(Qiniu_Rio_bufPool* self)
 {
-	Qiniu_Error err = {200, NULL};
-	Qiniu_Tee tee;
-	Qiniu_Section section;
-	Qiniu_Reader body, body1;
+	char* buf;
 
-	Qiniu_Crc32 crc32;
-	Qiniu_Writer h = Qiniu_Crc32Writer(&crc32, 0);
-	Qiniu_Int64 offbase = (Qiniu_Int64)(blkIdx) << blockBits;
+	if (self->nfree > 0) {
+		return self->bufs[--self->nfree];
+	}
+	if (self->nalloc < self->limit) {
+		buf = (char*)malloc(self->bufSize);
+		if (buf != NULL) {
+			self->nalloc++;
+		}
+		return buf;
+	}
+	return NULL;
+}
 
-	int chunkSize = extra->chunkSize;
-	int bodyLength;
-	int tryTimes;
-    int notifyRet = 0;
+// Called with the mutex held.
+static void Qiniu_Rio_bufPool_give(Qiniu_Rio_bufPool* self, char* buf)
+{
+	self->bufs[self->nfree++] = buf;
+	Qiniu_Cond_Broadcast(&self->cond);
+}
 
-	if (ret->ctx == NULL) {
+typedef struct _Qiniu_Rio_rahChunk {
+	char* buf;
+	int pos;
+	int n;
+} Qiniu_Rio_rahChunk;
+
+// Read the chunks of a block on a helper thread, at most depth chunks ahead of the one being sent.
+// The chunks are in ring[head, head+count), of which the first `ready` ones are read and the next one,
+// if any, is being read.
+typedef struct _Qiniu_Rio_readahead {
+	Qiniu_Rio_bufPool* pool;
+	Qiniu_ReaderAt f;
+	Qiniu_Int64 offbase;
+	int blkSize;
+	int chunkSize;
+	int next;
+	Qiniu_Rio_rahChunk* ring;
+	int depth;
+	int head;
+	int count;
+	int ready;
+	int stop;
+	int failed;
+	Qiniu_Thread thread;
+} Qiniu_Rio_readahead;
+
+static void Qiniu_Rio_readahead_run(void* params)
+{
+	Qiniu_Rio_readahead* self = (Qiniu_Rio_readahead*)params;
+	Qiniu_Rio_bufPool* pool = self->pool;
+	Qiniu_Rio_rahChunk* chunk;
+	char* buf = NULL;
+	ssize_t n;
+
+	Qiniu_Mutex_Lock(&pool->mutex);
+	while (!self->stop && self->next < self->blkSize) {
+		if (self->count >= self->depth || (buf = Qiniu_Rio_bufPool_take(pool)) == NULL) {
+			Qiniu_Cond_Wait(&pool->cond, &pool->mutex);
+			continue;
+		}
 
-		if (chunkSize < blkSize) {
-			bodyLength = chunkSize;
-		} else {
-			bodyLength = blkSize;
+		chunk = &self->ring[(self->head + self->count) % self->depth];
+		chunk->buf = buf;
+		chunk->pos = self->next;
+		chunk->n = self->blkSize - self->next;
+		if (chunk->n > self->chunkSize) {
+			chunk->n = self->chunkSize;
 		}
+		self->count++;
+		Qiniu_Mutex_Unlock(&pool->mutex);
 
-		body1 = Qiniu_SectionReader(&section, f, (Qiniu_Off_T)offbase, bodyLength);
-		body = Qiniu_TeeReader(&tee, body1, h);
+		n = self->f.ReadAt(self->f.self, buf, chunk->n, (Qiniu_Off_T)self->offbase + chunk->pos);
 
-		err = Qiniu_Rio_Mkblock(c, ret, blkSize, body, bodyLength, extra);
-		if (err.code != 200) {
-			return err;
-		}
-		if (ret->crc32 != crc32.val || (int)(ret->offset) != bodyLength) {
-			return ErrUnmatchedChecksum;
+		Qiniu_Mutex_Lock(&pool->mutex);
+		if (n != chunk->n) {
+			self->failed = 1;
+			Qiniu_Cond_Broadcast(&pool->cond);
+			break;
 		}
-		notifyRet = extra->notify(extra->notifyRecvr, blkIdx, blkSize, ret);
-        if (notifyRet == QINIU_RIO_NOTIFY_EXIT) {
-            // Terminate the upload process if  the caller requests
-            err.code = Qiniu_Rio_PutInterrupted;
-            err.message = "Interrupted by the caller";
-            return err;
-        }
+		self->next += chunk->n;
+		self->ready++;
+		Qiniu_Cond_Broadcast(&pool->cond);
 	}
+	Qiniu_Mutex_Unlock(&pool->mutex);
+}
 
-	while ((int)(ret->offset) < blkSize) {
+// Start reading the block from pos. Return a non-zero value if the helper thread can't be started,
+// in which case the block is read on demand as usual.
+static int Qiniu_Rio_readahead_Start(
+	Qiniu_Rio_readahead* self, Qiniu_Rio_bufPool* pool, int depth,
+	Qiniu_ReaderAt f, Qiniu_Int64 offbase, int blkSize, int chunkSize, int pos)
+{
+	memset(self, 0, sizeof(*self));
+	self->ring = (Qiniu_Rio_rahChunk*)malloc(sizeof(Qiniu_Rio_rahChunk) * depth);
+	if (self->ring == NULL) {
+		return 499;
+	}
+	self->pool = pool;
+	self->depth = depth;
+	self->f = f;
+	self->offbase = offbase;
+	self->blkSize = blkSize;
+	self->chunkSize = chunkSize;
+	self->next = pos;
+	if (Qiniu_Thread_Create(&self->thread, Qiniu_Rio_readahead_run, self) != 0) {
+		free(self->ring);
+		self->ring = NULL;
+		return 9987;
+	}
+	return 0;
+}
 
-		if (chunkSize < blkSize - (int)(ret->offset)) {
-			bodyLength = chunkSize;
-		} else {
-			bodyLength = blkSize - (int)(ret->offset);
-		}
+static void Qiniu_Rio_readahead_Stop(Qiniu_Rio_readahead* self)
+{
+	Qiniu_Rio_bufPool* pool = self->pool;
 
-		tryTimes = extra->tryTimes;
+	Qiniu_Mutex_Lock(&pool->mutex);
+	self->stop = 1;
+	Qiniu_Cond_Broadcast(&pool->cond);
+	Qiniu_Mutex_Unlock(&pool->mutex);
 
-lzRetry:
-		crc32.val = 0;
-		body1 = Qiniu_SectionReader(&section, f, (Qiniu_Off_T)offbase + (ret->offset), bodyLength);
-		body = Qiniu_TeeReader(&tee, body1, h);
+	Qiniu_Thread_Join(self->thread);
 
-		err = Qiniu_Rio_Blockput(c, ret, body, bodyLength);
-		if (err.code == 200) {
-			if (ret->crc32 == crc32.val) {
-				notifyRet = extra->notify(extra->notifyRecvr, blkIdx, blkSize, ret);
-                if (notifyRet == QINIU_RIO_NOTIFY_EXIT) {
-                    // Terminate the upload process if the caller requests
-                    err.code = Qiniu_Rio_PutInterrupted;
-                    err.message = "Interrupted by the caller";
-                    return err;
-                }
+	Qiniu_Mutex_Lock(&pool->mutex);
+	while (self->count > 0) {
+		Qiniu_Rio_bufPool_give(pool, self->ring[self->head].buf);
+		self->head = (self->head + 1) % self->depth;
+		self->count--;
+	}
+	Qiniu_Mutex_Unlock(&pool->mutex);
 
-				continue;
+	free(self->ring);
+	self->ring = NULL;
+}
+
+// Wait for the chunk at pos and return its data, which keeps valid until the next call. The chunks before it
+// are sent already, so they are given back to the pool. Return NULL if the chunk can't be read ahead.
+static const char* Qiniu_Rio_readahead_Get(Qiniu_Rio_readahead* self, int pos, int n)
+{
+	Qiniu_Rio_bufPool* pool = self->pool;
+	Qiniu_Rio_rahChunk* chunk;
+	const char* data = NULL;
+
+	Qiniu_Mutex_Lock(&pool->mutex);
+	for (;;) {
+		if (self->count == 0) {
+			if (self->failed || self->next > pos || self->next >= self->blkSize) {
+				break;
 			}
-			Qiniu_Log_Warn("ResumableBlockput: invalid checksum, retry");
-			err = ErrUnmatchedChecksum;
 		} else {
-			if (err.code == Qiniu_Rio_InvalidCtx) {
-				Qiniu_Rio_BlkputRet_Cleanup(ret); // reset
-				Qiniu_Log_Warn("ResumableBlockput: invalid ctx, please retry");
-				return err;
+			chunk = &self->ring[self->head];
+			if (self->ready > 0 && chunk->pos < pos) {
+				Qiniu_Rio_bufPool_give(pool, chunk->buf);
+				self->head = (self->head + 1) % self->depth;
+				self->count--;
+				self->ready--;
+				continue;
+			}
+			if (chunk->pos > pos || (self->ready > 0 && chunk->n != n)) {
+				break;
+			}
+			if (self->ready > 0) {
+				data = chunk->buf;
+				break;
+			}
+			if (self->failed) {
+				break;
 			}
-			Qiniu_Log_Warn("ResumableBlockput %d off:%d failed - %E", blkIdx, (int)ret->offset, err);
-		}
-		if (tryTimes > 1 && Qiniu_TemporaryError(err.code)) {
-			tryTimes--;
-			Qiniu_Log_Info("ResumableBlockput %E, retrying ...", err);
-			goto lzRetry;
 		}
-		break;
+		Qiniu_Cond_Wait(&pool->cond, &pool->mutex);
 	}
-	return err;
+	Qiniu_Mutex_Unlock(&pool->mutex);
+	return data;
 }
 
 /*============================================================================*/
+/* type Qiniu_Rio_blkHash */
 
-static Qiniu_Error Qiniu_Rio_Mkfile(
-	Qiniu_Client* c, Qiniu_Rio_PutRet* ret, const char* key, Qiniu_Int64 fsize, Qiniu_Rio_PutExtra* extra)
-{
-	size_t i, blkCount = extra->blockCnt;
-	Qiniu_Json* root;
-	Qiniu_Error err;
-	Qiniu_Rio_BlkputRet* prog;
-	Qiniu_Buffer url, body;
-
-	Qiniu_Buffer_Init(&url, 1024);
-	Qiniu_Buffer_AppendFormat(&url, "%s/mkfile/%D", extra->upHost, fsize);
+// Compute the CRC32 of the chunk in flight, and the SHA1 of the whole block for the qetag if blk is not NULL.
+// A retried chunk is fed again from the same offset, so only the bytes beyond `hashed` go into the SHA1.
+// The bytes after a gap (a block resumed from a saved progress) are read again by Qiniu_Rio_blkHash_Sum.
+typedef struct _Qiniu_Rio_blkHash {
+	Qiniu_Crc32 crc32;
+	struct _Qiniu_Qetag_Block* blk;
+	Qiniu_Uint32 pos;
+	Qiniu_Uint32 hashed;
+	Qiniu_Rio_readahead* rah;
+} Qiniu_Rio_blkHash;
 
-	if (NULL != key) {
-		Qiniu_Buffer_AppendFormat(&url, "/key/%S", key);
+static Qiniu_Error Qiniu_Rio_blkHash_Init(Qiniu_Rio_blkHash* self, int checkQetag)
+{
+	memset(self, 0, sizeof(*self));
+	if (checkQetag) {
+		return Qiniu_Qetag_NewBlock(&self->blk);
 	}
+	return Qiniu_OK;
+}
 
-	if (extra->mimeType != NULL) {
-		Qiniu_Buffer_AppendFormat(&url, "/mimeType/%S", extra->mimeType);
+static Qiniu_Error Qiniu_Rio_blkHash_Reset(Qiniu_Rio_blkHash* self)
+{
+	self->crc32.val = 0;
+	self->pos = 0;
+	self->hashed = 0;
+	if (self->blk != NULL) {
+		return Qiniu_Qetag_ResetBlock(self->blk);
 	}
-	
-	// if (extra->customMeta != NULL) {
-	// 	Qiniu_Buffer_AppendFormat(&url, "/meta/%S", extra->customMeta);
-	// }
-	// if (extra->callbackParams != NULL) {
-	// 	Qiniu_Buffer_AppendFormat(&url, "/params/%S", extra->callbackParams);
-	// }
+	return Qiniu_OK;
+}
 
-	Qiniu_Buffer_Init(&body, 176 * blkCount);
+static void Qiniu_Rio_blkHash_Cleanup(Qiniu_Rio_blkHash* self)
+{
+	Qiniu_Qetag_DestroyBlock(self->blk);
+	self->blk = NULL;
+}
+
+static size_t Qiniu_Rio_blkHash_Fwrite(const void* buf, size_t cbelem, size_t n, Qiniu_Rio_blkHash* self)
+{
+	Qiniu_Uint32 skip;
+
+	self->crc32.val = Qiniu_Crc32_Update(self->crc32.val, buf, n);
+	if (self->blk != NULL && self->pos <= self->hashed && self->pos + n > self->hashed) {
+		skip = self->hashed - self->pos;
+		if (Qiniu_Qetag_UpdateBlock(self->blk, (const char*)buf + skip, n - skip, NULL).code != 200) {
+			return 0;
+		}
+		self->hashed = self->pos + (Qiniu_Uint32)n;
+	}
+	self->pos += (Qiniu_Uint32)n;
+	return n;
+}
+
+// Return the writer for a chunk starting at the given offset in the block.
+static Qiniu_Writer Qiniu_Rio_blkHash_Writer(Qiniu_Rio_blkHash* self, Qiniu_Uint32 pos)
+{
+	Qiniu_Writer writer = {self, (Qiniu_FnWrite)Qiniu_Rio_blkHash_Fwrite};
+	self->crc32.val = 0;
+	self->pos = pos;
+	return writer;
+}
+
+// Prepare the body of a chunk. If the file is mapped or the chunk is read ahead, the memory is hashed and
+// returned to be sent without copies. Otherwise the body is read through a tee which hashes the data on the fly.
+static const char* Qiniu_Rio_blkHash_Body(
+	Qiniu_Rio_blkHash* self, Qiniu_ReaderAt f, Qiniu_Int64 offbase, Qiniu_Uint32 pos, int bodyLength,
+	Qiniu_Section* section, Qiniu_Tee* tee, Qiniu_Reader* body)
+{
+	Qiniu_Writer h = Qiniu_Rio_blkHash_Writer(self, pos);
+	const char* bodyBuf = Qiniu_ReaderAt_Slice(f, (Qiniu_Off_T)offbase + pos, bodyLength);
+
+	if (bodyBuf == NULL && self->rah != NULL) {
+		bodyBuf = Qiniu_Rio_readahead_Get(self->rah, (int)pos, bodyLength);
+	}
+	if (bodyBuf != NULL) {
+		h.Write(bodyBuf, 1, bodyLength, h.self);
+		return bodyBuf;
+	}
+	*body = Qiniu_TeeReader(tee, Qiniu_SectionReader(section, f, (Qiniu_Off_T)offbase + pos, bodyLength), h);
+	return NULL;
+}
+
+static Qiniu_Error Qiniu_Rio_blkHash_Sum(
+	Qiniu_Rio_blkHash* self, Qiniu_ReaderAt f, Qiniu_Int64 offbase, int blkSize, unsigned char* digest)
+{
+	Qiniu_Error err;
+	char* buf;
+	size_t bytes;
+	ssize_t n;
+
+	if (self->hashed < (Qiniu_Uint32)blkSize) {
+		buf = (char*)malloc(defaultChunkSize);
+		if (buf == NULL) {
+			err.code = 499;
+			err.message = "No enough memory";
+			return err;
+		}
+		while (self->hashed < (Qiniu_Uint32)blkSize) {
+			bytes = blkSize - self->hashed;
+			if (bytes > defaultChunkSize) {
+				bytes = defaultChunkSize;
+			}
+			n = f.ReadAt(f.self, buf, bytes, (Qiniu_Off_T)offbase + self->hashed);
+			if (n <= 0) {
+				free(buf);
+				err.code = 9990;
+				err.message = "Failed in reading file";
+				return err;
+			}
+			err = Qiniu_Qetag_UpdateBlock(self->blk, buf, (size_t)n, NULL);
+			if (err.code != 200) {
+				free(buf);
+				return err;
+			}
+			self->hashed += (Qiniu_Uint32)n;
+		}
+		free(buf);
+	}
+	return Qiniu_Qetag_SumBlock(self->blk, digest);
+}
+
+static Qiniu_Error ErrUnmatchedQetag = {
+	Qiniu_Rio_UnmatchedQetag, "unmatched qetag"
+};
+
+static Qiniu_Error ErrUnverifiedQetag = {
+	Qiniu_Rio_UnverifiedQetag, "unverified qetag: no hash in the response"
+};
+
+static Qiniu_Error Qiniu_Rio_verifyQetag(Qiniu_Client* c, Qiniu_Rio_PutRet* ret, char* qetag)
+{
+	const char* hash = Qiniu_Json_GetString(c->root, "hash", NULL);
+	Qiniu_Error err = Qiniu_OK;
+
+	if (ret != NULL) {
+		Qiniu_snprintf(ret->qetag, sizeof(ret->qetag), "%s", qetag);
+	}
+	if (hash == NULL) {
+		Qiniu_Log_Warn("resumable.Put: no hash to verify the local qetag %s", qetag);
+		err = ErrUnverifiedQetag;
+	} else if (strcmp(hash, qetag) != 0) {
+		Qiniu_Log_Warn("resumable.Put: unmatched qetag, local %s, remote %s", qetag, hash);
+		err = ErrUnmatchedQetag;
+	}
+	free(qetag);
+	return err;
+}
+
+/*============================================================================*/
+/* type Qiniu_Rio_chunkSizer */
+
+#define adaptiveChunkTime	2.0 // seconds per bput
+#define adaptiveChunkAlign	(4 * 1024)
+#define minAdaptiveChunkSize	(64 * 1024)
+
+void Qiniu_Rio_chunkSizer_Init(Qiniu_Rio_chunkSizer* self, Qiniu_Rio_PutExtra* extra)
+{
+	memset(self, 0, sizeof(*self));
+	self->minSize = extra->minChunkSize > 0 ? extra->minChunkSize : minAdaptiveChunkSize;
+	self->minSize = (self->minSize + adaptiveChunkAlign - 1) / adaptiveChunkAlign * adaptiveChunkAlign;
+	self->maxSize = extra->maxChunkSize > 0 ? extra->maxChunkSize : (1 << blockBits);
+	self->maxSize = self->maxSize / adaptiveChunkAlign * adaptiveChunkAlign;
+	if (self->maxSize < self->minSize) {
+		self->maxSize = self->minSize;
+	}
+	self->size = extra->chunkSize / adaptiveChunkAlign * adaptiveChunkAlign;
+	if (self->size < self->minSize) {
+		self->size = self->minSize;
+	} else if (self->size > self->maxSize) {
+		self->size = self->maxSize;
+	}
+	Qiniu_Mutex_Init(&self->mutex);
+}
+
+void Qiniu_Rio_chunkSizer_Cleanup(Qiniu_Rio_chunkSizer* self)
+{
+	Qiniu_Mutex_Cleanup(&self->mutex);
+}
+
+// Every block adapts its own copy of the chunk sizer, which is loaded from and stored back to the one
+// shared by the Put.
+static void Qiniu_Rio_chunkSizer_Load(Qiniu_Rio_chunkSizer* self, Qiniu_Rio_chunkSizer* shared)
+{
+	Qiniu_Mutex_Lock(&shared->mutex);
+	self->size = shared->size;
+	self->minSize = shared->minSize;
+	self->maxSize = shared->maxSize;
+	self->rate = shared->rate;
+	self->errRate = shared->errRate;
+	Qiniu_Mutex_Unlock(&shared->mutex);
+}
+
+static void Qiniu_Rio_chunkSizer_Store(Qiniu_Rio_chunkSizer* self, Qiniu_Rio_chunkSizer* shared)
+{
+	Qiniu_Mutex_Lock(&shared->mutex);
+	shared->size = self->size;
+	shared->rate = self->rate;
+	shared->errRate = self->errRate;
+	Qiniu_Mutex_Unlock(&shared->mutex);
+}
+
+void Qiniu_Rio_chunkSizer_Update(Qiniu_Rio_chunkSizer* self, int bytes, double seconds, int ok)
+{
+	double size = self->size;
+	double sample;
+
+	if (seconds < 0) {
+		// The request is never sent, which says nothing about the link.
+		return;
+	}
+	if (ok) {
+		self->errRate *= 0.8;
+		if (seconds < 0.001) {
+			seconds = 0.001;
+		}
+		sample = bytes / seconds;
+		self->rate = (self->rate > 0) ? (self->rate * 0.7 + sample * 0.3) : sample;
+		size = self->rate * adaptiveChunkTime * (1.0 - self->errRate);
+		if (size > self->size * 2.0) {
+			size = self->size * 2.0;
+		}
+	} else {
+		self->errRate = self->errRate * 0.8 + 0.2;
+		size = self->size / 2.0;
+	}
+
+	if (size > self->maxSize) {
+		size = self->maxSize;
+	}
+	self->size = (int)size / adaptiveChunkAlign * adaptiveChunkAlign;
+	if (self->size < self->minSize) {
+		self->size = self->minSize;
+	}
+}
+
+// Forget the time of the former request, which curl keeps until the next one is performed. Only the
+// options of the handle are reset, and the next request sets them again.
+static void Qiniu_Rio_startRequest(Qiniu_Client* c)
+{
+	curl_easy_reset((CURL*)c->curl);
+}
+
+// Return the time spent by the last request of the client in seconds, or -1 if none is performed
+// since Qiniu_Rio_startRequest, e.g. when the body can not be read.
+static double Qiniu_Rio_lastRequestTime(Qiniu_Client* c)
+{
+	double seconds = 0;
+	curl_easy_getinfo((CURL*)c->curl, CURLINFO_TOTAL_TIME, &seconds);
+	return (seconds > 0) ? seconds : -1;
+}
+
+/*============================================================================*/
+
+static Qiniu_Error ErrUnmatchedChecksum = {
+	Qiniu_Rio_UnmatchedChecksum, "unmatched checksum"
+};
+
+static int Qiniu_TemporaryError(int code) {
+	return code != 401;
+}
+
+static Qiniu_Error Qiniu_Rio_ResumableBlockput(
+	Qiniu_Client* c, Qiniu_Rio_BlkputRet* ret, Qiniu_ReaderAt f, int blkIdx, int blkSize, Qiniu_Rio_PutExtra* extra,
+	Qiniu_Rio_blkHash* hash, Qiniu_Rio_chunkSizer* sizer)
+{
+	Qiniu_Error err = {200, NULL};
+	Qiniu_Tee tee;
+	Qiniu_Section section;
+	Qiniu_Reader body;
+	const char* bodyBuf;
+
+	Qiniu_Int64 offbase = (Qiniu_Int64)(blkIdx) << blockBits;
+
+	int chunkSize = sizer ? sizer->size : extra->chunkSize;
+	int bodyLength;
+	int tryTimes;
+    int notifyRet = 0;
+
+	// Let a mapped file read the block ahead.
+	Qiniu_ReaderAt_Slice(f, (Qiniu_Off_T)offbase, blkSize);
+
+	if (ret->ctx == NULL) {
+
+		if (chunkSize < blkSize) {
+			bodyLength = chunkSize;
+		} else {
+			bodyLength = blkSize;
+		}
+
+		bodyBuf = Qiniu_Rio_blkHash_Body(hash, f, offbase, 0, bodyLength, &section, &tee, &body);
+
+		if (sizer) {
+			Qiniu_Rio_startRequest(c);
+		}
+		err = Qiniu_Rio_Mkblock(c, ret, blkSize, body, bodyBuf, bodyLength, extra);
+		if (sizer) {
+			Qiniu_Rio_chunkSizer_Update(sizer, bodyLength, Qiniu_Rio_lastRequestTime(c), err.code == 200);
+			chunkSize = sizer->size;
+		}
+		if (err.code != 200) {
+			return err;
+		}
+		if (ret->crc32 != hash->crc32.val || (int)(ret->offset) != bodyLength) {
+			return ErrUnmatchedChecksum;
+		}
+		notifyRet = extra->notify(extra->notifyRecvr, blkIdx, blkSize, ret);
+        if (notifyRet == QINIU_RIO_NOTIFY_EXIT) {
+            // Terminate the upload process if  the caller requests
+            err.code = Qiniu_Rio_PutInterrupted;
+            err.message = "Interrupted by the caller";
+            return err;
+        }
+	}
+
+	tryTimes = extra->tryTimes;
+
+	while ((int)(ret->offset) < blkSize) {
+
+		if (chunkSize < blkSize - (int)(ret->offset)) {
+			bodyLength = chunkSize;
+		} else {
+			bodyLength = blkSize - (int)(ret->offset);
+		}
+
+		bodyBuf = Qiniu_Rio_blkHash_Body(hash, f, offbase, ret->offset, bodyLength, &section, &tee, &body);
+
+		if (sizer) {
+			Qiniu_Rio_startRequest(c);
+		}
+		err = Qiniu_Rio_Blockput(c, ret, body, bodyBuf, bodyLength);
+		if (sizer) {
+			Qiniu_Rio_chunkSizer_Update(sizer, bodyLength, Qiniu_Rio_lastRequestTime(c), err.code == 200);
+			chunkSize = sizer->size;
+		}
+		if (err.code == 200) {
+			if (ret->crc32 == hash->crc32.val) {
+				tryTimes = extra->tryTimes;
+				notifyRet = extra->notify(extra->notifyRecvr, blkIdx, blkSize, ret);
+                if (notifyRet == QINIU_RIO_NOTIFY_EXIT) {
+                    // Terminate the upload process if the caller requests
+                    err.code = Qiniu_Rio_PutInterrupted;
+                    err.message = "Interrupted by the caller";
+                    return err;
+                }
+
+				continue;
+			}
+			Qiniu_Log_Warn("ResumableBlockput: invalid checksum, retry");
+			err = ErrUnmatchedChecksum;
+		} else {
+			if (err.code == Qiniu_Rio_InvalidCtx) {
+				Qiniu_Rio_BlkputRet_Cleanup(ret); // reset
+				Qiniu_Log_Warn("ResumableBlockput: invalid ctx, please retry");
+				return err;
+			}
+			Qiniu_Log_Warn("ResumableBlockput %d off:%d failed - %E", blkIdx, (int)ret->offset, err);
+		}
+		if (tryTimes > 1 && Qiniu_TemporaryError(err.code)) {
+			tryTimes--;
+			Qiniu_Log_Info("ResumableBlockput %E, retrying ...", err);
+			continue;
+		}
+		break;
+	}
+	return err;
+}
+
+/*============================================================================*/
+
+static Qiniu_Error Qiniu_Rio_Mkfile(
+	Qiniu_Client* c, Qiniu_Rio_PutRet* ret, const char* key, Qiniu_Int64 fsize, Qiniu_Rio_PutExtra* extra)
+{
+	size_t i, blkCount = extra->blockCnt;
+	Qiniu_Json* root;
+	Qiniu_Error err;
+	Qiniu_Rio_BlkputRet* prog;
+	Qiniu_Buffer url, body;
+
+	Qiniu_Buffer_Init(&url, 1024);
+	Qiniu_Buffer_AppendFormat(&url, "%s/mkfile/%D", extra->upHost, fsize);
+
+	if (NULL != key) {
+		Qiniu_Buffer_AppendFormat(&url, "/key/%S", key);
+	}
+
+	if (extra->mimeType != NULL) {
+		Qiniu_Buffer_AppendFormat(&url, "/mimeType/%S", extra->mimeType);
+	}
+	
+	// if (extra->customMeta != NULL) {
+	// 	Qiniu_Buffer_AppendFormat(&url, "/meta/%S", extra->customMeta);
+	// }
+	// if (extra->callbackParams != NULL) {
+	// 	Qiniu_Buffer_AppendFormat(&url, "/params/%S", extra->callbackParams);
+	// }
+
+	Qiniu_Buffer_Init(&body, 176 * blkCount);
 	for (i = 0; i < blkCount; i++) {
 		prog = &extra->progresses[i];
 		Qiniu_Buffer_Write(&body, prog->ctx, strlen(prog->ctx));
@@ -554,6 +1372,7 @@ static Qiniu_Error Qiniu_Rio_Mkfile(
 		} else {
 			ret->hash = Qiniu_Json_GetString(root, "hash", NULL);
 			ret->key = Qiniu_Json_GetString(root, "key", NULL);
+			ret->qetag[0] = '\0';
 		}
 	}
 	return err;
@@ -573,29 +1392,11 @@ static Qiniu_Error Qiniu_Rio_Mkfile2(
 
 	Qiniu_Buffer_Init(&url, 2048);
 
-	//// For using multi-region storage.
-	{
-		if ((upHost = extra->upHost) == NULL) {
-			if (Qiniu_Rgn_IsEnabled()) {
-				if (extra->upBucket && extra->accessKey) {
-					err = Qiniu_Rgn_Table_GetHost(c->regionTable, c, extra->upBucket, extra->accessKey, extra->upHostFlags, &upHost, &upHostVote);
-				} else {
-					err = Qiniu_Rgn_Table_GetHostByUptoken(c->regionTable, c, extra->uptoken, extra->upHostFlags, &upHost, &upHostVote);
-				} // if
-				if (err.code != 200) {
-					return err;
-				} // if
-			} else {
-				upHost = QINIU_UP_HOST;
-			} // if
-
-			if (upHost == NULL) {
-				err.code = 9988;
-				err.message = "No proper upload host name";
-				return err;
-			} // if
-		} // if
-	} 
+	err = Qiniu_Rio_upHost(c, extra, &upHost, &upHostVote);
+	if (err.code != 200) {
+		Qiniu_Buffer_Cleanup(&url);
+		return err;
+	} // if
 
 	Qiniu_Buffer_AppendFormat(&url, "%s/mkfile/%D", upHost, fsize);
 
@@ -635,6 +1436,7 @@ static Qiniu_Error Qiniu_Rio_Mkfile2(
 	if (err.code == 200) {
 		ret->hash = Qiniu_Json_GetString(root, "hash", NULL);
 		ret->key = Qiniu_Json_GetString(root, "key", NULL);
+		ret->qetag[0] = '\0';
 	}
 	return err;
 }
@@ -654,91 +1456,493 @@ typedef struct _Qiniu_Rio_task {
 	Qiniu_Client* mc;
 	Qiniu_Rio_PutExtra* extra;
 	Qiniu_Rio_WaitGroup wg;
-	int* nfails;
+	Qiniu_Count* nfails;
 	Qiniu_Count* ninterrupts;
+	Qiniu_Rio_BlkputRet* progress;
+	unsigned char* digest;
+	Qiniu_Rio_bufPool* pool;
+	Qiniu_Rio_chunkSizer* sizer;
+	void (*onDone)(void* recvr, struct _Qiniu_Rio_task* task);
+	void* doneRecvr;
 	int blkIdx;
 	int blkSize1;
 } Qiniu_Rio_task;
 
+static void Qiniu_Rio_task_finish(Qiniu_Rio_task* task)
+{
+	Qiniu_Rio_WaitGroup wg = task->wg;
+
+	if (task->onDone != NULL) {
+		task->onDone(task->doneRecvr, task);
+	}
+	free(task);
+	wg.itbl->Done(wg.self);
+}
+
 static void Qiniu_Rio_doTask(void* params)
 {
 	Qiniu_Error err;
 	Qiniu_Rio_BlkputRet ret;
 	Qiniu_Rio_task* task = (Qiniu_Rio_task*)params;
-	Qiniu_Rio_WaitGroup wg = task->wg;
 	Qiniu_Rio_PutExtra* extra = task->extra;
 	Qiniu_Rio_ThreadModel tm = extra->threadModel;
 	Qiniu_Client* c = tm.itbl->ClientTls(tm.self, task->mc);
+	Qiniu_Rio_blkHash hash;
+	Qiniu_Rio_readahead rah;
+	Qiniu_Rio_chunkSizer sizer;
 	int blkIdx = task->blkIdx;
 	int tryTimes = extra->tryTimes;
 
 	if ((*task->ninterrupts) > 0) {
-		free(task);
 		Qiniu_Count_Inc(task->ninterrupts);
-		wg.itbl->Done(wg.self);
+		Qiniu_Rio_task_finish(task);
 		return;
 	}
 
 	memset(&ret, 0, sizeof(ret));
 
+	err = Qiniu_Rio_blkHash_Init(&hash, task->digest != NULL);
+	if (err.code != 200) {
+		goto lzFail;
+	}
+
 lzRetry:
-	Qiniu_Rio_BlkputRet_Assign(&ret, &extra->progresses[blkIdx]);
-	err = Qiniu_Rio_ResumableBlockput(c, &ret, task->f, blkIdx, task->blkSize1, extra);
+	Qiniu_Rio_BlkputRet_Assign(&ret, task->progress);
+	if (task->pool != NULL && Qiniu_Rio_readahead_Start(&rah, task->pool, extra->readaheadDepth, task->f,
+			(Qiniu_Int64)(blkIdx) << blockBits, task->blkSize1, extra->chunkSize,
+			ret.ctx != NULL ? (int)ret.offset : 0) == 0) {
+		hash.rah = &rah;
+	}
+	if (task->sizer != NULL) {
+		Qiniu_Rio_chunkSizer_Load(&sizer, task->sizer);
+	}
+	err = Qiniu_Rio_ResumableBlockput(
+		c, &ret, task->f, blkIdx, task->blkSize1, extra, &hash, task->sizer ? &sizer : NULL);
+	if (task->sizer != NULL) {
+		Qiniu_Rio_chunkSizer_Store(&sizer, task->sizer);
+	}
+	if (hash.rah != NULL) {
+		Qiniu_Rio_readahead_Stop(hash.rah);
+		hash.rah = NULL;
+	}
+	if (err.code == 200 && hash.blk != NULL) {
+		err = Qiniu_Rio_blkHash_Sum(&hash, task->f, (Qiniu_Int64)(blkIdx) << blockBits, task->blkSize1, task->digest);
+	}
 	if (err.code != 200) {
         if (err.code == Qiniu_Rio_PutInterrupted) {
             // Terminate the upload process if the caller requests
 			Qiniu_Rio_BlkputRet_Cleanup(&ret);
+			Qiniu_Rio_blkHash_Cleanup(&hash);
 			Qiniu_Count_Inc(task->ninterrupts);
-			free(task);
-			wg.itbl->Done(wg.self);
+			Qiniu_Rio_task_finish(task);
             return;
         }
 
+		if (err.code == Qiniu_Rio_InvalidCtx) {
+			// The saved progress is stale, e.g. loaded from an old journal, so restart the block.
+			Qiniu_Rio_BlkputRet_Cleanup(task->progress);
+		}
 		if (tryTimes > 1 && Qiniu_TemporaryError(err.code)) {
 			tryTimes--;
 			Qiniu_Log_Info("resumable.Put %E, retrying ...", err);
 			goto lzRetry;
 		}
+lzFail:
 		Qiniu_Log_Warn("resumable.Put %d failed: %E", blkIdx, err);
 		extra->notifyErr(extra->notifyRecvr, task->blkIdx, task->blkSize1, err);
-		(*task->nfails)++;
+		Qiniu_Count_Inc(task->nfails);
 	} else {
-		Qiniu_Rio_BlkputRet_Assign(&extra->progresses[blkIdx], &ret);
+		Qiniu_Rio_BlkputRet_Assign(task->progress, &ret);
 	}
 	Qiniu_Rio_BlkputRet_Cleanup(&ret);
-	free(task);
-	wg.itbl->Done(wg.self);
+	Qiniu_Rio_blkHash_Cleanup(&hash);
+	Qiniu_Rio_task_finish(task);
 }
 
 /*============================================================================*/
-/* func Qiniu_Rio_PutXXX */
+/* type Qiniu_Rio_journal */
 
-static Qiniu_Error ErrPutFailed = {
-	Qiniu_Rio_PutFailed, "resumable put failed"
-};
-static Qiniu_Error ErrPutInterrupted = {
-	Qiniu_Rio_PutInterrupted, "resumable put interrupted"
+#define QINIU_RIO_JOURNAL_MAGIC		0x4a52514e // "NQRJ"
+#define QINIU_RIO_JOURNAL_VERSION	1
+
+typedef struct _Qiniu_Rio_journalHeader {
+	Qiniu_Uint32 magic;
+	Qiniu_Uint32 version;
+	Qiniu_Int64 fsize;
+	Qiniu_Int64 mtime;
+	Qiniu_Uint32 blockCnt;
+	Qiniu_Uint32 keyCrc32;
+	Qiniu_Uint32 checksum;
+} Qiniu_Rio_journalHeader;
+
+// Every block owns two slots, and an update always overwrites the older one. So a torn write caused
+// by a crash only destroys the slot being written, while the last acknowledged progress survives.
+typedef struct _Qiniu_Rio_journalSlot {
+	Qiniu_Uint32 seq;
+	Qiniu_Uint32 offset;
+	Qiniu_Uint32 crc32;
+	char ctx[224];
+	char host[80];
+	Qiniu_Uint32 checksum;
+} Qiniu_Rio_journalSlot;
+
+typedef struct _Qiniu_Rio_journal {
+	char* base;
+	size_t size;
+	size_t blockCnt;
+	Qiniu_Rio_journalSlot* slots;
+
+	void* notifyRecvr;
+	Qiniu_Rio_FnNotify notify;
+	Qiniu_Rio_FnNotifyErr notifyErr;
+
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+} Qiniu_Rio_journal;
+
+static Qiniu_Error ErrJournalFailed = {
+	9984, "Can not map the journal file"
 };
 
-Qiniu_Error Qiniu_Rio_Put(
-	Qiniu_Client* self, Qiniu_Rio_PutRet* ret,
-	const char* uptoken, const char* key, Qiniu_ReaderAt f, Qiniu_Int64 fsize, Qiniu_Rio_PutExtra* extra1)
+#if defined(_WIN32)
+
+static Qiniu_Error Qiniu_Rio_journal_map(Qiniu_Rio_journal* self, const char* path)
 {
-	Qiniu_Int64 offbase;
-	Qiniu_Rio_task* task;
-	Qiniu_Rio_WaitGroup wg;
-	Qiniu_Rio_PutExtra extra;
-	Qiniu_Rio_ThreadModel tm;
-	Qiniu_Auth auth, auth1 = self->auth;
-	int i, last, blkSize;
-	int nfails;
-    int retCode;
+	LARGE_INTEGER size;
+
+	self->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (self->file == INVALID_HANDLE_VALUE) {
+		return ErrJournalFailed;
+	}
+	size.QuadPart = (LONGLONG)self->size;
+	self->mapping = CreateFileMappingA(self->file, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, NULL);
+	if (self->mapping == NULL) {
+		CloseHandle(self->file);
+		return ErrJournalFailed;
+	}
+	self->base = (char*)MapViewOfFile(self->mapping, FILE_MAP_ALL_ACCESS, 0, 0, self->size);
+	if (self->base == NULL) {
+		CloseHandle(self->mapping);
+		CloseHandle(self->file);
+		return ErrJournalFailed;
+	}
+	return Qiniu_OK;
+}
+
+static void Qiniu_Rio_journal_sync(Qiniu_Rio_journal* self, void* p, size_t n)
+{
+	FlushViewOfFile(p, n);
+}
+
+static void Qiniu_Rio_journal_unmap(Qiniu_Rio_journal* self)
+{
+	UnmapViewOfFile(self->base);
+	CloseHandle(self->mapping);
+	CloseHandle(self->file);
+}
+
+#else
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static Qiniu_Error Qiniu_Rio_journal_map(Qiniu_Rio_journal* self, const char* path)
+{
+	struct stat st;
+
+	self->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (self->fd < 0) {
+		return ErrJournalFailed;
+	}
+	if (fstat(self->fd, &st) != 0 || ((size_t)st.st_size != self->size && ftruncate(self->fd, (off_t)self->size) != 0)) {
+		close(self->fd);
+		return ErrJournalFailed;
+	}
+	self->base = (char*)mmap(NULL, self->size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+	if (self->base == (char*)MAP_FAILED) {
+		close(self->fd);
+		return ErrJournalFailed;
+	}
+	return Qiniu_OK;
+}
+
+static void Qiniu_Rio_journal_sync(Qiniu_Rio_journal* self, void* p, size_t n)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t off = ((char*)p - self->base) / page * page;
+
+	msync(self->base + off, (char*)p + n - (self->base + off), MS_ASYNC);
+}
+
+static void Qiniu_Rio_journal_unmap(Qiniu_Rio_journal* self)
+{
+	munmap(self->base, self->size);
+	close(self->fd);
+}
+
+#endif
+
+static Qiniu_Uint32 Qiniu_Rio_journal_keyCrc32(const char* key)
+{
+	return (key == NULL) ? 0xFFFFFFFF : (Qiniu_Uint32)Qiniu_Crc32_Update(0, key, strlen(key));
+}
+
+// Open the journal of the given file, and return whether the saved progresses can be reused by it.
+static Qiniu_Error Qiniu_Rio_journal_Open(
+	Qiniu_Rio_journal* self, const char* path, Qiniu_Int64 fsize, Qiniu_Int64 mtime, const char* key,
+	size_t blockCnt, Qiniu_Bool* reused)
+{
+	Qiniu_Error err;
+	Qiniu_Rio_journalHeader hdr, *saved;
+
+	memset(self, 0, sizeof(*self));
+	self->blockCnt = blockCnt;
+	self->size = sizeof(Qiniu_Rio_journalHeader) + sizeof(Qiniu_Rio_journalSlot) * 2 * blockCnt;
+
+	err = Qiniu_Rio_journal_map(self, path);
+	if (err.code != 200) {
+		return err;
+	}
+	saved = (Qiniu_Rio_journalHeader*)self->base;
+	self->slots = (Qiniu_Rio_journalSlot*)(self->base + sizeof(Qiniu_Rio_journalHeader));
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = QINIU_RIO_JOURNAL_MAGIC;
+	hdr.version = QINIU_RIO_JOURNAL_VERSION;
+	hdr.fsize = fsize;
+	hdr.mtime = mtime;
+	hdr.blockCnt = (Qiniu_Uint32)blockCnt;
+	hdr.keyCrc32 = Qiniu_Rio_journal_keyCrc32(key);
+	hdr.checksum = (Qiniu_Uint32)Qiniu_Crc32_Update(0, &hdr, offsetof(Qiniu_Rio_journalHeader, checksum));
+
+	*reused = (memcmp(saved, &hdr, sizeof(hdr)) == 0);
+	if (!*reused) {
+		// The file is changed, or the journal belongs to another upload.
+		memset(self->base, 0, self->size);
+		memcpy(saved, &hdr, sizeof(hdr));
+		Qiniu_Rio_journal_sync(self, self->base, self->size);
+	}
+	return Qiniu_OK;
+}
+
+static void Qiniu_Rio_journal_Close(Qiniu_Rio_journal* self, const char* path, Qiniu_Bool done)
+{
+	Qiniu_Rio_journal_unmap(self);
+	if (done) {
+		remove(path);
+	}
+}
+
+static Qiniu_Bool Qiniu_Rio_journalSlot_IsValid(Qiniu_Rio_journalSlot* slot)
+{
+	return slot->seq != 0 &&
+		slot->checksum == (Qiniu_Uint32)Qiniu_Crc32_Update(0, slot, offsetof(Qiniu_Rio_journalSlot, checksum));
+}
+
+static Qiniu_Rio_journalSlot* Qiniu_Rio_journal_latest(Qiniu_Rio_journal* self, size_t blkIdx)
+{
+	Qiniu_Rio_journalSlot* a = &self->slots[blkIdx * 2];
+	Qiniu_Rio_journalSlot* b = a + 1;
+
+	if (!Qiniu_Rio_journalSlot_IsValid(a)) {
+		return Qiniu_Rio_journalSlot_IsValid(b) ? b : NULL;
+	}
+	if (!Qiniu_Rio_journalSlot_IsValid(b)) {
+		return a;
+	}
+	return (b->seq > a->seq) ? b : a;
+}
+
+// The loaded progresses point to the mapped memory, and must be copied before the next update.
+static void Qiniu_Rio_journal_Load(Qiniu_Rio_journal* self, Qiniu_Rio_BlkputRet* progresses)
+{
+	size_t i;
+	Qiniu_Rio_journalSlot* slot;
+
+	for (i = 0; i < self->blockCnt; i++) {
+		memset(&progresses[i], 0, sizeof(progresses[i]));
+		slot = Qiniu_Rio_journal_latest(self, i);
+		if (slot == NULL || slot->ctx[0] == '\0' || slot->offset == 0) {
+			continue;
+		}
+		progresses[i].ctx = slot->ctx;
+		progresses[i].host = slot->host;
+		progresses[i].offset = slot->offset;
+		progresses[i].crc32 = slot->crc32;
+	}
+}
+
+// Blocks are owned by one task at a time, so concurrent updates never touch the same slots.
+static int Qiniu_Rio_journal_Notify(void* recvr, int blkIdx, int blkSize, Qiniu_Rio_BlkputRet* ret)
+{
+	Qiniu_Rio_journal* self = (Qiniu_Rio_journal*)recvr;
+	Qiniu_Rio_journalSlot* latest = Qiniu_Rio_journal_latest(self, blkIdx);
+	Qiniu_Rio_journalSlot* slot = &self->slots[blkIdx * 2];
+	size_t ctxLen = strlen(ret->ctx);
+	size_t hostLen = strlen(ret->host);
+
+	if (ctxLen < sizeof(slot->ctx) && hostLen < sizeof(slot->host)) {
+		if (latest == slot) {
+			slot++;
+		}
+		memset(slot, 0, sizeof(*slot));
+		slot->seq = (latest == NULL) ? 1 : latest->seq + 1;
+		slot->offset = ret->offset;
+		slot->crc32 = ret->crc32;
+		memcpy(slot->ctx, ret->ctx, ctxLen);
+		memcpy(slot->host, ret->host, hostLen);
+		slot->checksum = (Qiniu_Uint32)Qiniu_Crc32_Update(0, slot, offsetof(Qiniu_Rio_journalSlot, checksum));
+		Qiniu_Rio_journal_sync(self, slot, sizeof(*slot));
+	} else {
+		Qiniu_Log_Warn("resumable.Put: the progress of block %d is too long to be journaled", blkIdx);
+	}
+	return self->notify(self->notifyRecvr, blkIdx, blkSize, ret);
+}
+
+// A block rejected for its context is dropped from the journal, so that the next upload restarts it.
+static int Qiniu_Rio_journal_NotifyErr(void* recvr, int blkIdx, int blkSize, Qiniu_Error err)
+{
+	Qiniu_Rio_journal* self = (Qiniu_Rio_journal*)recvr;
+	Qiniu_Rio_journalSlot* slot = &self->slots[blkIdx * 2];
+
+	if (err.code == Qiniu_Rio_InvalidCtx) {
+		memset(slot, 0, sizeof(*slot) * 2);
+		Qiniu_Rio_journal_sync(self, slot, sizeof(*slot) * 2);
+	}
+	return self->notifyErr(self->notifyRecvr, blkIdx, blkSize, err);
+}
+
+static Qiniu_Error Qiniu_Rio_putWithJournal(
+	Qiniu_Client* self, Qiniu_Rio_PutRet* ret, const char* uptoken, const char* key,
+	Qiniu_ReaderAt f, Qiniu_Int64 fsize, Qiniu_Int64 mtime, Qiniu_Rio_PutExtra* extra)
+{
+	Qiniu_Error err;
+	Qiniu_Rio_journal journal;
+	Qiniu_Rio_PutExtra extra1 = *extra;
+	Qiniu_Rio_BlkputRet* progresses = NULL;
+	Qiniu_Bool reused = Qiniu_False;
+	size_t blockCnt = (size_t)Qiniu_Rio_BlockCount(fsize);
+
+	err = Qiniu_Rio_journal_Open(&journal, extra->journalFile, fsize, mtime, key, blockCnt, &reused);
+	if (err.code != 200) {
+		return err;
+	}
+
+	// The progresses given by the caller take precedence over the journal.
+	if (reused && extra->progresses == NULL && blockCnt > 0) {
+		progresses = (Qiniu_Rio_BlkputRet*)malloc(sizeof(Qiniu_Rio_BlkputRet) * blockCnt);
+		if (progresses == NULL) {
+			Qiniu_Rio_journal_Close(&journal, extra->journalFile, Qiniu_False);
+			err.code = 499;
+			err.message = "No enough memory";
+			return err;
+		}
+		Qiniu_Rio_journal_Load(&journal, progresses);
+		extra1.progresses = progresses;
+		extra1.blockCnt = blockCnt;
+	}
+
+	journal.notify = (extra->notify != NULL) ? extra->notify : notifyNil;
+	journal.notifyErr = (extra->notifyErr != NULL) ? extra->notifyErr : notifyErrNil;
+	journal.notifyRecvr = extra->notifyRecvr;
+	extra1.notify = Qiniu_Rio_journal_Notify;
+	extra1.notifyErr = Qiniu_Rio_journal_NotifyErr;
+	extra1.notifyRecvr = &journal;
+
+	err = Qiniu_Rio_Put(self, ret, uptoken, key, f, fsize, &extra1);
+	if (err.code == Qiniu_Rio_InvalidCtx && progresses != NULL) {
+		// A context rejected by mkfile belongs to a finished block, so none of the journaled
+		// progresses is trusted, and the file is uploaded again from the beginning.
+		Qiniu_Log_Warn("resumable.Put: the journaled progresses are stale, restarting ...");
+		memset(journal.slots, 0, sizeof(Qiniu_Rio_journalSlot) * 2 * blockCnt);
+		Qiniu_Rio_journal_sync(&journal, journal.slots, sizeof(Qiniu_Rio_journalSlot) * 2 * blockCnt);
+		extra1.progresses = NULL;
+		extra1.blockCnt = 0;
+		err = Qiniu_Rio_Put(self, ret, uptoken, key, f, fsize, &extra1);
+	}
+
+	free(progresses);
+	Qiniu_Rio_journal_Close(&journal, extra->journalFile, err.code == 200);
+	return err;
+}
+
+/*============================================================================*/
+/* func Qiniu_Rio_PutXXX */
+
+static Qiniu_Error ErrPutFailed = {
+	Qiniu_Rio_PutFailed, "resumable put failed"
+};
+static Qiniu_Error ErrPutInterrupted = {
+	Qiniu_Rio_PutInterrupted, "resumable put interrupted"
+};
+
+Qiniu_Error Qiniu_Rio_Put(
+	Qiniu_Client* self, Qiniu_Rio_PutRet* ret,
+	const char* uptoken, const char* key, Qiniu_ReaderAt f, Qiniu_Int64 fsize, Qiniu_Rio_PutExtra* extra1)
+{
+	Qiniu_Int64 offbase;
+	Qiniu_Rio_task* task;
+	Qiniu_Rio_WaitGroup wg;
+	Qiniu_Rio_PutExtra extra;
+	Qiniu_Rio_ThreadModel tm;
+	Qiniu_Auth auth, auth1 = self->auth;
+	int i, last, blkSize;
+	Qiniu_Count nfails;
+    int retCode;
     Qiniu_Count ninterrupts;
+	unsigned char* digests = NULL;
+	char* qetag = NULL;
+	Qiniu_Rio_bufPool pool;
+	Qiniu_Rio_bufPool* ppool = NULL;
+	Qiniu_Int64 poolLimit;
+	Qiniu_Rio_chunkSizer sizer;
 	Qiniu_Error err = Qiniu_Rio_PutExtra_Init(&extra, fsize, extra1);
 	if (err.code != 200) {
 		return err;
 	}
 
+	if (extra.checkQetag) {
+		digests = (unsigned char*)malloc(QINIU_QETAG_BLOCK_DIGEST_SIZE * (extra.blockCnt + 1));
+		if (digests == NULL) {
+			Qiniu_Rio_PutExtra_Cleanup(&extra);
+			err.code = 499;
+			err.message = "No enough memory";
+			return err;
+		}
+	}
+
+	// A mapped file is read ahead by the system already.
+	if (extra.readaheadDepth > 0 && !extra.adaptiveChunkSize && f.ReadAt != Qiniu_MappedFile_ReadAt) {
+		if (extra.chunkSize > (1 << blockBits)) {
+			extra.chunkSize = 1 << blockBits;
+		}
+		if (extra.readaheadMemLimit > 0) {
+			poolLimit = (Qiniu_Int64)(extra.readaheadMemLimit / extra.chunkSize);
+		} else {
+			poolLimit = (Qiniu_Int64)extra.readaheadDepth * settings.workers;
+		}
+		if (poolLimit > (Qiniu_Int64)extra.readaheadDepth * extra.blockCnt) {
+			poolLimit = (Qiniu_Int64)extra.readaheadDepth * extra.blockCnt;
+		}
+		if (poolLimit > 0) {
+			err = Qiniu_Rio_bufPool_Init(&pool, (int)poolLimit, extra.chunkSize);
+			if (err.code != 200) {
+				Qiniu_Rio_PutExtra_Cleanup(&extra);
+				free(digests);
+				return err;
+			}
+			ppool = &pool;
+		}
+	}
+	if (extra.adaptiveChunkSize) {
+		Qiniu_Rio_chunkSizer_Init(&sizer, &extra);
+	}
+
 	//// For using multi-region storage.
 	{
 		if (Qiniu_Rgn_IsEnabled()) {
@@ -750,6 +1954,19 @@ Qiniu_Error Qiniu_Rio_Put(
 
 	tm = extra.threadModel;
 	wg = tm.itbl->WaitGroup(tm.self);
+	if (wg.itbl == NULL) {
+		Qiniu_Rio_PutExtra_Cleanup(&extra);
+		free(digests);
+		if (ppool != NULL) {
+			Qiniu_Rio_bufPool_Cleanup(ppool);
+		}
+		if (extra.adaptiveChunkSize) {
+			Qiniu_Rio_chunkSizer_Cleanup(&sizer);
+		}
+		err.code = 499;
+		err.message = "No enough memory";
+		return err;
+	}
 
 	last = extra.blockCnt - 1;
 	blkSize = 1 << blockBits;
@@ -766,6 +1983,11 @@ Qiniu_Error Qiniu_Rio_Put(
 		task->wg = wg;
 		task->nfails = &nfails;
 		task->ninterrupts = &ninterrupts;
+		task->progress = &extra.progresses[i];
+		task->digest = digests ? &digests[i * QINIU_QETAG_BLOCK_DIGEST_SIZE] : NULL;
+		task->pool = ppool;
+		task->sizer = extra.adaptiveChunkSize ? &sizer : NULL;
+		task->onDone = NULL;
 		task->blkIdx = i;
 		task->blkSize1 = blkSize;
 		if (i == last) {
@@ -793,9 +2015,22 @@ Qiniu_Error Qiniu_Rio_Put(
 		err = ErrPutInterrupted;
 	} else {
 		err = Qiniu_Rio_Mkfile2(self, ret, key, fsize, &extra);
+		if (err.code == 200 && digests != NULL) {
+			err = Qiniu_Qetag_SumBlockDigests(digests, extra.blockCnt, &qetag);
+			if (err.code == 200) {
+				err = Qiniu_Rio_verifyQetag(self, ret, qetag);
+			}
+		}
 	}
 
 	Qiniu_Rio_PutExtra_Cleanup(&extra);
+	free(digests);
+	if (ppool != NULL) {
+		Qiniu_Rio_bufPool_Cleanup(ppool);
+	}
+	if (extra.adaptiveChunkSize) {
+		Qiniu_Rio_chunkSizer_Cleanup(&sizer);
+	}
 
 	wg.itbl->Release(wg.self);
 	auth.itbl->Release(auth.self);
@@ -811,6 +2046,9 @@ Qiniu_Error Qiniu_Rio_PutFile(
 	Qiniu_Int64 fsize;
 	Qiniu_FileInfo fi;
 	Qiniu_File* f;
+	Qiniu_MappedFile* mf = NULL;
+	Qiniu_ReaderAt fr;
+	char* qetag = NULL;
 	Qiniu_Error err = Qiniu_File_Open(&f, localFile);
 	if (err.code != 200) {
 		return err;
@@ -824,11 +2062,779 @@ Qiniu_Error Qiniu_Rio_PutFile(
 			Qiniu_Zero(extra1);
 			Qiniu_Io_PutExtra_initFrom(&extra1, extra);
 
-			return Qiniu_Io_PutFile(self, ret, uptoken, key, localFile, &extra1);
+			err = Qiniu_Io_PutFile(self, ret, uptoken, key, localFile, &extra1);
+			if (err.code == 200 && extra != NULL && extra->checkQetag) {
+				// The file fits in one request, so it is hashed separately.
+				err = Qiniu_Qetag_DigestFile(localFile, &qetag);
+				if (err.code == 200) {
+					err = Qiniu_Rio_verifyQetag(self, ret, qetag);
+				}
+			}
+			return err;
+		}
+
+		// Send chunks from the mapped file without copies if asked, or fall back to reading it.
+		fr = Qiniu_FileReaderAt(f);
+		if (extra != NULL && extra->mapFile && Qiniu_MappedFile_Open(&mf, localFile).code == 200) {
+			fr = Qiniu_MappedFileReaderAt(mf);
+		}
+
+		if (extra != NULL && extra->journalFile != NULL) {
+			err = Qiniu_Rio_putWithJournal(self, ret, uptoken, key, fr, fsize, (Qiniu_Int64)fi.st_mtime, extra);
+		} else {
+			err = Qiniu_Rio_Put(self, ret, uptoken, key, fr, fsize, extra);
+		}
+
+		if (mf != NULL) {
+			Qiniu_MappedFile_Close(mf);
 		}
-		err = Qiniu_Rio_Put(self, ret, uptoken, key, Qiniu_FileReaderAt(f), fsize, extra);
 	}
 	Qiniu_File_Close(f);
 	return err;
 }
 
+
+/*============================================================================*/
+/* func Qiniu_Rio_PutStream */
+
+// The failures are counted by the workers while the stream is still being read.
+#if defined(_WIN32)
+#define Qiniu_Rio_loadCount(p)	InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+#else
+#define Qiniu_Rio_loadCount(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#endif
+
+// A block of the stream, which is uploaded from memory. The progress and the digest of the block
+// are moved to the arrays of the whole stream once the upload of it is done, then the buffer is reused.
+typedef struct _Qiniu_Rio_streamBlock {
+	char* buf;
+	Qiniu_Int64 offbase;
+	size_t size;
+	Qiniu_Rio_BlkputRet progress;
+	unsigned char digest[QINIU_QETAG_BLOCK_DIGEST_SIZE];
+	int busy;
+} Qiniu_Rio_streamBlock;
+
+typedef struct _Qiniu_Rio_stream {
+	Qiniu_Mutex mutex;
+	Qiniu_Cond cond;
+	Qiniu_Rio_streamBlock* blocks;
+	int ringSize;
+	Qiniu_Rio_PutExtra* extra;
+	unsigned char* digests;
+} Qiniu_Rio_stream;
+
+static ssize_t Qiniu_Rio_streamBlock_ReadAt(void* self, void* buf, size_t bytes, Qiniu_Off_T offset)
+{
+	Qiniu_Rio_streamBlock* blk = (Qiniu_Rio_streamBlock*)self;
+	Qiniu_Int64 pos = (Qiniu_Int64)offset - blk->offbase;
+
+	if (pos < 0 || pos > (Qiniu_Int64)blk->size) {
+		return -1;
+	}
+	if (bytes > blk->size - (size_t)pos) {
+		bytes = blk->size - (size_t)pos;
+	}
+	memcpy(buf, blk->buf + pos, bytes);
+	return (ssize_t)bytes;
+}
+
+static void Qiniu_Rio_stream_onDone(void* recvr, Qiniu_Rio_task* task)
+{
+	Qiniu_Rio_stream* self = (Qiniu_Rio_stream*)recvr;
+	Qiniu_Rio_streamBlock* blk = (Qiniu_Rio_streamBlock*)task->f.self;
+
+	Qiniu_Mutex_Lock(&self->mutex);
+	self->extra->progresses[task->blkIdx] = blk->progress;
+	memset(&blk->progress, 0, sizeof(blk->progress));
+	if (self->digests != NULL) {
+		memcpy(&self->digests[task->blkIdx * QINIU_QETAG_BLOCK_DIGEST_SIZE], blk->digest, QINIU_QETAG_BLOCK_DIGEST_SIZE);
+	}
+	blk->busy = 0;
+	Qiniu_Cond_Broadcast(&self->cond);
+	Qiniu_Mutex_Unlock(&self->mutex);
+}
+
+// Wait for a free block, and make room for the progress and the digest of the next block of the stream.
+static Qiniu_Error Qiniu_Rio_stream_acquire(Qiniu_Rio_stream* self, Qiniu_Rio_streamBlock** blk)
+{
+	Qiniu_Error err = Qiniu_OK;
+	Qiniu_Rio_PutExtra* extra = self->extra;
+	Qiniu_Rio_BlkputRet* progresses;
+	unsigned char* digests;
+	int i;
+
+	Qiniu_Mutex_Lock(&self->mutex);
+	for (;;) {
+		for (i = 0; i < self->ringSize; i++) {
+			if (!self->blocks[i].busy) {
+				break;
+			}
+		}
+		if (i < self->ringSize) {
+			break;
+		}
+		Qiniu_Cond_Wait(&self->cond, &self->mutex);
+	}
+	*blk = &self->blocks[i];
+
+	progresses = (Qiniu_Rio_BlkputRet*)realloc(extra->progresses, sizeof(Qiniu_Rio_BlkputRet) * (extra->blockCnt + 1));
+	if (progresses == NULL) {
+		goto lzNoMem;
+	}
+	extra->progresses = progresses;
+	memset(&progresses[extra->blockCnt], 0, sizeof(Qiniu_Rio_BlkputRet));
+
+	if (extra->checkQetag) {
+		digests = (unsigned char*)realloc(self->digests, QINIU_QETAG_BLOCK_DIGEST_SIZE * (extra->blockCnt + 1));
+		if (digests == NULL) {
+			goto lzNoMem;
+		}
+		self->digests = digests;
+	}
+
+	if ((*blk)->buf == NULL) {
+		(*blk)->buf = (char*)malloc(1 << blockBits);
+		if ((*blk)->buf == NULL) {
+			goto lzNoMem;
+		}
+	}
+	(*blk)->busy = 1;
+	extra->blockCnt++;
+	Qiniu_Mutex_Unlock(&self->mutex);
+	return Qiniu_OK;
+
+lzNoMem:
+	Qiniu_Mutex_Unlock(&self->mutex);
+	err.code = 499;
+	err.message = "No enough memory";
+	return err;
+}
+
+static size_t Qiniu_Rio_readFull(Qiniu_Reader r, char* buf, size_t n)
+{
+	size_t n1, total = 0;
+
+	while (total < n) {
+		n1 = r.Read(buf + total, 1, n - total, r.self);
+		if (n1 == 0) {
+			break;
+		}
+		total += n1;
+	}
+	return total;
+}
+
+Qiniu_Error Qiniu_Rio_PutStream(
+	Qiniu_Client* self, Qiniu_Rio_PutRet* ret,
+	const char* uptoken, const char* key, Qiniu_Reader body, Qiniu_Rio_PutExtra* extra1)
+{
+	Qiniu_Rio_stream st;
+	Qiniu_Rio_chunkSizer sizer;
+	Qiniu_Rio_streamBlock* blk;
+	Qiniu_Rio_streamBlock* small = NULL;
+	Qiniu_Io_PutExtra extra2;
+	Qiniu_Rio_task* task;
+	Qiniu_Rio_WaitGroup wg;
+	Qiniu_Rio_PutExtra extra;
+	Qiniu_Rio_ThreadModel tm;
+	Qiniu_Auth auth, auth1 = self->auth;
+	Qiniu_Count nfails;
+	Qiniu_Count ninterrupts;
+	Qiniu_Int64 fsize = 0;
+	size_t n, blkSize = 1 << blockBits;
+	int i, retCode;
+	char* qetag = NULL;
+	Qiniu_Error err = Qiniu_Rio_PutExtra_Init(&extra, 0, extra1);
+	if (err.code != 200) {
+		return err;
+	}
+
+	memset(&st, 0, sizeof(st));
+	st.ringSize = settings.workers + 1;
+	st.blocks = (Qiniu_Rio_streamBlock*)calloc(st.ringSize, sizeof(Qiniu_Rio_streamBlock));
+	if (st.blocks == NULL) {
+		Qiniu_Rio_PutExtra_Cleanup(&extra);
+		err.code = 499;
+		err.message = "No enough memory";
+		return err;
+	}
+	st.extra = &extra;
+	Qiniu_Mutex_Init(&st.mutex);
+	Qiniu_Cond_Init(&st.cond);
+	if (extra.adaptiveChunkSize) {
+		Qiniu_Rio_chunkSizer_Init(&sizer, &extra);
+	}
+
+	//// For using multi-region storage.
+	{
+		if (Qiniu_Rgn_IsEnabled()) {
+			if (!extra.uptoken) {
+				extra.uptoken = uptoken;
+			} // if
+		} // if
+	}
+
+	tm = extra.threadModel;
+	wg = tm.itbl->WaitGroup(tm.self);
+	if (wg.itbl == NULL) {
+		free(st.blocks);
+		Qiniu_Cond_Cleanup(&st.cond);
+		Qiniu_Mutex_Cleanup(&st.mutex);
+		if (extra.adaptiveChunkSize) {
+			Qiniu_Rio_chunkSizer_Cleanup(&sizer);
+		}
+		Qiniu_Rio_PutExtra_Cleanup(&extra);
+		err.code = 499;
+		err.message = "No enough memory";
+		return err;
+	}
+
+	nfails = 0;
+	ninterrupts = 0;
+
+	self->auth = auth = Qiniu_UptokenAuth(uptoken);
+
+	// Read the next block while the previous ones are being uploaded.
+	while (Qiniu_Rio_loadCount(&nfails) == 0 && Qiniu_Rio_loadCount(&ninterrupts) == 0) {
+		err = Qiniu_Rio_stream_acquire(&st, &blk);
+		if (err.code != 200) {
+			break;
+		}
+
+		n = Qiniu_Rio_readFull(body, blk->buf, blkSize);
+		blk->offbase = fsize;
+		blk->size = n;
+		if (extra.blockCnt == 1 && n < blkSize && n <= (size_t)extra.chunkSize) {
+			// The stream is too small, don't need resumable-io
+			small = blk;
+			break;
+		}
+		if (n == 0) {
+			Qiniu_Mutex_Lock(&st.mutex);
+			blk->busy = 0;
+			extra.blockCnt--;
+			Qiniu_Mutex_Unlock(&st.mutex);
+			break;
+		}
+		fsize += n;
+
+		task = (Qiniu_Rio_task*)malloc(sizeof(Qiniu_Rio_task));
+		task->f.self = blk;
+		task->f.ReadAt = Qiniu_Rio_streamBlock_ReadAt;
+		task->extra = &extra;
+		task->mc = self;
+		task->wg = wg;
+		task->nfails = &nfails;
+		task->ninterrupts = &ninterrupts;
+		task->progress = &blk->progress;
+		task->digest = extra.checkQetag ? blk->digest : NULL;
+		task->pool = NULL;
+		task->sizer = extra.adaptiveChunkSize ? &sizer : NULL;
+		task->onDone = Qiniu_Rio_stream_onDone;
+		task->doneRecvr = &st;
+		task->blkIdx = (int)extra.blockCnt - 1;
+		task->blkSize1 = (int)n;
+
+		wg.itbl->Add(wg.self, 1);
+		retCode = tm.itbl->RunTask(tm.self, Qiniu_Rio_doTask, task);
+		if (retCode == QINIU_RIO_NOTIFY_EXIT) {
+			Qiniu_Count_Inc(&ninterrupts);
+			Qiniu_Rio_task_finish(task);
+		}
+
+		if (n < blkSize) {
+			break;
+		}
+	} // while
+
+	wg.itbl->Wait(wg.self);
+	if (err.code == 200) {
+		if (nfails != 0) {
+			err = ErrPutFailed;
+		} else if (ninterrupts != 0) {
+			err = ErrPutInterrupted;
+		} else if (small != NULL) {
+			Qiniu_Zero(extra2);
+			Qiniu_Io_PutExtra_initFrom(&extra2, &extra);
+
+			err = Qiniu_Io_PutBuffer(self, ret, uptoken, key, small->buf, small->size, &extra2);
+			if (err.code == 200 && extra.checkQetag) {
+				err = Qiniu_Qetag_DigestBuffer(small->buf, small->size, &qetag);
+				if (err.code == 200) {
+					err = Qiniu_Rio_verifyQetag(self, ret, qetag);
+				}
+			}
+		} else {
+			err = Qiniu_Rio_Mkfile2(self, ret, key, fsize, &extra);
+			if (err.code == 200 && extra.checkQetag) {
+				err = Qiniu_Qetag_SumBlockDigests(st.digests, extra.blockCnt, &qetag);
+				if (err.code == 200) {
+					err = Qiniu_Rio_verifyQetag(self, ret, qetag);
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < st.ringSize; i++) {
+		Qiniu_Rio_BlkputRet_Cleanup(&st.blocks[i].progress);
+		free(st.blocks[i].buf);
+	}
+	free(st.blocks);
+	free(st.digests);
+	Qiniu_Cond_Cleanup(&st.cond);
+	Qiniu_Mutex_Cleanup(&st.mutex);
+	if (extra.adaptiveChunkSize) {
+		Qiniu_Rio_chunkSizer_Cleanup(&sizer);
+	}
+	Qiniu_Rio_PutExtra_Cleanup(&extra);
+
+	wg.itbl->Release(wg.self);
+	auth.itbl->Release(auth.self);
+	self->auth = auth1;
+	return err;
+}
+
+/*============================================================================*/
+/* func Qiniu_Rio_PutMulti */
+
+typedef struct _Qiniu_Rio_multi {
+	Qiniu_Async* async;
+	Qiniu_Client* mc;
+	Qiniu_ReaderAt f;
+	Qiniu_Int64 fsize;
+	Qiniu_Rio_PutExtra* extra;
+	unsigned char* digests;
+	int nextBlkIdx;
+	int nfails;
+	int ninterrupts;
+} Qiniu_Rio_multi;
+
+typedef struct _Qiniu_Rio_mblock {
+	Qiniu_Rio_multi* mu;
+	Qiniu_Rio_BlkputRet ret;
+	int blkIdx;
+	int blkSize;
+	int bodyLength;
+	int tryTimes;
+	int blkTryTimes;
+
+	// The body of the chunk in flight, which must keep valid until the request is finished.
+	Qiniu_Rio_blkHash hash;
+	Qiniu_Section section;
+	Qiniu_Tee tee;
+
+	Qiniu_Bool voting;
+	Qiniu_Rgn_HostVote upHostVote;
+} Qiniu_Rio_mblock;
+
+static Qiniu_Bool Qiniu_Rio_mblock_step(Qiniu_Rio_mblock* b);
+
+// Load the next blocks into the slot until a request is in flight, or release the slot if there is no
+// more block to upload. The blocks which are finished already or fail at once are passed over in the
+// loop, so that the stack does not grow with them.
+static void Qiniu_Rio_mblock_next(Qiniu_Rio_mblock* b)
+{
+	Qiniu_Rio_multi* mu = b->mu;
+	Qiniu_Rio_PutExtra* extra = mu->extra;
+
+	for (;;) {
+		Qiniu_Rio_BlkputRet_Cleanup(&b->ret);
+		if (mu->ninterrupts > 0 || mu->nextBlkIdx >= (int)extra->blockCnt) {
+			Qiniu_Rio_blkHash_Cleanup(&b->hash);
+			free(b);
+			return;
+		}
+
+		b->blkIdx = mu->nextBlkIdx++;
+		b->blkSize = 1 << blockBits;
+		if (b->blkIdx == (int)extra->blockCnt - 1) {
+			b->blkSize = (int)(mu->fsize - ((Qiniu_Int64)(b->blkIdx) << blockBits));
+		}
+		b->tryTimes = extra->tryTimes;
+		b->blkTryTimes = extra->tryTimes;
+		Qiniu_Rio_BlkputRet_Assign(&b->ret, &extra->progresses[b->blkIdx]);
+		Qiniu_Rio_blkHash_Reset(&b->hash);
+
+		// Let a mapped file read the block ahead.
+		Qiniu_ReaderAt_Slice(mu->f, (Qiniu_Off_T)(b->blkIdx) << blockBits, b->blkSize);
+		if (Qiniu_Rio_mblock_step(b)) {
+			return;
+		}
+	}
+}
+
+// Return true if the block is restarted from the last saved progress, or false if it is given up.
+static Qiniu_Bool Qiniu_Rio_mblock_fail(Qiniu_Rio_mblock* b, Qiniu_Error err)
+{
+	Qiniu_Rio_PutExtra* extra = b->mu->extra;
+
+	if (err.code == Qiniu_Rio_InvalidCtx) {
+		Qiniu_Rio_BlkputRet_Cleanup(&extra->progresses[b->blkIdx]);
+	}
+	if (err.code == Qiniu_Rio_PutInterrupted) {
+		b->mu->ninterrupts += 1;
+	} else if (b->blkTryTimes > 1 && Qiniu_TemporaryError(err.code)) {
+		// Restart the block from the last saved progress, like Qiniu_Rio_doTask does.
+		b->blkTryTimes--;
+		b->tryTimes = extra->tryTimes;
+		Qiniu_Log_Info("resumable.PutMulti %E, retrying ...", err);
+		Qiniu_Rio_BlkputRet_Assign(&b->ret, &extra->progresses[b->blkIdx]);
+		return Qiniu_True;
+	} else {
+		Qiniu_Log_Warn("resumable.PutMulti %d failed: %E", b->blkIdx, err);
+		extra->notifyErr(extra->notifyRecvr, b->blkIdx, b->blkSize, err);
+		b->mu->nfails += 1;
+	}
+	return Qiniu_False;
+}
+
+// Go on with the block after a chunk, or with the next block if it needs no more requests.
+static void Qiniu_Rio_mblock_continue(Qiniu_Rio_mblock* b)
+{
+	if (!Qiniu_Rio_mblock_step(b)) {
+		Qiniu_Rio_mblock_next(b);
+	}
+}
+
+static void Qiniu_Rio_mblock_retry(Qiniu_Rio_mblock* b, Qiniu_Error err)
+{
+	if (Qiniu_Rio_mblock_fail(b, err)) {
+		Qiniu_Rio_mblock_continue(b);
+	} else {
+		Qiniu_Rio_mblock_next(b);
+	}
+}
+
+static void Qiniu_Rio_mblock_onChunk(void* recvr, Qiniu_Error err, Qiniu_Json* root)
+{
+	Qiniu_Rio_mblock* b = (Qiniu_Rio_mblock*)recvr;
+	Qiniu_Rio_multi* mu = b->mu;
+	Qiniu_Rio_PutExtra* extra = mu->extra;
+	Qiniu_Bool mkblk = (b->ret.ctx == NULL);
+	Qiniu_Rio_BlkputRet ret;
+
+	if (b->voting) {
+		Qiniu_Rgn_Table_VoteHost(mu->mc->regionTable, &b->upHostVote, err);
+		b->voting = Qiniu_False;
+	}
+
+	// Keep the progress of the block untouched until the chunk is verified, so that it can be retried.
+	memset(&ret, 0, sizeof(ret));
+	if (err.code == 200) {
+		err = Qiniu_Rio_bputResult(&ret, root);
+	}
+
+	if (err.code == 200) {
+		if (ret.crc32 == b->hash.crc32.val && (!mkblk || (int)(ret.offset) == b->bodyLength)) {
+			Qiniu_Rio_BlkputRet_Assign(&b->ret, &ret);
+			Qiniu_Rio_BlkputRet_Cleanup(&ret);
+			b->tryTimes = extra->tryTimes;
+			if (extra->notify(extra->notifyRecvr, b->blkIdx, b->blkSize, &b->ret) == QINIU_RIO_NOTIFY_EXIT) {
+				// Terminate the upload process if the caller requests
+				err.code = Qiniu_Rio_PutInterrupted;
+				err.message = "Interrupted by the caller";
+				Qiniu_Rio_mblock_retry(b, err);
+				return;
+			}
+			Qiniu_Rio_mblock_continue(b);
+			return;
+		}
+		Qiniu_Rio_BlkputRet_Cleanup(&ret);
+		Qiniu_Log_Warn("ResumableBlockput: invalid checksum, retry");
+		err = ErrUnmatchedChecksum;
+	} else if (err.code == Qiniu_Rio_InvalidCtx) {
+		Qiniu_Log_Warn("ResumableBlockput: invalid ctx, please retry");
+		Qiniu_Rio_mblock_retry(b, err);
+		return;
+	} else {
+		Qiniu_Log_Warn("ResumableBlockput %d off:%d failed - %E", b->blkIdx, (int)b->ret.offset, err);
+	}
+
+	if (!mkblk && b->tryTimes > 1 && Qiniu_TemporaryError(err.code)) {
+		// Retry the same chunk.
+		b->tryTimes--;
+		Qiniu_Log_Info("ResumableBlockput %E, retrying ...", err);
+		Qiniu_Rio_mblock_continue(b);
+		return;
+	}
+	Qiniu_Rio_mblock_retry(b, err);
+}
+
+// Send the next chunk of the block. Return true if a request is in flight, or false if the block is
+// finished or given up, or the upload is interrupted. A block which fails at once is restarted here.
+static Qiniu_Bool Qiniu_Rio_mblock_step(Qiniu_Rio_mblock* b)
+{
+	Qiniu_Error err;
+	Qiniu_Reader body;
+	const char* bodyBuf;
+	Qiniu_Rio_multi* mu = b->mu;
+	Qiniu_Rio_PutExtra* extra = mu->extra;
+	Qiniu_Int64 offbase = (Qiniu_Int64)(b->blkIdx) << blockBits;
+	const char* upHost = NULL;
+	char* url;
+
+	for (;;) {
+		if (mu->ninterrupts > 0) {
+			return Qiniu_False;
+		}
+
+		if (b->ret.ctx != NULL && (int)(b->ret.offset) >= b->blkSize) {
+			if (b->hash.blk != NULL) {
+				err = Qiniu_Rio_blkHash_Sum(&b->hash, mu->f, offbase, b->blkSize,
+					&mu->digests[b->blkIdx * QINIU_QETAG_BLOCK_DIGEST_SIZE]);
+				if (err.code != 200) {
+					if (Qiniu_Rio_mblock_fail(b, err)) {
+						continue;
+					}
+					return Qiniu_False;
+				}
+			}
+			Qiniu_Rio_BlkputRet_Assign(&extra->progresses[b->blkIdx], &b->ret);
+			return Qiniu_False;
+		}
+
+		b->bodyLength = extra->chunkSize;
+		if (b->bodyLength > b->blkSize - (int)(b->ret.offset)) {
+			b->bodyLength = b->blkSize - (int)(b->ret.offset);
+		}
+
+		if (b->ret.ctx == NULL) {
+			err = Qiniu_Rio_upHost(mu->mc, extra, &upHost, &b->upHostVote);
+			if (err.code != 200) {
+				if (Qiniu_Rio_mblock_fail(b, err)) {
+					continue;
+				}
+				return Qiniu_False;
+			}
+			b->voting = Qiniu_Rgn_IsEnabled() ? Qiniu_True : Qiniu_False;
+			b->upHostVote.bytes = b->bodyLength;
+			url = Qiniu_String_Format(128, "%s/mkblk/%d", upHost, b->blkSize);
+		} else {
+			url = Qiniu_String_Format(1024, "%s/bput/%s/%d", b->ret.host, b->ret.ctx, (int)b->ret.offset);
+		}
+
+		bodyBuf = Qiniu_Rio_blkHash_Body(&b->hash, mu->f, offbase, b->ret.offset, b->bodyLength, &b->section, &b->tee, &body);
+		if (bodyBuf != NULL) {
+			err = Qiniu_Async_CallWithBuffer(mu->async, url, bodyBuf, b->bodyLength, NULL, Qiniu_Rio_mblock_onChunk, b);
+		} else {
+			err = Qiniu_Async_CallWithBinary(mu->async, url, body, b->bodyLength, NULL, Qiniu_Rio_mblock_onChunk, b);
+		}
+		Qiniu_Free(url);
+		if (err.code == 200) {
+			return Qiniu_True;
+		}
+		if (b->voting) {
+			Qiniu_Rgn_Table_ReleaseHost(mu->mc->regionTable, &b->upHostVote);
+			b->voting = Qiniu_False;
+		}
+		if (!Qiniu_Rio_mblock_fail(b, err)) {
+			return Qiniu_False;
+		}
+	}
+}
+
+Qiniu_Error Qiniu_Rio_PutMulti(
+	Qiniu_Client* self, Qiniu_Rio_PutRet* ret,
+	const char* uptoken, const char* key, Qiniu_ReaderAt f, Qiniu_Int64 fsize, Qiniu_Rio_PutExtra* extra1)
+{
+	Qiniu_Rio_multi mu;
+	Qiniu_Rio_mblock* b;
+	Qiniu_Rio_PutExtra extra;
+	Qiniu_Auth auth, auth1 = self->auth;
+	int i;
+	char* qetag = NULL;
+	Qiniu_Error err = Qiniu_Rio_PutExtra_Init(&extra, fsize, extra1);
+	if (err.code != 200) {
+		return err;
+	}
+
+	//// For using multi-region storage.
+	{
+		if (Qiniu_Rgn_IsEnabled()) {
+			if (!extra.uptoken) {
+				extra.uptoken = uptoken;
+			} // if
+		} // if
+	}
+
+	memset(&mu, 0, sizeof(mu));
+	mu.mc = self;
+	mu.f = f;
+	mu.fsize = fsize;
+	mu.extra = &extra;
+	if (extra.checkQetag) {
+		mu.digests = (unsigned char*)malloc(QINIU_QETAG_BLOCK_DIGEST_SIZE * (extra.blockCnt + 1));
+	}
+	mu.async = Qiniu_Async_Create(self, 0);
+	if (mu.async == NULL || (extra.checkQetag && mu.digests == NULL)) {
+		if (mu.async != NULL) {
+			Qiniu_Async_Destroy(mu.async);
+		}
+		free(mu.digests);
+		Qiniu_Rio_PutExtra_Cleanup(&extra);
+		err.code = 499;
+		err.message = "No enough memory";
+		return err;
+	}
+
+	self->auth = auth = Qiniu_UptokenAuth(uptoken);
+
+	for (i = 0; i < settings.workers && i < (int)extra.blockCnt; i++) {
+		b = (Qiniu_Rio_mblock*)calloc(1, sizeof(Qiniu_Rio_mblock));
+		if (b == NULL) {
+			break;
+		}
+		b->mu = &mu;
+		if (Qiniu_Rio_blkHash_Init(&b->hash, extra.checkQetag).code != 200) {
+			free(b);
+			break;
+		}
+		Qiniu_Rio_mblock_next(b);
+	} // for
+
+	Qiniu_Async_Run(mu.async);
+	Qiniu_Async_Destroy(mu.async);
+
+	if (i == 0 && extra.blockCnt > 0) {
+		err.code = 499;
+		err.message = "No enough memory";
+	} else if (mu.nfails != 0) {
+		err = ErrPutFailed;
+	} else if (mu.ninterrupts != 0) {
+		err = ErrPutInterrupted;
+	} else {
+		err = Qiniu_Rio_Mkfile2(self, ret, key, fsize, &extra);
+		if (err.code == 200 && mu.digests != NULL) {
+			err = Qiniu_Qetag_SumBlockDigests(mu.digests, extra.blockCnt, &qetag);
+			if (err.code == 200) {
+				err = Qiniu_Rio_verifyQetag(self, ret, qetag);
+			}
+		}
+	}
+
+	Qiniu_Rio_PutExtra_Cleanup(&extra);
+	free(mu.digests);
+
+	auth.itbl->Release(auth.self);
+	self->auth = auth1;
+	return err;
+}
+
+/*============================================================================*/
+/* func Qiniu_Rio_PutFilesIfChanged */
+
+#define batchStatSize		1000
+
+static Qiniu_Error Qiniu_Rio_hashFile(Qiniu_Rio_PutFileEntry* entry)
+{
+	char* digest = NULL;
+	Qiniu_Error err = Qiniu_Qetag_DigestFileEx(entry->localFile, settings.workers, &digest);
+	if (err.code == 200) {
+		strncpy(entry->hash, digest, sizeof(entry->hash) - 1);
+		entry->hash[sizeof(entry->hash) - 1] = '\0';
+		free(digest);
+	}
+	return err;
+}
+
+Qiniu_Error Qiniu_Rio_PutFilesIfChanged(
+	Qiniu_Client* self, const char* uptoken, const char* bucket,
+	Qiniu_Rio_PutFileEntry* entries, int entryCount, Qiniu_Rio_PutExtra* extra)
+{
+	Qiniu_Error err;
+	Qiniu_Rio_PutRet ret;
+	Qiniu_Rio_PutExtra extra1;
+	Qiniu_Rio_PutFileEntry* entry;
+	Qiniu_RS_EntryPath* paths;
+	Qiniu_RS_BatchStatRet* rets;
+	int* batch;
+	int i, j, k, end, count;
+	int nfails = 0;
+
+	paths = (Qiniu_RS_EntryPath*)malloc(sizeof(Qiniu_RS_EntryPath) * batchStatSize);
+	rets = (Qiniu_RS_BatchStatRet*)malloc(sizeof(Qiniu_RS_BatchStatRet) * batchStatSize);
+	batch = (int*)malloc(sizeof(int) * batchStatSize);
+	if (paths == NULL || rets == NULL || batch == NULL) {
+		free(paths);
+		free(rets);
+		free(batch);
+		err.code = 499;
+		err.message = "No enough memory";
+		return err;
+	}
+
+	// Every file is hashed once before the stat, and the hash returned by its upload is checked
+	// against that one, so the upload doesn't hash it again.
+	if (extra != NULL && extra->checkQetag) {
+		extra1 = *extra;
+		extra1.checkQetag = 0;
+		extra = &extra1;
+	}
+
+	for (i = 0; i < entryCount; i = end) {
+		// Hash the files until a batch of keys to stat is collected.
+		count = 0;
+		for (end = i; end < entryCount && count < batchStatSize; end++) {
+			entry = &entries[end];
+			entry->code = 0;
+			entry->hash[0] = '\0';
+
+			err = Qiniu_Rio_hashFile(entry);
+			if (err.code != 200) {
+				Qiniu_Log_Warn("resumable.PutFilesIfChanged: can't hash %s - %E", entry->localFile, err);
+				entry->code = err.code;
+				continue;
+			}
+			if (entry->key != NULL) {
+				paths[count].bucket = bucket;
+				paths[count].key = entry->key;
+				batch[count++] = end;
+			}
+		}
+
+		if (count > 0) {
+			memset(rets, 0, sizeof(Qiniu_RS_BatchStatRet) * count);
+			err = Qiniu_RS_BatchStat(self, rets, paths, count);
+			if (err.code / 100 == 2) {
+				for (k = 0; k < count; k++) {
+					entry = &entries[batch[k]];
+					if (rets[k].code == 200 && rets[k].data.hash != NULL && strcmp(rets[k].data.hash, entry->hash) == 0) {
+						entry->code = Qiniu_Rio_PutSkipped;
+					}
+				}
+			} else {
+				// Upload all files of the batch if their remote files are unknown.
+				Qiniu_Log_Warn("resumable.PutFilesIfChanged: batch stat failed - %E", err);
+			}
+		}
+
+		for (j = i; j < end; j++) {
+			entry = &entries[j];
+			if (entry->code != 0) {
+				continue;
+			}
+			err = Qiniu_Rio_PutFile(self, &ret, uptoken, entry->key, entry->localFile, extra);
+			if (err.code == 200 && ret.hash != NULL && strcmp(ret.hash, entry->hash) != 0) {
+				Qiniu_Log_Warn("resumable.PutFilesIfChanged: unmatched qetag of %s, local %s, remote %s",
+					entry->localFile, entry->hash, ret.hash);
+				err = ErrUnmatchedQetag;
+			}
+			if (err.code != 200) {
+				Qiniu_Log_Warn("resumable.PutFilesIfChanged: can't upload %s - %E", entry->localFile, err);
+			}
+			entry->code = err.code;
+		}
+	}
+
+	for (i = 0; i < entryCount; i++) {
+		if (entries[i].code != 200 && entries[i].code != Qiniu_Rio_PutSkipped) {
+			nfails++;
+		}
+	}
+
+	free(paths);
+	free(rets);
+	free(batch);
+	return nfails == 0 ? Qiniu_OK : ErrPutFailed;
+}
@@ -27,6 +27,8 @@ extern "C"
 #define Qiniu_Rio_InvalidPutProgress	9901
 #define Qiniu_Rio_PutFailed				9902
 #define Qiniu_Rio_PutInterrupted		9903
+#define Qiniu_Rio_UnmatchedQetag		9904
+#define Qiniu_Rio_UnverifiedQetag		9905
 
 /*============================================================================*/
 /* type Qiniu_Rio_WaitGroup */
@@ -43,11 +45,8 @@ typedef struct _Qiniu_Rio_WaitGroup {
 	Qiniu_Rio_WaitGroup_Itbl* itbl;
 } Qiniu_Rio_WaitGroup;
 
-#if defined(_WIN32)
-
-Qiniu_Rio_WaitGroup Qiniu_Rio_MTWG_Create(void);
-
-#endif
+// The itbl of the wait group is NULL if there is no enough memory, and the puts fail with code 499 then.
+QINIU_DLLAPI extern Qiniu_Rio_WaitGroup Qiniu_Rio_MTWG_Create(void);
 
 /*============================================================================*/
 /* type Qiniu_Rio_ThreadModel */
@@ -65,6 +64,18 @@ typedef struct _Qiniu_Rio_ThreadModel {
 
 QINIU_DLLAPI extern Qiniu_Rio_ThreadModel Qiniu_Rio_ST;
 
+// Create a thread model backed by a pool of `workers` threads and a bounded task queue
+// of `taskQsize` entries. Pass 0 to use the values from Qiniu_Rio_Settings.
+// Each worker thread owns a Qiniu_Client, which is returned by ClientTls() and
+// borrows the auth, NIC, speed limit, share and region table settings from the calling client.
+//
+// **NOTICE**: With this model, the notify/notifyErr callbacks of Qiniu_Rio_PutExtra
+// are invoked from the worker threads concurrently.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Rio_MT_Create(Qiniu_Rio_ThreadModel* tm, int workers, int taskQsize);
+
+// Wait for all queued tasks to finish, then stop the worker threads.
+QINIU_DLLAPI extern void Qiniu_Rio_MT_Destroy(Qiniu_Rio_ThreadModel tm);
+
 /*============================================================================*/
 /* type Qiniu_Rio_Settings */
 
@@ -133,6 +144,40 @@ typedef struct _Qiniu_Rio_PutExtra {
 	const char* upBucket;
 	const char* accessKey;
 	const char* uptoken;
+
+	// Set the following field to non-zero to compute the qetag while uploading, in the same pass as the CRC32,
+	// and verify it against the hash returned by the server. The qetag is returned in ret->qetag. If the
+	// response carries no hash, the file is stored but Qiniu_Rio_UnverifiedQetag is returned.
+	// Blocks resumed from saved progresses are read from the start of them again for the qetag.
+	int checkQetag;
+
+	// Use the following field to name a journal file for Qiniu_Rio_PutFile, which records the progress
+	// of every acknowledged chunk. If the upload is restarted with the same file, key and journal,
+	// it resumes from the saved progresses. The journal is removed once the upload succeeds. A saved
+	// progress rejected as an invalid context is dropped, and its block is uploaded again; if mkfile
+	// rejects one, the whole file is.
+	const char* journalFile;
+
+	// Set readaheadDepth to read up to that many chunks of a block ahead on a helper thread, so that the disk
+	// reads overlap with the chunk being sent. The buffers of all blocks in flight come from one pool of at
+	// most readaheadMemLimit bytes, or readaheadDepth chunks per worker if it is 0. Qiniu_Rio_PutMulti and
+	// memory-mapped files (see mapFile) don't read ahead in this way.
+	int readaheadDepth;
+	size_t readaheadMemLimit;
+
+	// Set adaptiveChunkSize to non-zero to size every bput from the throughput and the error rate measured
+	// so far, between minChunkSize and maxChunkSize (64 KB and the block size if 0), starting at chunkSize.
+	// Chunks are not read ahead in this mode, and Qiniu_Rio_PutMulti always uses chunkSize.
+	int adaptiveChunkSize;
+	int minChunkSize;
+	int maxChunkSize;
+
+	// Set mapFile to non-zero to have Qiniu_Rio_PutFile send the chunks straight from a memory mapping of
+	// the file instead of reading them, which saves a copy per chunk; files that can't be mapped are read.
+	// The file must not be truncated while it is uploaded: touching the pages past the new end raises
+	// SIGBUS (an exception on Windows) and kills the process, where a read would fail the upload instead.
+	// Mapped files are not read ahead.
+	int mapFile;
 } Qiniu_Rio_PutExtra;
 
 /*============================================================================*/
@@ -160,6 +205,46 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_Rio_PutFile(
 	Qiniu_Client* self, Qiniu_Rio_PutRet* ret,
 	const char* uptoken, const char* key, const char* localFile, Qiniu_Rio_PutExtra* extra);
 
+// Upload a stream of unknown length, such as a pipe or generated data, without spooling it to a file.
+// The stream is read into a ring of Qiniu_Rio_Settings.workers + 1 block buffers, and each block is uploaded
+// by the thread model of extra as soon as it is full, so the memory use is bounded. The stream ends when
+// body.Read returns 0. The progresses field of extra is not supported, since the stream can't be read again.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Rio_PutStream(
+	Qiniu_Client* self, Qiniu_Rio_PutRet* ret,
+	const char* uptoken, const char* key, Qiniu_Reader body, Qiniu_Rio_PutExtra* extra);
+
+// Upload up to Qiniu_Rio_Settings.workers blocks concurrently on the calling thread, by driving
+// the mkblk/bput chains of them with one event loop instead of a thread model.
+// The threadModel field of extra is ignored, and the notify callbacks are invoked on the calling thread.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Rio_PutMulti(
+	Qiniu_Client* self, Qiniu_Rio_PutRet* ret,
+	const char* uptoken, const char* key, Qiniu_ReaderAt f, Qiniu_Int64 fsize, Qiniu_Rio_PutExtra* extra);
+
+/*============================================================================*/
+/* func Qiniu_Rio_PutFilesIfChanged */
+
+#define Qiniu_Rio_PutSkipped			304
+
+typedef struct _Qiniu_Rio_PutFileEntry {
+	const char* key;
+	const char* localFile;
+
+	// Set to 200 if the file is uploaded, Qiniu_Rio_PutSkipped if the remote file has the same content,
+	// or the error code otherwise. The hash field is set to the qetag of the local file.
+	int code;
+	char hash[32];
+} Qiniu_Rio_PutFileEntry;
+
+// Upload the files whose content differs from the remote files of the same keys in the bucket.
+// The qetag of every file is computed locally and compared with the hash returned by the batch stat
+// of up to 1000 keys a time, so unchanged files are not transferred. The changed files are uploaded by
+// Qiniu_Rio_PutFile with the given extra, and the returned hashes are checked against the local ones, so
+// checkQetag doesn't hash them again. The client must be authorized by a Qiniu_Mac for the stat,
+// and Qiniu_Rio_PutFailed is returned if any file fails, with the details in the entries.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_Rio_PutFilesIfChanged(
+	Qiniu_Client* self, const char* uptoken, const char* bucket,
+	Qiniu_Rio_PutFileEntry* entries, int entryCount, Qiniu_Rio_PutExtra* extra);
+
 /*============================================================================*/
 
 #pragma pack()
@@ -242,285 +242,805 @@ Qiniu_Error Qiniu_RS_Move(Qiniu_Client* self,
 }
 
 /*============================================================================*/
-/* func Qiniu_RS_BatchStat */
+/* type Qiniu_RS_BatchSettings */
 
-Qiniu_Error Qiniu_RS_BatchStat(
-	Qiniu_Client* self, Qiniu_RS_BatchStatRet* rets,
-	Qiniu_RS_EntryPath* entries, Qiniu_ItemCount entryCount)
+#define defaultOpsPerBatch	1000
+#define defaultBatchConcurrency	4
+
+static Qiniu_RS_BatchSettings batchSettings = {
+	defaultOpsPerBatch,
+	defaultBatchConcurrency
+};
+
+void Qiniu_RS_SetBatchSettings(Qiniu_RS_BatchSettings* v)
+{
+	batchSettings = *v;
+	if (batchSettings.opsPerBatch <= 0) {
+		batchSettings.opsPerBatch = defaultOpsPerBatch;
+	}
+	if (batchSettings.concurrency <= 0) {
+		batchSettings.concurrency = defaultBatchConcurrency;
+	}
+}
+
+/*============================================================================*/
+/* type Qiniu_RS_batch */
+
+typedef void (*Qiniu_RS_FnAppendOp)(
+	Qiniu_Buffer* body, Qiniu_Buffer* scratch, const void* entries, Qiniu_ItemCount i);
+typedef void (*Qiniu_RS_FnSetRet)(
+	void* rets, Qiniu_ItemCount i, int code, const char* error, cJSON* data);
+
+typedef struct _Qiniu_RS_batch {
+	const void* entries;
+	void* rets;
+	Qiniu_ItemCount count;
+	Qiniu_ItemCount next;
+	Qiniu_RS_FnAppendOp appendOp;
+	Qiniu_RS_FnSetRet setRet;
+	Qiniu_Buffer scratch;
+	Qiniu_Async* async;
+	cJSON* roots;
+	char* url;
+	Qiniu_Error err;
+} Qiniu_RS_batch;
+
+typedef struct _Qiniu_RS_batchReq {
+	Qiniu_RS_batch* batch;
+	Qiniu_ItemCount begin;
+	Qiniu_ItemCount end;
+	Qiniu_Buffer body;
+} Qiniu_RS_batchReq;
+
+static void Qiniu_RS_appendEntryURI(
+	Qiniu_Buffer* body, Qiniu_Buffer* scratch, const Qiniu_RS_EntryPath* entry)
+{
+	Qiniu_Buffer_Reset(scratch);
+	Qiniu_Buffer_Write(scratch, entry->bucket, strlen(entry->bucket));
+	Qiniu_Buffer_PutChar(scratch, ':');
+	Qiniu_Buffer_Write(scratch, entry->key, strlen(entry->key));
+	Qiniu_Buffer_AppendEncodedBinary(body, scratch->buf, Qiniu_Buffer_Len(scratch));
+}
+
+static void Qiniu_RS_batchBuild(
+	Qiniu_RS_batch* batch, Qiniu_Buffer* body, Qiniu_ItemCount begin, Qiniu_ItemCount end)
+{
+	Qiniu_ItemCount i;
+
+	for (i = begin; i < end; i++) {
+		if (i != begin) {
+			Qiniu_Buffer_PutChar(body, '&');
+		}
+		batch->appendOp(body, &batch->scratch, batch->entries, i);
+	}
+}
+
+static void Qiniu_RS_batchFail(
+	Qiniu_RS_batch* batch, Qiniu_ItemCount begin, Qiniu_ItemCount end, Qiniu_Error err)
+{
+	Qiniu_ItemCount i;
+
+	for (i = begin; i < end; i++) {
+		batch->setRet(batch->rets, i, err.code, err.message, NULL);
+	}
+}
+
+// Walk the result array once instead of indexing it, which would be quadratic.
+// A response that is not an array or has too few items fails the entries it left unset.
+static void Qiniu_RS_batchParse(
+	Qiniu_RS_batch* batch, Qiniu_ItemCount begin, Qiniu_ItemCount end, cJSON* root, Qiniu_Error* err)
 {
 	int code;
+	cJSON *item, *data;
+	Qiniu_ItemCount i = begin;
+
+	if (root->type == cJSON_Array) {
+		for (item = root->child; item != NULL && i < end; item = item->next, i++) {
+			code = (int)Qiniu_Json_GetInt64(item, "code", 0);
+			data = cJSON_GetObjectItem(item, "data");
+			batch->setRet(batch->rets, i, code, Qiniu_Json_GetString(data, "error", 0), data);
+		}
+	}
+	if (i < end) {
+		err->code = 9983;
+		err->message = "Invalid batch response";
+		Qiniu_RS_batchFail(batch, i, end, *err);
+	}
+}
+
+// Keep the first failure, or the first partial success (298) if all requests got through.
+static void Qiniu_RS_mergeErr(Qiniu_Error* ret, Qiniu_Error err)
+{
+	if (ret->code == 200 || (ret->code / 100 == 2 && err.code / 100 != 2)) {
+		*ret = err;
+	}
+}
+
+static Qiniu_Error Qiniu_RS_batchSubmit(Qiniu_RS_batch* batch);
+
+static void Qiniu_RS_batchDone(void* recvr, Qiniu_Error err, Qiniu_Json* root)
+{
+	cJSON* holder;
+	Qiniu_ItemCount begin;
+	Qiniu_RS_batchReq* req = (Qiniu_RS_batchReq*)recvr;
+	Qiniu_RS_batch* batch = req->batch;
+
+	if (err.code / 100 == 2 && root != NULL) {
+		Qiniu_RS_batchParse(batch, req->begin, req->end, root, &err);
+	} else {
+		Qiniu_RS_batchFail(batch, req->begin, req->end, err);
+	}
+	Qiniu_RS_mergeErr(&batch->err, err);
+
+	// The returned strings point into the response, so move its items out before it is destroyed.
+	if (root != NULL && root->child != NULL) {
+		holder = cJSON_CreateArray();
+		holder->child = root->child;
+		root->child = NULL;
+		cJSON_AddItemToArray(batch->roots, holder);
+	}
+
+	Qiniu_Buffer_Cleanup(&req->body);
+	free(req);
+
+	if (batch->next < batch->count) {
+		begin = batch->next;
+		err = Qiniu_RS_batchSubmit(batch);
+		if (err.code != 200) {
+			Qiniu_RS_batchFail(batch, begin, batch->count, err);
+			Qiniu_RS_mergeErr(&batch->err, err);
+			batch->next = batch->count;
+		}
+	}
+}
+
+static Qiniu_Error Qiniu_RS_batchSubmit(Qiniu_RS_batch* batch)
+{
 	Qiniu_Error err;
-	cJSON *root, *arrayItem, *dataItem;
-	char *body = NULL, *bodyTmp = NULL;
-	char *entryURI, *entryURIEncoded, *opBody;
-	Qiniu_RS_EntryPath* entry = entries;
-	Qiniu_ItemCount curr = 0;
-	Qiniu_ItemCount retSize = 0;
-	char* url = Qiniu_String_Concat2(QINIU_RS_HOST, "/batch");
-
-	while (curr < entryCount) {
-		entryURI = Qiniu_String_Concat3(entry->bucket, ":", entry->key);
-		entryURIEncoded = Qiniu_String_Encode(entryURI);
-		opBody = Qiniu_String_Concat2("op=/stat/", entryURIEncoded);
-		free(entryURI);
-		free(entryURIEncoded);
-
-		if (!body) {
-			bodyTmp = opBody;
+	Qiniu_RS_batchReq* req = (Qiniu_RS_batchReq*)malloc(sizeof(Qiniu_RS_batchReq));
+
+	if (req == NULL) {
+		err.code = 499;
+		err.message = "No enough memory";
+		return err;
+	}
+
+	req->batch = batch;
+	req->begin = batch->next;
+	req->end = batch->count - req->begin > batchSettings.opsPerBatch ?
+		req->begin + batchSettings.opsPerBatch : batch->count;
+
+	Qiniu_Buffer_Init(&req->body, 64 * (size_t)(req->end - req->begin));
+	Qiniu_RS_batchBuild(batch, &req->body, req->begin, req->end);
+
+	err = Qiniu_Async_CallWithBuffer(batch->async, batch->url,
+		req->body.buf, Qiniu_Buffer_Len(&req->body), "application/x-www-form-urlencoded",
+		Qiniu_RS_batchDone, req);
+	if (err.code != 200) {
+		Qiniu_Buffer_Cleanup(&req->body);
+		free(req);
+		return err;
+	}
+	batch->next = req->end;
+	return err;
+}
+
+// Run the batch with one request if it fits in the server limit. Otherwise split it into
+// sub-batches and keep up to batchSettings.concurrency of them in flight on an event loop.
+// Either way the returned strings stay valid until the next call on the client.
+static Qiniu_Error Qiniu_RS_batchRun(Qiniu_Client* self, Qiniu_RS_batch* batch)
+{
+	int i;
+	cJSON* root;
+	Qiniu_Buffer body;
+	Qiniu_Error err = Qiniu_OK;
+
+	if (batch->count <= 0) {
+		return err;
+	}
+
+	batch->url = Qiniu_String_Concat2(QINIU_RS_HOST, "/batch");
+	Qiniu_Buffer_Init(&batch->scratch, 256);
+
+	if (batch->count <= batchSettings.opsPerBatch) {
+		Qiniu_Buffer_Init(&body, 64 * (size_t)batch->count);
+		Qiniu_RS_batchBuild(batch, &body, 0, batch->count);
+
+		err = Qiniu_Client_CallWithBuffer(self, &root,
+			batch->url, body.buf, Qiniu_Buffer_Len(&body), "application/x-www-form-urlencoded");
+		Qiniu_Buffer_Cleanup(&body);
+
+		if (err.code / 100 == 2 && root != NULL) {
+			Qiniu_RS_batchParse(batch, 0, batch->count, root, &err);
 		} else {
-			bodyTmp = Qiniu_String_Concat3(body, "&", opBody);
-			free(opBody);
+			Qiniu_RS_batchFail(batch, 0, batch->count, err);
 		}
-		free(body);
-		body = bodyTmp;
-		curr++;
-		entry = &entries[curr];
+		goto done;
 	}
 
-	err = Qiniu_Client_CallWithBuffer(self, &root, 
-	url, body, strlen(body), "application/x-www-form-urlencoded");
-	free(url);
-	/*
-	 * Bug No.(4672) Wang Xiaotao  2013\10\15 17:56:00 
-	 * Change for : free  var 'body'
-	 * Reason     : memory leak!
-	 */
-	free(body);
-
-	retSize = cJSON_GetArraySize(root);
-	
-	curr = 0;
-	while (curr < retSize) {
-		arrayItem = cJSON_GetArrayItem(root, curr);
-		code = (int)Qiniu_Json_GetInt64(arrayItem, "code", 0);
-		dataItem = cJSON_GetObjectItem(arrayItem, "data");
-
-		rets[curr].code = code;
-
-		if (code != 200) {
-			rets[curr].error = Qiniu_Json_GetString(dataItem, "error", 0);
-		} else {
-			rets[curr].data.hash = Qiniu_Json_GetString(dataItem, "hash", 0);
-			rets[curr].data.mimeType = Qiniu_Json_GetString(dataItem, "mimeType", 0);
-			rets[curr].data.fsize = Qiniu_Json_GetInt64(dataItem, "fsize", 0);
-			rets[curr].data.putTime = Qiniu_Json_GetInt64(dataItem, "putTime", 0);
+	batch->async = Qiniu_Async_Create(self, batchSettings.concurrency);
+	if (batch->async == NULL) {
+		err.code = 499;
+		err.message = "No enough memory";
+		goto done;
+	}
+
+	batch->roots = cJSON_CreateArray();
+	batch->err = Qiniu_OK;
+	for (i = 0; i < batchSettings.concurrency && batch->next < batch->count; i++) {
+		err = Qiniu_RS_batchSubmit(batch);
+		if (err.code != 200) {
+			Qiniu_RS_batchFail(batch, batch->next, batch->count, err);
+			Qiniu_RS_mergeErr(&batch->err, err);
+			batch->next = batch->count;
+			break;
 		}
-		curr++;
 	}
+	Qiniu_Async_Run(batch->async);
+	Qiniu_Async_Destroy(batch->async);
+
+	if (self->root != NULL) {
+		cJSON_Delete(self->root);
+	}
+	self->root = batch->roots;
+	err = batch->err;
 
+done:
+	Qiniu_Buffer_Cleanup(&batch->scratch);
+	free(batch->url);
 	return err;
 }
 
 /*============================================================================*/
-/* func Qiniu_RS_BatchDelete */
+/* func Qiniu_RS_BatchStat */
 
-Qiniu_Error Qiniu_RS_BatchDelete(
-	Qiniu_Client* self, Qiniu_RS_BatchItemRet* rets,
-	Qiniu_RS_EntryPath* entries, Qiniu_ItemCount entryCount)
+static void Qiniu_RS_appendStatOp(
+	Qiniu_Buffer* body, Qiniu_Buffer* scratch, const void* entries, Qiniu_ItemCount i)
 {
-	int code;
-	Qiniu_Error err;
-	cJSON *root, *arrayItem, *dataItem;
-	char *body = NULL, *bodyTmp = NULL;
-	char *entryURI, *entryURIEncoded, *opBody;
-	Qiniu_ItemCount curr = 0;
-	Qiniu_ItemCount retSize = 0;
-	Qiniu_RS_EntryPath* entry = entries;
-	char* url = Qiniu_String_Concat2(QINIU_RS_HOST, "/batch");
-
-	curr = 0;
-	while (curr < entryCount) {
-		entryURI = Qiniu_String_Concat3(entry->bucket, ":", entry->key);
-		entryURIEncoded = Qiniu_String_Encode(entryURI);
-		opBody = Qiniu_String_Concat2("op=/delete/", entryURIEncoded);
-		free(entryURI);
-		free(entryURIEncoded);
-
-		if (!body) {
-			bodyTmp = opBody;
-		} else {
-			bodyTmp = Qiniu_String_Concat3(body, "&", opBody);
-			free(opBody);
-		}
-		free(body);
-		body = bodyTmp;
-		curr++;
-		entry = &entries[curr];
+	Qiniu_Buffer_Write(body, "op=/stat/", 9);
+	Qiniu_RS_appendEntryURI(body, scratch, &((const Qiniu_RS_EntryPath*)entries)[i]);
+}
+
+static void Qiniu_RS_setStatRet(
+	void* rets, Qiniu_ItemCount i, int code, const char* error, cJSON* data)
+{
+	Qiniu_RS_BatchStatRet* ret = &((Qiniu_RS_BatchStatRet*)rets)[i];
+
+	ret->code = code;
+	if (code != 200) {
+		ret->error = error;
+	} else {
+		ret->data.hash = Qiniu_Json_GetString(data, "hash", 0);
+		ret->data.mimeType = Qiniu_Json_GetString(data, "mimeType", 0);
+		ret->data.fsize = Qiniu_Json_GetInt64(data, "fsize", 0);
+		ret->data.putTime = Qiniu_Json_GetInt64(data, "putTime", 0);
 	}
+}
 
-	err = Qiniu_Client_CallWithBuffer(self, &root, 
-	url, body, strlen(body), "application/x-www-form-urlencoded");
-	free(url);
-	/*
-	 * Bug No.(4672) Wang Xiaotao  2013\10\15 17:56:00 
-	 * Change for : free  var 'body'
-	 * Reason     : memory leak!
-	 */
-	free(body);
+Qiniu_Error Qiniu_RS_BatchStat(
+	Qiniu_Client* self, Qiniu_RS_BatchStatRet* rets,
+	Qiniu_RS_EntryPath* entries, Qiniu_ItemCount entryCount)
+{
+	Qiniu_RS_batch batch;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.entries = entries;
+	batch.rets = rets;
+	batch.count = entryCount;
+	batch.appendOp = Qiniu_RS_appendStatOp;
+	batch.setRet = Qiniu_RS_setStatRet;
+	return Qiniu_RS_batchRun(self, &batch);
+}
 
-	retSize = cJSON_GetArraySize(root);
+/*============================================================================*/
+/* func Qiniu_RS_BatchDelete */
 
-	curr = 0;
-	while (curr < retSize) {
-		arrayItem = cJSON_GetArrayItem(root, curr);
-		code = (int)Qiniu_Json_GetInt64(arrayItem, "code", 0);
-		dataItem = cJSON_GetObjectItem(arrayItem, "data");
+static void Qiniu_RS_appendDeleteOp(
+	Qiniu_Buffer* body, Qiniu_Buffer* scratch, const void* entries, Qiniu_ItemCount i)
+{
+	Qiniu_Buffer_Write(body, "op=/delete/", 11);
+	Qiniu_RS_appendEntryURI(body, scratch, &((const Qiniu_RS_EntryPath*)entries)[i]);
+}
 
-		rets[curr].code = code;
+static void Qiniu_RS_setItemRet(
+	void* rets, Qiniu_ItemCount i, int code, const char* error, cJSON* data)
+{
+	Qiniu_RS_BatchItemRet* ret = &((Qiniu_RS_BatchItemRet*)rets)[i];
 
-		if (code != 200) {
-			rets[curr].error = Qiniu_Json_GetString(dataItem, "error", 0);
-		}
-		curr++;
+	ret->code = code;
+	if (code != 200) {
+		ret->error = error;
 	}
+}
 
-	return err;
+Qiniu_Error Qiniu_RS_BatchDelete(
+	Qiniu_Client* self, Qiniu_RS_BatchItemRet* rets,
+	Qiniu_RS_EntryPath* entries, Qiniu_ItemCount entryCount)
+{
+	Qiniu_RS_batch batch;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.entries = entries;
+	batch.rets = rets;
+	batch.count = entryCount;
+	batch.appendOp = Qiniu_RS_appendDeleteOp;
+	batch.setRet = Qiniu_RS_setItemRet;
+	return Qiniu_RS_batchRun(self, &batch);
 }
 
 /*============================================================================*/
 /* func Qiniu_RS_BatchMove */
 
+static void Qiniu_RS_appendPairOp(
+	Qiniu_Buffer* body, Qiniu_Buffer* scratch, const Qiniu_RS_EntryPathPair* entryPair)
+{
+	Qiniu_RS_appendEntryURI(body, scratch, &entryPair->src);
+	Qiniu_Buffer_PutChar(body, '/');
+	Qiniu_RS_appendEntryURI(body, scratch, &entryPair->dest);
+}
+
+static void Qiniu_RS_appendMoveOp(
+	Qiniu_Buffer* body, Qiniu_Buffer* scratch, const void* entryPairs, Qiniu_ItemCount i)
+{
+	Qiniu_Buffer_Write(body, "op=/move/", 9);
+	Qiniu_RS_appendPairOp(body, scratch, &((const Qiniu_RS_EntryPathPair*)entryPairs)[i]);
+}
+
 Qiniu_Error Qiniu_RS_BatchMove(
 	Qiniu_Client* self, Qiniu_RS_BatchItemRet* rets,
 	Qiniu_RS_EntryPathPair* entryPairs, Qiniu_ItemCount entryCount)
 {
-	int code;
-	Qiniu_Error err;
-	cJSON *root, *arrayItem, *dataItem;
-	char *body = NULL, *bodyTmp = NULL;
-	char *entryURISrc, *entryURISrcEncoded, *opBody;
-	char *entryURIDest, *entryURIDestEncoded, *bodyPart;
-	Qiniu_ItemCount curr = 0;
-	Qiniu_ItemCount retSize = 0;
-	Qiniu_RS_EntryPathPair* entryPair = entryPairs;
-	char* url = Qiniu_String_Concat2(QINIU_RS_HOST, "/batch");
-
-	curr = 0;
-	while (curr < entryCount) {
-		entryURISrc = Qiniu_String_Concat3(entryPair->src.bucket, ":", entryPair->src.key);
-		entryURISrcEncoded = Qiniu_String_Encode(entryURISrc);
-		entryURIDest = Qiniu_String_Concat3(entryPair->dest.bucket, ":", entryPair->dest.key);
-		entryURIDestEncoded = Qiniu_String_Encode(entryURIDest);
-
-		bodyPart = Qiniu_String_Concat3(entryURISrcEncoded, "/", entryURIDestEncoded);
-		opBody = Qiniu_String_Concat2("op=/move/", bodyPart);
-		free(entryURISrc);
-		free(entryURISrcEncoded);
-		free(entryURIDest);
-		free(entryURIDestEncoded);
-		free(bodyPart);
-
-		if (!body) {
-			bodyTmp = opBody;
-		} else {
-			bodyTmp = Qiniu_String_Concat3(body, "&", opBody);
-			free(opBody);
+	Qiniu_RS_batch batch;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.entries = entryPairs;
+	batch.rets = rets;
+	batch.count = entryCount;
+	batch.appendOp = Qiniu_RS_appendMoveOp;
+	batch.setRet = Qiniu_RS_setItemRet;
+	return Qiniu_RS_batchRun(self, &batch);
+}
+
+/*============================================================================*/
+/* func Qiniu_RS_BatchCopy */
+
+static void Qiniu_RS_appendCopyOp(
+	Qiniu_Buffer* body, Qiniu_Buffer* scratch, const void* entryPairs, Qiniu_ItemCount i)
+{
+	Qiniu_Buffer_Write(body, "op=/copy/", 9);
+	Qiniu_RS_appendPairOp(body, scratch, &((const Qiniu_RS_EntryPathPair*)entryPairs)[i]);
+}
+
+Qiniu_Error Qiniu_RS_BatchCopy(
+	Qiniu_Client* self, Qiniu_RS_BatchItemRet* rets,
+	Qiniu_RS_EntryPathPair* entryPairs, Qiniu_ItemCount entryCount)
+{
+	Qiniu_RS_batch batch;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.entries = entryPairs;
+	batch.rets = rets;
+	batch.count = entryCount;
+	batch.appendOp = Qiniu_RS_appendCopyOp;
+	batch.setRet = Qiniu_RS_setItemRet;
+	return Qiniu_RS_batchRun(self, &batch);
+}
+
+/*============================================================================*/
+/* type Qiniu_RS_Batch */
+
+// Strings of the results are kept in blocks which are never moved, so that they can be
+// handed out while the response is still being decoded.
+typedef struct _Qiniu_RS_batchStrs {
+	struct _Qiniu_RS_batchStrs* next;
+	size_t size;
+	size_t used;
+	char data[1];
+} Qiniu_RS_batchStrs;
+
+#define Qiniu_RS_batchStrsBlock	4096
+
+static const char* Qiniu_RS_Batch_saveStr(Qiniu_RS_Batch* self, const char* s, size_t n)
+{
+	char* p;
+	size_t size;
+	Qiniu_RS_batchStrs* blk = self->strs;
+
+	if (blk == NULL || blk->size - blk->used < n + 1) {
+		size = (n + 1 > Qiniu_RS_batchStrsBlock) ? n + 1 : Qiniu_RS_batchStrsBlock;
+		blk = (Qiniu_RS_batchStrs*)malloc(sizeof(Qiniu_RS_batchStrs) + size);
+		if (blk == NULL) {
+			return NULL;
 		}
-		free(body);
-		body = bodyTmp;
-		curr++;
-		entryPair = &entryPairs[curr];
+		blk->next = self->strs;
+		blk->size = size;
+		blk->used = 0;
+		self->strs = blk;
 	}
+	p = blk->data + blk->used;
+	memcpy(p, s, n);
+	p[n] = '\0';
+	blk->used += n + 1;
+	return p;
+}
 
-	err = Qiniu_Client_CallWithBuffer(self, &root, 
-	url, body, strlen(body), "application/x-www-form-urlencoded");
-	free(url);
-	/*
-	 * Bug No.(4672) Wang Xiaotao  2013\10\15 17:56:00 
-	 * Change for : free  var 'body'
-	 * Reason     : memory leak!
-	 */
-	free(body);
-
-	retSize = cJSON_GetArraySize(root);
-	
-	curr = 0;
-	while (curr < retSize) {
-		arrayItem = cJSON_GetArrayItem(root, curr);
-		code = (int)Qiniu_Json_GetInt64(arrayItem, "code", 0);
-		dataItem = cJSON_GetObjectItem(arrayItem, "data");
-
-		rets[curr].code = code;
-
-		if (code != 200) {
-			rets[curr].error = Qiniu_Json_GetString(dataItem, "error", 0);
-		}
-		curr++;
+static void Qiniu_RS_Batch_freeStrs(Qiniu_RS_Batch* self)
+{
+	Qiniu_RS_batchStrs* blk;
+
+	while (self->strs != NULL) {
+		blk = self->strs;
+		self->strs = blk->next;
+		free(blk);
 	}
+}
 
-	return err;
+void Qiniu_RS_Batch_Init(Qiniu_RS_Batch* self)
+{
+	Qiniu_Buffer_Init(&self->body, 1024);
+	Qiniu_Buffer_Init(&self->offs, 16 * sizeof(size_t));
+	Qiniu_Buffer_Init(&self->scratch, 256);
+	self->strs = NULL;
+	self->count = 0;
+}
+
+void Qiniu_RS_Batch_Reset(Qiniu_RS_Batch* self)
+{
+	Qiniu_Buffer_Reset(&self->body);
+	Qiniu_Buffer_Reset(&self->offs);
+	Qiniu_RS_Batch_freeStrs(self);
+	self->count = 0;
+}
+
+void Qiniu_RS_Batch_Cleanup(Qiniu_RS_Batch* self)
+{
+	Qiniu_Buffer_Cleanup(&self->body);
+	Qiniu_Buffer_Cleanup(&self->offs);
+	Qiniu_Buffer_Cleanup(&self->scratch);
+	Qiniu_RS_Batch_freeStrs(self);
+	self->count = 0;
+}
+
+// Remember where each op starts, so that a range of ops can be sent as a sub-batch.
+static void Qiniu_RS_Batch_begin(Qiniu_RS_Batch* self, const char* op, const char* bucket, const char* key)
+{
+	size_t off;
+	Qiniu_RS_EntryPath entry;
+
+	if (self->count > 0) {
+		Qiniu_Buffer_PutChar(&self->body, '&');
+	}
+	off = Qiniu_Buffer_Len(&self->body);
+	Qiniu_Buffer_Write(&self->offs, &off, sizeof(off));
+	self->count++;
+
+	Qiniu_Buffer_Write(&self->body, "op=", 3);
+	Qiniu_Buffer_Write(&self->body, op, strlen(op));
+	entry.bucket = bucket;
+	entry.key = key;
+	Qiniu_RS_appendEntryURI(&self->body, &self->scratch, &entry);
+}
+
+void Qiniu_RS_Batch_Stat(Qiniu_RS_Batch* self, const char* bucket, const char* key)
+{
+	Qiniu_RS_Batch_begin(self, "/stat/", bucket, key);
+}
+
+void Qiniu_RS_Batch_Delete(Qiniu_RS_Batch* self, const char* bucket, const char* key)
+{
+	Qiniu_RS_Batch_begin(self, "/delete/", bucket, key);
+}
+
+static void Qiniu_RS_Batch_pair(Qiniu_RS_Batch* self, const char* op,
+	const char* tableNameSrc, const char* keySrc, const char* tableNameDest, const char* keyDest)
+{
+	Qiniu_RS_EntryPath dest;
+
+	Qiniu_RS_Batch_begin(self, op, tableNameSrc, keySrc);
+	Qiniu_Buffer_PutChar(&self->body, '/');
+	dest.bucket = tableNameDest;
+	dest.key = keyDest;
+	Qiniu_RS_appendEntryURI(&self->body, &self->scratch, &dest);
+}
+
+void Qiniu_RS_Batch_Copy(Qiniu_RS_Batch* self,
+	const char* tableNameSrc, const char* keySrc, const char* tableNameDest, const char* keyDest)
+{
+	Qiniu_RS_Batch_pair(self, "/copy/", tableNameSrc, keySrc, tableNameDest, keyDest);
+}
+
+void Qiniu_RS_Batch_Move(Qiniu_RS_Batch* self,
+	const char* tableNameSrc, const char* keySrc, const char* tableNameDest, const char* keyDest)
+{
+	Qiniu_RS_Batch_pair(self, "/move/", tableNameSrc, keySrc, tableNameDest, keyDest);
+}
+
+void Qiniu_RS_Batch_ChangeMime(Qiniu_RS_Batch* self, const char* bucket, const char* key, const char* mimeType)
+{
+	Qiniu_RS_Batch_begin(self, "/chgm/", bucket, key);
+	Qiniu_Buffer_Write(&self->body, "/mime/", 6);
+	Qiniu_Buffer_AppendEncodedBinary(&self->body, mimeType, strlen(mimeType));
 }
 
 /*============================================================================*/
-/* func Qiniu_RS_BatchCopy */
+/* type Qiniu_RS_batchDecoder */
+
+// Decodes the batch response, [{"code": 200, "data": {...}}, ...], from the stream and writes each
+// item straight into the result array. Only the fields of the results are kept.
+
+enum {
+	Qiniu_RS_keyOther,
+	Qiniu_RS_keyCode,
+	Qiniu_RS_keyData,
+	Qiniu_RS_keyHash,
+	Qiniu_RS_keyMimeType,
+	Qiniu_RS_keyError,
+	Qiniu_RS_keyFsize,
+	Qiniu_RS_keyPutTime
+};
+
+typedef struct _Qiniu_RS_batchDecoder {
+	Qiniu_RS_Batch* batch;
+	Qiniu_RS_BatchStatRet* rets;
+	Qiniu_ItemCount curr;
+	Qiniu_ItemCount end;
+	int itemKey;
+	int dataKey;
+} Qiniu_RS_batchDecoder;
+
+static int Qiniu_RS_batchDecoder_key(const char* key, size_t n)
+{
+	static const struct {
+		const char* name;
+		int key;
+	} keys[] = {
+		{"code", Qiniu_RS_keyCode},
+		{"data", Qiniu_RS_keyData},
+		{"hash", Qiniu_RS_keyHash},
+		{"mimeType", Qiniu_RS_keyMimeType},
+		{"error", Qiniu_RS_keyError},
+		{"fsize", Qiniu_RS_keyFsize},
+		{"putTime", Qiniu_RS_keyPutTime}
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		if (strlen(keys[i].name) == n && memcmp(keys[i].name, key, n) == 0) {
+			return keys[i].key;
+		}
+	}
+	return Qiniu_RS_keyOther;
+}
 
-Qiniu_Error Qiniu_RS_BatchCopy(
-	Qiniu_Client* self, Qiniu_RS_BatchItemRet* rets,
-	Qiniu_RS_EntryPathPair* entryPairs, Qiniu_ItemCount entryCount)
+static Qiniu_RS_BatchStatRet* Qiniu_RS_batchDecoder_ret(Qiniu_RS_batchDecoder* self)
 {
-	int code;
-	Qiniu_Error err;
-	cJSON *root, *arrayItem, *dataItem;
-	char *body = NULL, *bodyTmp = NULL;
-	char *entryURISrc, *entryURISrcEncoded, *opBody;
-	char *entryURIDest, *entryURIDestEncoded, *bodyPart;
-	Qiniu_ItemCount curr = 0;
-	Qiniu_ItemCount retSize = 0;
-	Qiniu_RS_EntryPathPair* entryPair = entryPairs;
-	char* url = Qiniu_String_Concat2(QINIU_RS_HOST, "/batch");
-
-	curr = 0;
-	while (curr < entryCount) {
-		entryURISrc = Qiniu_String_Concat3(entryPair->src.bucket, ":", entryPair->src.key);
-		entryURISrcEncoded = Qiniu_String_Encode(entryURISrc);
-		entryURIDest = Qiniu_String_Concat3(entryPair->dest.bucket, ":", entryPair->dest.key);
-		entryURIDestEncoded = Qiniu_String_Encode(entryURIDest);
-		
-		bodyPart = Qiniu_String_Concat3(entryURISrcEncoded, "/", entryURIDestEncoded);
-		opBody = Qiniu_String_Concat2("op=/copy/", bodyPart);
-		free(entryURISrc);
-		free(entryURISrcEncoded);
-		free(entryURIDest);
-		free(entryURIDestEncoded);
-		free(bodyPart);
-
-		if (!body) {
-			bodyTmp = opBody;
-		} else {
-			bodyTmp = Qiniu_String_Concat3(body, "&", opBody);
-			free(opBody);
+	return (self->curr < self->end) ? &self->rets[self->curr] : NULL;
+}
+
+static void Qiniu_RS_batchDecoder_Open(void* recvr, Qiniu_JsonStream* js, char c)
+{
+	Qiniu_RS_batchDecoder* self = (Qiniu_RS_batchDecoder*)recvr;
+	Qiniu_RS_BatchStatRet* ret;
+
+	if (js->depth == 1 && c != '[') {
+		js->failed = 1;
+	} else if (js->depth == 2) {
+		ret = Qiniu_RS_batchDecoder_ret(self);
+		if (ret != NULL) {
+			memset(ret, 0, sizeof(*ret));
 		}
-		free(body);
-		body = bodyTmp;
-		curr++;
-		entryPair = &entryPairs[curr];
+		self->itemKey = Qiniu_RS_keyOther;
+	} else if (js->depth == 3) {
+		self->dataKey = Qiniu_RS_keyOther;
 	}
+}
 
-	err = Qiniu_Client_CallWithBuffer(self, &root, 
-	url, body, strlen(body), "application/x-www-form-urlencoded");
-	free(url);
-	/*
-	 * Bug No.(4672) Wang Xiaotao  2013\10\15 17:56:00 
-	 * Change for : free  var 'body'
-	 * Reason     : memory leak!
-	 */
-	free(body);
-
-	retSize = cJSON_GetArraySize(root);
-	
-	curr = 0;
-	while (curr < retSize) {
-		arrayItem = cJSON_GetArrayItem(root, curr);
-		code = (int)Qiniu_Json_GetInt64(arrayItem, "code", 0);
-		dataItem = cJSON_GetObjectItem(arrayItem, "data");
-
-		rets[curr].code = code;
-
-		if (code != 200) {
-			rets[curr].error = Qiniu_Json_GetString(dataItem, "error", 0);
+static void Qiniu_RS_batchDecoder_Close(void* recvr, Qiniu_JsonStream* js, char c)
+{
+	Qiniu_RS_batchDecoder* self = (Qiniu_RS_batchDecoder*)recvr;
+
+	if (js->depth == 2) {
+		self->curr++;
+	}
+}
+
+static void Qiniu_RS_batchDecoder_Key(void* recvr, Qiniu_JsonStream* js, const char* key, size_t n)
+{
+	Qiniu_RS_batchDecoder* self = (Qiniu_RS_batchDecoder*)recvr;
+
+	if (js->depth == 2) {
+		self->itemKey = Qiniu_RS_batchDecoder_key(key, n);
+	} else if (js->depth == 3) {
+		self->dataKey = Qiniu_RS_batchDecoder_key(key, n);
+	}
+}
+
+static void Qiniu_RS_batchDecoder_String(void* recvr, Qiniu_JsonStream* js, const char* s, size_t n)
+{
+	Qiniu_RS_batchDecoder* self = (Qiniu_RS_batchDecoder*)recvr;
+	Qiniu_RS_BatchStatRet* ret = Qiniu_RS_batchDecoder_ret(self);
+
+	if (ret == NULL || js->depth != 3 || self->itemKey != Qiniu_RS_keyData) {
+		return;
+	}
+	switch (self->dataKey) {
+	case Qiniu_RS_keyHash:
+		ret->data.hash = Qiniu_RS_Batch_saveStr(self->batch, s, n);
+		break;
+	case Qiniu_RS_keyMimeType:
+		ret->data.mimeType = Qiniu_RS_Batch_saveStr(self->batch, s, n);
+		break;
+	case Qiniu_RS_keyError:
+		ret->error = Qiniu_RS_Batch_saveStr(self->batch, s, n);
+		break;
+	}
+}
+
+static void Qiniu_RS_batchDecoder_Number(void* recvr, Qiniu_JsonStream* js, const char* s)
+{
+	Qiniu_RS_batchDecoder* self = (Qiniu_RS_batchDecoder*)recvr;
+	Qiniu_RS_BatchStatRet* ret = Qiniu_RS_batchDecoder_ret(self);
+	Qiniu_Int64 v;
+
+	if (ret == NULL) {
+		return;
+	}
+	v = (Qiniu_Int64)Qiniu_strtoll(s, NULL, 10);
+	if (js->depth == 2 && self->itemKey == Qiniu_RS_keyCode) {
+		ret->code = (int)v;
+	} else if (js->depth == 3 && self->itemKey == Qiniu_RS_keyData) {
+		if (self->dataKey == Qiniu_RS_keyFsize) {
+			ret->data.fsize = v;
+		} else if (self->dataKey == Qiniu_RS_keyPutTime) {
+			ret->data.putTime = v;
 		}
-		curr++;
 	}
+}
+
+static const Qiniu_JsonStream_Itbl Qiniu_RS_batchDecoder_Itbl = {
+	Qiniu_RS_batchDecoder_Open,
+	Qiniu_RS_batchDecoder_Close,
+	Qiniu_RS_batchDecoder_Key,
+	Qiniu_RS_batchDecoder_String,
+	Qiniu_RS_batchDecoder_Number
+};
+
+/*============================================================================*/
+/* func Qiniu_RS_Batch_Do */
+
+Qiniu_Error Qiniu_RS_Batch_Do(Qiniu_RS_Batch* self, Qiniu_Client* cli, Qiniu_RS_BatchStatRet* rets)
+{
+	Qiniu_Error err = Qiniu_OK;
+	Qiniu_Error err2;
+	Qiniu_Json* root;
+	Qiniu_JsonStream js;
+	Qiniu_RS_batchDecoder dec;
+	Qiniu_Writer w;
+	Qiniu_ItemCount begin, end, i;
+	const size_t* offs = (const size_t*)self->offs.buf;
+	size_t from, to;
+	const char* msg;
+	char* url;
+
+	Qiniu_RS_Batch_freeStrs(self);
+	if (self->count == 0) {
+		return err;
+	}
+
+	url = Qiniu_String_Concat2(QINIU_RS_HOST, "/batch");
+	Qiniu_JsonStream_Init(&js, &Qiniu_RS_batchDecoder_Itbl, &dec);
+	w.self = &js;
+	w.Write = Qiniu_JsonStream_Write;
+
+	for (begin = 0; begin < self->count; begin = end) {
+		end = (self->count - begin > batchSettings.opsPerBatch) ? begin + batchSettings.opsPerBatch : self->count;
+		from = offs[begin];
+		to = (end < self->count) ? offs[end] - 1 : Qiniu_Buffer_Len(&self->body);
+
+		dec.batch = self;
+		dec.rets = rets;
+		dec.curr = begin;
+		dec.end = end;
+		Qiniu_JsonStream_Reset(&js);
+
+		err2 = Qiniu_Client_CallWithBufferStream(cli, &root, url,
+			self->body.buf + from, to - from, "application/x-www-form-urlencoded", w);
+		if (js.failed || (err2.code / 100 == 2 && (!Qiniu_JsonStream_Done(&js) || dec.curr != end))) {
+			err2.code = 9983;
+			err2.message = "Invalid batch response";
+		} else if (err2.code / 100 != 2) {
+			// The message may point into the client, which is reused by the next sub-batch.
+			msg = Qiniu_RS_Batch_saveStr(self, err2.message, strlen(err2.message));
+			err2.message = (msg != NULL) ? msg : "Batch request failed";
+		}
+		if (err2.code / 100 != 2) {
+			for (i = begin; i < end; i++) {
+				memset(&rets[i], 0, sizeof(rets[i]));
+				rets[i].code = err2.code;
+				rets[i].error = err2.message;
+			}
+		}
+		Qiniu_RS_mergeErr(&err, err2);
+	}
+
+	Qiniu_JsonStream_Cleanup(&js);
+	free(url);
+	return err;
+}
+
+/*============================================================================*/
+/* func Qiniu_RS_AsyncStat/Delete/Copy/Move */
+
+static char* Qiniu_RS_entryURL(const char* op, const char* tableName, const char* key)
+{
+	char* entryURI = Qiniu_String_Concat3(tableName, ":", key);
+	char* entryURIEncoded = Qiniu_String_Encode(entryURI);
+	char* url = Qiniu_String_Concat(QINIU_RS_HOST, op, entryURIEncoded, NULL);
+
+	Qiniu_Free(entryURI);
+	Qiniu_Free(entryURIEncoded);
+	return url;
+}
+
+static char* Qiniu_RS_entryPairURL(
+	const char* op, const char* tableNameSrc, const char* keySrc,
+	const char* tableNameDest, const char* keyDest)
+{
+	char* entryURISrc = Qiniu_String_Concat3(tableNameSrc, ":", keySrc);
+	char* entryURISrcEncoded = Qiniu_String_Encode(entryURISrc);
+	char* entryURIDest = Qiniu_String_Concat3(tableNameDest, ":", keyDest);
+	char* entryURIDestEncoded = Qiniu_String_Encode(entryURIDest);
+	char* url = Qiniu_String_Concat(QINIU_RS_HOST, op, entryURISrcEncoded, "/", entryURIDestEncoded, NULL);
+
+	Qiniu_Free(entryURISrc);
+	Qiniu_Free(entryURISrcEncoded);
+	Qiniu_Free(entryURIDest);
+	Qiniu_Free(entryURIDestEncoded);
+	return url;
+}
+
+Qiniu_Error Qiniu_RS_AsyncStat(
+	Qiniu_Async* async, const char* tableName, const char* key, Qiniu_Async_FnDone done, void* recvr)
+{
+	Qiniu_Error err;
+	char* url = Qiniu_RS_entryURL("/stat/", tableName, key);
 
+	err = Qiniu_Async_Call(async, url, done, recvr);
+	Qiniu_Free(url);
+	return err;
+}
+
+Qiniu_Error Qiniu_RS_AsyncDelete(
+	Qiniu_Async* async, const char* tableName, const char* key, Qiniu_Async_FnDone done, void* recvr)
+{
+	Qiniu_Error err;
+	char* url = Qiniu_RS_entryURL("/delete/", tableName, key);
+
+	err = Qiniu_Async_Call(async, url, done, recvr);
+	Qiniu_Free(url);
+	return err;
+}
+
+Qiniu_Error Qiniu_RS_AsyncCopy(Qiniu_Async* async,
+	const char* tableNameSrc, const char* keySrc,
+	const char* tableNameDest, const char* keyDest, Qiniu_Async_FnDone done, void* recvr)
+{
+	Qiniu_Error err;
+	char* url = Qiniu_RS_entryPairURL("/copy/", tableNameSrc, keySrc, tableNameDest, keyDest);
+
+	err = Qiniu_Async_Call(async, url, done, recvr);
+	Qiniu_Free(url);
+	return err;
+}
+
+Qiniu_Error Qiniu_RS_AsyncMove(Qiniu_Async* async,
+	const char* tableNameSrc, const char* keySrc,
+	const char* tableNameDest, const char* keyDest, Qiniu_Async_FnDone done, void* recvr)
+{
+	Qiniu_Error err;
+	char* url = Qiniu_RS_entryPairURL("/move/", tableNameSrc, keySrc, tableNameDest, keyDest);
+
+	err = Qiniu_Async_Call(async, url, done, recvr);
+	Qiniu_Free(url);
 	return err;
 }
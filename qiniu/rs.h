@@ -11,6 +11,7 @@
 #define QINIU_RS_H
 
 #include "http.h"
+#include "async.h"
 
 #pragma pack(1)
 
@@ -89,6 +90,19 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_RS_Move(Qiniu_Client* self,
         const char* tableNameSrc, const char* keySrc, 
         const char* tableNameDest, const char* keyDest);
 
+/*============================================================================*/
+/* type Qiniu_RS_BatchSettings */
+
+// Batches larger than opsPerBatch (default 1000, the server limit) are split into sub-batches,
+// and at most concurrency (default 4) of them are in flight at the same time. Results are
+// always returned in the order of the entries.
+typedef struct _Qiniu_RS_BatchSettings {
+	int opsPerBatch;
+	int concurrency;
+} Qiniu_RS_BatchSettings;
+
+QINIU_DLLAPI extern void Qiniu_RS_SetBatchSettings(Qiniu_RS_BatchSettings* v);
+
 /*============================================================================*/
 /* func Qiniu_RS_BatchStat */
 
@@ -153,6 +167,59 @@ QINIU_DLLAPI extern Qiniu_Error Qiniu_RS_BatchCopy(
         Qiniu_Client* self, Qiniu_RS_BatchItemRet* rets,
         Qiniu_RS_EntryPathPair* entryPairs, Qiniu_ItemCount entryCount);
 
+/*============================================================================*/
+/* type Qiniu_RS_Batch */
+
+// A reusable builder of mixed batch operations. Qiniu_RS_Batch_Do decodes the results while the
+// response is received, without building a JSON tree, and splits the ops into sub-batches of
+// Qiniu_RS_BatchSettings.opsPerBatch which are sent one after another.
+typedef struct _Qiniu_RS_Batch {
+	Qiniu_Buffer body;
+	Qiniu_Buffer offs;
+	Qiniu_Buffer scratch;
+	struct _Qiniu_RS_batchStrs* strs;
+	Qiniu_ItemCount count;
+} Qiniu_RS_Batch;
+
+QINIU_DLLAPI extern void Qiniu_RS_Batch_Init(Qiniu_RS_Batch* self);
+QINIU_DLLAPI extern void Qiniu_RS_Batch_Reset(Qiniu_RS_Batch* self);
+QINIU_DLLAPI extern void Qiniu_RS_Batch_Cleanup(Qiniu_RS_Batch* self);
+
+QINIU_DLLAPI extern void Qiniu_RS_Batch_Stat(Qiniu_RS_Batch* self, const char* bucket, const char* key);
+QINIU_DLLAPI extern void Qiniu_RS_Batch_Delete(Qiniu_RS_Batch* self, const char* bucket, const char* key);
+QINIU_DLLAPI extern void Qiniu_RS_Batch_Copy(Qiniu_RS_Batch* self,
+        const char* tableNameSrc, const char* keySrc,
+        const char* tableNameDest, const char* keyDest);
+QINIU_DLLAPI extern void Qiniu_RS_Batch_Move(Qiniu_RS_Batch* self,
+        const char* tableNameSrc, const char* keySrc,
+        const char* tableNameDest, const char* keyDest);
+QINIU_DLLAPI extern void Qiniu_RS_Batch_ChangeMime(Qiniu_RS_Batch* self,
+        const char* bucket, const char* key, const char* mimeType);
+
+// The rets must have room for self->count results, which are in the order of the ops. Only the
+// stat ops fill the data. The strings of rets keep valid until the batch is run again, reset or
+// cleaned up. Return the first failure, or 298 if some of the ops failed.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_RS_Batch_Do(
+        Qiniu_RS_Batch* self, Qiniu_Client* cli, Qiniu_RS_BatchStatRet* rets);
+
+/*============================================================================*/
+/* func Qiniu_RS_AsyncStat/Delete/Copy/Move */
+
+// Submit the request to the event loop. The callback receives the same JSON object as the blocking version.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_RS_AsyncStat(
+	Qiniu_Async* async, const char* bucket, const char* key, Qiniu_Async_FnDone done, void* recvr);
+
+QINIU_DLLAPI extern Qiniu_Error Qiniu_RS_AsyncDelete(
+	Qiniu_Async* async, const char* bucket, const char* key, Qiniu_Async_FnDone done, void* recvr);
+
+QINIU_DLLAPI extern Qiniu_Error Qiniu_RS_AsyncCopy(Qiniu_Async* async,
+        const char* tableNameSrc, const char* keySrc,
+        const char* tableNameDest, const char* keyDest, Qiniu_Async_FnDone done, void* recvr);
+
+QINIU_DLLAPI extern Qiniu_Error Qiniu_RS_AsyncMove(Qiniu_Async* async,
+        const char* tableNameSrc, const char* keySrc,
+        const char* tableNameDest, const char* keyDest, Qiniu_Async_FnDone done, void* recvr);
+
 /*============================================================================*/
 
 #pragma pack()
@@ -0,0 +1,501 @@
+/*
+ ============================================================================
+ Name        : rsf.c
+ Author      : Qiniu.com
+ Copyright   : 2012(c) Shanghai Qiniu Information Technologies Co., Ltd.
+ Description :
+ ============================================================================
+ */
+#include "rsf.h"
+#include "private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*============================================================================*/
+/* type Qiniu_RSF_page */
+
+// While a page is decoded, strings are saved as offsets into the arena, since it may be moved
+// when it grows. They are turned into pointers once the page is complete. The buffers of a page
+// are reused by the pages after it, so the memory is bounded by the largest page.
+typedef struct _Qiniu_RSF_rawItem {
+	size_t key;
+	size_t hash;
+	size_t mimeType;
+	size_t endUser;
+	Qiniu_Int64 fsize;
+	Qiniu_Int64 putTime;
+	int type;
+} Qiniu_RSF_rawItem;
+
+typedef struct _Qiniu_RSF_page {
+	Qiniu_Buffer strs;
+	Qiniu_Buffer raws;
+	Qiniu_Buffer rawPrefixes;
+	Qiniu_Buffer items;
+	Qiniu_Buffer prefixes;
+	size_t marker;
+	int topKey;
+	int itemKey;
+	Qiniu_Error err;
+} Qiniu_RSF_page;
+
+enum {
+	Qiniu_RSF_keyOther,
+	Qiniu_RSF_keyMarker,
+	Qiniu_RSF_keyCommonPrefixes,
+	Qiniu_RSF_keyItems,
+	Qiniu_RSF_keyKey,
+	Qiniu_RSF_keyHash,
+	Qiniu_RSF_keyMimeType,
+	Qiniu_RSF_keyEndUser,
+	Qiniu_RSF_keyFsize,
+	Qiniu_RSF_keyPutTime,
+	Qiniu_RSF_keyType
+};
+
+static void Qiniu_RSF_page_Init(Qiniu_RSF_page* self)
+{
+	Qiniu_Buffer_Init(&self->strs, 64 * 1024);
+	Qiniu_Buffer_Init(&self->raws, 1024 * sizeof(Qiniu_RSF_rawItem));
+	Qiniu_Buffer_Init(&self->rawPrefixes, 64 * sizeof(size_t));
+	Qiniu_Buffer_Init(&self->items, 1024 * sizeof(Qiniu_RSF_ListItem));
+	Qiniu_Buffer_Init(&self->prefixes, 64 * sizeof(const char*));
+}
+
+static void Qiniu_RSF_page_Cleanup(Qiniu_RSF_page* self)
+{
+	Qiniu_Buffer_Cleanup(&self->strs);
+	Qiniu_Buffer_Cleanup(&self->raws);
+	Qiniu_Buffer_Cleanup(&self->rawPrefixes);
+	Qiniu_Buffer_Cleanup(&self->items);
+	Qiniu_Buffer_Cleanup(&self->prefixes);
+}
+
+static void Qiniu_RSF_page_Reset(Qiniu_RSF_page* self)
+{
+	Qiniu_Buffer_Reset(&self->strs);
+	Qiniu_Buffer_Reset(&self->raws);
+	Qiniu_Buffer_Reset(&self->rawPrefixes);
+	Qiniu_Buffer_Reset(&self->items);
+	Qiniu_Buffer_Reset(&self->prefixes);
+
+	// Offset 0 stands for a missing string.
+	Qiniu_Buffer_PutChar(&self->strs, '\0');
+	self->marker = 0;
+	self->topKey = Qiniu_RSF_keyOther;
+	self->itemKey = Qiniu_RSF_keyOther;
+}
+
+static size_t Qiniu_RSF_page_saveStr(Qiniu_RSF_page* self, const char* s, size_t n)
+{
+	size_t off = Qiniu_Buffer_Len(&self->strs);
+
+	Qiniu_Buffer_Write(&self->strs, s, n);
+	Qiniu_Buffer_PutChar(&self->strs, '\0');
+	return off;
+}
+
+static const char* Qiniu_RSF_page_str(Qiniu_RSF_page* self, size_t off)
+{
+	return (off != 0) ? self->strs.buf + off : NULL;
+}
+
+static Qiniu_RSF_rawItem* Qiniu_RSF_page_lastItem(Qiniu_RSF_page* self)
+{
+	return ((Qiniu_RSF_rawItem*)self->raws.curr) - 1;
+}
+
+static void Qiniu_RSF_page_Finish(Qiniu_RSF_page* self)
+{
+	size_t i;
+	size_t itemCount = Qiniu_Buffer_Len(&self->raws) / sizeof(Qiniu_RSF_rawItem);
+	size_t prefixCount = Qiniu_Buffer_Len(&self->rawPrefixes) / sizeof(size_t);
+	const Qiniu_RSF_rawItem* raw = (const Qiniu_RSF_rawItem*)self->raws.buf;
+	const size_t* rawPrefix = (const size_t*)self->rawPrefixes.buf;
+	Qiniu_RSF_ListItem* item;
+	const char** prefix;
+
+	item = (Qiniu_RSF_ListItem*)Qiniu_Buffer_Expand(&self->items, itemCount * sizeof(Qiniu_RSF_ListItem));
+	for (i = 0; i < itemCount; i++) {
+		item[i].key = Qiniu_RSF_page_str(self, raw[i].key);
+		item[i].hash = Qiniu_RSF_page_str(self, raw[i].hash);
+		item[i].mimeType = Qiniu_RSF_page_str(self, raw[i].mimeType);
+		item[i].endUser = Qiniu_RSF_page_str(self, raw[i].endUser);
+		item[i].fsize = raw[i].fsize;
+		item[i].putTime = raw[i].putTime;
+		item[i].type = raw[i].type;
+	}
+	Qiniu_Buffer_Commit(&self->items, (char*)(item + itemCount));
+
+	prefix = (const char**)Qiniu_Buffer_Expand(&self->prefixes, prefixCount * sizeof(const char*));
+	for (i = 0; i < prefixCount; i++) {
+		prefix[i] = Qiniu_RSF_page_str(self, rawPrefix[i]);
+	}
+	Qiniu_Buffer_Commit(&self->prefixes, (char*)(prefix + prefixCount));
+}
+
+/*============================================================================*/
+/* type Qiniu_RSF_pageDecoder */
+
+// Decodes {"marker": "...", "commonPrefixes": ["..."], "items": [{...}, ...]} into a page.
+
+static int Qiniu_RSF_pageDecoder_key(const char* key, size_t n)
+{
+	static const struct {
+		const char* name;
+		int key;
+	} keys[] = {
+		{"marker", Qiniu_RSF_keyMarker},
+		{"commonPrefixes", Qiniu_RSF_keyCommonPrefixes},
+		{"items", Qiniu_RSF_keyItems},
+		{"key", Qiniu_RSF_keyKey},
+		{"hash", Qiniu_RSF_keyHash},
+		{"mimeType", Qiniu_RSF_keyMimeType},
+		{"endUser", Qiniu_RSF_keyEndUser},
+		{"fsize", Qiniu_RSF_keyFsize},
+		{"putTime", Qiniu_RSF_keyPutTime},
+		{"type", Qiniu_RSF_keyType}
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		if (strlen(keys[i].name) == n && memcmp(keys[i].name, key, n) == 0) {
+			return keys[i].key;
+		}
+	}
+	return Qiniu_RSF_keyOther;
+}
+
+static void Qiniu_RSF_pageDecoder_Open(void* recvr, Qiniu_JsonStream* js, char c)
+{
+	Qiniu_RSF_page* self = (Qiniu_RSF_page*)recvr;
+	Qiniu_RSF_rawItem* raw;
+
+	if (js->depth == 1 && c != '{') {
+		js->failed = 1;
+	} else if (js->depth == 3 && self->topKey == Qiniu_RSF_keyItems) {
+		raw = (Qiniu_RSF_rawItem*)Qiniu_Buffer_Expand(&self->raws, sizeof(Qiniu_RSF_rawItem));
+		memset(raw, 0, sizeof(*raw));
+		Qiniu_Buffer_Commit(&self->raws, (char*)(raw + 1));
+		self->itemKey = Qiniu_RSF_keyOther;
+	}
+}
+
+static void Qiniu_RSF_pageDecoder_Close(void* recvr, Qiniu_JsonStream* js, char c)
+{
+}
+
+static void Qiniu_RSF_pageDecoder_Key(void* recvr, Qiniu_JsonStream* js, const char* key, size_t n)
+{
+	Qiniu_RSF_page* self = (Qiniu_RSF_page*)recvr;
+
+	if (js->depth == 1) {
+		self->topKey = Qiniu_RSF_pageDecoder_key(key, n);
+	} else if (js->depth == 3) {
+		self->itemKey = Qiniu_RSF_pageDecoder_key(key, n);
+	}
+}
+
+static void Qiniu_RSF_pageDecoder_String(void* recvr, Qiniu_JsonStream* js, const char* s, size_t n)
+{
+	Qiniu_RSF_page* self = (Qiniu_RSF_page*)recvr;
+	Qiniu_RSF_rawItem* raw;
+	size_t off;
+
+	if (js->depth == 1) {
+		if (self->topKey == Qiniu_RSF_keyMarker) {
+			self->marker = Qiniu_RSF_page_saveStr(self, s, n);
+		}
+	} else if (js->depth == 2) {
+		if (self->topKey == Qiniu_RSF_keyCommonPrefixes) {
+			off = Qiniu_RSF_page_saveStr(self, s, n);
+			Qiniu_Buffer_Write(&self->rawPrefixes, &off, sizeof(off));
+		}
+	} else if (js->depth == 3 && self->topKey == Qiniu_RSF_keyItems) {
+		raw = Qiniu_RSF_page_lastItem(self);
+		switch (self->itemKey) {
+		case Qiniu_RSF_keyKey:
+			raw->key = Qiniu_RSF_page_saveStr(self, s, n);
+			break;
+		case Qiniu_RSF_keyHash:
+			raw->hash = Qiniu_RSF_page_saveStr(self, s, n);
+			break;
+		case Qiniu_RSF_keyMimeType:
+			raw->mimeType = Qiniu_RSF_page_saveStr(self, s, n);
+			break;
+		case Qiniu_RSF_keyEndUser:
+			raw->endUser = Qiniu_RSF_page_saveStr(self, s, n);
+			break;
+		}
+	}
+}
+
+static void Qiniu_RSF_pageDecoder_Number(void* recvr, Qiniu_JsonStream* js, const char* s)
+{
+	Qiniu_RSF_page* self = (Qiniu_RSF_page*)recvr;
+	Qiniu_RSF_rawItem* raw;
+
+	if (js->depth != 3 || self->topKey != Qiniu_RSF_keyItems) {
+		return;
+	}
+	raw = Qiniu_RSF_page_lastItem(self);
+	switch (self->itemKey) {
+	case Qiniu_RSF_keyFsize:
+		raw->fsize = (Qiniu_Int64)Qiniu_strtoll(s, NULL, 10);
+		break;
+	case Qiniu_RSF_keyPutTime:
+		raw->putTime = (Qiniu_Int64)Qiniu_strtoll(s, NULL, 10);
+		break;
+	case Qiniu_RSF_keyType:
+		raw->type = (int)strtol(s, NULL, 10);
+		break;
+	}
+}
+
+static const Qiniu_JsonStream_Itbl Qiniu_RSF_pageDecoder_Itbl = {
+	Qiniu_RSF_pageDecoder_Open,
+	Qiniu_RSF_pageDecoder_Close,
+	Qiniu_RSF_pageDecoder_Key,
+	Qiniu_RSF_pageDecoder_String,
+	Qiniu_RSF_pageDecoder_Number
+};
+
+/*============================================================================*/
+/* type Qiniu_RSF_List */
+
+struct _Qiniu_RSF_List {
+	Qiniu_Client client;
+	Qiniu_Buffer url;
+	size_t urlBase;
+	Qiniu_Buffer marker;
+	Qiniu_JsonStream js;
+
+	// The caller holds one page while the helper thread fills the other one.
+	Qiniu_RSF_page pages[2];
+	int ready[2];
+	int held;
+	int want;
+	int finished;
+	int stopping;
+
+	Qiniu_Mutex mutex;
+	Qiniu_Cond cond;
+	Qiniu_Thread thread;
+};
+
+static void Qiniu_RSF_List_appendQuery(Qiniu_Buffer* url, const char* name, const char* value)
+{
+	Qiniu_Bool fesc;
+	char* esc = Qiniu_QueryEscape(value, &fesc);
+
+	if (url->curr[-1] != '?') {
+		Qiniu_Buffer_PutChar(url, '&');
+	}
+	Qiniu_Buffer_Write(url, name, strlen(name));
+	Qiniu_Buffer_PutChar(url, '=');
+	Qiniu_Buffer_Write(url, esc, strlen(esc));
+	if (fesc) {
+		free(esc);
+	}
+}
+
+static void Qiniu_RSF_List_fetch(Qiniu_RSF_List* self, Qiniu_RSF_page* page)
+{
+	Qiniu_Error err;
+	Qiniu_Json* root;
+	Qiniu_Writer w;
+
+	self->url.curr = self->url.buf + self->urlBase;
+	if (Qiniu_Buffer_Len(&self->marker) != 0) {
+		Qiniu_RSF_List_appendQuery(&self->url, "marker", Qiniu_Buffer_CStr(&self->marker));
+	}
+
+	Qiniu_RSF_page_Reset(page);
+	Qiniu_JsonStream_Reset(&self->js);
+	self->js.self = page;
+	w.self = &self->js;
+	w.Write = Qiniu_JsonStream_Write;
+
+	err = Qiniu_Client_CallWithBufferStream(&self->client, &root, Qiniu_Buffer_CStr(&self->url),
+		"", 0, "application/x-www-form-urlencoded", w);
+	if (self->js.failed || (err.code / 100 == 2 && !Qiniu_JsonStream_Done(&self->js))) {
+		err.code = 9983;
+		err.message = "Invalid list response";
+	}
+	if (err.code / 100 == 2) {
+		Qiniu_RSF_page_Finish(page);
+	}
+	page->err = err;
+}
+
+static void Qiniu_RSF_List_run(void* params)
+{
+	Qiniu_RSF_List* self = (Qiniu_RSF_List*)params;
+	Qiniu_RSF_page* page;
+	const char* marker;
+	int slot = 0;
+	int more;
+
+	for (;;) {
+		Qiniu_Mutex_Lock(&self->mutex);
+		while (!self->stopping && (self->ready[slot] || self->held == slot)) {
+			Qiniu_Cond_Wait(&self->cond, &self->mutex);
+		}
+		if (self->stopping) {
+			Qiniu_Mutex_Unlock(&self->mutex);
+			break;
+		}
+		Qiniu_Mutex_Unlock(&self->mutex);
+
+		page = &self->pages[slot];
+		Qiniu_RSF_List_fetch(self, page);
+
+		// The marker is copied out, since the page is handed over to the caller.
+		marker = Qiniu_RSF_page_str(page, page->marker);
+		more = (page->err.code / 100 == 2 && marker != NULL && *marker != '\0');
+		if (more) {
+			Qiniu_Buffer_Reset(&self->marker);
+			Qiniu_Buffer_Write(&self->marker, marker, strlen(marker));
+		}
+
+		Qiniu_Mutex_Lock(&self->mutex);
+		self->ready[slot] = 1;
+		self->finished = !more;
+		Qiniu_Cond_Broadcast(&self->cond);
+		Qiniu_Mutex_Unlock(&self->mutex);
+
+		if (!more) {
+			break;
+		}
+		slot ^= 1;
+	}
+}
+
+Qiniu_Error Qiniu_RSF_List_Open(
+	Qiniu_RSF_List** ret, Qiniu_Client* cli, const char* bucket,
+	const char* prefix, const char* delimiter, const char* marker, int limit)
+{
+	Qiniu_Error err;
+	Qiniu_RSF_List* self;
+	char limitStr[32];
+
+	self = (Qiniu_RSF_List*)calloc(1, sizeof(Qiniu_RSF_List));
+	if (self == NULL) {
+		err.code = 499;
+		err.message = "No enough memory";
+		return err;
+	}
+
+	// The auth object is borrowed from the caller's client and must not be released here.
+	Qiniu_Client_InitNoAuth(&self->client, 1024);
+	self->client.auth = cli->auth;
+	self->client.boundNic = cli->boundNic;
+	self->client.lowSpeedLimit = cli->lowSpeedLimit;
+	self->client.lowSpeedTime = cli->lowSpeedTime;
+	if (Qiniu_Share_forThreads(cli->share) != NULL) {
+		Qiniu_Client_SetShare(&self->client, cli->share);
+	}
+
+	// The query without the marker, which is appended for each page.
+	Qiniu_Buffer_Init(&self->url, 256);
+	Qiniu_Buffer_Write(&self->url, QINIU_RSF_HOST, strlen(QINIU_RSF_HOST));
+	Qiniu_Buffer_Write(&self->url, "/list?", 6);
+	Qiniu_RSF_List_appendQuery(&self->url, "bucket", bucket);
+	if (prefix != NULL && *prefix != '\0') {
+		Qiniu_RSF_List_appendQuery(&self->url, "prefix", prefix);
+	}
+	if (delimiter != NULL && *delimiter != '\0') {
+		Qiniu_RSF_List_appendQuery(&self->url, "delimiter", delimiter);
+	}
+	if (limit > 0) {
+		Qiniu_snprintf(limitStr, sizeof(limitStr), "%d", limit);
+		Qiniu_RSF_List_appendQuery(&self->url, "limit", limitStr);
+	}
+	self->urlBase = Qiniu_Buffer_Len(&self->url);
+
+	Qiniu_Buffer_Init(&self->marker, 256);
+	if (marker != NULL) {
+		Qiniu_Buffer_Write(&self->marker, marker, strlen(marker));
+	}
+
+	Qiniu_JsonStream_Init(&self->js, &Qiniu_RSF_pageDecoder_Itbl, NULL);
+	Qiniu_RSF_page_Init(&self->pages[0]);
+	Qiniu_RSF_page_Init(&self->pages[1]);
+	self->held = -1;
+	Qiniu_Mutex_Init(&self->mutex);
+	Qiniu_Cond_Init(&self->cond);
+
+	if (Qiniu_Thread_Create(&self->thread, Qiniu_RSF_List_run, self) != 0) {
+		self->stopping = 1;
+		Qiniu_RSF_List_Close(self);
+		err.code = 9987;
+		err.message = "Can not create the list thread";
+		return err;
+	}
+
+	*ret = self;
+	return Qiniu_OK;
+}
+
+Qiniu_Error Qiniu_RSF_List_Next(Qiniu_RSF_List* self, Qiniu_RSF_ListPage* ret)
+{
+	Qiniu_Error err;
+	Qiniu_RSF_page* page;
+
+	Qiniu_Mutex_Lock(&self->mutex);
+	self->held = -1;
+	Qiniu_Cond_Broadcast(&self->cond);
+	while (!self->ready[self->want] && !self->finished) {
+		Qiniu_Cond_Wait(&self->cond, &self->mutex);
+	}
+	if (!self->ready[self->want]) {
+		Qiniu_Mutex_Unlock(&self->mutex);
+		err.code = Qiniu_RSF_EOF;
+		err.message = "No more pages";
+		return err;
+	}
+	self->ready[self->want] = 0;
+	self->held = self->want;
+	self->want ^= 1;
+	Qiniu_Mutex_Unlock(&self->mutex);
+
+	page = &self->pages[self->held];
+	if (page->err.code / 100 != 2) {
+		return page->err;
+	}
+	ret->items = (Qiniu_RSF_ListItem*)page->items.buf;
+	ret->itemCount = (int)(Qiniu_Buffer_Len(&page->items) / sizeof(Qiniu_RSF_ListItem));
+	ret->commonPrefixes = (const char**)page->prefixes.buf;
+	ret->commonPrefixCount = (int)(Qiniu_Buffer_Len(&page->prefixes) / sizeof(const char*));
+	ret->marker = Qiniu_RSF_page_str(page, page->marker);
+	if (ret->marker != NULL && *ret->marker == '\0') {
+		ret->marker = NULL;
+	}
+	return page->err;
+}
+
+void Qiniu_RSF_List_Close(Qiniu_RSF_List* self)
+{
+	if (self == NULL) {
+		return;
+	}
+	if (!self->stopping) {
+		Qiniu_Mutex_Lock(&self->mutex);
+		self->stopping = 1;
+		Qiniu_Cond_Broadcast(&self->cond);
+		Qiniu_Mutex_Unlock(&self->mutex);
+		Qiniu_Thread_Join(self->thread);
+	}
+
+	Qiniu_Mutex_Cleanup(&self->mutex);
+	Qiniu_Cond_Cleanup(&self->cond);
+	Qiniu_RSF_page_Cleanup(&self->pages[0]);
+	Qiniu_RSF_page_Cleanup(&self->pages[1]);
+	Qiniu_JsonStream_Cleanup(&self->js);
+	Qiniu_Buffer_Cleanup(&self->marker);
+	Qiniu_Buffer_Cleanup(&self->url);
+	self->client.auth = Qiniu_NoAuth;
+	Qiniu_Client_Cleanup(&self->client);
+	free(self);
+}
@@ -0,0 +1,72 @@
+/*
+ ============================================================================
+ Name        : rsf.h
+ Author      : Qiniu.com
+ Copyright   : 2012(c) Shanghai Qiniu Information Technologies Co., Ltd.
+ Description :
+ ============================================================================
+ */
+
+#ifndef QINIU_RSF_H
+#define QINIU_RSF_H
+
+#include "http.h"
+
+#pragma pack(1)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*============================================================================*/
+/* type Qiniu_RSF_List */
+
+typedef struct _Qiniu_RSF_ListItem {
+	const char* key;
+	const char* hash;
+	const char* mimeType;
+	const char* endUser;
+	Qiniu_Int64 fsize;
+	Qiniu_Int64 putTime;
+	int type;
+} Qiniu_RSF_ListItem;
+
+typedef struct _Qiniu_RSF_ListPage {
+	Qiniu_RSF_ListItem* items;
+	int itemCount;
+	const char** commonPrefixes;
+	int commonPrefixCount;
+
+	// Where the next page starts, which can be passed to Qiniu_RSF_List_Open to resume the listing.
+	// It is NULL on the last page.
+	const char* marker;
+} Qiniu_RSF_ListPage;
+
+typedef struct _Qiniu_RSF_List Qiniu_RSF_List;
+
+#define Qiniu_RSF_EOF		9982
+
+// Start listing the bucket on a helper thread, which fetches the next page while the caller is
+// consuming the current one. The prefix, delimiter and marker may be NULL, and limit may be 0 for
+// the server default. The client provides the auth, the bound NIC, the low speed limit and the share
+// object, and it must outlive the list.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_RSF_List_Open(
+	Qiniu_RSF_List** self, Qiniu_Client* cli, const char* bucket,
+	const char* prefix, const char* delimiter, const char* marker, int limit);
+
+// Return the next page, which keeps valid until the next call. Return Qiniu_RSF_EOF after the last
+// page. A failed page ends the listing, and it can be resumed from the marker of the last page.
+QINIU_DLLAPI extern Qiniu_Error Qiniu_RSF_List_Next(Qiniu_RSF_List* self, Qiniu_RSF_ListPage* page);
+
+QINIU_DLLAPI extern void Qiniu_RSF_List_Close(Qiniu_RSF_List* self);
+
+/*============================================================================*/
+
+#pragma pack()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QINIU_RSF_H */
@@ -23,9 +23,15 @@ QINIU_DLLAPI extern Qiniu_Uint64 Qiniu_Tm_LocalTime(void)
 	return Qiniu_Posix_GetTimeOfDay();
 } // Qiniu
 
+QINIU_DLLAPI extern Qiniu_Uint64 Qiniu_Tm_MonotonicMs(void)
+{
+	return GetTickCount64();
+} // Qiniu_Tm_MonotonicMs
+
 #else
 
 #include <sys/time.h>
+#include <time.h>
 
 QINIU_DLLAPI extern Qiniu_Uint64 Qiniu_Tm_LocalTime(void)
 {
@@ -34,6 +40,13 @@ QINIU_DLLAPI extern Qiniu_Uint64 Qiniu_Tm_LocalTime(void)
 	return tv.tv_sec;
 } // Qiniu_Tm_LocalTime
 
+QINIU_DLLAPI extern Qiniu_Uint64 Qiniu_Tm_MonotonicMs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (Qiniu_Uint64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+} // Qiniu_Tm_MonotonicMs
+
 #endif
 
 #ifdef __cplusplus
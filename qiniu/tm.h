@@ -19,6 +19,9 @@ extern "C"
 
 QINIU_DLLAPI extern Qiniu_Uint64 Qiniu_Tm_LocalTime(void);
 
+// Return the milliseconds elapsed since an unspecified point, which is not affected by clock changes.
+QINIU_DLLAPI extern Qiniu_Uint64 Qiniu_Tm_MonotonicMs(void);
+
 #ifdef __cplusplus
 }
 #endif
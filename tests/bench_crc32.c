@@ -0,0 +1,60 @@
+/*
+ ============================================================================
+ Name        : bench_crc32.c
+ Author      : Qiniu.com
+ Copyright   : 2012 Shanghai Qiniu Information Technologies Co., Ltd.
+ Description : Throughput of the Qiniu_Crc32 implementations
+ ============================================================================
+ */
+
+#include "../qiniu/http.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+	static const char* names[] = { "auto", "bytewise", "slice-by-8", "slice-by-16", "pclmul" };
+	size_t chunk = (argc > 1) ? (size_t)atol(argv[1]) : 256 * 1024;
+	size_t total = (size_t)1 << 30;
+	size_t i, rounds;
+	unsigned long crc;
+	double start, elapsed;
+	char* buf;
+	int impl;
+
+	Qiniu_Global_Init(-1);
+
+	buf = (char*)malloc(chunk);
+	for (i = 0; i < chunk; i++) {
+		buf[i] = (char)rand();
+	}
+	rounds = total / chunk;
+
+	printf("chunk size: %lu bytes\n", (unsigned long)chunk);
+	for (impl = QINIU_CRC32_BYTEWISE; impl <= QINIU_CRC32_PCLMUL; impl++) {
+		if (!Qiniu_Crc32_IsSupported(impl)) {
+			printf("%-12s not supported\n", names[impl]);
+			continue;
+		}
+		crc = 0;
+		start = now();
+		for (i = 0; i < rounds; i++) {
+			crc = Qiniu_Crc32_UpdateWith(impl, crc, buf, chunk);
+		}
+		elapsed = now() - start;
+		printf("%-12s %8.2f GB/s  (crc %08lx)\n", names[impl], (double)(rounds * chunk) / elapsed / 1e9, crc);
+	}
+
+	free(buf);
+	Qiniu_Global_Cleanup();
+	return 0;
+}
@@ -14,13 +14,29 @@
 #include <assert.h>
 
 void testFileIo();
+void testMappedFile();
 void testBaseIo();
+void testCrc32();
+void testQetagParallel();
 void testIoPut();
 void testResumableIoPut();
+void testRioChunkSizer();
 void testFmt();
+void testShare();
 void testEqual();
 void testRsBatchOps();
+void testRsBatchSplit();
+void testRsAsyncOps();
+void testRsBatchBuilder();
+void testRsfList();
+void testDownload();
 void testFop();
+void testRgnTable();
+void testRgnCacheFile();
+void testRgnRefresh();
+void testRgnPickHost();
+void testRgnBreaker();
+void testRgnUptoken();
 
 static int setup(){
 	printf("setup\n");
@@ -55,13 +71,29 @@ int main(){
 
 	/* add the tests to the suite */
 	CU_add_test(pSuite, "testFmt", testFmt);
+	CU_add_test(pSuite, "testShare", testShare);
+	CU_add_test(pSuite, "testMappedFile", testMappedFile);
 	CU_add_test(pSuite, "testBaseIo", testBaseIo);
+	CU_add_test(pSuite, "testCrc32", testCrc32);
+	CU_add_test(pSuite, "testQetagParallel", testQetagParallel);
 	CU_add_test(pSuite, "testFileIo", testFileIo);
 	CU_add_test(pSuite, "testEqual", testEqual);
 	CU_add_test(pSuite, "testResumableIoPut", testResumableIoPut);
+	CU_add_test(pSuite, "testRioChunkSizer", testRioChunkSizer);
 	CU_add_test(pSuite, "testIoPut", testIoPut);
 	CU_add_test(pSuite, "testRsBatchOps", testRsBatchOps);
+	CU_add_test(pSuite, "testRsBatchSplit", testRsBatchSplit);
+	CU_add_test(pSuite, "testRsAsyncOps", testRsAsyncOps);
+	CU_add_test(pSuite, "testRsBatchBuilder", testRsBatchBuilder);
+	CU_add_test(pSuite, "testRsfList", testRsfList);
+	CU_add_test(pSuite, "testDownload", testDownload);
 	CU_add_test(pSuite, "testFop", testFop);
+	CU_add_test(pSuite, "testRgnTable", testRgnTable);
+	CU_add_test(pSuite, "testRgnCacheFile", testRgnCacheFile);
+	CU_add_test(pSuite, "testRgnRefresh", testRgnRefresh);
+	CU_add_test(pSuite, "testRgnPickHost", testRgnPickHost);
+	CU_add_test(pSuite, "testRgnBreaker", testRgnBreaker);
+	CU_add_test(pSuite, "testRgnUptoken", testRgnUptoken);
 
 	/* Run all tests using the CUnit Basic interface */
 	CU_basic_set_mode(CU_BRM_VERBOSE);
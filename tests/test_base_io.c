@@ -8,6 +8,7 @@
  */
 
 #include "test.h"
+#include "../qiniu/qetag.h"
 
 static const Qiniu_Int64 fsize = 4*1024*1024 + 2;
 
@@ -53,6 +54,41 @@ void testFileIo()
 	Qiniu_File_Close(fp);
 }
 
+void testMappedFile()
+{
+	char buf[24];
+	char buf2[24];
+	size_t len = 20;
+	ssize_t n;
+	const char* p;
+	Qiniu_File* fp;
+	Qiniu_MappedFile* mf;
+	Qiniu_ReaderAt r;
+
+	Qiniu_Error err = Qiniu_MappedFile_Open(&mf, __FILE__);
+	CU_ASSERT_FATAL(err.code == 200);
+	err = Qiniu_File_Open(&fp, __FILE__);
+	CU_ASSERT_FATAL(err.code == 200);
+
+	n = Qiniu_MappedFile_ReadAt(mf, buf, len, 2);
+	CU_ASSERT_EQUAL(n, len);
+	n = Qiniu_File_ReadAt(fp, buf2, len, 2);
+	CU_ASSERT_EQUAL(n, len);
+	CU_ASSERT(memcmp(buf, buf2, len) == 0);
+
+	r = Qiniu_MappedFileReaderAt(mf);
+	p = Qiniu_ReaderAt_Slice(r, 2, len);
+	CU_ASSERT(p != NULL && memcmp(p, buf2, len) == 0);
+	CU_ASSERT(Qiniu_ReaderAt_Slice(r, Qiniu_MappedFile_Size(mf) - 1, 2) == NULL);
+	CU_ASSERT(Qiniu_ReaderAt_Slice(Qiniu_FileReaderAt(fp), 2, len) == NULL);
+
+	n = Qiniu_MappedFile_ReadAt(mf, buf, len, Qiniu_MappedFile_Size(mf));
+	CU_ASSERT_EQUAL(n, 0);
+
+	Qiniu_File_Close(fp);
+	Qiniu_MappedFile_Close(mf);
+}
+
 void testBaseIo()
 {
 	char buf[32];
@@ -106,3 +142,75 @@ void testBaseIo()
 	CU_ASSERT(crc32.val == 0x74e38c01);
 }
 
+
+void testCrc32()
+{
+	char buf[4096 + 16];
+	size_t len, off;
+	unsigned long expected;
+	int impl;
+
+	for (len = 0; len < sizeof(buf); len++) {
+		buf[len] = (char)(len * 131 + 7);
+	}
+
+	CU_ASSERT(Qiniu_Crc32_Update(0, "1234567890123", 13) == 0x74e38c01);
+
+	for (impl = QINIU_CRC32_AUTO; impl <= QINIU_CRC32_PCLMUL; impl++) {
+		if (!Qiniu_Crc32_IsSupported(impl)) {
+			printf("crc32 impl %d is not supported\n", impl);
+			continue;
+		}
+		// Cover unaligned heads, short tails and the folding path.
+		for (off = 0; off < 16; off++) {
+			for (len = 0; len + off <= sizeof(buf); len += 61) {
+				expected = Qiniu_Crc32_UpdateWith(QINIU_CRC32_BYTEWISE, 0x12345678, buf + off, len);
+				CU_ASSERT(Qiniu_Crc32_UpdateWith(impl, 0x12345678, buf + off, len) == expected);
+			}
+		}
+	}
+}
+
+void testQetagParallel()
+{
+	const char* file = "test_qetag.tmp";
+	size_t fsizes[] = { 0, 1, 4*1024*1024, 4*1024*1024 + 1, 3*4*1024*1024 + 5 };
+	size_t i, j;
+	char* expected;
+	char* digest;
+	FILE* fp;
+	Qiniu_MappedFile* mf;
+	Qiniu_Error err;
+
+	for (i = 0; i < sizeof(fsizes) / sizeof(fsizes[0]); i++) {
+		fp = fopen(file, "wb");
+		CU_ASSERT_FATAL(fp != NULL);
+		for (j = 0; j < fsizes[i]; j++) {
+			fputc((int)(j * 31 + 7) & 0xff, fp);
+		}
+		fclose(fp);
+
+		expected = NULL;
+		err = Qiniu_Qetag_DigestFile(file, &expected);
+		CU_ASSERT(err.code == 200);
+
+		digest = NULL;
+		err = Qiniu_Qetag_DigestFileEx(file, 4, &digest);
+		CU_ASSERT(err.code == 200);
+		CU_ASSERT(expected != NULL && digest != NULL && strcmp(expected, digest) == 0);
+		free(digest);
+
+		// A mapped file is only hashed from memory when the caller asks for it.
+		err = Qiniu_MappedFile_Open(&mf, file);
+		CU_ASSERT_FATAL(err.code == 200);
+		digest = NULL;
+		err = Qiniu_Qetag_DigestReaderAt(Qiniu_MappedFileReaderAt(mf), Qiniu_MappedFile_Size(mf), 4, &digest);
+		CU_ASSERT(err.code == 200);
+		CU_ASSERT(expected != NULL && digest != NULL && strcmp(expected, digest) == 0);
+		Qiniu_MappedFile_Close(mf);
+
+		free(expected);
+		free(digest);
+	}
+	remove(file);
+}
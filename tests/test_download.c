@@ -0,0 +1,138 @@
+/*
+ ============================================================================
+ Name        : test_download.c
+ Author      : Qiniu.com
+ Copyright   : 2012 Shanghai Qiniu Information Technologies Co., Ltd.
+ Description : Qiniu C SDK Unit Test
+ ============================================================================
+ */
+
+#include "test.h"
+#include "../qiniu/io.h"
+#include "../qiniu/download.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char bucket[] = "csdk";
+static const char key[] = "key.download";
+static const char domain[] = "csdk.qiniudn.com";
+static const char localFile[] = "test_download.tmp";
+
+static int sameFile(const char* a, const char* b)
+{
+	int ca, cb;
+	FILE* fa = fopen(a, "rb");
+	FILE* fb = fopen(b, "rb");
+
+	if (fa == NULL || fb == NULL) {
+		if (fa != NULL) fclose(fa);
+		if (fb != NULL) fclose(fb);
+		return 0;
+	}
+	do {
+		ca = fgetc(fa);
+		cb = fgetc(fb);
+	} while (ca == cb && ca != EOF);
+	fclose(fa);
+	fclose(fb);
+	return ca == cb;
+}
+
+void testDownload(void)
+{
+	Qiniu_Client client;
+	Qiniu_RS_PutPolicy putPolicy;
+	Qiniu_RS_GetPolicy getPolicy;
+	Qiniu_Io_PutRet putRet;
+	Qiniu_Download_Extra extra;
+	Qiniu_Download_Ret ret;
+	Qiniu_Error err;
+	char* uptoken;
+	char* dnBaseUrl;
+	char* dnRequest;
+	FILE* state;
+	Qiniu_Buffer body;
+	Qiniu_Download_Cache* cache;
+	Qiniu_Download_CacheStats stats;
+	char* cached;
+
+	Qiniu_Client_InitMacAuth(&client, 1024, NULL);
+
+	Qiniu_Zero(putPolicy);
+	putPolicy.scope = bucket;
+	uptoken = Qiniu_RS_PutPolicy_Token(&putPolicy, NULL);
+
+	Qiniu_RS_Delete(&client, bucket, key);
+	Qiniu_Zero(putRet);
+	err = Qiniu_Io_PutFile(&client, &putRet, uptoken, key, __FILE__, NULL);
+	CU_ASSERT_FATAL(err.code == 200);
+	Qiniu_Free(uptoken);
+
+	Qiniu_Zero(getPolicy);
+	dnBaseUrl = Qiniu_RS_MakeBaseUrl(domain, key);
+	dnRequest = Qiniu_RS_GetPolicy_MakeRequest(&getPolicy, dnBaseUrl, NULL);
+
+	// Use tiny segments to fetch the file over several connections.
+	Qiniu_Zero(extra);
+	extra.connections = 3;
+	extra.segmentSize = 512;
+	extra.stateFile = "test_download.state";
+
+	err = Qiniu_Download_ToFile(&client, &ret, dnRequest, localFile, &extra);
+	if (err.code != 200) {
+		printf("\nerror code: %d, message: %s\n", err.code, err.message);
+	}
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT(sameFile(__FILE__, localFile));
+	CU_ASSERT_STRING_EQUAL(ret.etag, putRet.hash);
+	state = fopen(extra.stateFile, "rb");
+	CU_ASSERT(state == NULL);
+	if (state != NULL) {
+		fclose(state);
+	}
+
+	remove(localFile);
+
+	// Stream the object into memory, and check the qetag of it on the fly.
+	Qiniu_Buffer_Init(&body, 1024);
+	Qiniu_Zero(extra);
+	extra.checkQetag = 1;
+
+	err = Qiniu_Download_ToWriter(&client, &ret, dnRequest, Qiniu_BufWriter(&body), &extra);
+	if (err.code != 200) {
+		printf("\nerror code: %d, message: %s\n", err.code, err.message);
+	}
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT(ret.fsize == (Qiniu_Int64)Qiniu_Buffer_Len(&body));
+	CU_ASSERT_STRING_EQUAL(ret.qetag, putRet.hash);
+	CU_ASSERT(Qiniu_Buffer_Len(&client.b) == 0);
+	Qiniu_Buffer_Cleanup(&body);
+
+	// The first read fills the cache, and the second one with the hash is served from the disk.
+	err = Qiniu_Download_Cache_Open(&cache, "test_download.cache", 1024 * 1024, 0);
+	CU_ASSERT_FATAL(err.code == 200);
+
+	err = Qiniu_Download_Cache_Get(cache, &client, &ret, bucket, key, dnRequest, NULL, NULL, &cached);
+	CU_ASSERT(err.code == 200);
+	if (err.code == 200) {
+		CU_ASSERT(sameFile(__FILE__, cached));
+		Qiniu_Free(cached);
+	}
+	err = Qiniu_Download_Cache_Get(cache, &client, &ret, bucket, key, dnRequest, putRet.hash, NULL, &cached);
+	CU_ASSERT(err.code == 200);
+	if (err.code == 200) {
+		CU_ASSERT(sameFile(__FILE__, cached));
+		remove(cached);
+		Qiniu_Free(cached);
+	}
+	Qiniu_Download_Cache_GetStats(cache, &stats);
+	CU_ASSERT(stats.misses == 1 && stats.hits == 1 && stats.entries == 1);
+	Qiniu_Download_Cache_Close(cache);
+
+	Qiniu_Free(dnRequest);
+	Qiniu_Free(dnBaseUrl);
+
+	Qiniu_RS_Delete(&client, bucket, key);
+	Qiniu_Client_Cleanup(&client);
+}
@@ -0,0 +1,513 @@
+/*
+ ============================================================================
+ Name        : test_region.c
+ Author      : Qiniu.com
+ Copyright   : 2016(c) Shanghai Qiniu Information Technologies Co., Ltd.
+ Description : Qiniu C SDK Unit Test
+ ============================================================================
+ */
+
+#include "test.h"
+#include "../qiniu/region.h"
+#include "../qiniu/tm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// The regions are made up here, so the tests send no query to UC.
+
+// Make a region of the bucket in one block, like the parsed ones, which is freed by Qiniu_Rgn_Info_Destroy.
+static Qiniu_Rgn_RegionInfo* newRegion(const char* bucket, Qiniu_Int64 ttl, const char** upHosts, Qiniu_Uint32 upHostCount)
+{
+	Qiniu_Rgn_RegionInfo* rgnInfo;
+	Qiniu_Rgn_HostInfo* hosts;
+	char* pos;
+	size_t size = sizeof(Qiniu_Rgn_RegionInfo) + strlen(bucket) + 1;
+	Qiniu_Uint32 i;
+
+	for (i = 0; i < upHostCount; i++) {
+		size += sizeof(Qiniu_Rgn_HostInfo*) + sizeof(Qiniu_Rgn_HostInfo) + strlen(upHosts[i]) + 1;
+	}
+
+	rgnInfo = (Qiniu_Rgn_RegionInfo*)calloc(1, size);
+	CU_ASSERT_FATAL(rgnInfo != NULL);
+
+	rgnInfo->upHosts = (Qiniu_Rgn_HostInfo**)(rgnInfo + 1);
+	hosts = (Qiniu_Rgn_HostInfo*)(rgnInfo->upHosts + upHostCount);
+	pos = (char*)(hosts + upHostCount);
+	for (i = 0; i < upHostCount; i++) {
+		rgnInfo->upHosts[i] = &hosts[i];
+		hosts[i].flags = QINIU_RGN_HTTP_HOST;
+		hosts[i].host = strcpy(pos, upHosts[i]);
+		pos += strlen(upHosts[i]) + 1;
+	}
+	rgnInfo->upHostCount = upHostCount;
+	rgnInfo->bucket = strcpy(pos, bucket);
+	rgnInfo->ttl = ttl;
+	rgnInfo->nextTimestampToUpdate = Qiniu_Tm_LocalTime() + ttl;
+	return rgnInfo;
+}
+
+static const char* testHosts[] = { "http://up1.test", "http://up2.test", "http://up3.test", "http://up4.test" };
+
+/*============================================================================*/
+
+void testRgnTable(void)
+{
+	Qiniu_Error err;
+	Qiniu_Rgn_RegionTable* rgnTable = Qiniu_Rgn_Table_Create();
+	Qiniu_Rgn_RegionInfo* rgnInfo;
+	Qiniu_Rgn_HostVote vote;
+	const char* upHost;
+	char bucket[32];
+	int i, missing = 0;
+
+	// More buckets than the slots of the first index, which is grown several times.
+	for (i = 0; i < 200; i++) {
+		Qiniu_snprintf(bucket, sizeof(bucket), "bucket-%d", i);
+		err = Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion(bucket, 3600, &testHosts[i % 4], 1));
+		CU_ASSERT(err.code == 200);
+	}
+	for (i = 0; i < 200; i++) {
+		Qiniu_snprintf(bucket, sizeof(bucket), "bucket-%d", i);
+		rgnInfo = Qiniu_Rgn_Table_GetRegionInfo(rgnTable, bucket);
+		if (rgnInfo == NULL || strcmp(rgnInfo->bucket, bucket) != 0 || strcmp(rgnInfo->upHosts[0]->host, testHosts[i % 4]) != 0) {
+			missing++;
+		}
+		Qiniu_Rgn_Table_ReleaseRegionInfo(rgnTable, rgnInfo);
+	}
+	CU_ASSERT(missing == 0);
+	CU_ASSERT(Qiniu_Rgn_Table_GetRegionInfo(rgnTable, "bucket-200") == NULL);
+
+	// The host of a known bucket is got without a query, so no client is needed.
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "bucket-7", "ak", 0, &upHost, &vote);
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT(upHost != NULL && strcmp(upHost, testHosts[3]) == 0);
+	CU_ASSERT(vote.rgnInfo != NULL && vote.rgnInfo->upHosts[0]->inflight == 1);
+	Qiniu_Rgn_Table_VoteHost(rgnTable, &vote, Qiniu_OK);
+	CU_ASSERT(vote.rgnInfo == NULL);
+
+	// A region set again replaces the old one of the bucket.
+	err = Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion("bucket-7", 3600, &testHosts[0], 1));
+	CU_ASSERT(err.code == 200);
+	rgnInfo = Qiniu_Rgn_Table_GetRegionInfo(rgnTable, "bucket-7");
+	CU_ASSERT(rgnInfo != NULL && strcmp(rgnInfo->upHosts[0]->host, testHosts[0]) == 0);
+
+	// The region is held by the caller only, since a host picked without a vote holds nothing.
+	CU_ASSERT(rgnInfo->refCount == 1);
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "bucket-7", "ak", 0, &upHost, NULL);
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT(upHost != NULL && strcmp(upHost, testHosts[0]) == 0);
+	CU_ASSERT(rgnInfo->refCount == 1 && rgnInfo->upHosts[0]->inflight == 0);
+	Qiniu_Rgn_Table_ReleaseRegionInfo(rgnTable, rgnInfo);
+	CU_ASSERT(rgnInfo->refCount == 0);
+
+	Qiniu_Rgn_Table_Destroy(rgnTable);
+}
+
+/*============================================================================*/
+
+static const char rgnCacheFile[] = "test_region_cache.json";
+
+static void writeRgnCache(const char* text)
+{
+	FILE* fp = fopen(rgnCacheFile, "wb");
+	CU_ASSERT_FATAL(fp != NULL);
+	fputs(text, fp);
+	fclose(fp);
+}
+
+void testRgnCacheFile(void)
+{
+	Qiniu_Error err;
+	Qiniu_Client client;
+	Qiniu_Rgn_RegionTable* rgnTable;
+	Qiniu_Rgn_RegionInfo* rgnInfo;
+	Qiniu_Rgn_HostVote vote;
+	const char* upHost;
+	const char* ucHost = QINIU_UC_HOST;
+	Qiniu_Uint64 now = Qiniu_Tm_LocalTime();
+	char text[512];
+
+	// The file is left by another process, with an entry still valid and an expired one.
+	Qiniu_snprintf(text, sizeof(text),
+		"{\"fresh\":{\"http\":{\"up\":[\"http://up.cached.test\"],\"io\":[\"http://io.cached.test\"]},"
+		"\"https\":{\"up\":[\"https://up.cached.test\"]},\"ttl\":3600,\"global\":false,\"deadline\":%d},"
+		"\"expired\":{\"http\":{\"up\":[\"http://up.expired.test\"]},\"ttl\":3600,\"deadline\":%d}}",
+		(int)(now + 1000), (int)(now - 10));
+	writeRgnCache(text);
+
+	// Nothing is queried for the valid entry, so no client is needed.
+	rgnTable = Qiniu_Rgn_Table_Create();
+	Qiniu_Rgn_Table_SetCacheFile(rgnTable, rgnCacheFile);
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "fresh", "ak", 0, &upHost, &vote);
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT(upHost != NULL && strcmp(upHost, "http://up.cached.test") == 0);
+	Qiniu_Rgn_Table_ReleaseHost(rgnTable, &vote);
+
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "fresh", "ak", QINIU_RGN_HTTPS_HOST, &upHost, &vote);
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT(upHost != NULL && strcmp(upHost, "https://up.cached.test") == 0);
+	Qiniu_Rgn_Table_ReleaseHost(rgnTable, &vote);
+
+	rgnInfo = Qiniu_Rgn_Table_GetRegionInfo(rgnTable, "fresh");
+	CU_ASSERT_FATAL(rgnInfo != NULL);
+	CU_ASSERT(rgnInfo->nextTimestampToUpdate == now + 1000);
+	CU_ASSERT(rgnInfo->upHostCount == 2 && rgnInfo->ioHostCount == 1);
+	Qiniu_Rgn_Table_ReleaseRegionInfo(rgnTable, rgnInfo);
+
+	// The expired entry is queried again, which fails since UC can't be reached here.
+	QINIU_UC_HOST = "http://127.0.0.1:1";
+	Qiniu_Client_InitNoAuth(&client, 1024);
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, &client, "expired", "ak", 0, &upHost, &vote);
+	CU_ASSERT(err.code != 200);
+	CU_ASSERT(Qiniu_Rgn_Table_GetRegionInfo(rgnTable, "expired") == NULL);
+	Qiniu_Rgn_Table_Destroy(rgnTable);
+
+	// A broken file is ignored as well.
+	writeRgnCache("[\"fresh\"]");
+	rgnTable = Qiniu_Rgn_Table_Create();
+	Qiniu_Rgn_Table_SetCacheFile(rgnTable, rgnCacheFile);
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, &client, "fresh", "ak", 0, &upHost, &vote);
+	CU_ASSERT(err.code != 200);
+	Qiniu_Rgn_Table_Destroy(rgnTable);
+
+	Qiniu_Client_Cleanup(&client);
+	QINIU_UC_HOST = ucHost;
+	remove(rgnCacheFile);
+}
+
+/*============================================================================*/
+
+void testRgnRefresh(void)
+{
+	Qiniu_Error err;
+	Qiniu_Client client;
+	Qiniu_Rgn_RegionTable* rgnTable = Qiniu_Rgn_Table_Create();
+	Qiniu_Rgn_RegionInfo* rgnInfo;
+	Qiniu_Rgn_HostVote vote;
+	const char* upHost;
+	const char* ucHost = QINIU_UC_HOST;
+	Qiniu_Uint64 now = Qiniu_Tm_LocalTime();
+
+	// The refreshes fail since UC can't be reached here.
+	QINIU_UC_HOST = "http://127.0.0.1:1";
+	Qiniu_Client_InitNoAuth(&client, 1024);
+
+	// A region in the last tenth of its ttl is used while it is refreshed in the background.
+	rgnInfo = newRegion("renewing", 100, &testHosts[0], 1);
+	rgnInfo->nextTimestampToUpdate = now + 5;
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, rgnInfo);
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, &client, "renewing", "ak", 0, &upHost, &vote);
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT(upHost != NULL && strcmp(upHost, testHosts[0]) == 0);
+	Qiniu_Rgn_Table_ReleaseHost(rgnTable, &vote);
+
+	// So is an expired one within another ttl.
+	rgnInfo = newRegion("expired", 100, &testHosts[1], 1);
+	rgnInfo->nextTimestampToUpdate = now - 5;
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, rgnInfo);
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, &client, "expired", "ak", 0, &upHost, &vote);
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT(upHost != NULL && strcmp(upHost, testHosts[1]) == 0);
+	Qiniu_Rgn_Table_ReleaseHost(rgnTable, &vote);
+	CU_ASSERT(Qiniu_Rgn_Table_GetRegionInfo(rgnTable, "expired") == rgnInfo);
+	Qiniu_Rgn_Table_ReleaseRegionInfo(rgnTable, rgnInfo);
+
+	// But a region expired longer than that is queried again before it is used.
+	rgnInfo = newRegion("dead", 100, &testHosts[2], 1);
+	rgnInfo->nextTimestampToUpdate = now - 200;
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, rgnInfo);
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, &client, "dead", "ak", 0, &upHost, &vote);
+	CU_ASSERT(err.code != 200);
+
+	// A replaced region is kept while a host picked from it is not voted.
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion("held", 3600, &testHosts[0], 1));
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "held", "ak", 0, &upHost, &vote);
+	CU_ASSERT(err.code == 200);
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion("held", 3600, &testHosts[1], 1));
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion("held", 3600, &testHosts[2], 1));
+	CU_ASSERT(strcmp(vote.rgnInfo->bucket, "held") == 0);
+	CU_ASSERT(strcmp(upHost, testHosts[0]) == 0);
+	Qiniu_Rgn_Table_VoteHost(rgnTable, &vote, Qiniu_OK);
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion("held", 3600, &testHosts[3], 1));
+
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "held", "ak", 0, &upHost, &vote);
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT(upHost != NULL && strcmp(upHost, testHosts[3]) == 0);
+	Qiniu_Rgn_Table_ReleaseHost(rgnTable, &vote);
+
+	Qiniu_Rgn_Table_Destroy(rgnTable);
+	Qiniu_Client_Cleanup(&client);
+	QINIU_UC_HOST = ucHost;
+}
+
+/*============================================================================*/
+
+static int hostIndex(const char* upHost)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (upHost != NULL && strcmp(upHost, testHosts[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Pick a host of the bucket n times, and release every one before the next pick.
+static void countPicks(Qiniu_Rgn_RegionTable* rgnTable, const char* bucket, int n, int picks[4])
+{
+	Qiniu_Error err;
+	Qiniu_Rgn_HostVote vote;
+	const char* upHost;
+	int i;
+
+	memset(picks, 0, sizeof(int) * 4);
+	for (i = 0; i < n; i++) {
+		err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, bucket, "ak", 0, &upHost, &vote);
+		CU_ASSERT_FATAL(err.code == 200 && hostIndex(upHost) >= 0);
+		picks[hostIndex(upHost)]++;
+		Qiniu_Rgn_Table_ReleaseHost(rgnTable, &vote);
+	}
+}
+
+void testRgnPickHost(void)
+{
+	Qiniu_Error err;
+	Qiniu_Error errFailed;
+	Qiniu_Rgn_RegionTable* rgnTable = Qiniu_Rgn_Table_Create();
+	Qiniu_Rgn_RegionInfo* rgnInfo;
+	Qiniu_Rgn_RegionInfo* newRgnInfo;
+	Qiniu_Rgn_HostVote votes[8];
+	const char* upHost;
+	int picks[4];
+	int i, failed = 0;
+
+	errFailed.code = 503;
+	errFailed.message = "Service Unavailable";
+
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion("bucket", 3600, testHosts, 4));
+
+	// The requests in flight are spread over the hosts.
+	memset(picks, 0, sizeof(picks));
+	for (i = 0; i < 8; i++) {
+		err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "bucket", "ak", 0, &upHost, &votes[i]);
+		CU_ASSERT_FATAL(err.code == 200 && hostIndex(upHost) >= 0);
+		picks[hostIndex(upHost)]++;
+	}
+	for (i = 0; i < 4; i++) {
+		CU_ASSERT(picks[i] >= 1 && picks[i] <= 3);
+	}
+
+	// A host which fails once is left for the others, though its breaker is still closed.
+	for (i = 0; i < 8; i++) {
+		if (!failed && hostIndex((*votes[i].host)->host) == 0) {
+			Qiniu_Rgn_Table_VoteHost(rgnTable, &votes[i], errFailed);
+			failed = 1;
+		} else {
+			Qiniu_Rgn_Table_VoteHost(rgnTable, &votes[i], Qiniu_OK);
+		}
+	}
+	rgnInfo = Qiniu_Rgn_Table_GetRegionInfo(rgnTable, "bucket");
+	CU_ASSERT(rgnInfo->upHosts[0]->errorRate > 0);
+	CU_ASSERT(rgnInfo->upHosts[0]->breaker == QINIU_RGN_BREAKER_CLOSED);
+	CU_ASSERT(rgnInfo->upHosts[0]->inflight == 0);
+
+	countPicks(rgnTable, "bucket", 100, picks);
+	CU_ASSERT(picks[0] == 0);
+	CU_ASSERT(picks[1] > 0 && picks[2] > 0 && picks[3] > 0);
+
+	// The scores are carried over to the refreshed region of the same hosts.
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion("bucket", 3600, testHosts, 4));
+	newRgnInfo = Qiniu_Rgn_Table_GetRegionInfo(rgnTable, "bucket");
+	CU_ASSERT(newRgnInfo != rgnInfo);
+	CU_ASSERT(newRgnInfo->upHosts[0]->errorRate > 0);
+	CU_ASSERT(newRgnInfo->upHosts[1]->voteCount > 0);
+	Qiniu_Rgn_Table_ReleaseRegionInfo(rgnTable, newRgnInfo);
+	Qiniu_Rgn_Table_ReleaseRegionInfo(rgnTable, rgnInfo);
+
+	countPicks(rgnTable, "bucket", 100, picks);
+	CU_ASSERT(picks[0] == 0);
+
+	Qiniu_Rgn_Table_Destroy(rgnTable);
+}
+
+/*============================================================================*/
+
+// Vote the picked host of the bucket, which is the only one, with the result.
+static void voteSolo(Qiniu_Rgn_RegionTable* rgnTable, int code)
+{
+	Qiniu_Error err;
+	Qiniu_Rgn_HostVote vote;
+	const char* upHost;
+
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "solo", "ak", 0, &upHost, &vote);
+	CU_ASSERT_FATAL(err.code == 200 && upHost != NULL);
+	err.code = code;
+	err.message = (code == 200) ? "OK" : "Service Unavailable";
+	Qiniu_Rgn_Table_VoteHost(rgnTable, &vote, err);
+}
+
+void testRgnBreaker(void)
+{
+	Qiniu_Error err;
+	Qiniu_Error errFailed;
+	Qiniu_Rgn_RegionTable* rgnTable = Qiniu_Rgn_Table_Create();
+	Qiniu_Rgn_RegionInfo* solo;
+	Qiniu_Rgn_RegionInfo* pair;
+	Qiniu_Rgn_HostInfo* host;
+	Qiniu_Rgn_HostVote votes[20];
+	const char* upHost;
+	int picks[4];
+	int i, n, failed = 0;
+
+	errFailed.code = 503;
+	errFailed.message = "Service Unavailable";
+
+	// Consecutive failures open the breaker.
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion("solo", 3600, &testHosts[0], 1));
+	solo = Qiniu_Rgn_Table_GetRegionInfo(rgnTable, "solo");
+	host = solo->upHosts[0];
+	voteSolo(rgnTable, 503);
+	voteSolo(rgnTable, 503);
+	CU_ASSERT(host->breaker == QINIU_RGN_BREAKER_CLOSED);
+	voteSolo(rgnTable, 503);
+	CU_ASSERT(host->breaker == QINIU_RGN_BREAKER_OPEN);
+	CU_ASSERT(host->cooldown == 5);
+
+	// A single host is still picked, but gets no trial until the cooldown passes.
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "solo", "ak", 0, &upHost, &votes[0]);
+	CU_ASSERT(err.code == 200 && upHost != NULL);
+	CU_ASSERT(host->breaker == QINIU_RGN_BREAKER_OPEN);
+	Qiniu_Rgn_Table_ReleaseHost(rgnTable, &votes[0]);
+
+	// The trial after the cooldown closes the breaker if it succeeds.
+	host->openUntil = (Qiniu_Uint32)(Qiniu_Tm_MonotonicMs() / 1000);
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "solo", "ak", 0, &upHost, &votes[0]);
+	CU_ASSERT(host->breaker == QINIU_RGN_BREAKER_HALF_OPEN);
+	Qiniu_Rgn_Table_VoteHost(rgnTable, &votes[0], Qiniu_OK);
+	CU_ASSERT(host->breaker == QINIU_RGN_BREAKER_CLOSED);
+	CU_ASSERT(host->failures == 0);
+
+	// Or opens it again for a doubled cooldown if it fails.
+	voteSolo(rgnTable, 503);
+	voteSolo(rgnTable, 503);
+	voteSolo(rgnTable, 503);
+	CU_ASSERT(host->breaker == QINIU_RGN_BREAKER_OPEN && host->cooldown == 5);
+	host->openUntil = (Qiniu_Uint32)(Qiniu_Tm_MonotonicMs() / 1000);
+	voteSolo(rgnTable, 503);
+	CU_ASSERT(host->breaker == QINIU_RGN_BREAKER_OPEN);
+	CU_ASSERT(host->cooldown == 10);
+
+	// The host whose breaker is open is skipped while the others are closed.
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion("pair", 3600, testHosts, 2));
+	pair = Qiniu_Rgn_Table_GetRegionInfo(rgnTable, "pair");
+	host = pair->upHosts[0];
+	for (n = 0; n < 20 && failed < 3; n++) {
+		err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "pair", "ak", 0, &upHost, &votes[n]);
+		CU_ASSERT_FATAL(err.code == 200);
+		if (*votes[n].host == host) {
+			failed++;
+		}
+	}
+	CU_ASSERT_FATAL(failed == 3);
+	for (i = 0; i < n; i++) {
+		Qiniu_Rgn_Table_VoteHost(rgnTable, &votes[i], (*votes[i].host == host) ? errFailed : Qiniu_OK);
+	}
+	CU_ASSERT(host->breaker == QINIU_RGN_BREAKER_OPEN);
+
+	memset(picks, 0, sizeof(picks));
+	for (i = 0; i < 20; i++) {
+		err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "pair", "ak", 0, &upHost, &votes[0]);
+		CU_ASSERT_FATAL(err.code == 200 && hostIndex(upHost) >= 0);
+		picks[hostIndex(upHost)]++;
+		Qiniu_Rgn_Table_VoteHost(rgnTable, &votes[0], Qiniu_OK);
+	}
+	CU_ASSERT(picks[0] == 0 && picks[1] == 20);
+
+	// And it takes the trial before the others once the cooldown passes.
+	host->openUntil = (Qiniu_Uint32)(Qiniu_Tm_MonotonicMs() / 1000);
+	err = Qiniu_Rgn_Table_GetHost(rgnTable, NULL, "pair", "ak", 0, &upHost, &votes[0]);
+	CU_ASSERT(err.code == 200 && hostIndex(upHost) == 0);
+	Qiniu_Rgn_Table_VoteHost(rgnTable, &votes[0], Qiniu_OK);
+	CU_ASSERT(host->breaker == QINIU_RGN_BREAKER_CLOSED);
+
+	Qiniu_Rgn_Table_ReleaseRegionInfo(rgnTable, pair);
+	Qiniu_Rgn_Table_ReleaseRegionInfo(rgnTable, solo);
+	Qiniu_Rgn_Table_Destroy(rgnTable);
+}
+
+/*============================================================================*/
+
+// Make an uptoken of the bucket, whose signature is never checked by the table.
+static char* makeUptoken(const char* bucket, int n, Qiniu_Uint64 deadline)
+{
+	char policy[128];
+	char* encoded;
+	char* uptoken;
+
+	Qiniu_snprintf(policy, sizeof(policy), "{\"scope\":\"%s:key-%d\",\"deadline\":%d}", bucket, n, (int)deadline);
+	encoded = Qiniu_String_Encode(policy);
+	uptoken = Qiniu_String_Concat2("ak:sig:", encoded);
+	Qiniu_Free(encoded);
+	return uptoken;
+}
+
+static int hostOfUptoken(Qiniu_Rgn_RegionTable* rgnTable, const char* uptoken)
+{
+	Qiniu_Error err;
+	Qiniu_Rgn_HostVote vote;
+	const char* upHost = NULL;
+
+	err = Qiniu_Rgn_Table_GetHostByUptoken(rgnTable, NULL, uptoken, 0, &upHost, &vote);
+	if (err.code != 200) {
+		return -err.code;
+	}
+	Qiniu_Rgn_Table_ReleaseHost(rgnTable, &vote);
+	return hostIndex(upHost);
+}
+
+void testRgnUptoken(void)
+{
+	Qiniu_Rgn_RegionTable* rgnTable = Qiniu_Rgn_Table_Create();
+	Qiniu_Uint64 deadline = Qiniu_Tm_LocalTime() + 3600;
+	char* uptoken;
+	char* first;
+	int i, wrong = 0;
+
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion("tokbucket", 3600, &testHosts[2], 1));
+
+	// The parsed uptoken is remembered, and still leads to the bucket after its region is replaced.
+	first = makeUptoken("tokbucket", 0, deadline);
+	CU_ASSERT(hostOfUptoken(rgnTable, first) == 2);
+	CU_ASSERT(hostOfUptoken(rgnTable, first) == 2);
+	Qiniu_Rgn_Table_SetRegionInfo(rgnTable, newRegion("tokbucket", 3600, &testHosts[3], 1));
+	CU_ASSERT(hostOfUptoken(rgnTable, first) == 3);
+
+	// The oldest uptokens make room for the ones beyond the 256 remembered, and are parsed again later.
+	for (i = 1; i < 600; i++) {
+		uptoken = makeUptoken("tokbucket", i, deadline);
+		if (hostOfUptoken(rgnTable, uptoken) != 3 || hostOfUptoken(rgnTable, uptoken) != 3) {
+			wrong++;
+		}
+		Qiniu_Free(uptoken);
+	}
+	CU_ASSERT(wrong == 0);
+	CU_ASSERT(hostOfUptoken(rgnTable, first) == 3);
+	CU_ASSERT(hostOfUptoken(rgnTable, first) == 3);
+	Qiniu_Free(first);
+
+	// The expired ones are never remembered, so they are parsed every time.
+	uptoken = makeUptoken("tokbucket", 0, Qiniu_Tm_LocalTime() - 10);
+	CU_ASSERT(hostOfUptoken(rgnTable, uptoken) == 3);
+	CU_ASSERT(hostOfUptoken(rgnTable, uptoken) == 3);
+	Qiniu_Free(uptoken);
+
+	CU_ASSERT(hostOfUptoken(rgnTable, "garbage") == -9989);
+	CU_ASSERT(hostOfUptoken(rgnTable, "ak:sig:e30=") == -9989);
+
+	Qiniu_Rgn_Table_Destroy(rgnTable);
+}
+
+/*============================================================================*/
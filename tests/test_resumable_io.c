@@ -9,8 +9,11 @@
 
 #include "test.h"
 #include "../qiniu/resumable_io.h"
+#include "../qiniu/private.h"
+#include "../qiniu/qetag.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <curl/curl.h>
 
@@ -86,6 +89,363 @@ static void clientIoPutBuffer(const char* uptoken)
 	Qiniu_Client_Cleanup(&client);
 }
 
+static void clientIoPutBufferWithQetag(const char* uptoken)
+{
+	Qiniu_Error err;
+	Qiniu_Client client;
+	Qiniu_Rio_PutExtra extra;
+	Qiniu_Rio_PutRet putRet;
+	Qiniu_Seq seq;
+	Qiniu_ReaderAt in;
+	Qiniu_Int64 fsize = testFsize;
+
+	Qiniu_Client_InitNoAuth(&client, 1024);
+
+	Qiniu_Zero(extra);
+	extra.bucket = bucket;
+	extra.notify = notify;
+	extra.notifyErr = notifyErr;
+	extra.chunkSize = 1024;
+	extra.checkQetag = 1;
+
+	in = Qiniu_SeqReaderAt(&seq, (size_t)fsize, 10, '0', 0);
+
+	err = Qiniu_Rio_Put(&client, &putRet, uptoken, key, in, fsize, &extra);
+
+	printf("\n%s", Qiniu_Buffer_CStr(&client.respHeader));
+	printf("hash: %s\n", putRet.hash);
+
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT_STRING_EQUAL(putRet.hash, "FoErrxvY99fW7npWmVii0RncWKme");
+	CU_ASSERT_STRING_EQUAL(putRet.qetag, "FoErrxvY99fW7npWmVii0RncWKme");
+
+	Qiniu_Client_Cleanup(&client);
+}
+
+static void clientIoPutBufferWithReadahead(const char* uptoken)
+{
+	Qiniu_Error err;
+	Qiniu_Client client;
+	Qiniu_Rio_PutExtra extra;
+	Qiniu_Rio_PutRet putRet;
+	Qiniu_Seq seq;
+	Qiniu_ReaderAt in;
+	Qiniu_Int64 fsize = testFsize;
+
+	Qiniu_Client_InitNoAuth(&client, 1024);
+
+	Qiniu_Zero(extra);
+	extra.bucket = bucket;
+	extra.notify = notify;
+	extra.notifyErr = notifyErr;
+	extra.chunkSize = 1024;
+	extra.readaheadDepth = 2;
+
+	in = Qiniu_SeqReaderAt(&seq, (size_t)fsize, 10, '0', 0);
+
+	err = Qiniu_Rio_Put(&client, &putRet, uptoken, key, in, fsize, &extra);
+
+	printf("\n%s", Qiniu_Buffer_CStr(&client.respHeader));
+	printf("hash: %s\n", putRet.hash);
+
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT_STRING_EQUAL(putRet.hash, "FoErrxvY99fW7npWmVii0RncWKme");
+
+	Qiniu_Client_Cleanup(&client);
+}
+
+static void clientIoPutMulti(const char* uptoken)
+{
+	Qiniu_Error err;
+	Qiniu_Client client;
+	Qiniu_Rio_PutExtra extra;
+	Qiniu_Rio_PutRet putRet;
+	Qiniu_Seq seq;
+	Qiniu_ReaderAt in;
+	Qiniu_Int64 fsize = testFsize;
+
+	Qiniu_Client_InitNoAuth(&client, 1024);
+
+	Qiniu_Zero(extra);
+	extra.bucket = bucket;
+	extra.notify = notify;
+	extra.notifyErr = notifyErr;
+	extra.chunkSize = 1024;
+
+	in = Qiniu_SeqReaderAt(&seq, (size_t)fsize, 10, '0', 0);
+
+	err = Qiniu_Rio_PutMulti(&client, &putRet, uptoken, key, in, fsize, &extra);
+
+	printf("\n%s", Qiniu_Buffer_CStr(&client.respHeader));
+	printf("hash: %s\n", putRet.hash);
+
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT_STRING_EQUAL(putRet.hash, "FoErrxvY99fW7npWmVii0RncWKme");
+
+	Qiniu_Client_Cleanup(&client);
+}
+
+static void clientIoPutWithThreads(const char* uptoken)
+{
+	Qiniu_Error err;
+	Qiniu_Client client;
+	Qiniu_Rio_PutExtra extra;
+	Qiniu_Rio_PutRet putRet;
+	Qiniu_Rio_ThreadModel tm;
+	Qiniu_Seq seq;
+	Qiniu_ReaderAt in;
+	size_t fsize = (4 << 20) * 3 + 7;
+	char* buf = (char*)malloc(fsize);
+	char* qetag = NULL;
+
+	// Hash the same sequence locally to check the uploaded object.
+	in = Qiniu_SeqReaderAt(&seq, fsize, 10, '0', 0);
+	in.ReadAt(in.self, buf, fsize, 0);
+	err = Qiniu_Qetag_DigestBuffer(buf, fsize, &qetag);
+	CU_ASSERT_FATAL(err.code == 200);
+	free(buf);
+
+	// The blocks are uploaded by the pool at the same time, each with the client of its worker.
+	err = Qiniu_Rio_MT_Create(&tm, 3, 0);
+	CU_ASSERT_FATAL(err.code == 200);
+
+	Qiniu_Client_InitNoAuth(&client, 1024);
+
+	Qiniu_Zero(extra);
+	extra.bucket = bucket;
+	extra.notify = notify;
+	extra.notifyErr = notifyErr;
+	extra.threadModel = tm;
+	extra.checkQetag = 1;
+
+	err = Qiniu_Rio_Put(&client, &putRet, uptoken, key, in, (Qiniu_Int64)fsize, &extra);
+
+	printf("\n%s", Qiniu_Buffer_CStr(&client.respHeader));
+	printf("hash: %s\n", putRet.hash);
+
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT_STRING_EQUAL(putRet.hash, qetag);
+	CU_ASSERT_STRING_EQUAL(putRet.qetag, qetag);
+
+	Qiniu_Rio_MT_Destroy(tm);
+	free(qetag);
+	Qiniu_Client_Cleanup(&client);
+}
+
+static void clientIoPutStream(const char* uptoken, size_t fsize)
+{
+	Qiniu_Error err;
+	Qiniu_Client client;
+	Qiniu_Rio_PutExtra extra;
+	Qiniu_Rio_PutRet putRet;
+	Qiniu_Seq seq;
+	Qiniu_ReaderAt in;
+	char* buf = (char*)malloc(fsize + 1);
+	char* qetag = NULL;
+
+	// Hash the same sequence locally to check the uploaded object.
+	in = Qiniu_SeqReaderAt(&seq, fsize, 10, '0', 0);
+	in.ReadAt(in.self, buf, fsize, 0);
+	err = Qiniu_Qetag_DigestBuffer(buf, fsize, &qetag);
+	CU_ASSERT_FATAL(err.code == 200);
+	free(buf);
+
+	Qiniu_Client_InitNoAuth(&client, 1024);
+
+	Qiniu_Zero(extra);
+	extra.bucket = bucket;
+	extra.notify = notify;
+	extra.notifyErr = notifyErr;
+
+	err = Qiniu_Rio_PutStream(&client, &putRet, uptoken, key, Qiniu_SeqReader(&seq, fsize, 10, '0', 0), &extra);
+
+	printf("\n%s", Qiniu_Buffer_CStr(&client.respHeader));
+	printf("size: %d, hash: %s\n", (int)fsize, putRet.hash);
+
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT_STRING_EQUAL(putRet.hash, qetag);
+
+	free(qetag);
+	Qiniu_Client_Cleanup(&client);
+}
+
+static const char journalData[] = "test_journal.tmp";
+static const char journalFile[] = "test_journal.tmp.journal";
+
+// The slot layout of the journal in resumable_io.c, which is used to forge a stale progress.
+typedef struct _journalSlot {
+	Qiniu_Uint32 seq;
+	Qiniu_Uint32 offset;
+	Qiniu_Uint32 crc32;
+	char ctx[224];
+	char host[80];
+	Qiniu_Uint32 checksum;
+} journalSlot;
+
+static int journalNotifies;
+static char journalCtx[224];
+
+static int notifyInterrupt(void* self, int blkIdx, int blkSize, Qiniu_Rio_BlkputRet* ret)
+{
+	Qiniu_snprintf(journalCtx, sizeof(journalCtx), "%s", ret->ctx);
+	return (++journalNotifies == 2) ? QINIU_RIO_NOTIFY_EXIT : QINIU_RIO_NOTIFY_OK;
+}
+
+static int journalExists()
+{
+	FILE* fp = fopen(journalFile, "rb");
+
+	if (fp == NULL) {
+		return 0;
+	}
+	fclose(fp);
+	return 1;
+}
+
+static void clientIoPutJournaled(const char* uptoken, Qiniu_Rio_FnNotify notify1, int code)
+{
+	Qiniu_Error err;
+	Qiniu_Client client;
+	Qiniu_Rio_PutExtra extra;
+	Qiniu_Rio_PutRet putRet;
+
+	Qiniu_Client_InitNoAuth(&client, 1024);
+
+	Qiniu_Zero(extra);
+	extra.bucket = bucket;
+	extra.notify = notify1;
+	extra.notifyErr = notifyErr;
+	extra.chunkSize = 1024;
+	extra.journalFile = journalFile;
+
+	journalNotifies = 0;
+	err = Qiniu_Rio_PutFile(&client, &putRet, uptoken, key, journalData, &extra);
+
+	printf("\n%s", Qiniu_Buffer_CStr(&client.respHeader));
+
+	CU_ASSERT(err.code == code);
+	if (code == 200) {
+		CU_ASSERT_STRING_EQUAL(putRet.hash, "FoErrxvY99fW7npWmVii0RncWKme");
+	}
+	CU_ASSERT(journalExists() == (code != 200));
+
+	Qiniu_Client_Cleanup(&client);
+}
+
+// Replace the context of the last acknowledged chunk with one the server does not know.
+static void forgeStaleJournal()
+{
+	FILE* fp = fopen(journalFile, "r+b");
+	char* buf;
+	char* p;
+	long size;
+	size_t ctxLen = strlen(journalCtx);
+	journalSlot* slot;
+
+	CU_ASSERT_FATAL(fp != NULL && ctxLen > 0);
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	buf = (char*)malloc(size);
+	fseek(fp, 0, SEEK_SET);
+	CU_ASSERT_FATAL(fread(buf, 1, size, fp) == (size_t)size);
+
+	for (p = buf; p + ctxLen <= buf + size && memcmp(p, journalCtx, ctxLen) != 0; p++) {
+	}
+	CU_ASSERT_FATAL(p + ctxLen <= buf + size);
+
+	slot = (journalSlot*)(p - offsetof(journalSlot, ctx));
+	memset(slot->ctx, 'A', ctxLen);
+	slot->checksum = (Qiniu_Uint32)Qiniu_Crc32_Update(0, slot, offsetof(journalSlot, checksum));
+
+	fseek(fp, 0, SEEK_SET);
+	fwrite(buf, 1, size, fp);
+	fclose(fp);
+	free(buf);
+}
+
+static void clientIoPutFileWithJournal(const char* uptoken)
+{
+	Qiniu_Seq seq;
+	Qiniu_ReaderAt in;
+	char buf[4*1024 + 2];
+	FILE* fp;
+
+	in = Qiniu_SeqReaderAt(&seq, sizeof(buf), 10, '0', 0);
+	in.ReadAt(in.self, buf, sizeof(buf), 0);
+	fp = fopen(journalData, "wb");
+	CU_ASSERT_FATAL(fp != NULL);
+	fwrite(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+	remove(journalFile);
+
+	// Resume from the journal of an interrupted upload.
+	clientIoPutJournaled(uptoken, notifyInterrupt, Qiniu_Rio_PutInterrupted);
+	clientIoPutJournaled(uptoken, notify, 200);
+
+	// A stale progress in the journal is dropped, and its block is uploaded again.
+	clientIoPutJournaled(uptoken, notifyInterrupt, Qiniu_Rio_PutInterrupted);
+	forgeStaleJournal();
+	clientIoPutJournaled(uptoken, notify, 200);
+
+	remove(journalData);
+}
+
+static const char changedKey[] = "key2.changed";
+static const char unchangedData[] = "test_unchanged.tmp";
+static const char changedData[] = "test_changed.tmp";
+
+static void writeSeqFile(const char* path, size_t fsize, size_t delta)
+{
+	Qiniu_Seq seq;
+	Qiniu_ReaderAt in;
+	char* buf = (char*)malloc(fsize);
+	FILE* fp;
+
+	in = Qiniu_SeqReaderAt(&seq, fsize, 10, '0', delta);
+	in.ReadAt(in.self, buf, fsize, 0);
+	fp = fopen(path, "wb");
+	CU_ASSERT_FATAL(fp != NULL);
+	fwrite(buf, 1, fsize, fp);
+	fclose(fp);
+	free(buf);
+}
+
+// The key holds the testFsize sequence, so its entry is skipped, and the other key is uploaded.
+static void clientIoPutFilesIfChanged(Qiniu_Client* macClient, const char* uptoken)
+{
+	Qiniu_Error err;
+	Qiniu_Rio_PutExtra extra;
+	Qiniu_Rio_PutFileEntry entries[2];
+
+	writeSeqFile(unchangedData, (size_t)testFsize, 0);
+	writeSeqFile(changedData, (size_t)testFsize, 1);
+	Qiniu_RS_Delete(macClient, bucket, changedKey);
+
+	Qiniu_Zero(extra);
+	extra.bucket = bucket;
+	extra.checkQetag = 1;
+
+	Qiniu_Zero(entries);
+	entries[0].key = key;
+	entries[0].localFile = unchangedData;
+	entries[1].key = changedKey;
+	entries[1].localFile = changedData;
+
+	err = Qiniu_Rio_PutFilesIfChanged(macClient, uptoken, bucket, entries, 2, &extra);
+
+	printf("\nskipped: %d %s, changed: %d %s\n", entries[0].code, entries[0].hash, entries[1].code, entries[1].hash);
+
+	CU_ASSERT(err.code == 200);
+	CU_ASSERT(entries[0].code == Qiniu_Rio_PutSkipped);
+	CU_ASSERT_STRING_EQUAL(entries[0].hash, "FoErrxvY99fW7npWmVii0RncWKme");
+	CU_ASSERT(entries[1].code == 200);
+	CU_ASSERT(strcmp(entries[1].hash, entries[0].hash) != 0);
+
+	Qiniu_RS_Delete(macClient, bucket, changedKey);
+	remove(unchangedData);
+	remove(changedData);
+}
+
 static void clientIoGet(const char* url)
 {
 	Qiniu_Eq eq;
@@ -142,6 +502,33 @@ void testResumableIoPut(void)
 	Qiniu_RS_Delete(&client, bucket, key);
 	clientIoPutBuffer(uptoken);
 
+	Qiniu_RS_Delete(&client, bucket, key);
+	clientIoPutBufferWithQetag(uptoken);
+
+	Qiniu_RS_Delete(&client, bucket, key);
+	clientIoPutBufferWithReadahead(uptoken);
+
+	Qiniu_RS_Delete(&client, bucket, key);
+	clientIoPutMulti(uptoken);
+
+	Qiniu_RS_Delete(&client, bucket, key);
+	clientIoPutWithThreads(uptoken);
+
+	// An empty stream, one shorter than a block, and one of several blocks.
+	Qiniu_RS_Delete(&client, bucket, key);
+	clientIoPutStream(uptoken, 0);
+
+	Qiniu_RS_Delete(&client, bucket, key);
+	clientIoPutStream(uptoken, (1 << 20) + 5);
+
+	Qiniu_RS_Delete(&client, bucket, key);
+	clientIoPutStream(uptoken, (4 << 20) * 2 + 3);
+
+	Qiniu_RS_Delete(&client, bucket, key);
+	clientIoPutFileWithJournal(uptoken);
+
+	clientIoPutFilesIfChanged(&client, uptoken);
+
 	Qiniu_Free(uptoken);
 
 	Qiniu_Zero(getPolicy);
@@ -156,3 +543,67 @@ void testResumableIoPut(void)
 	Qiniu_Client_Cleanup(&client);
 }
 
+
+static int chunkSizerAligned(Qiniu_Rio_chunkSizer* sizer)
+{
+	return sizer->size % (4 * 1024) == 0 && sizer->size >= sizer->minSize && sizer->size <= sizer->maxSize;
+}
+
+void testRioChunkSizer(void)
+{
+	Qiniu_Rio_chunkSizer sizer;
+	Qiniu_Rio_PutExtra extra;
+	int i, size;
+
+	// The bounds and the first size are aligned to 4 KB.
+	Qiniu_Zero(extra);
+	extra.chunkSize = 100000;
+	extra.minChunkSize = 1000;
+	extra.maxChunkSize = 1000000;
+	Qiniu_Rio_chunkSizer_Init(&sizer, &extra);
+	CU_ASSERT(sizer.minSize == 4 * 1024);
+	CU_ASSERT(sizer.maxSize == 244 * 4 * 1024);
+	CU_ASSERT(sizer.size == 24 * 4 * 1024);
+	Qiniu_Rio_chunkSizer_Cleanup(&sizer);
+
+	// The defaults are 64 KB and the block size.
+	Qiniu_Zero(extra);
+	extra.chunkSize = 256 * 1024;
+	Qiniu_Rio_chunkSizer_Init(&sizer, &extra);
+	CU_ASSERT(sizer.minSize == 64 * 1024);
+	CU_ASSERT(sizer.maxSize == 4 * 1024 * 1024);
+	CU_ASSERT(sizer.size == 256 * 1024);
+
+	// A fast link grows the size by doubling at most, up to the max size.
+	size = sizer.size;
+	Qiniu_Rio_chunkSizer_Update(&sizer, size, 0.01, 1);
+	CU_ASSERT(sizer.size == size * 2);
+	for (i = 0; i < 10; i++) {
+		Qiniu_Rio_chunkSizer_Update(&sizer, sizer.size, 0.01, 1);
+		CU_ASSERT(chunkSizerAligned(&sizer));
+	}
+	CU_ASSERT(sizer.size == sizer.maxSize);
+
+	// A failure halves the size and raises the error rate, and a request never sent changes nothing.
+	Qiniu_Rio_chunkSizer_Update(&sizer, sizer.size, 1.0, 0);
+	CU_ASSERT(sizer.size == 2 * 1024 * 1024);
+	CU_ASSERT(sizer.errRate > 0.19 && sizer.errRate < 0.21);
+	Qiniu_Rio_chunkSizer_Update(&sizer, sizer.size, -1, 0);
+	CU_ASSERT(sizer.size == 2 * 1024 * 1024);
+	CU_ASSERT(sizer.errRate > 0.19 && sizer.errRate < 0.21);
+	for (i = 0; i < 10; i++) {
+		Qiniu_Rio_chunkSizer_Update(&sizer, sizer.size, 1.0, 0);
+		CU_ASSERT(chunkSizerAligned(&sizer));
+	}
+	CU_ASSERT(sizer.size == sizer.minSize);
+	Qiniu_Rio_chunkSizer_Cleanup(&sizer);
+
+	// A slow link shrinks the size to about 2 seconds of the throughput, aligned down.
+	Qiniu_Zero(extra);
+	extra.chunkSize = 4 * 1024 * 1024;
+	Qiniu_Rio_chunkSizer_Init(&sizer, &extra);
+	Qiniu_Rio_chunkSizer_Update(&sizer, 1000 * 1000, 10.0, 1);
+	CU_ASSERT(sizer.size == 48 * 4 * 1024);
+	CU_ASSERT(chunkSizerAligned(&sizer));
+	Qiniu_Rio_chunkSizer_Cleanup(&sizer);
+}
@@ -1,7 +1,9 @@
 #include "../qiniu/rs.h"
+#include "../qiniu/rsf.h"
 #include "test.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static const char* copyNames[3] = { "testa.tmp", "testb.tmp", "testc.tmp" };
 static const char* moveNames[3] = { "testa.mov.tmp", "testb.mov.tmp", "testc.mov.tmp" };
@@ -159,3 +161,170 @@ void testRsBatchOps()
 
 	Qiniu_Client_Cleanup(&client);
 }
+
+void testRsBatchSplit()
+{
+	Qiniu_Client client;
+	Qiniu_RS_EntryPath entries[3];
+	Qiniu_RS_EntryPathPair entryPairs[3];
+	Qiniu_RS_BatchSettings settings;
+	int i;
+
+	Qiniu_Client_InitMacAuth(&client, 1024, NULL);
+
+	// Split into sub-batches of 2 ops to exercise the concurrent path.
+	settings.opsPerBatch = 2;
+	settings.concurrency = 2;
+	Qiniu_RS_SetBatchSettings(&settings);
+
+	for (i = 0; i < 3; i++) {
+		entryPairs[i].src.bucket = bucket;
+		entryPairs[i].dest.bucket = bucket;
+		entryPairs[i].src.key = key;
+		entryPairs[i].dest.key = copyNames[i];
+		entries[i].bucket = bucket;
+		entries[i].key = copyNames[i];
+	}
+	batchCopy(&client, entryPairs, 3);
+	batchStat(&client, entries, 3);
+	batchDelete(&client, entries, 3);
+
+	settings.opsPerBatch = 0;
+	settings.concurrency = 0;
+	Qiniu_RS_SetBatchSettings(&settings);
+
+	Qiniu_Client_Cleanup(&client);
+}
+
+static void asyncDone(void* recvr, Qiniu_Error err, Qiniu_Json* root)
+{
+	int* okCount = (int*)recvr;
+	if (err.code != 200) {
+		printf("\nerror code: %d, message: %s\n", err.code, err.message);
+	} else {
+		*okCount += 1;
+	}
+}
+
+void testRsAsyncOps()
+{
+	Qiniu_Client client;
+	Qiniu_Async* async;
+	Qiniu_Error err;
+	int okCount = 0;
+	int i;
+
+	Qiniu_Client_InitMacAuth(&client, 1024, NULL);
+	async = Qiniu_Async_Create(&client, 0);
+	CU_ASSERT_FATAL(async != NULL);
+
+	for (i = 0; i < 3; i++) {
+		err = Qiniu_RS_AsyncCopy(async, bucket, key, bucket, copyNames[i], asyncDone, &okCount);
+		CU_ASSERT(err.code == 200);
+	}
+	Qiniu_Async_Run(async);
+	CU_ASSERT(okCount == 3);
+
+	for (i = 0; i < 3; i++) {
+		err = Qiniu_RS_AsyncStat(async, bucket, copyNames[i], asyncDone, &okCount);
+		CU_ASSERT(err.code == 200);
+	}
+	Qiniu_Async_Run(async);
+	CU_ASSERT(okCount == 6);
+
+	for (i = 0; i < 3; i++) {
+		err = Qiniu_RS_AsyncDelete(async, bucket, copyNames[i], asyncDone, &okCount);
+		CU_ASSERT(err.code == 200);
+	}
+	Qiniu_Async_Run(async);
+	CU_ASSERT(okCount == 9);
+	CU_ASSERT(Qiniu_Async_Pending(async) == 0);
+
+	Qiniu_Async_Destroy(async);
+	Qiniu_Client_Cleanup(&client);
+}
+
+void testRsBatchBuilder()
+{
+	Qiniu_Client client;
+	Qiniu_RS_Batch batch;
+	Qiniu_RS_BatchStatRet rets[12];
+	Qiniu_Error err;
+	int i;
+
+	Qiniu_Client_InitMacAuth(&client, 1024, NULL);
+	Qiniu_RS_Batch_Init(&batch);
+
+	for (i = 0; i < 3; i++) {
+		Qiniu_RS_Batch_Copy(&batch, bucket, key, bucket, copyNames[i]);
+		Qiniu_RS_Batch_ChangeMime(&batch, bucket, copyNames[i], "text/plain");
+		Qiniu_RS_Batch_Stat(&batch, bucket, copyNames[i]);
+		Qiniu_RS_Batch_Delete(&batch, bucket, copyNames[i]);
+	}
+	CU_ASSERT(batch.count == 12);
+
+	err = Qiniu_RS_Batch_Do(&batch, &client, rets);
+	if (err.code != 200) {
+		debug(&client, err);
+	}
+	CU_ASSERT(err.code == 200);
+	for (i = 0; i < 12; i++) {
+		CU_ASSERT(rets[i].code == 200);
+	}
+	for (i = 2; i < 12; i += 4) {
+		CU_ASSERT(rets[i].data.mimeType != NULL && strcmp(rets[i].data.mimeType, "text/plain") == 0);
+		CU_ASSERT(rets[i].data.hash != NULL);
+	}
+
+	// The builder can be reused, and failed ops are reported in place.
+	Qiniu_RS_Batch_Reset(&batch);
+	Qiniu_RS_Batch_Stat(&batch, bucket, key);
+	Qiniu_RS_Batch_Stat(&batch, bucket, copyNames[0]);
+	err = Qiniu_RS_Batch_Do(&batch, &client, rets);
+	CU_ASSERT(err.code == 298);
+	CU_ASSERT(rets[0].code == 200);
+	CU_ASSERT(rets[1].code == 612 && rets[1].error != NULL);
+
+	Qiniu_RS_Batch_Cleanup(&batch);
+	Qiniu_Client_Cleanup(&client);
+}
+
+void testRsfList()
+{
+	Qiniu_Client client;
+	Qiniu_RSF_List* list;
+	Qiniu_RSF_ListPage page;
+	Qiniu_Error err;
+	int pages = 0;
+	int found = 0;
+	int i;
+
+	Qiniu_Client_InitMacAuth(&client, 1024, NULL);
+
+	// Use a tiny page size to go through several pages.
+	err = Qiniu_RSF_List_Open(&list, &client, bucket, key, NULL, NULL, 1);
+	CU_ASSERT_FATAL(err.code == 200);
+	for (;;) {
+		err = Qiniu_RSF_List_Next(list, &page);
+		if (err.code != 200) {
+			break;
+		}
+		pages++;
+		for (i = 0; i < page.itemCount; i++) {
+			CU_ASSERT(strncmp(page.items[i].key, key, strlen(key)) == 0);
+			if (strcmp(page.items[i].key, key) == 0) {
+				CU_ASSERT(page.items[i].hash != NULL);
+				found++;
+			}
+		}
+	}
+	if (err.code != Qiniu_RSF_EOF) {
+		debug(&client, err);
+	}
+	CU_ASSERT(err.code == Qiniu_RSF_EOF);
+	CU_ASSERT(pages >= 1);
+	CU_ASSERT(found == 1);
+
+	Qiniu_RSF_List_Close(list);
+	Qiniu_Client_Cleanup(&client);
+}
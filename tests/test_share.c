@@ -0,0 +1,225 @@
+/*
+ ============================================================================
+ Name        : test_share.c
+ Author      : Qiniu.com
+ Copyright   : 2012 Shanghai Qiniu Information Technologies Co., Ltd.
+ Description : Qiniu C SDK Unit Test
+ ============================================================================
+ */
+
+#include "test.h"
+#include "../qiniu/private.h"
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/*============================================================================*/
+/* type shareServer */
+
+#define SHARE_SERVER_CONNS	8
+
+// A local HTTP server which answers every request with an empty JSON object on a kept-alive
+// connection, and counts the connections it accepts.
+typedef struct _shareServer {
+	int fd;
+	int port;
+	int accepts;
+	int requests;
+	volatile int stop;
+	int conns[SHARE_SERVER_CONNS];
+	char bufs[SHARE_SERVER_CONNS][4096];
+	size_t lens[SHARE_SERVER_CONNS];
+	Qiniu_Thread thread;
+} shareServer;
+
+static const char shareResponse[] =
+	"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: 2\r\n\r\n{}";
+
+// Answer the complete requests in the buffer of the connection, and keep the rest of it.
+static int shareServer_serve(shareServer* self, int i)
+{
+	char* end;
+	const char* length;
+	size_t size;
+
+	for (;;) {
+		self->bufs[i][self->lens[i]] = '\0';
+		end = strstr(self->bufs[i], "\r\n\r\n");
+		if (end == NULL) {
+			return 0;
+		}
+		size = end + 4 - self->bufs[i];
+		length = strstr(self->bufs[i], "Content-Length:");
+		if (length != NULL && length < end) {
+			size += (size_t)atoi(length + 15);
+		}
+		if (size > self->lens[i]) {
+			return 0;
+		}
+		if (write(self->conns[i], shareResponse, sizeof(shareResponse) - 1) < 0) {
+			return -1;
+		}
+		self->requests++;
+		memmove(self->bufs[i], self->bufs[i] + size, self->lens[i] - size);
+		self->lens[i] -= size;
+	}
+}
+
+static void shareServer_run(void* params)
+{
+	shareServer* self = (shareServer*)params;
+	struct pollfd fds[SHARE_SERVER_CONNS + 1];
+	ssize_t n;
+	int i, fd;
+
+	while (!self->stop) {
+		fds[0].fd = self->fd;
+		fds[0].events = POLLIN;
+		for (i = 0; i < SHARE_SERVER_CONNS; i++) {
+			fds[i + 1].fd = self->conns[i];
+			fds[i + 1].events = POLLIN;
+		}
+		if (poll(fds, SHARE_SERVER_CONNS + 1, 100) <= 0) {
+			continue;
+		}
+		if (fds[0].revents & POLLIN) {
+			fd = accept(self->fd, NULL, NULL);
+			for (i = 0; fd >= 0 && i < SHARE_SERVER_CONNS; i++) {
+				if (self->conns[i] < 0) {
+					self->conns[i] = fd;
+					self->lens[i] = 0;
+					self->accepts++;
+					fd = -1;
+				}
+			}
+			if (fd >= 0) {
+				close(fd);
+			}
+		}
+		for (i = 0; i < SHARE_SERVER_CONNS; i++) {
+			if (self->conns[i] < 0 || fds[i + 1].revents == 0) {
+				continue;
+			}
+			n = read(self->conns[i], self->bufs[i] + self->lens[i], sizeof(self->bufs[i]) - 1 - self->lens[i]);
+			if (n > 0) {
+				self->lens[i] += (size_t)n;
+			}
+			if (n <= 0 || shareServer_serve(self, i) < 0) {
+				close(self->conns[i]);
+				self->conns[i] = -1;
+			}
+		}
+	}
+}
+
+static int shareServer_Start(shareServer* self)
+{
+	struct sockaddr_in addr;
+	socklen_t addrLen = sizeof(addr);
+	int i;
+
+	memset(self, 0, sizeof(*self));
+	for (i = 0; i < SHARE_SERVER_CONNS; i++) {
+		self->conns[i] = -1;
+	}
+	self->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (self->fd < 0) {
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(self->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(self->fd, 8) != 0 ||
+		getsockname(self->fd, (struct sockaddr*)&addr, &addrLen) != 0) {
+		close(self->fd);
+		return -1;
+	}
+	self->port = ntohs(addr.sin_port);
+	if (Qiniu_Thread_Create(&self->thread, shareServer_run, self) != 0) {
+		close(self->fd);
+		return -1;
+	}
+	return 0;
+}
+
+static void shareServer_Stop(shareServer* self)
+{
+	int i;
+
+	self->stop = 1;
+	Qiniu_Thread_Join(self->thread);
+	for (i = 0; i < SHARE_SERVER_CONNS; i++) {
+		if (self->conns[i] >= 0) {
+			close(self->conns[i]);
+		}
+	}
+	close(self->fd);
+}
+
+/*============================================================================*/
+
+// Let two clients with the share call the server in turn, and return the connections it accepted.
+static int callInTurn(shareServer* server, Qiniu_Share* share)
+{
+	Qiniu_Client clients[2];
+	Qiniu_Error err;
+	char url[64];
+	int i, accepts = server->accepts;
+
+	Qiniu_snprintf(url, sizeof(url), "http://localhost:%d/stat", server->port);
+	for (i = 0; i < 2; i++) {
+		Qiniu_Client_InitNoAuth(&clients[i], 1024);
+		if (share != NULL) {
+			Qiniu_Client_SetShare(&clients[i], share);
+		}
+	}
+	for (i = 0; i < 4; i++) {
+		err = Qiniu_Client_CallNoRet(&clients[i % 2], url);
+		CU_ASSERT(err.code == 200);
+	}
+	accepts = server->accepts - accepts;
+	for (i = 0; i < 2; i++) {
+		Qiniu_Client_Cleanup(&clients[i]);
+	}
+	return accepts;
+}
+
+void testShare(void)
+{
+	shareServer server;
+	Qiniu_Share* share;
+	int accepts;
+
+	CU_ASSERT_FATAL(shareServer_Start(&server) == 0);
+
+	// Every client keeps its own connection without a share.
+	accepts = callInTurn(&server, NULL);
+	CU_ASSERT(accepts == 2);
+
+	// The clients sharing the DNS cache and the connections take turns on one connection, and the
+	// share is not given to the threads of the SDK.
+	share = Qiniu_Share_Create(QINIU_SHARE_DNS | QINIU_SHARE_CONNECTION);
+	CU_ASSERT_FATAL(share != NULL);
+	CU_ASSERT(Qiniu_Share_forThreads(share) == NULL);
+	accepts = callInTurn(&server, share);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	CU_ASSERT(accepts == 1);
+#endif
+	Qiniu_Share_Destroy(share);
+
+	// The share without the connections is safe for them.
+	share = Qiniu_Share_Create(QINIU_SHARE_ALL);
+	CU_ASSERT_FATAL(share != NULL);
+	CU_ASSERT(Qiniu_Share_forThreads(share) == share);
+	callInTurn(&server, share);
+	Qiniu_Share_Destroy(share);
+
+	CU_ASSERT(server.requests == 12);
+	shareServer_Stop(&server);
+}
@@ -9,11 +9,20 @@
 
 #include "emu_posix.h"
 #include <sys/stat.h>
+#include <fcntl.h>
 
 Qiniu_Posix_Handle Qiniu_Posix_Open(const char* file, int oflag, int mode)
 {
-	Qiniu_Posix_Handle fd = CreateFileA(
-		file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	DWORD access = GENERIC_READ;
+	DWORD share = FILE_SHARE_READ;
+	DWORD disposition = (oflag & O_CREAT) ? OPEN_ALWAYS : OPEN_EXISTING;
+	Qiniu_Posix_Handle fd;
+
+	if (oflag & (O_WRONLY | O_RDWR)) {
+		access |= GENERIC_WRITE;
+		share |= FILE_SHARE_WRITE;
+	}
+	fd = CreateFileA(file, access, share, NULL, disposition, FILE_FLAG_RANDOM_ACCESS, NULL);
 	if (fd != INVALID_HANDLE_VALUE) {
 		errno = 0;
 		return fd;
@@ -44,6 +53,34 @@ ssize_t Qiniu_Posix_Pread2(Qiniu_Posix_Handle fd, void* buf, size_t nbytes, Emu_
 	return -1;
 }
 
+ssize_t Qiniu_Posix_Pwrite2(Qiniu_Posix_Handle fd, const void* buf, size_t nbytes, Emu_Off_T offset)
+{
+	BOOL ret;
+	DWORD nwritten = 0;
+	OVERLAPPED o = {0};
+	o.Offset = (DWORD)(offset & (~(DWORD)0));
+	o.OffsetHigh = (DWORD)((offset >> 32) & (~(DWORD)0));
+	ret = WriteFile(fd, buf, nbytes, &nwritten, &o);
+	if (ret) {
+		errno = 0;
+		return nwritten;
+	}
+	errno = GetLastError();
+	return -1;
+}
+
+int Qiniu_Posix_Ftruncate2(Qiniu_Posix_Handle fd, Emu_Off_T length)
+{
+	LARGE_INTEGER pos;
+	pos.QuadPart = length;
+	if (SetFilePointerEx(fd, pos, NULL, FILE_BEGIN) && SetEndOfFile(fd)) {
+		errno = 0;
+		return 0;
+	}
+	errno = GetLastError();
+	return -1;
+}
+
 static time_t fileTime2time_t(FILETIME ft)
 {
 	ULONGLONG ll = ft.dwLowDateTime | ((ULONGLONG)ft.dwHighDateTime << 32);